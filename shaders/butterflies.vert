@@ -2,9 +2,11 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
 
 #include "util.glsl"
 #include "noise3D.glsl"
+#include "draw-material.glsl"
 
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 modl;  // global
@@ -35,6 +37,7 @@ layout(location = 0) out vec2 uv;
 layout(location = 1) out vec3 normal;
 layout(location = 2) out vec4 currpos;
 layout(location = 3) out vec4 lastpos;
+layout(location = 4) flat out uint material;
 
 mat4 computeModel(PointLight butterfly, float timeDelta) {
     mat4 model;
@@ -62,6 +65,7 @@ vec3 flap(vec3 inpos, float time) {
 }
 
 void main() {
+    material = drawMaterial();
     mat4 model = computeModel(b.utterflies[gl_InstanceIndex], 0);
     // TODO [optimization] outsource uniform multiplications to the CPU
     gl_Position = ubo.proj * ubo.view * ubo.modl * model * vec4(flap(inPosition, ubo.time), 1.0);
@@ -17,6 +17,7 @@ layout(set = 0, binding = 1) uniform DenoiserUBO {
     float albedoSigma;
     float normalSigma;
     float positionSigma;
+    ivec2 viewport;
 } denoiser;
 
 layout(set = 0, binding = 2) uniform sampler2D albedo;
@@ -44,7 +45,7 @@ void main() {
         return;
     }
 
-    vec3 mPos = calculatePositionFromUV(mD, pos / vec2(textureSize(accColor, 0)), denoiser.inverseV);
+    vec3 mPos = calculatePositionFromUV(mD, pos / vec2(denoiser.viewport), denoiser.inverseV);
     vec3 mNormal = texelFetch(normal, pos, 0).xyz;
 
     vec4 color = vec4(0);
@@ -55,7 +56,7 @@ void main() {
        // ivec2 other = pos + denoiser.offsets[i].xy * (1 << (denoiser.iterCnt - iterNumber - 1));
         ivec2 other = pos + denoiser.offsets[i].xy * stepwidth;
         if (any(lessThan(other, ivec2(0, 0))) ||
-            any(greaterThanEqual(other, textureSize(accColor, 0)))) {
+            any(greaterThanEqual(other, denoiser.viewport))) {
             continue;
         }
 
@@ -65,7 +66,7 @@ void main() {
             continue;
         }
 
-        vec3 oPos = calculatePositionFromUV(oD, pos / vec2(textureSize(albedo, 0)), denoiser.inverseV);
+        vec3 oPos = calculatePositionFromUV(oD, pos / vec2(denoiser.viewport), denoiser.inverseV);
         vec3 oAlbedo = texelFetch(albedo, other, 0).rgb;
         vec3 oNormal = texelFetch(normal, other, 0).xyz;
 
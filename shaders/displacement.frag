@@ -2,12 +2,16 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "material.glsl"
 
 layout(location = 0) in vec2 uv;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec3 fsPos;
 layout(location = 3) in vec4 fsPosClipSpace;
 layout(location = 4) in vec4 fsOldPosClipSpace;
+layout(location = 5) flat in uint material;
 
 layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec4 outNormal;
@@ -21,24 +25,6 @@ layout(set = 0, binding = 0) uniform UniformBufferObject {
     vec2 jitt;
 } ubo;
 
-layout(set = 2, binding = 0) uniform sampler2D albedo;
-layout(set = 2, binding = 1) uniform sampler2D normalMap;
-layout(set = 2, binding = 2) uniform sampler2D heightMap;
-
-layout(set = 3, binding = 0, std140) uniform MaterialSettings {
-    float heightScale;
-    int raymarchSteps;
-    int enableInverseDisplacement;
-    int enableLinearApprox;
-    int useInvertedFormat;
-} mapping;
-
-layout(push_constant, std430) uniform constants
-{
-    int normalMapOnly;
-    float materialReflectivity;
-};
-
 void computeTangentSpace(vec3 N, out vec3 T, out vec3 B) {
     vec3 Q1 = dFdx(fsPos);
     vec3 Q2 = dFdy(fsPos);
@@ -57,7 +43,7 @@ void computeTangentSpace(vec3 N, out vec3 T, out vec3 B) {
 
 void readConvertNormal(vec3 T, vec3 B, vec3 N, vec2 uv) {
     float gamma = 1.0/2.2;
-    vec3 normal = pow(texture(normalMap, uv).rgb, vec3(gamma)) * 2 - 1;
+    vec3 normal = pow(texture(textures[materials[material].normalTexture], uv).rgb, vec3(gamma)) * 2 - 1;
     normal = normalize(transpose(inverse(mat3(T, B, N))) * normal);
 
     // Convert normal to world space, because our lighting uses it
@@ -66,14 +52,15 @@ void readConvertNormal(vec3 T, vec3 B, vec3 N, vec2 uv) {
 }
 
 void main() {
+    Material m = materials[material];
     outMotion = (fsOldPosClipSpace/fsOldPosClipSpace.w - fsPosClipSpace/fsPosClipSpace.w).xy;
     outEmission = vec4(0);
     vec3 N = normalize(normal);
 
     vec3 T, B;
     computeTangentSpace(N, T, B);
-    if (normalMapOnly > 0 || mapping.enableInverseDisplacement == 0) {
-        outColor = vec4(texture(albedo, uv).rgb, materialReflectivity);
+    if (m.normalMapOnly > 0 || mapping.enableInverseDisplacement == 0) {
+        outColor = vec4(texture(textures[m.albedoTexture], uv).rgb, m.reflectivity);
         // Convert normal to world space, because our lighting uses it
         readConvertNormal(T, B, N, uv);
         //gl_FragDepth = fsPosClipSpace.z / fsPosClipSpace.w;
@@ -100,9 +87,9 @@ void main() {
     for (int i = 0; i < mapping.raymarchSteps; i++) {
         float depth;
         if (mapping.useInvertedFormat > 0) {
-            depth = (1.0 - pow(texture(heightMap, currentPos.st).r, 1.0/2.2)) * mapping.heightScale;
+            depth = (1.0 - pow(texture(textures[m.heightTexture], currentPos.st).r, 1.0/2.2)) * mapping.heightScale;
         } else {
-            depth = pow(texture(heightMap, currentPos.st).r, 1.0/2.2) * mapping.heightScale;
+            depth = pow(texture(textures[m.heightTexture], currentPos.st).r, 1.0/2.2) * mapping.heightScale;
         }
 
         const float heightAbove = currentPos.z - depth;
@@ -119,7 +106,7 @@ void main() {
             //vec4 finalNdcPos = ubo.proj * vec4(finalViewPos, 1.0);
             //gl_FragDepth = finalNdcPos.z / finalNdcPos.w;
 
-            outColor = vec4(texture(albedo, currentPos.st).rgb, materialReflectivity);
+            outColor = vec4(texture(textures[m.albedoTexture], currentPos.st).rgb, m.reflectivity);
             readConvertNormal(T, B, N, currentPos.st);
             return;
         } else {
@@ -0,0 +1,18 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+// Material index of the current draw for vertex shaders. Requires GL_ARB_shader_draw_parameters.
+
+// material of every compacted draw command, written by select_lods.comp
+layout(std430, set = 2, binding = 1) readonly buffer DrawMaterialBuffer {
+    uint drawMaterials[];
+};
+
+layout(push_constant, std430) uniform DrawBatch {
+    // first draw of the batch in the compacted draw commands
+    uint firstDraw;
+} batch;
+
+uint drawMaterial() {
+    return drawMaterials[batch.firstDraw + gl_DrawIDARB];
+}
@@ -28,6 +28,9 @@ layout(set = 0, binding = 1) uniform GlobalFogUBO {
     int ssrRaySteps;
 
     bool renderEmission;
+
+    // the inputs are only rendered in this top left part, see Swapchain::activeRenderSize
+    vec2 renderUVScale;
 } fog;
 
 layout(set = 0, binding = 2) uniform sampler2D albedo;
@@ -61,7 +64,7 @@ vec3 fogAmbientTerm(float worldDepth) {
 }
 
 vec4 sampleNdc(sampler2D tex, vec2 ndc) {
-    return texture(tex, ndc * 0.5 + 0.5);
+    return texture(tex, (ndc * 0.5 + 0.5) * fog.renderUVScale);
 }
 
 float getFadeFactor01(float f) {
@@ -2,6 +2,12 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "vertex-quantization.glsl"
+#include "material.glsl"
+#include "draw-material.glsl"
 
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 modl;  // global
@@ -23,10 +29,6 @@ layout(set = 1, binding = 0) buffer ModelTransform {
     mat4 model[];
 } model;
 
-layout(push_constant, std140) uniform PushConstant {
-    vec4 color; //rgb, strength (cast to 8 bit float)
-};
-
 layout(location = 0) in vec3 inPosition;
 layout(location = 2) in vec3 inNormal;
 
@@ -43,6 +45,6 @@ void main() {
     lastpos = lastubo.proj * lastubo.view * lastubo.modl * model.model[gl_InstanceIndex] * vec4(inPosition, 1.0);
     lastpos += lastpos.w * vec4(ubo.jitt, 0, 0);
 
-    fragColor = color;
-    normal = (transpose(inverse(ubo.modl * model.model[gl_InstanceIndex])) * vec4(inNormal, 0.0)).xyz;
+    fragColor = materials[drawMaterial()].emissiveColor;
+    normal = (transpose(inverse(ubo.modl * model.model[gl_InstanceIndex])) * vec4(decodeNormal(inNormal), 0.0)).xyz;
 }
@@ -0,0 +1,32 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+// Bindless materials of the scene, see Scene::setupMaterials. Requires GL_EXT_nonuniform_qualifier for the texture
+// array. The material index of a draw is dynamically uniform within the draw, so no nonuniformEXT is needed.
+
+// Must match MaterialData in Scene.h
+struct Material {
+    vec4 emissiveColor; // rgb, strength (cast to 8 bit float)
+    uint albedoTexture;
+    uint emissiveTexture;
+    uint normalTexture;
+    uint heightTexture;
+    int normalMapOnly;
+    float reflectivity;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer MaterialBuffer {
+    Material materials[];
+};
+
+layout(set = 2, binding = 2, std140) uniform MaterialSettings {
+    float heightScale;
+    int raymarchSteps;
+    int enableInverseDisplacement;
+    int enableLinearApprox;
+    int useInvertedFormat;
+} mapping;
+
+layout(set = 2, binding = 3) uniform sampler2D textures[];
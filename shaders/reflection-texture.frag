@@ -2,21 +2,23 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "material.glsl"
 
 layout(location = 0) in vec2 uv;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec4 currpos;
 layout(location = 3) in vec4 lastpos;
+layout(location = 4) flat in uint material;
 
 layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec4 outNormal;
 layout(location = 2) out vec2 outMotion;
 layout(location = 3) out vec4 outEmission;
 
-layout(set = 2, binding = 0) uniform sampler2D texSampler;
-
 void main() {
-    vec3 color = texture(texSampler, uv).rgb;
+    vec3 color = texture(textures[materials[material].albedoTexture], uv).rgb;
 
     // Alpha channel == reflectance
     outColor = vec4(color, 1.0);
@@ -3,9 +3,12 @@
 
 #include "util.glsl"
 
-// NUM_SAMPLES_PER_RESERVOIR must also be adjusted in Lighting.cpp.
-// The value there must be >= than the value used by the shader, otherwise we don't have enough storage space.
-#define NUM_SAMPLES_PER_RESERVOIR 1
+// Storage space of a reservoir, must match MAX_SAMPLES_PER_RESERVOIR in Lighting.h.
+// The size of arrays in buffers cannot be specialized, Vulkan keeps the layout of the declared size.
+#define MAX_SAMPLES_PER_RESERVOIR 4
+
+// Samples in use, chosen at runtime with DeferredLighting::restirSamplesPerReservoir (at most MAX_SAMPLES_PER_RESERVOIR).
+layout(constant_id = 0) const int NUM_SAMPLES_PER_RESERVOIR = 1;
 
 // Very simple pseudo-random number generators.
 // We might want something better, I just used this as a easy start
@@ -38,16 +41,16 @@ vec2 nextRandV2(inout uint randState) {
 
 struct Reservoir {
     // 0 => invalid, > 0: point light number+1, < 0: negated (emissive triangle id+1)
-    int selected[NUM_SAMPLES_PER_RESERVOIR];
+    int selected[MAX_SAMPLES_PER_RESERVOIR];
 
     // Position of (or on) the selected light source
-    vec3 position[NUM_SAMPLES_PER_RESERVOIR];
+    vec3 position[MAX_SAMPLES_PER_RESERVOIR];
 
     // Sum of sampling weights
-    float sumW[NUM_SAMPLES_PER_RESERVOIR];
+    float sumW[MAX_SAMPLES_PER_RESERVOIR];
 
     // The estimated light contribution
-    float pHat[NUM_SAMPLES_PER_RESERVOIR];
+    float pHat[MAX_SAMPLES_PER_RESERVOIR];
 
     int totalNumSamples;
 };
@@ -81,7 +84,7 @@ void addSample(inout Reservoir r, inout uint randState, int id, float w, float p
     }
 }
 
-void mergeReservoir(inout uint randState, inout Reservoir dest, Reservoir src, float[NUM_SAMPLES_PER_RESERVOIR] correctedPHats,
+void mergeReservoir(inout uint randState, inout Reservoir dest, Reservoir src, float[MAX_SAMPLES_PER_RESERVOIR] correctedPHats,
         float maxSamplesTake)
 {
     if (src.totalNumSamples <= 0) {
@@ -123,7 +126,7 @@ void getEmissiveTriangleParams(EmissiveTriangle tri, out float intensity, out ve
 PointLightParams getPointLight(int idx);
 void getEmissiveTriangle(int idx, out float intensity, out vec3 N, out float area);
 
-void calculatePHats(Reservoir r, SurfacePoint point, out float pHats[NUM_SAMPLES_PER_RESERVOIR],
+void calculatePHats(Reservoir r, SurfacePoint point, out float pHats[MAX_SAMPLES_PER_RESERVOIR],
         in SceneLightInfo slInfo) {
     for (int i = 0; i < NUM_SAMPLES_PER_RESERVOIR; i++) {
         int sel = r.selected[i];
@@ -148,7 +151,7 @@ void tryMergeReservoir(inout uint randState, inout Reservoir dest, Reservoir src
         return;
     }
 
-    float pHats[NUM_SAMPLES_PER_RESERVOIR];
+    float pHats[MAX_SAMPLES_PER_RESERVOIR];
     calculatePHats(src, point, pHats, slInfo);
     mergeReservoir(randState, dest, src, pHats, maxSamplesTake);
 }
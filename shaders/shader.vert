@@ -3,6 +3,8 @@
 
 #version 450
 
+#include "vertex-quantization.glsl"
+
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 modl;  // global
     mat4 view;
@@ -41,5 +43,5 @@ void main() {
     lastpos += lastpos.w * vec4(ubo.jitt, 0, 0);
 
     fragColor = inColor.rgb;
-    normal = (transpose(inverse(ubo.modl * model.model[gl_InstanceIndex])) * vec4(inNormal, 0.0)).xyz;
+    normal = (transpose(inverse(ubo.modl * model.model[gl_InstanceIndex])) * vec4(decodeNormal(inNormal), 0.0)).xyz;
 }
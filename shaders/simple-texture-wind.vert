@@ -2,7 +2,10 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
 #include "wind.glsl"
+#include "vertex-quantization.glsl"
+#include "draw-material.glsl"
 
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 modl;  // global
@@ -32,8 +35,10 @@ layout(location = 0) out vec2 uv;
 layout(location = 1) out vec3 normal;
 layout(location = 2) out vec4 currpos;
 layout(location = 3) out vec4 lastpos;
+layout(location = 4) flat out uint material;
 
 void main() {
+    material = drawMaterial();
     mat4 combinedModel = ubo.modl * model.model[gl_InstanceIndex];
     vec4 worldpos = combinedModel * vec4(inPosition, 1.0);
     vec3 worldorigin = combinedModel[3].xyz;
@@ -49,5 +54,5 @@ void main() {
     lastpos += lastpos.w * vec4(ubo.jitt, 0, 0);
 
     uv = inUV;
-    normal = (transpose(inverse(ubo.modl * model.model[gl_InstanceIndex])) * vec4(inNormal, 0.0)).xyz;
+    normal = (transpose(inverse(ubo.modl * model.model[gl_InstanceIndex])) * vec4(decodeNormal(inNormal), 0.0)).xyz;
 }
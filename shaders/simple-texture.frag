@@ -2,26 +2,28 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "material.glsl"
 
 layout(location = 0) in vec2 uv;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec4 currpos;
 layout(location = 3) in vec4 lastpos;
+layout(location = 4) flat in uint material;
 
 layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec4 outNormal;
 layout(location = 2) out vec2 outMotion;
 layout(location = 3) out vec4 outEmission;
 
-layout(set = 2, binding = 0) uniform sampler2D texSampler;
-
 float rand(vec2 co){
     return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
 }
 
 void main() {
     float random = rand(uv * 10000 + gl_FragCoord.xy);
-    vec4 color = texture(texSampler, uv);
+    vec4 color = texture(textures[materials[material].albedoTexture], uv);
     if (color.a < 0.05 || (color.a < 0.95 && color.a <= random)) discard;
     outColor = vec4(color.rgb, 0.0);
     outNormal = vec4(normalize(normal), 0.0);
@@ -15,6 +15,13 @@ layout(set = 0, binding = 1) uniform TAAUBO {
     int mode;
     uint width;
     uint height;
+    // the current frame only covers this top left part of the render resolution inputs
+    vec2 renderUVScale;
+    // size of that part in pixels
+    vec2 renderSize;
+    // offset of the current frame's samples from the render pixel centers, in render pixels
+    vec2 jitter;
+    int upscale;
 } taa;
 
 layout(set = 0, binding = 2) uniform sampler2D albedo;
@@ -24,8 +31,14 @@ layout(set = 0, binding = 5) uniform sampler2D motion;
 
 layout(set = 0, binding = 6) uniform sampler2D lastFrame;
 
+// Output UV to UV in a render resolution input, clamped to half a texel inside its rendered part
+vec2 renderUV(sampler2D smpl, vec2 uv) {
+    vec2 halfTexel = 0.5 / vec2(textureSize(smpl, 0));
+    return min(uv * taa.renderUVScale, taa.renderUVScale - halfTexel);
+}
+
 vec4 fetchFrom(sampler2D smpl, ivec2 coords) {
-    return texture(smpl, coords / vec2(taa.width, taa.height));
+    return texture(smpl, renderUV(smpl, coords / vec2(taa.width, taa.height)));
 }
 
 // from incg assignment
@@ -95,6 +108,66 @@ uint clamp_method)
     return current_color;
 }
 
+// Temporal upscaling: the output pixel is reconstructed from the 3x3 render pixels around it, each weighted by the
+// distance of the position it was shaded at (pixel center plus jitter) to the output pixel center. An output pixel
+// close to a sample of this frame takes more of it, the others mostly keep their history, so that over the jitter
+// sequence the history accumulates samples at output resolution.
+vec3
+upscale_frames(vec2 tex_coord, vec3 previous_color)
+{
+    vec2 render_pos = tex_coord * taa.renderSize;
+    // output pixels per render pixel
+    vec2 upscale = vec2(taa.width, taa.height) / taa.renderSize;
+    ivec2 closest = ivec2(floor(render_pos - taa.jitter));
+
+    vec3 color = vec3(0);
+    float sum_weights = 0;
+    float confidence = 0;
+    vec3 minRGB = vec3(1e10);
+    vec3 maxRGB = vec3(-1e10);
+    vec3 EX = vec3(0);
+    vec3 EXX = vec3(0);
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 texel = clamp(closest + ivec2(x, y), ivec2(0), ivec2(taa.renderSize) - 1);
+            vec3 rgb = texelFetch(currentFrame, texel, 0).rgb;
+            // distance in output pixels, Gaussian approximation of Blackman-Harris
+            vec2 offset = (vec2(texel) + 0.5 + taa.jitter - render_pos) * upscale;
+            float weight = exp(-2.29 * dot(offset, offset));
+            color += rgb * weight;
+            sum_weights += weight;
+            confidence = max(confidence, weight);
+
+            minRGB = min(minRGB, rgb);
+            maxRGB = max(maxRGB, rgb);
+            EX += rgb;
+            EXX += rgb * rgb;
+        }
+    }
+    color /= max(sum_weights, 1e-6);
+
+    switch (taa.mode) {
+        default :
+        case 0:// off
+        break;
+        case 1:// min max
+        previous_color = min(maxRGB, max(minRGB, previous_color));
+        break;
+        case 2:// moments
+        EX /= 9;
+        EXX /= 9;
+        vec3 sigma = sqrt(max(EXX - (EX*EX), vec3(0)));
+        previous_color = min(EX + sigma, max(EX - sigma, previous_color));
+        break;
+    }
+
+    // An output pixel is hit by a sample about once per upscale_area frames, so that is how much more of a close
+    // sample is taken. At native resolution this is the usual blending with alpha.
+    float upscale_area = upscale.x * upscale.y;
+    float alpha = clamp(taa.alpha * confidence * upscale_area, taa.alpha / upscale_area, 1.0);
+    return previous_color * (1-alpha) + color * alpha;
+}
+
 // adapted from https://www.shadertoy.com/view/MtVGWz
 
 // note: entirely stolen from https://gist.github.com/TheRealMJP/c83b8c0f46b63f3a88a5986f4fa982b1
@@ -161,16 +234,21 @@ main()
     vec2 tex_coord = gl_FragCoord.xy / vec2(taa.width, taa.height);
     vec2 motion_vec = sample_motion(1);
 
-    // color in the current frame
-    vec3 current_color = texture(currentFrame, tex_coord).rgb;
-    // color of the previous frame
+    // color of the previous frame, the history is kept at output resolution
     vec3 previous_color = sampleCatmullRom(lastFrame, tex_coord + motion_vec).rgb;
     // texture is never initialized and might contain NaN
     if (any(isnan(previous_color)))
     previous_color = vec3(0);
 
-    // perform blending between previous and current frame
-    vec3 merged_color = merge_frames(current_color, previous_color, taa.alpha, taa.mode);
+    vec3 merged_color;
+    if (taa.upscale != 0) {
+        merged_color = upscale_frames(tex_coord, previous_color);
+    } else {
+        // color in the current frame
+        vec3 current_color = texture(currentFrame, renderUV(currentFrame, tex_coord)).rgb;
+        // perform blending between previous and current frame
+        merged_color = merge_frames(current_color, previous_color, taa.alpha, taa.mode);
+    }
 
     outColor = vec4(merged_color, 1.0);
 }
@@ -0,0 +1,18 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+// Set by the application if the NORMAL attribute is octahedral-encoded (see MeshQuantizer).
+// In that case, the vertex input format only has two components and z is always 0.
+layout(constant_id = 0) const bool OCTAHEDRAL_NORMALS = false;
+
+vec3 decodeNormal(vec3 n) {
+    if (!OCTAHEDRAL_NORMALS) {
+        return n;
+    }
+
+    vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    if (v.z < 0) {
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0 ? 1.0 : -1.0, v.y >= 0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
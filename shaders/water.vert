@@ -2,6 +2,10 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
+
+#include "vertex-quantization.glsl"
+#include "draw-material.glsl"
 
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 modl;  // global
@@ -32,8 +36,10 @@ layout(location = 1) out vec3 normal;
 layout(location = 2) out vec3 fsPos;
 layout(location = 3) out vec4 fsPosClipSpace;
 layout(location = 4) out vec4 fsOldPosClipSpace;
+layout(location = 5) flat out uint material;
 
 void main() {
+    material = drawMaterial();
     mat4 M = ubo.view * ubo.modl * model.model[gl_InstanceIndex];
     vec4 pos = M * vec4(inPosition, 1.0);
     fsPos = pos.xyz;
@@ -46,5 +52,5 @@ void main() {
     fsOldPosClipSpace += fsOldPosClipSpace.w * vec4(ubo.jitt, 0, 0);
 
     uv = inUV + vec2(0, -0.1) * ubo.time; // this fucks with motion vectors, but I don't care
-    normal = (transpose(inverse(M)) * vec4(inNormal, 0.0)).xyz;
+    normal = (transpose(inverse(M)) * vec4(decodeNormal(inNormal), 0.0)).xyz;
 }
@@ -0,0 +1,122 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "AsyncCompute.h"
+#include "VulkanHelper.h"
+
+static VkSemaphore createTimelineSemaphore(VkDevice device) {
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore;
+    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore))
+    return semaphore;
+}
+
+AsyncCompute::AsyncCompute(VulkanDevice *device, Swapchain *swapchain) {
+    this->device = device;
+    this->swapchain = swapchain;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = device->chosenQueues.computeFamily.value();
+    VK_CHECK_RESULT(vkCreateCommandPool(*device, &poolInfo, nullptr, &commandPool))
+
+    commandBuffers.resize(Swapchain::framesInFlight);
+    for (auto &frameBuffers: commandBuffers) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = frameBuffers.size();
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(*device, &allocInfo, frameBuffers.data()))
+    }
+
+    for (int i = 0; i < NumDependencies; i++) {
+        graphicsSemaphores[i] = createTimelineSemaphore(*device);
+        computeSemaphores[i] = createTimelineSemaphore(*device);
+    }
+}
+
+AsyncCompute::~AsyncCompute() {
+    for (int i = 0; i < NumDependencies; i++) {
+        vkDestroySemaphore(*device, graphicsSemaphores[i], nullptr);
+        vkDestroySemaphore(*device, computeSemaphores[i], nullptr);
+    }
+    vkDestroyCommandPool(*device, commandPool, nullptr);
+}
+
+void AsyncCompute::beginFrame() {
+    frame++;
+    sceneWaitSemaphores.clear();
+    sceneWaitStages.clear();
+}
+
+void AsyncCompute::submit(Dependency after, VkPipelineStageFlags graphicsStages,
+                          const std::function<void(VkCommandBuffer)> &record) {
+    // The buffer was last submitted framesInFlight frames ago, the scene of that frame waited for it and the fence of
+    // the frame has been waited for since.
+    VkCommandBuffer commandBuffer = commandBuffers[swapchain->currentFrame][after];
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo))
+    record(commandBuffer);
+    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer))
+
+    // Nothing to wait for in the first frame, the semaphores start at 0.
+    uint64_t waitValue = frame - 1;
+    uint64_t signalValue = frame;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &waitValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &graphicsSemaphores[after];
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &computeSemaphores[after];
+    VK_CHECK_RESULT(vkQueueSubmit(device->computeQueue, 1, &submitInfo, VK_NULL_HANDLE))
+
+    sceneWaitSemaphores.push_back(computeSemaphores[after]);
+    sceneWaitStages.push_back(graphicsStages);
+}
+
+void AsyncCompute::submitScene(VkCommandBuffer commandBuffer) {
+    std::vector<uint64_t> waitValues(sceneWaitSemaphores.size(), frame);
+    uint64_t signalValue = frame;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = waitValues.size();
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = sceneWaitSemaphores.size();
+    submitInfo.pWaitSemaphores = sceneWaitSemaphores.data();
+    submitInfo.pWaitDstStageMask = sceneWaitStages.data();
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &graphicsSemaphores[AfterScene];
+    VK_CHECK_RESULT(vkQueueSubmit(device->graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE))
+}
@@ -0,0 +1,74 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_ASYNCCOMPUTE_H
+#define JUNGLE_ASYNCCOMPUTE_H
+
+#include <array>
+#include <functional>
+#include <vector>
+#include "PhysicalDevice.h"
+#include "Swapchain.h"
+
+/**
+ * Runs compute work of a frame on the dedicated compute queue, so that it overlaps with the graphics work of the
+ * previous frame.
+ *
+ * The graphics work of a frame is submitted in two parts, the scene (G-buffer and depth pyramid) with submitScene and
+ * the rest with Swapchain::queuePresent, which has to signal frameSignal(). Compute work of a frame starts as soon as
+ * the previous frame has passed one of these points, and the scene of its own frame waits for it. Both directions use
+ * timeline semaphores counting frames. Buffers are shared by both queue families (VulkanDevice::bufferQueueFamilies),
+ * so no ownership transfers are needed.
+ */
+class AsyncCompute {
+  public:
+    // Point of the graphics work of the previous frame after which compute work may start
+    enum Dependency {
+        AfterScene,
+        AfterFrame,
+        NumDependencies,
+    };
+
+    AsyncCompute(VulkanDevice *device, Swapchain *swapchain);
+    ~AsyncCompute();
+
+    AsyncCompute(const AsyncCompute &) = delete;
+    AsyncCompute &operator=(const AsyncCompute &) = delete;
+
+    // Start a new frame, before its first submit.
+    void beginFrame();
+
+    // Record and submit compute work of the current frame, at most once per dependency. The scene of the frame waits
+    // for it at graphicsStages, which has to include every stage using its results or the resources it writes.
+    void submit(Dependency after, VkPipelineStageFlags graphicsStages,
+                const std::function<void(VkCommandBuffer)> &record);
+
+    // Submit the scene part of the graphics work of the current frame, after the compute work.
+    void submitScene(VkCommandBuffer commandBuffer);
+
+    // Has to be signaled by the submission of the rest of the current frame.
+    TimelineSignal frameSignal() {
+        return {graphicsSemaphores[AfterFrame], frame};
+    }
+
+  private:
+    VulkanDevice *device;
+    Swapchain *swapchain;
+
+    uint64_t frame = 0;
+
+    VkCommandPool commandPool{VK_NULL_HANDLE};
+    // One per frame in flight and dependency
+    std::vector<std::array<VkCommandBuffer, NumDependencies>> commandBuffers;
+
+    // Set to the frame number by the graphics queue when the frame passed the dependency
+    std::array<VkSemaphore, NumDependencies> graphicsSemaphores{};
+    // Set to the frame number when the compute work submitted with the dependency is done
+    std::array<VkSemaphore, NumDependencies> computeSemaphores{};
+
+    // Compute work of the current frame the scene has to wait for
+    std::vector<VkSemaphore> sceneWaitSemaphores;
+    std::vector<VkPipelineStageFlags> sceneWaitStages;
+};
+
+#endif //JUNGLE_ASYNCCOMPUTE_H
@@ -12,6 +12,7 @@
 #include "DataBuffer.h"
 #include "PhysicalDevice.h"
 #include "Scene.h"
+#include "MeshQuantizer.h"
 #include "tiny_gltf.h"
 #include <glm/gtx/component_wise.hpp>
 #include <vulkan/vulkan_core.h>
@@ -34,6 +35,9 @@ inline std::ostream &operator<<(std::ostream &out, const glm::vec3 &value) {
  */
 class BVH {
   public:
+    // Size of the traversal stack in direct-light.comp, which gets it as a specialization constant.
+    static constexpr int MAX_STACK_SIZE = 32;
+
     struct Triangle {
         glm::vec3 x alignas(16);
         glm::vec3 y alignas(16);
@@ -346,7 +350,6 @@ class BVH {
         // We can use the SAH heuristic only if we can guarantee that in the unlucky case, we still manage to
         // switch to balanced splits and not exceed the depth.
         int needBalancedDepth = std::ceil(std::log2(size)) + 1;
-        static constexpr int MAX_STACK_SIZE = 32;
 
         if (depth + needBalancedDepth < MAX_STACK_SIZE - 2) {
             // pseudo-SAH, improve the split candidate.
@@ -468,13 +471,9 @@ class BVH {
                 }
 
                 auto posAccessor = model.accessors[primitive.attributes.at("POSITION")];
-                auto posBView = model.bufferViews[posAccessor.bufferView];
 
-                if (posAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
-                    posAccessor.type != TINYGLTF_TYPE_VEC3 ||
-                    posAccessor.normalized)
-                {
-                    std::cout << "Currently, we support only Vec3 non-normalized floats for the BVH!" << std::endl;
+                if (posAccessor.type != TINYGLTF_TYPE_VEC3) {
+                    std::cout << "Currently, we support only Vec3 positions for the BVH!" << std::endl;
                     continue;
                 }
 
@@ -494,8 +493,8 @@ class BVH {
                 };
 
 
-                auto vertexArray = reinterpret_cast<const float*>(
-                    &model.buffers[posBView.buffer].data[posBView.byteOffset]);
+                // quantized positions are brought back to object space by the mesh transforms
+                auto vertexArray = MeshQuantizer::readVec3(model, posAccessor);
 
                 for (int _idx = 0; _idx < indexAccessor.count; _idx += 3) {
                     int idx0 = getIndexArray(_idx + 0);
@@ -503,9 +502,9 @@ class BVH {
                     int idx2 = getIndexArray(_idx + 2);
 
                     TriangleType tri;
-                    tri.x = glm::vec3(vertexArray[3 * idx0], vertexArray[3 * idx0 + 1], vertexArray[3 * idx0 + 2]);
-                    tri.y = glm::vec3(vertexArray[3 * idx1], vertexArray[3 * idx1 + 1], vertexArray[3 * idx1 + 2]);
-                    tri.z = glm::vec3(vertexArray[3 * idx2], vertexArray[3 * idx2 + 1], vertexArray[3 * idx2 + 2]);
+                    tri.x = vertexArray[idx0];
+                    tri.y = vertexArray[idx1];
+                    tri.z = vertexArray[idx2];
 
                     if constexpr (std::is_same_v<TriangleType, EmissiveTriangle>) {
                         auto& material = model.materials[primitive.material];
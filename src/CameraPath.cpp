@@ -0,0 +1,97 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "CameraPath.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+void CameraPath::add(const CameraKeyframe &keyframe) {
+    keyframes.push_back(keyframe);
+}
+
+CameraKeyframe CameraPath::sample(float time) const {
+    if (keyframes.empty()) {
+        return {};
+    }
+
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+                                 [](float t, const CameraKeyframe &keyframe) { return t < keyframe.time; });
+    if (next == keyframes.begin()) {
+        return keyframes.front();
+    }
+    if (next == keyframes.end()) {
+        return keyframes.back();
+    }
+
+    auto &a = *(next - 1);
+    auto &b = *next;
+    float alpha = b.time > a.time ? (time - a.time) / (b.time - a.time) : 1.0f;
+    return {
+        .time = time,
+        .position = glm::mix(a.position, b.position, alpha),
+        .lookAt = glm::mix(a.lookAt, b.lookAt, alpha),
+        .up = glm::normalize(glm::mix(a.up, b.up, alpha)),
+        .fovY = glm::mix(a.fovY, b.fovY, alpha),
+        .sceneTime = glm::mix(a.sceneTime, b.sceneTime, alpha),
+    };
+}
+
+float CameraPath::duration() const {
+    return keyframes.empty() ? 0 : keyframes.back().time;
+}
+
+void CameraPath::save(const std::string &filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "[camera] WARN: Could not write camera path " << filename << std::endl;
+        return;
+    }
+
+    file << "# time position.xyz lookAt.xyz up.xyz fovY sceneTime\n";
+    file.precision(9);
+    for (auto &k: keyframes) {
+        file << k.time << " "
+             << k.position.x << " " << k.position.y << " " << k.position.z << " "
+             << k.lookAt.x << " " << k.lookAt.y << " " << k.lookAt.z << " "
+             << k.up.x << " " << k.up.y << " " << k.up.z << " "
+             << k.fovY << " " << k.sceneTime << "\n";
+    }
+    std::cout << "[camera] Saved " << keyframes.size() << " keyframes to " << filename << std::endl;
+}
+
+CameraPath CameraPath::load(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open camera path " + filename);
+    }
+
+    CameraPath path;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream values(line);
+        CameraKeyframe k;
+        values >> k.time
+               >> k.position.x >> k.position.y >> k.position.z
+               >> k.lookAt.x >> k.lookAt.y >> k.lookAt.z
+               >> k.up.x >> k.up.y >> k.up.z
+               >> k.fovY >> k.sceneTime;
+        if (values.fail()) {
+            throw std::runtime_error("Invalid keyframe in camera path " + filename + ": " + line);
+        }
+        if (!path.keyframes.empty() && k.time < path.keyframes.back().time) {
+            throw std::runtime_error("Keyframes of camera path " + filename + " are not ordered by time");
+        }
+        path.add(k);
+    }
+
+    if (path.empty()) {
+        throw std::runtime_error("Camera path " + filename + " has no keyframes");
+    }
+    return path;
+}
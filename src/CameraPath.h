@@ -0,0 +1,49 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_CAMERAPATH_H
+#define JUNGLE_CAMERAPATH_H
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct CameraKeyframe {
+    // Seconds since the start of the recording
+    float time = 0;
+    glm::vec3 position{0};
+    glm::vec3 lookAt{0};
+    glm::vec3 up{0, 0, 1};
+    float fovY = 45;
+    // Time of the scene animation, see JungleApp::updateUniformBuffers
+    float sceneTime = 0;
+};
+
+/**
+ * A recorded camera flight, replayed to render the same frames in every benchmark run.
+ *
+ * Stored as text with one keyframe per line: time, position, look-at point, up vector, vertical FOV and scene time.
+ */
+class CameraPath {
+  public:
+    // Keyframes have to be added in the order of their time.
+    void add(const CameraKeyframe &keyframe);
+
+    // Linearly interpolated between the surrounding keyframes, clamped to the first and last one.
+    CameraKeyframe sample(float time) const;
+
+    float duration() const;
+
+    bool empty() const {
+        return keyframes.empty();
+    }
+
+    void save(const std::string &filename) const;
+    // Throws if the file cannot be read or has no keyframes.
+    static CameraPath load(const std::string &filename);
+
+  private:
+    std::vector<CameraKeyframe> keyframes;
+};
+
+#endif //JUNGLE_CAMERAPATH_H
@@ -0,0 +1,47 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "CommandBufferCache.h"
+#include "CommandRecorder.h"
+#include "VulkanHelper.h"
+
+CommandBufferCache::CommandBufferCache(VulkanDevice *device, Swapchain *swapchain) {
+    this->device = device;
+    this->swapchain = swapchain;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = device->chosenQueues.graphicsFamily.value();
+    VK_CHECK_RESULT(vkCreateCommandPool(*device, &poolInfo, nullptr, &commandPool))
+
+    commandBuffers.resize(Swapchain::framesInFlight);
+    isRecorded.assign(Swapchain::framesInFlight, false);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(*device, &allocInfo, commandBuffers.data()))
+}
+
+CommandBufferCache::~CommandBufferCache() {
+    vkDestroyCommandPool(*device, commandPool, nullptr);
+}
+
+void CommandBufferCache::invalidate() {
+    isRecorded.assign(Swapchain::framesInFlight, false);
+}
+
+VkCommandBuffer CommandBufferCache::get(const std::function<void(VkCommandBuffer)> &record,
+                                        VkRenderPass renderPass, uint32_t subpass) {
+    auto frame = swapchain->currentFrame;
+    if (!isRecorded[frame]) {
+        CommandRecorder::beginSecondary(commandBuffers[frame], renderPass, subpass);
+        record(commandBuffers[frame]);
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffers[frame]))
+        isRecorded[frame] = true;
+    }
+
+    return commandBuffers[frame];
+}
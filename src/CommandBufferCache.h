@@ -0,0 +1,42 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_COMMANDBUFFERCACHE_H
+#define JUNGLE_COMMANDBUFFERCACHE_H
+
+#include <functional>
+#include <vector>
+#include "PhysicalDevice.h"
+#include "Swapchain.h"
+
+/**
+ * Secondary command buffers, one per frame in flight, for passes which record the same commands every frame.
+ * They are recorded on first use and afterwards only executed, until invalidate() is called because a pipeline,
+ * descriptor set or buffer used by the commands was recreated or rewritten.
+ *
+ * The buffer of a frame is only recorded again while that frame is being recorded, so the previous submission of
+ * it has finished already. Every cache has its own command pool, so different caches can be recorded on different
+ * threads at the same time (see CommandRecorder).
+ */
+class CommandBufferCache {
+  public:
+    CommandBufferCache(VulkanDevice *device, Swapchain *swapchain);
+    ~CommandBufferCache();
+
+    void invalidate();
+
+    // The buffer of the current frame, recorded with record first if it is outdated. Buffers used inside a render
+    // pass continue the given subpass, which must have been started with secondary command buffer contents.
+    VkCommandBuffer get(const std::function<void(VkCommandBuffer)> &record,
+                        VkRenderPass renderPass = VK_NULL_HANDLE, uint32_t subpass = 0);
+
+  private:
+    VulkanDevice *device;
+    Swapchain *swapchain;
+
+    VkCommandPool commandPool{VK_NULL_HANDLE};
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<bool> isRecorded;
+};
+
+#endif //JUNGLE_COMMANDBUFFERCACHE_H
@@ -0,0 +1,90 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "CommandRecorder.h"
+#include "CommandBufferCache.h"
+#include "CpuProfiler.h"
+#include "VulkanHelper.h"
+#include <omp.h>
+
+CommandRecorder::CommandRecorder(VulkanDevice *device, Swapchain *swapchain) {
+    this->device = device;
+    this->swapchain = swapchain;
+
+    pools.resize(Swapchain::framesInFlight * numThreads());
+    for (auto &threadPool: pools) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = device->chosenQueues.graphicsFamily.value();
+        VK_CHECK_RESULT(vkCreateCommandPool(*device, &poolInfo, nullptr, &threadPool.pool))
+    }
+}
+
+CommandRecorder::~CommandRecorder() {
+    for (auto &threadPool: pools) {
+        vkDestroyCommandPool(*device, threadPool.pool, nullptr);
+    }
+}
+
+int CommandRecorder::numThreads() {
+    return omp_get_max_threads();
+}
+
+void CommandRecorder::beginSecondary(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t subpass) {
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = subpass;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = renderPass != VK_NULL_HANDLE ? VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : 0;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo))
+}
+
+void CommandRecorder::beginFrame() {
+    for (int thread = 0; thread < numThreads(); thread++) {
+        auto &threadPool = pools[swapchain->currentFrame * numThreads() + thread];
+        VK_CHECK_RESULT(vkResetCommandPool(*device, threadPool.pool, 0))
+        threadPool.numUsed = 0;
+    }
+}
+
+VkCommandBuffer CommandRecorder::allocate(ThreadPool &threadPool) {
+    if (threadPool.numUsed == threadPool.buffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = threadPool.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(*device, &allocInfo, &commandBuffer))
+        threadPool.buffers.push_back(commandBuffer);
+    }
+
+    return threadPool.buffers[threadPool.numUsed++];
+}
+
+std::vector<VkCommandBuffer> CommandRecorder::record(const std::vector<RecordingJob> &jobs) {
+    std::vector<VkCommandBuffer> commandBuffers(jobs.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int) jobs.size(); i++) {
+        PROFILE_SCOPE("Recording job");
+        auto &job = jobs[i];
+        if (job.cache) {
+            commandBuffers[i] = job.cache->get(job.record, job.renderPass, job.subpass);
+            continue;
+        }
+
+        auto &threadPool = pools[swapchain->currentFrame * numThreads() + omp_get_thread_num()];
+        commandBuffers[i] = allocate(threadPool);
+        beginSecondary(commandBuffers[i], job.renderPass, job.subpass);
+        job.record(commandBuffers[i]);
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffers[i]))
+    }
+
+    return commandBuffers;
+}
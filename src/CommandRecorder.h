@@ -0,0 +1,61 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_COMMANDRECORDER_H
+#define JUNGLE_COMMANDRECORDER_H
+
+#include <functional>
+#include <vector>
+#include "PhysicalDevice.h"
+#include "Swapchain.h"
+
+class CommandBufferCache;
+
+// Commands of one pass, recorded into their own secondary command buffer.
+struct RecordingJob {
+    std::function<void(VkCommandBuffer)> record;
+    // render pass and subpass continued by the commands, VK_NULL_HANDLE for commands outside of a render pass
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    // Cached jobs are only recorded when the cache is outdated, the others every frame.
+    CommandBufferCache *cache = nullptr;
+};
+
+/**
+ * Records the passes of a frame into secondary command buffers on all OpenMP threads, which the primary command
+ * buffer then only executes in order.
+ *
+ * Command pools are externally synchronized, so every thread records into buffers of its own pool, with one set of
+ * pools per frame in flight. The pools of a frame are reset as a whole once its previous submission has finished.
+ */
+class CommandRecorder {
+  public:
+    CommandRecorder(VulkanDevice *device, Swapchain *swapchain);
+    ~CommandRecorder();
+
+    // Reset the pools of the current frame, after waiting for its fence.
+    void beginFrame();
+
+    // Record all jobs in parallel, the returned buffers are in the order of the jobs.
+    std::vector<VkCommandBuffer> record(const std::vector<RecordingJob> &jobs);
+
+    static int numThreads();
+    static void beginSecondary(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t subpass);
+
+  private:
+    VulkanDevice *device;
+    Swapchain *swapchain;
+
+    struct ThreadPool {
+        VkCommandPool pool{VK_NULL_HANDLE};
+        // allocated once and reused after every reset of the pool
+        std::vector<VkCommandBuffer> buffers;
+        size_t numUsed = 0;
+    };
+    // frame in flight * numThreads() + thread
+    std::vector<ThreadPool> pools;
+
+    VkCommandBuffer allocate(ThreadPool &threadPool);
+};
+
+#endif //JUNGLE_COMMANDRECORDER_H
@@ -0,0 +1,128 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "CpuProfiler.h"
+
+#ifdef JUNGLE_CPU_PROFILER
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    struct Event {
+        const char *name;
+        int64_t start;
+        int64_t end;
+    };
+
+    // An event in a ring buffer, guarded by a sequence lock: sequence is the number of the event plus one once it is
+    // completely written, and 0 while the owning thread writes it. The fields are atomic, so that a trace written at
+    // the same time reads them without a data race, and drops the event if the sequence changed meanwhile.
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<int64_t> start{0};
+        std::atomic<int64_t> end{0};
+    };
+
+    // Events per thread, older ones are overwritten
+    constexpr size_t BUFFER_SIZE = 1 << 16;
+
+    struct ThreadBuffer {
+        uint32_t threadId;
+        std::vector<Slot> events = std::vector<Slot>(BUFFER_SIZE);
+        // Number of events ever recorded, only written by the owning thread
+        std::atomic<uint64_t> count{0};
+    };
+
+    const auto processStart = std::chrono::steady_clock::now();
+
+    // Buffers are never freed, so that events of threads which exited can still be written.
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer &threadBuffer() {
+        thread_local ThreadBuffer *buffer = [] {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffers.back()->threadId = buffers.size() - 1;
+            return buffers.back().get();
+        }();
+        return *buffer;
+    }
+
+    void writeEscaped(std::ostream &out, const char *name) {
+        for (const char *c = name; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                out << '\\';
+            }
+            out << *c;
+        }
+    }
+}
+
+int64_t CpuProfiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - processStart).count();
+}
+
+void CpuProfiler::record(const char *name, int64_t start, int64_t end) {
+    auto &buffer = threadBuffer();
+    uint64_t index = buffer.count.load(std::memory_order_relaxed);
+    auto &slot = buffer.events[index % BUFFER_SIZE];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    // The slot is marked as being written before any field changes
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    slot.sequence.store(index + 1, std::memory_order_release);
+    buffer.count.store(index + 1, std::memory_order_release);
+}
+
+bool CpuProfiler::writeTrace(const std::string &filename) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cout << "[profiler] WARN: Could not write CPU trace " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    bool first = true;
+    for (auto &buffer: buffers) {
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t begin = count > BUFFER_SIZE ? count - BUFFER_SIZE : 0;
+        for (uint64_t i = begin; i < count; i++) {
+            // The owning thread may be overwriting the oldest events, those are skipped.
+            auto &slot = buffer->events[i % BUFFER_SIZE];
+            if (slot.sequence.load(std::memory_order_acquire) != i + 1) {
+                continue;
+            }
+            Event event{
+                slot.name.load(std::memory_order_relaxed),
+                slot.start.load(std::memory_order_relaxed),
+                slot.end.load(std::memory_order_relaxed),
+            };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != i + 1) {
+                continue;
+            }
+
+            out << (first ? "\n" : ",\n") << "{\"name\":\"";
+            writeEscaped(out, event.name);
+            // Complete events, timestamps are in microseconds
+            out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadId
+                << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    std::cout << "[profiler] Wrote CPU trace to " << filename << std::endl;
+    return true;
+}
+#endif
@@ -0,0 +1,54 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_CPUPROFILER_H
+#define JUNGLE_CPUPROFILER_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Records the CPU time of scopes on all threads, written as Chrome trace_event JSON on demand (open it in
+ * chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Every thread appends to its own ring buffer without locking, only the first event of a thread registers the
+ * buffer. The profiler only exists if JUNGLE_CPU_PROFILER is defined (CMake option of the same name), otherwise
+ * PROFILE_SCOPE expands to nothing.
+ */
+#ifdef JUNGLE_CPU_PROFILER
+namespace CpuProfiler {
+    // Nanoseconds since the start of the process
+    int64_t now();
+
+    // name must outlive the profiler, e.g. a string literal
+    void record(const char *name, int64_t start, int64_t end);
+
+    // Write all events still held by the thread buffers. Events recorded meanwhile may be missing, and events which
+    // are overwritten while the trace is written are left out.
+    bool writeTrace(const std::string &filename);
+
+    class Scope {
+      public:
+        explicit Scope(const char *name) : name(name), start(now()) {}
+        ~Scope() {
+            record(name, start, now());
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        const char *name;
+        int64_t start;
+    };
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// Measure from here to the end of the enclosing scope
+#define PROFILE_SCOPE(name) CpuProfiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif //JUNGLE_CPUPROFILER_H
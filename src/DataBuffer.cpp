@@ -10,11 +10,13 @@ void DataBuffer::uploadData(VulkanDevice* device, void* data,
 {
     if (data == nullptr)
     {
-        VulkanHelper::createBuffer(*device, device->physicalDevice, size, usage, properties, buffer, memory);
+        VulkanHelper::createBuffer(*device, device->physicalDevice, size, usage, properties, buffer, memory,
+            device->bufferQueueFamilies());
     } else
     {
         usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        VulkanHelper::createBuffer(*device, device->physicalDevice, size, usage, properties, buffer, memory);
+        VulkanHelper::createBuffer(*device, device->physicalDevice, size, usage, properties, buffer, memory,
+            device->bufferQueueFamilies());
         VulkanHelper::uploadBuffer(*device, device->physicalDevice, size, buffer,
             data, device->commandPool, device->graphicsQueue);
     }
@@ -22,6 +24,12 @@ void DataBuffer::uploadData(VulkanDevice* device, void* data,
     this->size = size;
 }
 
+void DataBuffer::readData(VulkanDevice* device, void* data, VkDeviceSize size)
+{
+    VulkanHelper::downloadBuffer(*device, device->physicalDevice, size, buffer, data, device->commandPool,
+        device->graphicsQueue);
+}
+
 void DataBuffer::destroy(VulkanDevice* device)
 {
     if (buffer != VK_NULL_HANDLE) {
@@ -30,6 +30,20 @@ class DataBuffer {
         }
     }
 
+    // Read the first count elements back, for debugging. The buffer needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT and must
+    // not be in use by the GPU.
+    template<class T>
+    std::vector<T> readData(VulkanDevice* device, size_t count)
+    {
+        std::vector<T> data(count);
+        if (count > 0)
+        {
+            readData(device, data.data(), sizeof(T) * count);
+        }
+        return data;
+    }
+    void readData(VulkanDevice* device, void* data, VkDeviceSize size);
+
     VkDescriptorBufferInfo& getDescriptor() {
         this->descriptor = VkDescriptorBufferInfo {
             .buffer = buffer,
@@ -16,12 +16,13 @@ void Denoiser::enable() {
 }
 
 void Denoiser::setupBuffers() {
-    uniformBuffer.allocate(device, sizeof(ubo), MAX_FRAMES_IN_FLIGHT);
-    tmpBuffer.allocate(device, sizeof(ubo), MAX_FRAMES_IN_FLIGHT);
+    uniformBuffer.allocate(device, sizeof(ubo), Swapchain::framesInFlight);
+    tmpBuffer.allocate(device, sizeof(ubo), Swapchain::framesInFlight);
 }
 
 void Denoiser::updateBuffers() {
     this->ubo.iterationCount = enabled ? iterationCount : 0;
+    this->ubo.viewport = glm::ivec2(swapchain->activeRenderSize().width, swapchain->activeRenderSize().height);
 
     // When we render with the non-tmp sets, we render our final iteration. In this case, lastIteration=1
     uniformBuffer.update(&ubo, sizeof(ubo), swapchain->currentFrame);
@@ -37,14 +38,10 @@ Denoiser::Denoiser(VulkanDevice *pDevice, Swapchain *pSwapchain) : PostProcessin
             ++idx;
         }
     }
-
-    // Update stuff needed for temporary pass
-    recreateTmpTargets();
 }
 
 Denoiser::~Denoiser() {
     tmpBuffer.destroy(device);
-    tmpTarget.destroyAll();
 }
 
 RequiredDescriptors Denoiser::getNumDescriptors() {
@@ -56,7 +53,9 @@ RequiredDescriptors Denoiser::getNumDescriptors() {
 
 void Denoiser::createRenderPass() {
     PostProcessingStep::createRenderPass();
-    tmpTarget.createFramebuffers(renderPass, swapchain->renderSize());
+    for (auto target : tmpTargets) {
+        target->createFramebuffers(renderPass, swapchain->renderSize());
+    }
 }
 
 void Denoiser::createDescriptorSets(VkDescriptorPool pool,
@@ -64,7 +63,8 @@ void Denoiser::createDescriptorSets(VkDescriptorPool pool,
 {
     PostProcessingStep::createDescriptorSets(pool, sourceBuffer, gBuffer);
 
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    tmpTargetSets.resize(Swapchain::framesInFlight);
+    for (int i = 0; i < Swapchain::framesInFlight; i++) {
         for (int j = 0; j < NR_TMP_BUFFERS; j++) {
             tmpTargetSets[i][j] =
                 VulkanHelper::createDescriptorSetsFromLayout(*device, pool, descriptorSetLayout, 1)[0];
@@ -75,13 +75,13 @@ void Denoiser::createDescriptorSets(VkDescriptorPool pool,
 }
 
 void Denoiser::updateTmpSets(const RenderTarget& gBuffer) {
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (int i = 0; i < Swapchain::framesInFlight; i++) {
         for (int j = 0; j < NR_TMP_BUFFERS; j++) {
             std::vector<VkWriteDescriptorSet> writes;
             std::vector<VkDescriptorImageInfo> images;
             images.reserve(1 + GBufferTarget::NumAttachments);
 
-            images.push_back(vkutil::createDescriptorImageInfo(tmpTarget.imageViews[j][0], this->samplers[i][0]));
+            images.push_back(vkutil::createDescriptorImageInfo(tmpTargets[j]->imageViews[i][0], this->samplers[i][0]));
             writes.push_back(vkutil::createDescriptorWriteSampler(images.back(), tmpTargetSets[i][j], 0));
 
             auto uboInfo = vkutil::createDescriptorBufferInfo(uniformBuffer.buffers[i], 0, sizeof(DenoiserUBO));
@@ -102,16 +102,26 @@ void Denoiser::handleResize(
 {
     PostProcessingStep::handleResize(sourceBuffer, gBuffer);
 
-    recreateTmpTargets();
-    tmpTarget.createFramebuffers(renderPass, swapchain->renderSize());
+    for (auto target : tmpTargets) {
+        target->createFramebuffers(renderPass, swapchain->renderSize());
+    }
     updateTmpSets(gBuffer);
 }
 
-void Denoiser::recreateTmpTargets() {
-    tmpTarget.destroyAll();
-    tmpTarget.init(device, MAX_FRAMES_IN_FLIGHT);
-    tmpTarget.addAttachment(swapchain->renderSize(), POST_PROCESSING_FORMAT,
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+std::vector<std::pair<RenderGraph::Image, ImageAccess>> Denoiser::addTmpTargets(RenderGraph *renderGraph) {
+    // Every iteration samples the target the previous one rendered to
+    auto access = ImageAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED);
+    access.stages |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    access.access |= VK_ACCESS_SHADER_READ_BIT;
+
+    std::vector<std::pair<RenderGraph::Image, ImageAccess>> accesses;
+    for (int i = 0; i < NR_TMP_BUFFERS; i++) {
+        auto image = renderGraph->addTransient("Denoiser " + std::to_string(i), POST_PROCESSING_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        tmpTargets[i] = renderGraph->target(image);
+        accesses.push_back({image, access});
+    }
+    return accesses;
 }
 
 void Denoiser::recordCommandBuffer(
@@ -141,17 +151,17 @@ void Denoiser::recordCommandBuffer(
     auto& tmpSets = tmpTargetSets[swapchain->currentFrame];
 
     // General strategy for this effect: we need to do N iterations.
-    // We pass the data (while blurring it) between tmpTarget[0] and tmpTarget[1].
-    // The first iteration is copying to tmpTarget[0], and the last iteration copies
-    // from tmpTarget[currentlyIn] to the actual target.
-    runRenderPass(commandBuffer, tmpTarget.framebuffers[renderPass][0],
+    // We pass the data (while blurring it) between tmpTargets[0] and tmpTargets[1].
+    // The first iteration is copying to tmpTargets[0], and the last iteration copies
+    // from tmpTargets[currentlyIn] to the actual target.
+    runRenderPass(commandBuffer, tmpTargets[0]->framebuffers[renderPass][swapchain->currentFrame],
         descriptorSets[swapchain->currentFrame], false, {pushValue});
     int iterRemaining = ubo.iterationCount - 1;
     int currentlyIn = 0;
 
     while (iterRemaining > 1) {
         pushValues[ITER_NUMBER]++;
-        runRenderPass(commandBuffer, tmpTarget.framebuffers[renderPass][currentlyIn ^ 1],
+        runRenderPass(commandBuffer, tmpTargets[currentlyIn ^ 1]->framebuffers[renderPass][swapchain->currentFrame],
             tmpSets[currentlyIn], false, {pushValue});
         currentlyIn ^= 1;
         iterRemaining--;
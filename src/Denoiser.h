@@ -9,6 +9,7 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include "PostProcessingStep.h"
+#include "RenderGraph.h"
 
 
 struct DenoiserUBO {
@@ -21,6 +22,9 @@ struct DenoiserUBO {
     glm::float32 albedoSigma = 0.1;
     glm::float32 normalSigma = 0.5;
     glm::float32 positionSigma = 0.1;
+
+    // Rendered part of the inputs, see Swapchain::activeRenderSize
+    glm::ivec2 viewport;
 };
 
 class Denoiser : public PostProcessingStep<DenoiserUBO> {
@@ -48,16 +52,18 @@ public:
 
     static constexpr int NR_TMP_BUFFERS = 2;
 
-    RenderTarget tmpTarget;
+    // Transient targets of the render graph, the iterations ping-pong between them
+    std::array<RenderTarget *, NR_TMP_BUFFERS> tmpTargets{};
     UniformBuffer tmpBuffer;
 
-    // tmpTargetSets[i][j] has the GBuffer attachments from GBuffer[i] and accColor equal to tmpTarget[j]
-    std::array<std::array<VkDescriptorSet, NR_TMP_BUFFERS>, MAX_FRAMES_IN_FLIGHT> tmpTargetSets;
+    // tmpTargetSets[i][j] has the GBuffer attachments from GBuffer[i] and accColor equal to tmpTargets[j]
+    std::vector<std::array<VkDescriptorSet, NR_TMP_BUFFERS>> tmpTargetSets;
 
     int32_t iterationCount = 4;
     bool enabled = true;
     bool ignoreAlbedo = false;
 
-    void recreateTmpTargets();
+    // Declare the temporary targets, returns how the denoiser pass accesses them
+    std::vector<std::pair<RenderGraph::Image, ImageAccess>> addTmpTargets(RenderGraph *renderGraph);
     void updateTmpSets(const RenderTarget& gBuffer);
 };
@@ -0,0 +1,132 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "DepthPyramid.h"
+#include "GBufferDescription.h"
+#include "VulkanHelper.h"
+
+struct DepthPyramidPushConstants {
+    // offset, width, height and padding of the source and destination level
+    DepthPyramidLevel src;
+    DepthPyramidLevel dst;
+};
+
+DepthPyramid::DepthPyramid(VulkanDevice *device, Swapchain *swapchain) {
+    this->device = device;
+    this->swapchain = swapchain;
+
+    descriptorSetLayout = device->createDescriptorSetLayout({
+        vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT),
+        vkutil::createSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
+    });
+    depthSampler = VulkanHelper::createSampler(device, false);
+}
+
+DepthPyramid::~DepthPyramid() {
+    pipeline.reset();
+    buffer.destroy(device);
+    vkDestroySampler(*device, depthSampler, nullptr);
+    vkDestroyDescriptorSetLayout(*device, descriptorSetLayout, nullptr);
+}
+
+void DepthPyramid::createPipeline(bool recompileShaders) {
+    PipelineSwap swap;
+    createPipeline(recompileShaders, swap);
+    swap.apply();
+}
+
+void DepthPyramid::createPipeline(bool recompileShaders, PipelineSwap &swap) {
+    ComputePipeline::Parameters params{};
+    params.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/depth_pyramid.comp"};
+    params.recompileShaders = recompileShaders;
+    params.descriptorSetLayouts = {descriptorSetLayout};
+    VkPushConstantRange levelRange{};
+    levelRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    levelRange.size = sizeof(DepthPyramidPushConstants);
+    params.pushConstantRanges.push_back(levelRange);
+    swap.replace(pipeline, std::make_unique<ComputePipeline>(device, params));
+}
+
+RequiredDescriptors DepthPyramid::getNumDescriptors() {
+    return RequiredDescriptors{
+        .requireSamplers = Swapchain::framesInFlight,
+        .requireSSBOs = Swapchain::framesInFlight,
+    };
+}
+
+void DepthPyramid::createDescriptorSets(VkDescriptorPool pool, const RenderTarget &gBuffer) {
+    descriptorSets = VulkanHelper::createDescriptorSetsFromLayout(*device, pool, descriptorSetLayout,
+                                                                  Swapchain::framesInFlight);
+    createBuffer();
+    updateDescriptorSets(gBuffer);
+}
+
+void DepthPyramid::handleResize(const RenderTarget &gBuffer) {
+    buffer.destroy(device);
+    createBuffer();
+    updateDescriptorSets(gBuffer);
+}
+
+void DepthPyramid::createBuffer() {
+    auto size = swapchain->renderSize();
+    auto maxLevels = InstanceCulling::pyramidLevels(size.width, size.height);
+    buffer = {};
+    buffer.createEmpty(device, sizeof(float) * InstanceCulling::pyramidSize(maxLevels),
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    updateLevels();
+}
+
+void DepthPyramid::updateLevels() {
+    auto size = swapchain->activeRenderSize();
+    levels = InstanceCulling::pyramidLevels(size.width, size.height);
+    isValid = false;
+}
+
+void DepthPyramid::updateDescriptorSets(const RenderTarget &gBuffer) {
+    for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
+        auto depthInfo = vkutil::createDescriptorImageInfo(gBuffer.imageViews[i][GBufferTarget::Depth], depthSampler);
+        device->writeDescriptorSets({
+            vkutil::createDescriptorWriteSampler(depthInfo, descriptorSets[i], 0),
+            vkutil::createDescriptorWriteSBO(buffer.getDescriptor(), descriptorSets[i], 1),
+        });
+    }
+}
+
+void DepthPyramid::recordCommandBuffer(VkCommandBuffer commandBuffer) {
+    // Wait for the depth writes of the scene pass and for the culling pass reading the previous pyramid.
+    VkMemoryBarrier depthBarrier{};
+    depthBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, {}, 1, &depthBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->layout,
+                            0, 1, &descriptorSets[swapchain->currentFrame], 0, nullptr);
+
+    for (size_t level = 0; level < levels.size(); level++) {
+        if (level > 0) {
+            VkBufferMemoryBarrier levelBarrier{};
+            levelBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            levelBarrier.buffer = buffer.buffer;
+            levelBarrier.offset = 0;
+            levelBarrier.size = VK_WHOLE_SIZE;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, {}, 0, nullptr, 1, &levelBarrier, 0, nullptr);
+        }
+
+        DepthPyramidPushConstants constants{levels[level > 0 ? level - 1 : 0], levels[level]};
+        vkCmdPushConstants(commandBuffer, pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(constants), &constants);
+        vkCmdDispatch(commandBuffer, (levels[level].width + 7) / 8, (levels[level].height + 7) / 8, 1);
+    }
+
+    isValid = true;
+}
@@ -0,0 +1,55 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_DEPTHPYRAMID_H
+#define JUNGLE_DEPTHPYRAMID_H
+
+#include <memory>
+#include <vector>
+#include "DataBuffer.h"
+#include "InstanceCulling.h"
+#include "Pipeline.h"
+#include "PipelineSwap.h"
+#include "Swapchain.h"
+
+/**
+ * Max-depth pyramid (Hi-Z) of the gBuffer depth for occlusion culling in the next frame, see InstanceCulling.
+ * It is stored as one float buffer with all levels instead of a mip-mapped image, since the pyramid is only read
+ * with texelFetch-style lookups in select_lods.comp anyway.
+ */
+class DepthPyramid {
+  public:
+    DepthPyramid(VulkanDevice *device, Swapchain *swapchain);
+    ~DepthPyramid();
+
+    void createPipeline(bool recompileShaders);
+    void createPipeline(bool recompileShaders, PipelineSwap &swap);
+    RequiredDescriptors getNumDescriptors();
+    void createDescriptorSets(VkDescriptorPool pool, const RenderTarget &gBuffer);
+    void handleResize(const RenderTarget &gBuffer);
+    // Lay out the levels for the rendered part of the depth buffer (Swapchain::activeRenderSize). The buffer is
+    // allocated for the full render size, so this never reallocates, but the pyramid has to be built again.
+    void updateLevels();
+
+    // Build the pyramid from the depth of the current frame, which must have been rendered already.
+    void recordCommandBuffer(VkCommandBuffer commandBuffer);
+
+    std::vector<DepthPyramidLevel> levels;
+    DataBuffer buffer;
+    // Set once the pyramid was built for the current size.
+    bool isValid = false;
+
+  private:
+    VulkanDevice *device;
+    Swapchain *swapchain;
+
+    VkDescriptorSetLayout descriptorSetLayout{VK_NULL_HANDLE};
+    std::vector<VkDescriptorSet> descriptorSets;
+    VkSampler depthSampler{VK_NULL_HANDLE};
+    std::unique_ptr<ComputePipeline> pipeline;
+
+    void createBuffer();
+    void updateDescriptorSets(const RenderTarget &gBuffer);
+};
+
+#endif //JUNGLE_DEPTHPYRAMID_H
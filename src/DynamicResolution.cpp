@@ -0,0 +1,61 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "DynamicResolution.h"
+#include <algorithm>
+#include <cmath>
+#include "Swapchain.h"
+
+void DynamicResolution::restartMeasuring() {
+    samples = 0;
+    averageMilliseconds = 0;
+    // The frame recorded next is timed framesInFlight frames later, the ones before still used the old scale.
+    framesToSkip = Swapchain::framesInFlight + 1;
+}
+
+void DynamicResolution::reset() {
+    currentScale = 1.0f;
+    restartMeasuring();
+}
+
+std::optional<float> DynamicResolution::update(float gpuMilliseconds) {
+    if (!enabled) {
+        if (currentScale != 1.0f) {
+            reset();
+            return currentScale;
+        }
+        return std::nullopt;
+    }
+
+    if (framesToSkip > 0) {
+        framesToSkip--;
+        return std::nullopt;
+    }
+    averageMilliseconds = samples == 0 ? gpuMilliseconds
+                                       : averageMilliseconds + SMOOTHING * (gpuMilliseconds - averageMilliseconds);
+    samples++;
+    if (samples < MIN_SAMPLES) {
+        return std::nullopt;
+    }
+
+    float scale = currentScale;
+    if (averageMilliseconds > targetMilliseconds) {
+        // Jump right to the scale expected to fit the budget, rounded down to a step
+        float fitting = currentScale * std::sqrt(targetMilliseconds / averageMilliseconds);
+        scale = std::min(std::floor(fitting / step + 1e-3f) * step, currentScale - step);
+    } else {
+        float larger = currentScale + step;
+        float expected = averageMilliseconds * (larger * larger) / (currentScale * currentScale);
+        if (expected < targetMilliseconds * (1.0f - headroom)) {
+            scale = larger;
+        }
+    }
+
+    scale = std::clamp(scale, std::min(minScale, 1.0f), 1.0f);
+    if (std::abs(scale - currentScale) < step / 2) {
+        return std::nullopt;
+    }
+    currentScale = scale;
+    restartMeasuring();
+    return currentScale;
+}
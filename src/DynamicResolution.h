@@ -0,0 +1,52 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_DYNAMICRESOLUTION_H
+#define JUNGLE_DYNAMICRESOLUTION_H
+
+#include <optional>
+
+/**
+ * Chooses the render scale (Swapchain::dynamicScale) from the measured GPU time of every frame, so that frames stay
+ * within a time budget.
+ *
+ * The GPU cost is assumed to be proportional to the number of pixels, i.e. to the square of the scale. The scale is
+ * lowered as soon as the smoothed frame time exceeds the budget, but only raised by one step once the time expected at
+ * the larger scale leaves some headroom, so that it does not oscillate between two steps. After every change, the
+ * measurements are ignored until the frames rendered with the new scale are timed.
+ */
+class DynamicResolution {
+  public:
+    // Feed the GPU time of the latest timed frame. Returns the new scale if it should change.
+    std::optional<float> update(float gpuMilliseconds);
+
+    // Back to full scale, e.g. after the controller was disabled.
+    void reset();
+
+    float scale() const {
+        return currentScale;
+    }
+
+    bool enabled = false;
+    float targetMilliseconds = 1000.0f / 60.0f;
+    float minScale = 0.5f;
+    // The scale only takes multiples of step, so that small fluctuations do not change it
+    float step = 0.05f;
+    // Relative part of the budget which has to stay free at a larger scale before it is used
+    float headroom = 0.1f;
+
+  private:
+    // Weight of a new time in the exponential moving average
+    static constexpr float SMOOTHING = 0.1f;
+    // Frames the average has to cover before the scale changes
+    static constexpr int MIN_SAMPLES = 8;
+
+    float currentScale = 1.0f;
+    float averageMilliseconds = 0;
+    int samples = 0;
+    int framesToSkip = 0;
+
+    void restartMeasuring();
+};
+
+#endif //JUNGLE_DYNAMICRESOLUTION_H
@@ -0,0 +1,28 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "FramePacer.h"
+#include <thread>
+
+void FramePacer::wait(double framesPerSecond) {
+    if (framesPerSecond <= 0) {
+        nextFrame.reset();
+        return;
+    }
+
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond));
+    auto now = Clock::now();
+    nextFrame = nextFrame.has_value() ? *nextFrame + interval : now + interval;
+    // A frame which took too long starts the schedule anew, instead of racing through the missed starts.
+    if (*nextFrame < now) {
+        nextFrame = now;
+        return;
+    }
+
+    if (*nextFrame - now > spinMargin) {
+        std::this_thread::sleep_until(*nextFrame - spinMargin);
+    }
+    while (Clock::now() < *nextFrame) {
+        std::this_thread::yield();
+    }
+}
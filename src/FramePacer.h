@@ -0,0 +1,31 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_FRAMEPACER_H
+#define JUNGLE_FRAMEPACER_H
+
+#include <chrono>
+#include <optional>
+
+/**
+ * Limits the frame rate by starting frames at evenly spaced points in time.
+ *
+ * The start times are advanced from the previous one rather than from the end of the frame, so that late wakeups do
+ * not add up. The thread sleeps until shortly before the start and spins for the rest, as sleeping alone overshoots by
+ * the scheduler's wakeup latency.
+ */
+class FramePacer {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Block until the next frame may start, at most framesPerSecond frames per second. Returns right away for 0.
+    void wait(double framesPerSecond);
+
+    // Time before the start of a frame at which sleeping turns into spinning
+    std::chrono::microseconds spinMargin{1000};
+
+  private:
+    std::optional<Clock::time_point> nextFrame;
+};
+
+#endif //JUNGLE_FRAMEPACER_H
@@ -0,0 +1,122 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "GeometryBuffers.h"
+#include "MeshOptimizer.h"
+#include "VulkanHelper.h"
+#include <cstring>
+
+VertexAttributeFormat GeometryBuffers::attributeFormat(const tinygltf::Model &model, int accessor, bool halfFloat) {
+    const auto &gltfAccessor = model.accessors[accessor];
+    if (halfFloat) {
+        return {VK_FORMAT_R16G16_SFLOAT, 2 * sizeof(uint16_t)};
+    }
+
+    int numComponents = tinygltf::GetNumComponentsInType(gltfAccessor.type);
+    uint32_t componentSize = tinygltf::GetComponentSizeInBytes(gltfAccessor.componentType);
+    if (gltfAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT && numComponents == 3) {
+        // Packed with a fourth component, since three-component 8 and 16 bit formats are rarely supported.
+        numComponents = 4;
+    }
+    return {VulkanHelper::gltfAccessorToVertexFormat(gltfAccessor, numComponents * componentSize),
+            numComponents * componentSize};
+}
+
+GeometryBuffers::PrimitiveRange GeometryBuffers::addPrimitive(const tinygltf::Model &model,
+                                                              const std::array<std::optional<int>, 3> &accessors,
+                                                              int indexAccessor,
+                                                              const std::set<int> &halfFloatAccessors) {
+    VertexLayout layout;
+    for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+        if (accessors[i].has_value()) {
+            layout.attributes[i] = attributeFormat(model, *accessors[i], halfFloatAccessors.contains(*accessors[i]));
+        }
+    }
+
+    auto &pool = pools[layout];
+    if (!vertexOffsets.contains(accessors)) {
+        vertexOffsets[accessors] = pool.vertexCount;
+
+        size_t vertexCount = model.accessors[*accessors[0]].count;
+        for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+            if (!accessors[i].has_value()) {
+                continue;
+            }
+
+            const auto &accessor = model.accessors[*accessors[i]];
+            const auto &bufferView = model.bufferViews[accessor.bufferView];
+            const auto *data = model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset + accessor.byteOffset;
+            const size_t byteStride = accessor.ByteStride(bufferView);
+            const size_t elementSize = tinygltf::GetNumComponentsInType(accessor.type) *
+                tinygltf::GetComponentSizeInBytes(accessor.componentType);
+            const uint32_t packedSize = layout.attributes[i].size;
+
+            auto &stream = pool.streams[i];
+            size_t first = stream.size();
+            stream.resize(first + vertexCount * packedSize, 0);
+            for (size_t v = 0; v < std::min<size_t>(vertexCount, accessor.count); v++) {
+                std::memcpy(stream.data() + first + v * packedSize, data + v * byteStride,
+                            std::min<size_t>(elementSize, packedSize));
+            }
+        }
+        pool.vertexCount += vertexCount;
+    }
+
+    int32_t vertexOffset = vertexOffsets[accessors];
+    auto indexKey = std::pair(indexAccessor, vertexOffset);
+    if (!firstIndices.contains(indexKey)) {
+        firstIndices[indexKey] = indices.size();
+        auto primitiveIndices = MeshOptimizer::readIndices(model, model.accessors[indexAccessor]);
+        indices.insert(indices.end(), primitiveIndices.begin(), primitiveIndices.end());
+    }
+
+    return {layout, firstIndices[indexKey], (uint32_t) model.accessors[indexAccessor].count, vertexOffset};
+}
+
+void GeometryBuffers::upload(VulkanDevice *device) {
+    for (auto &[layout, pool]: pools) {
+        for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+            if (pool.streams[i].empty()) {
+                continue;
+            }
+            pool.buffers[i].uploadData(device, pool.streams[i], VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+            pool.streams[i] = {};
+        }
+    }
+    indexBuffer.uploadData(device, indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    indices = {};
+}
+
+void GeometryBuffers::destroy(VulkanDevice *device) {
+    for (auto &[layout, pool]: pools) {
+        for (auto &buffer: pool.buffers) {
+            buffer.destroy(device);
+        }
+    }
+    indexBuffer.destroy(device);
+}
+
+std::array<VkBuffer, GeometryBuffers::NUM_ATTRIBUTES> GeometryBuffers::getVertexBuffers(
+        const VertexLayout &layout) const {
+    auto &pool = pools.at(layout);
+    std::array<VkBuffer, NUM_ATTRIBUTES> result;
+    for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+        result[i] = pool.buffers[i].buffer;
+    }
+    return result;
+}
+
+void GeometryBuffers::bindVertexBuffers(VkCommandBuffer commandBuffer,
+                                        const std::array<VkBuffer, NUM_ATTRIBUTES> &buffers) {
+    VkDeviceSize offset = 0;
+    for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+        // Unused streams leave their binding alone, e.g. binding 1 for emissive color materials.
+        if (buffers[i] != VK_NULL_HANDLE) {
+            vkCmdBindVertexBuffers(commandBuffer, i, 1, &buffers[i], &offset);
+        }
+    }
+}
+
+void GeometryBuffers::bindIndexBuffer(VkCommandBuffer commandBuffer) {
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+}
@@ -0,0 +1,83 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_GEOMETRYBUFFERS_H
+#define JUNGLE_GEOMETRYBUFFERS_H
+
+#include <array>
+#include <compare>
+#include <map>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "DataBuffer.h"
+#include "tiny_gltf.h"
+
+// Format of one vertex attribute stream, the streams are tightly packed.
+struct VertexAttributeFormat {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t size = 0;
+
+    auto operator<=>(const VertexAttributeFormat &other) const = default;
+};
+
+// Bindings 0 (position), 1 (color or texture coordinates) and 2 (normal) of the scene pipelines.
+struct VertexLayout {
+    std::array<VertexAttributeFormat, 3> attributes;
+
+    auto operator<=>(const VertexLayout &other) const = default;
+};
+
+/**
+ * Vertex and index data of all scene primitives, packed into a few shared buffers.
+ *
+ * Primitives with the same vertex layout share one buffer per attribute stream, so that all of their draws can be
+ * issued with the same vertex buffer bindings and only differ in vertexOffset. All indices are stored as 32 bit in a
+ * single index buffer. Primitives using the same accessors (e.g. generated LoDs referencing the vertices of their base
+ * mesh) share their vertex data.
+ */
+class GeometryBuffers {
+  public:
+    static const int NUM_ATTRIBUTES = 3;
+
+    struct PrimitiveRange {
+        VertexLayout layout;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t vertexOffset;
+    };
+
+    static VertexAttributeFormat attributeFormat(const tinygltf::Model &model, int accessor, bool halfFloat);
+
+    // Accessors of the attribute streams, std::nullopt for unused streams. The index accessor is required.
+    PrimitiveRange addPrimitive(const tinygltf::Model &model, const std::array<std::optional<int>, 3> &accessors,
+                                int indexAccessor, const std::set<int> &halfFloatAccessors);
+
+    void upload(VulkanDevice *device);
+    void destroy(VulkanDevice *device);
+
+    // Buffers of the attribute streams of a layout, VK_NULL_HANDLE for unused streams.
+    std::array<VkBuffer, NUM_ATTRIBUTES> getVertexBuffers(const VertexLayout &layout) const;
+    static void bindVertexBuffers(VkCommandBuffer commandBuffer, const std::array<VkBuffer, NUM_ATTRIBUTES> &buffers);
+    void bindIndexBuffer(VkCommandBuffer commandBuffer);
+
+  private:
+    struct Pool {
+        std::array<std::vector<uint8_t>, NUM_ATTRIBUTES> streams;
+        std::array<DataBuffer, NUM_ATTRIBUTES> buffers;
+        uint32_t vertexCount = 0;
+    };
+
+    std::map<VertexLayout, Pool> pools;
+    std::vector<uint32_t> indices;
+    DataBuffer indexBuffer;
+
+    // accessors of the attribute streams -> vertexOffset
+    std::map<std::array<std::optional<int>, 3>, int32_t> vertexOffsets;
+    // (index accessor, vertexOffset) -> firstIndex
+    std::map<std::pair<int, int32_t>, uint32_t> firstIndices;
+};
+
+#endif //JUNGLE_GEOMETRYBUFFERS_H
@@ -35,8 +35,12 @@ void GlobalFog::updateCamera(glm::mat4 view, glm::mat4 projection, float near, f
     ubo.view = view;
     ubo.projection = projection;
     ubo.inverseVP = glm::inverse(projection * view);
-    ubo.viewportWidth = swapchain->renderSize().width;
-    ubo.viewportHeight = swapchain->renderSize().height;
+    ubo.viewportWidth = swapchain->activeRenderSize().width;
+    ubo.viewportHeight = swapchain->activeRenderSize().height;
+    ubo.renderUVScale = {
+        ubo.viewportWidth / swapchain->renderSize().width,
+        ubo.viewportHeight / swapchain->renderSize().height,
+    };
 }
 
 GlobalFog::GlobalFog(VulkanDevice *pDevice, Swapchain *pSwapchain) :
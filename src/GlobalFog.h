@@ -33,6 +33,9 @@ struct GlobalFogUBO {
     glm::int32 ssrRaySteps;
 
     glm::int32 renderEmission;
+
+    // Rendered part of the inputs, for sampling them at normalized coordinates
+    alignas(8) glm::vec2 renderUVScale;
 };
 
 /**
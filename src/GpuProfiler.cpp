@@ -0,0 +1,224 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "GpuProfiler.h"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include "VulkanHelper.h"
+#include "imgui.h"
+
+GpuProfiler::GpuProfiler(VulkanDevice *device, Swapchain *swapchain) : device(device), swapchain(swapchain) {
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device->physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device->physicalDevice, &queueFamilyCount, queueFamilies.data());
+    validBits = queueFamilies[device->chosenQueues.graphicsFamily.value()].timestampValidBits;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device->physicalDevice, &properties);
+    nanosecondsPerTick = properties.limits.timestampPeriod;
+
+    if (validBits == 0) {
+        std::cout << "[profiler] WARN: The graphics queue does not support timestamps, GPU times are not measured"
+                  << std::endl;
+        return;
+    }
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_SECTIONS * 2;
+
+    queryPools.resize(Swapchain::framesInFlight);
+    submittedFrames.resize(Swapchain::framesInFlight);
+    for (auto &pool: queryPools) {
+        VK_CHECK_RESULT(vkCreateQueryPool(*device, &poolInfo, nullptr, &pool))
+    }
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (auto &pool: queryPools) {
+        vkDestroyQueryPool(*device, pool, nullptr);
+    }
+}
+
+void GpuProfiler::writeCsv(const std::string &filename) {
+    csv.open(filename);
+    if (!csv.is_open()) {
+        std::cout << "[profiler] WARN: Could not open " << filename << " for writing" << std::endl;
+        return;
+    }
+    csv << "frame,section,milliseconds\n";
+}
+
+FrameStatistics FrameStatistics::of(std::vector<float> times) {
+    if (times.empty()) {
+        return {};
+    }
+    std::sort(times.begin(), times.end());
+    auto percentile = [&](float p) {
+        return times[std::min(times.size() - 1, (size_t) (p * times.size()))];
+    };
+    return {
+        .average = std::accumulate(times.begin(), times.end(), 0.0f) / times.size(),
+        .p50 = percentile(0.5f),
+        .p95 = percentile(0.95f),
+        .p99 = percentile(0.99f),
+    };
+}
+
+void GpuProfiler::readResults(uint32_t frame) {
+    auto pool = queryPools[frame];
+    auto &submittedFrame = submittedFrames[frame];
+    if (submittedFrame.has_value()) {
+        // Value and availability of every query. Sections which were not recorded in that frame stay unavailable,
+        // so VK_NOT_READY is expected here and only the available pairs are used.
+        std::vector<uint64_t> results(MAX_SECTIONS * 2 * 2);
+        vkGetQueryPoolResults(*device, pool, 0, MAX_SECTIONS * 2, results.size() * sizeof(uint64_t),
+                              results.data(), 2 * sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+        uint64_t mask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < sections.size(); i++) {
+            uint64_t *beginQuery = &results[i * 4];
+            uint64_t *endQuery = &results[i * 4 + 2];
+            if (!beginQuery[1] || !endQuery[1]) {
+                continue;
+            }
+
+            float milliseconds = (float) ((endQuery[0] - beginQuery[0]) & mask) * nanosecondsPerTick / 1e6f;
+            auto &history = sections[i].history;
+            history.push_back(milliseconds);
+            if (history.size() > HISTORY_SIZE) {
+                history.pop_front();
+            }
+            sections[i].latest = SectionTime{*submittedFrame, milliseconds};
+            if (csv.is_open()) {
+                csv << *submittedFrame << "," << sections[i].name << "," << milliseconds << "\n";
+            }
+            if (collectedSection == sections[i].name) {
+                collected.push_back(milliseconds);
+            }
+        }
+    }
+    submittedFrame.reset();
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer) {
+    if (validBits == 0) {
+        return;
+    }
+
+    readResults(swapchain->currentFrame);
+    vkCmdResetQueryPool(commandBuffer, queryPools[swapchain->currentFrame], 0, MAX_SECTIONS * 2);
+    submittedFrames[swapchain->currentFrame] = frameNumber++;
+}
+
+void GpuProfiler::flush() {
+    if (validBits == 0) {
+        return;
+    }
+
+    // Oldest frame first, to keep the frame order
+    std::vector<uint32_t> frames;
+    for (uint32_t i = 0; i < submittedFrames.size(); i++) {
+        if (submittedFrames[i].has_value()) {
+            frames.push_back(i);
+        }
+    }
+    std::sort(frames.begin(), frames.end(), [&](uint32_t a, uint32_t b) {
+        return *submittedFrames[a] < *submittedFrames[b];
+    });
+    for (auto frame: frames) {
+        readResults(frame);
+    }
+}
+
+std::optional<SectionTime> GpuProfiler::latest(const std::string &section) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto index = sectionIndices.find(section);
+    if (index == sectionIndices.end()) {
+        return std::nullopt;
+    }
+    return sections[index->second].latest;
+}
+
+void GpuProfiler::startCollecting(const std::string &section) {
+    std::lock_guard<std::mutex> lock(mutex);
+    collectedSection = section;
+    collected.clear();
+}
+
+std::vector<float> GpuProfiler::stopCollecting() {
+    std::lock_guard<std::mutex> lock(mutex);
+    collectedSection.reset();
+    return std::move(collected);
+}
+
+std::optional<uint32_t> GpuProfiler::queryIndex(const std::string &section) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!sectionIndices.contains(section)) {
+        if (sections.size() == MAX_SECTIONS) {
+            return std::nullopt;
+        }
+        sectionIndices[section] = sections.size();
+        sections.push_back({.name = section});
+    }
+    return sectionIndices[section] * 2;
+}
+
+void GpuProfiler::begin(VkCommandBuffer commandBuffer, const std::string &section) {
+    if (validBits == 0) {
+        return;
+    }
+    // Bottom of pipe for both timestamps, so that the time of a section does not include waiting for earlier ones.
+    if (auto query = queryIndex(section)) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPools[swapchain->currentFrame],
+                            *query);
+    }
+}
+
+void GpuProfiler::end(VkCommandBuffer commandBuffer, const std::string &section) {
+    if (validBits == 0) {
+        return;
+    }
+    if (auto query = queryIndex(section)) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPools[swapchain->currentFrame],
+                            *query + 1);
+    }
+}
+
+void GpuProfiler::drawImGUI(bool *open) {
+    if (ImGui::Begin("GPU Profiler", open)) {
+        if (validBits == 0) {
+            ImGui::Text("Timestamps are not supported on the graphics queue");
+        } else if (ImGui::BeginTable("Sections", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("Section");
+            ImGui::TableSetupColumn("Avg ms");
+            ImGui::TableSetupColumn("P50 ms");
+            ImGui::TableSetupColumn("P95 ms");
+            ImGui::TableSetupColumn("P99 ms");
+            ImGui::TableHeadersRow();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &section: sections) {
+                if (section.history.empty()) {
+                    continue;
+                }
+                auto statistics = FrameStatistics::of({section.history.begin(), section.history.end()});
+
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", section.name.c_str());
+                for (float value: {statistics.average, statistics.p50, statistics.p95, statistics.p99}) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.3f", value);
+                }
+            }
+            ImGui::EndTable();
+        }
+    }
+    ImGui::End();
+}
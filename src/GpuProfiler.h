@@ -0,0 +1,111 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_GPUPROFILER_H
+#define JUNGLE_GPUPROFILER_H
+
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "PhysicalDevice.h"
+#include "Swapchain.h"
+
+// Average and percentiles of a series of times
+struct FrameStatistics {
+    float average = 0;
+    float p50 = 0;
+    float p95 = 0;
+    float p99 = 0;
+
+    static FrameStatistics of(std::vector<float> times);
+};
+
+// Time of a section in one frame
+struct SectionTime {
+    // Number of the frame the time was measured in, counted from the first frame of the profiler
+    uint64_t frame;
+    float milliseconds;
+};
+
+/**
+ * Measures the GPU time of named sections of a frame with timestamp queries.
+ *
+ * Every frame in flight has its own query pool. Its results are read when the frame slot is recorded again, at which
+ * point acquireNextImage has waited for the previous submission already, so reading never stalls. Sections get fixed
+ * query indices on first use, which keeps cached secondary command buffers that contain timestamps valid.
+ */
+class GpuProfiler {
+  public:
+    GpuProfiler(VulkanDevice *device, Swapchain *swapchain);
+    ~GpuProfiler();
+
+    // Collect the results of the previous submission of the current frame and reset its queries. Has to be recorded
+    // into the primary command buffer before any command buffer containing sections is executed.
+    void beginFrame(VkCommandBuffer commandBuffer);
+
+    // Time the commands between begin and end. The calls may be recorded into any command buffer of the current
+    // frame, but not inside a render pass whose contents are secondary command buffers.
+    void begin(VkCommandBuffer commandBuffer, const std::string &section);
+    void end(VkCommandBuffer commandBuffer, const std::string &section);
+
+    // Collect the results of all frames in flight, after waiting for the device to be idle.
+    void flush();
+
+    // Most recent time measured for the section, nothing before its first result. It stays the same until the result
+    // of a later frame is read, which can take more than one frame.
+    std::optional<SectionTime> latest(const std::string &section);
+
+    // Keep every time measured for the section from now on, in frame order, until stopCollecting.
+    void startCollecting(const std::string &section);
+    std::vector<float> stopCollecting();
+
+    // Append "frame,section,milliseconds" lines for every measured frame to the given file.
+    void writeCsv(const std::string &filename);
+
+    void drawImGUI(bool *open);
+
+  private:
+    // Two queries per section, begin and end
+    static constexpr uint32_t MAX_SECTIONS = 64;
+    // Number of frames the statistics are computed over
+    static constexpr size_t HISTORY_SIZE = 256;
+
+    struct Section {
+        std::string name;
+        std::deque<float> history;
+        std::optional<SectionTime> latest;
+    };
+
+    VulkanDevice *device;
+    Swapchain *swapchain;
+
+    // Zero if the graphics queue does not support timestamps, the profiler does nothing then.
+    uint32_t validBits = 0;
+    float nanosecondsPerTick = 1.0f;
+
+    std::vector<VkQueryPool> queryPools;
+    // Frame number of the last submission of every frame in flight, none before the first one.
+    std::vector<std::optional<uint64_t>> submittedFrames;
+    uint64_t frameNumber = 0;
+
+    // Guards sections, sectionIndices and the collected times, sections are added by the recording threads.
+    std::mutex mutex;
+    std::vector<Section> sections;
+    std::map<std::string, uint32_t> sectionIndices;
+
+    std::ofstream csv;
+
+    std::optional<std::string> collectedSection;
+    std::vector<float> collected;
+
+    void readResults(uint32_t frame);
+
+    // Query index of the begin timestamp, or nothing if there are too many sections.
+    std::optional<uint32_t> queryIndex(const std::string &section);
+};
+
+#endif //JUNGLE_GPUPROFILER_H
@@ -0,0 +1,220 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "InstanceCulling.h"
+#include "MeshQuantizer.h"
+#include <algorithm>
+#include <limits>
+
+glm::vec4 InstanceCulling::computeBoundingSphere(const tinygltf::Model &model, const std::vector<int> &meshes) {
+    std::vector<glm::vec3> positions;
+    for (int mesh: meshes) {
+        for (const auto &primitive: model.meshes[mesh].primitives) {
+            if (primitive.attributes.count("POSITION")) {
+                auto meshPositions = MeshQuantizer::readVec3(model, model.accessors[primitive.attributes.at("POSITION")]);
+                positions.insert(positions.end(), meshPositions.begin(), meshPositions.end());
+            }
+        }
+    }
+
+    if (positions.empty()) {
+        return glm::vec4(0.0f);
+    }
+
+    // Center of the bounding box, not minimal but good enough for culling.
+    glm::vec3 low(std::numeric_limits<float>::max());
+    glm::vec3 high(-std::numeric_limits<float>::max());
+    for (auto &position: positions) {
+        low = glm::min(low, position);
+        high = glm::max(high, position);
+    }
+
+    glm::vec3 center = (low + high) * 0.5f;
+    float radius = 0.0f;
+    for (auto &position: positions) {
+        radius = std::max(radius, glm::length(position - center));
+    }
+    return glm::vec4(center, radius);
+}
+
+glm::vec4 InstanceCulling::transformSphere(const glm::mat4 &transform, const glm::vec4 &sphere) {
+    glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+    float scale = std::max({glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])),
+                            glm::length(glm::vec3(transform[2]))});
+    return glm::vec4(center, sphere.w * scale);
+}
+
+std::array<glm::vec4, 6> InstanceCulling::frustumPlanes(const glm::mat4 &viewProjection) {
+    // Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+    auto row = [&](int i) {
+        return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    };
+
+    std::array<glm::vec4, 6> planes = {
+        row(3) + row(0), // left
+        row(3) - row(0), // right
+        row(3) + row(1), // bottom
+        row(3) - row(1), // top
+        row(2),          // near, depth is in [0, 1]
+        row(3) - row(2), // far
+    };
+
+    for (auto &plane: planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return planes;
+}
+
+bool InstanceCulling::isInFrustum(const std::array<glm::vec4, 6> &planes, const glm::vec4 &sphere) {
+    for (auto &plane: planes) {
+        if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool InstanceCulling::isInFrustum(const CullingData &culling, const glm::vec4 &sphere) {
+    std::array<glm::vec4, 6> planes;
+    std::copy(std::begin(culling.frustumPlanes), std::end(culling.frustumPlanes), planes.begin());
+    return isInFrustum(planes, sphere);
+}
+
+std::vector<DepthPyramidLevel> InstanceCulling::pyramidLevels(uint32_t width, uint32_t height) {
+    std::vector<DepthPyramidLevel> levels;
+    uint32_t offset = 0;
+    width = std::max(width, 1u);
+    height = std::max(height, 1u);
+    while (levels.size() < MAX_DEPTH_PYRAMID_LEVELS) {
+        levels.push_back({offset, width, height, 0});
+        offset += width * height;
+        if (width == 1 && height == 1) {
+            break;
+        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    return levels;
+}
+
+size_t InstanceCulling::pyramidSize(const std::vector<DepthPyramidLevel> &levels) {
+    return levels.back().offset + levels.back().width * levels.back().height;
+}
+
+std::vector<float> InstanceCulling::buildDepthPyramid(const std::vector<float> &depth,
+                                                      const std::vector<DepthPyramidLevel> &levels) {
+    std::vector<float> pyramid(pyramidSize(levels));
+    std::copy(depth.begin(), depth.begin() + levels[0].width * levels[0].height, pyramid.begin());
+
+    for (size_t level = 1; level < levels.size(); level++) {
+        const auto &src = levels[level - 1];
+        const auto &dst = levels[level];
+        for (uint32_t y = 0; y < dst.height; y++) {
+            for (uint32_t x = 0; x < dst.width; x++) {
+                // All source texels overlapping the destination texel, 3 wide for odd sizes.
+                uint32_t x0 = x * src.width / dst.width;
+                uint32_t x1 = ((x + 1) * src.width + dst.width - 1) / dst.width;
+                uint32_t y0 = y * src.height / dst.height;
+                uint32_t y1 = ((y + 1) * src.height + dst.height - 1) / dst.height;
+
+                float farthest = 0.0f;
+                for (uint32_t sy = y0; sy < y1; sy++) {
+                    for (uint32_t sx = x0; sx < x1; sx++) {
+                        farthest = std::max(farthest, pyramid[src.offset + sy * src.width + sx]);
+                    }
+                }
+                pyramid[dst.offset + y * dst.width + x] = farthest;
+            }
+        }
+    }
+    return pyramid;
+}
+
+bool InstanceCulling::isOccluded(const CullingData &culling, const std::vector<float> &pyramid,
+                                 const glm::vec4 &sphere) {
+    if (!culling.occlusionCulling || culling.numPyramidLevels == 0) {
+        return false;
+    }
+
+    // Screen rectangle and nearest depth of the box around the sphere in the frame of the pyramid.
+    glm::vec2 low(std::numeric_limits<float>::max());
+    glm::vec2 high(-std::numeric_limits<float>::max());
+    float nearestDepth = 1.0f;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner = glm::vec3(sphere) + sphere.w * glm::vec3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1);
+        glm::vec4 clip = culling.pyramidViewProjection * glm::vec4(corner, 1.0f);
+        if (clip.w <= 0.0f) {
+            return false; // behind the camera, the projection is meaningless
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        low = glm::min(low, glm::vec2(ndc));
+        high = glm::max(high, glm::vec2(ndc));
+        nearestDepth = std::min(nearestDepth, ndc.z);
+    }
+
+    // The pyramid knows nothing about what was outside of the screen or in front of the near plane.
+    if (nearestDepth <= 0.0f || low.x < -1.0f || low.y < -1.0f || high.x > 1.0f || high.y > 1.0f) {
+        return false;
+    }
+
+    const auto &base = culling.pyramidLevels[0];
+    glm::vec2 size(base.width, base.height);
+    glm::uvec2 first = glm::min(glm::uvec2((low * 0.5f + 0.5f) * size), glm::uvec2(base.width - 1, base.height - 1));
+    glm::uvec2 last = glm::min(glm::uvec2((high * 0.5f + 0.5f) * size), glm::uvec2(base.width - 1, base.height - 1));
+
+    uint32_t level = 0;
+    while (level + 1 < culling.numPyramidLevels && (last.x - first.x > 1 || last.y - first.y > 1)) {
+        const auto &src = culling.pyramidLevels[level];
+        const auto &dst = culling.pyramidLevels[level + 1];
+        first = first * glm::uvec2(dst.width, dst.height) / glm::uvec2(src.width, src.height);
+        last = last * glm::uvec2(dst.width, dst.height) / glm::uvec2(src.width, src.height);
+        level++;
+    }
+
+    const auto &pyramidLevel = culling.pyramidLevels[level];
+    float farthest = 0.0f;
+    for (uint32_t y = first.y; y <= last.y; y++) {
+        for (uint32_t x = first.x; x <= last.x; x++) {
+            farthest = std::max(farthest, pyramid[pyramidLevel.offset + y * pyramidLevel.width + x]);
+        }
+    }
+    return nearestDepth > farthest;
+}
+
+InstanceCulling::Selection InstanceCulling::selectInstances(const std::vector<glm::mat4> &instances,
+                                                            const std::vector<LoDSelectionWorkgroup> &workgroups,
+                                                            const std::vector<LoDSelectionRange> &ranges,
+                                                            const CullingData &culling,
+                                                            const std::vector<float> &pyramid,
+                                                            size_t numSelectedTransforms) {
+    Selection selection;
+    selection.lodCounts.resize(ranges.size(), 0);
+    selection.transforms.resize(numSelectedTransforms);
+
+    for (const auto &workgroup: workgroups) {
+        for (uint32_t i = 0; i < workgroup.numInstances; i++) {
+            const auto &instance = instances[workgroup.firstInstance + i];
+            glm::vec4 sphere = transformSphere(instance, workgroup.boundingSphere);
+            if (culling.frustumCulling && !isInFrustum(culling, sphere)) {
+                continue;
+            }
+            if (isOccluded(culling, pyramid, sphere)) {
+                continue;
+            }
+
+            // LoDs are sorted by distance, use the first one which reaches far enough
+            uint32_t lod = workgroup.numLoDs - 1;
+            float cameraDistance = glm::length(glm::vec3(instance[3]) - culling.cameraPosition);
+            for (uint32_t j = 0; j + 1 < workgroup.numLoDs; j++) {
+                if (cameraDistance < ranges[workgroup.firstLoD + j].distMax) {
+                    lod = j;
+                    break;
+                }
+            }
+
+            uint32_t range = workgroup.firstLoD + lod;
+            selection.transforms[ranges[range].firstOutput + selection.lodCounts[range]++] = instance;
+        }
+    }
+    return selection;
+}
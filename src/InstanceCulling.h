@@ -0,0 +1,127 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_INSTANCECULLING_H
+#define JUNGLE_INSTANCECULLING_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "tiny_gltf.h"
+
+// Must match select_lods.comp
+const uint32_t LOD_SELECTION_WORKGROUP_SIZE = 128;
+const uint32_t MAX_LODS_PER_MESH = 8;
+const uint32_t NO_LOD_SELECTION = ~0u;
+// Enough for a 32768x32768 depth buffer
+const uint32_t MAX_DEPTH_PYRAMID_LEVELS = 16;
+
+// Every workgroup of select_lods.comp handles up to LOD_SELECTION_WORKGROUP_SIZE instances of a single mesh.
+struct LoDSelectionWorkgroup {
+    uint32_t firstLoD;
+    uint32_t numLoDs;
+    uint32_t firstInstance;
+    uint32_t numInstances;
+    // object space bounding sphere of all LoDs of the mesh, xyz center and w radius
+    glm::vec4 boundingSphere;
+};
+
+struct LoDSelectionRange {
+    float distMin;
+    float distMax;
+    // start of the region of this LoD in the selected transforms, used as firstInstance of its draws
+    uint32_t firstOutput;
+    uint32_t padding;
+};
+
+// Per draw command data of select_lods.comp
+struct DrawCommandInfo {
+    // LoD range providing the instance count, NO_LOD_SELECTION for draws with a fixed instance count
+    uint32_t lod;
+    // batch of draws issued with one vkCmdDrawIndexedIndirectCount
+    uint32_t batch;
+    // first draw of the batch in the compacted draw commands
+    uint32_t firstBatchDraw;
+    // glTF material, copied next to the compacted draw for the bindless material lookup
+    uint32_t material;
+};
+
+// One level of the depth pyramid, all levels are stored one after another in a single float buffer.
+struct DepthPyramidLevel {
+    uint32_t offset;
+    uint32_t width;
+    uint32_t height;
+    uint32_t padding;
+};
+
+// Per-frame parameters of select_lods.comp, must match CullingData there.
+struct alignas(16) CullingData {
+    // planes of the current view frustum with normals pointing inwards
+    glm::vec4 frustumPlanes[6];
+    // view projection of the frame the depth pyramid was built from
+    glm::mat4 pyramidViewProjection;
+    DepthPyramidLevel pyramidLevels[MAX_DEPTH_PYRAMID_LEVELS];
+    glm::vec3 cameraPosition;
+    uint32_t numDrawCommands;
+    uint32_t numPyramidLevels;
+    uint32_t frustumCulling;
+    // only set once the depth pyramid holds data of a previous frame
+    uint32_t occlusionCulling;
+};
+
+/**
+ * Frustum and hierarchical depth (Hi-Z) occlusion culling of mesh instances.
+ *
+ * Every frame, select_lods.comp tests the bounding sphere of every instance against the view frustum and against a
+ * max-depth pyramid built from the depth buffer of the previous frame (depth_pyramid.comp), before it selects the LoD
+ * and compacts the surviving transforms into the indirect draws. An instance is occluded if its nearest point is
+ * behind the farthest depth of all pyramid texels covering its screen rectangle, picked from the level where the
+ * rectangle spans at most 2x2 texels.
+ *
+ * The functions here are a CPU reference of both shaders with the same conventions and data layout. Scene::checkCulling
+ * compares the GPU results with them (--check-culling).
+ */
+class InstanceCulling {
+  public:
+    // Bounding sphere around the POSITION data of all given meshes, in the space of the raw accessor values.
+    static glm::vec4 computeBoundingSphere(const tinygltf::Model &model, const std::vector<int> &meshes);
+
+    // Bounding sphere of an instance with the given transform, a scaled transform scales the radius by its largest axis.
+    static glm::vec4 transformSphere(const glm::mat4 &transform, const glm::vec4 &sphere);
+
+    // Normalized frustum planes of a Vulkan style (depth in [0, 1]) view projection.
+    static std::array<glm::vec4, 6> frustumPlanes(const glm::mat4 &viewProjection);
+
+    static bool isInFrustum(const std::array<glm::vec4, 6> &planes, const glm::vec4 &sphere);
+    static bool isInFrustum(const CullingData &culling, const glm::vec4 &sphere);
+
+    // Layout of a pyramid for a depth buffer of the given size, every level halves the size (rounding up).
+    static std::vector<DepthPyramidLevel> pyramidLevels(uint32_t width, uint32_t height);
+    static size_t pyramidSize(const std::vector<DepthPyramidLevel> &levels);
+
+    // Same reduction as depth_pyramid.comp, depth is the row major depth buffer of size levels[0].
+    static std::vector<float> buildDepthPyramid(const std::vector<float> &depth,
+                                                const std::vector<DepthPyramidLevel> &levels);
+
+    // Same test as select_lods.comp, sphere is in world space.
+    static bool isOccluded(const CullingData &culling, const std::vector<float> &pyramid, const glm::vec4 &sphere);
+
+    struct Selection {
+        // number of selected instances per LoD range
+        std::vector<uint32_t> lodCounts;
+        // selected transforms, each LoD range starts at its firstOutput
+        std::vector<glm::mat4> transforms;
+    };
+
+    /**
+     * Same selection as select_lods.comp: cull every instance and pick its LoD. The order of the transforms within
+     * the region of a LoD is the instance order here, while it depends on the scheduling of workgroups on the GPU.
+     */
+    static Selection selectInstances(const std::vector<glm::mat4> &instances,
+                                     const std::vector<LoDSelectionWorkgroup> &workgroups,
+                                     const std::vector<LoDSelectionRange> &ranges, const CullingData &culling,
+                                     const std::vector<float> &pyramid, size_t numSelectedTransforms);
+};
+
+#endif //JUNGLE_INSTANCECULLING_H
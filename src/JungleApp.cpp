@@ -4,11 +4,13 @@
 // Parts of this file are licensed under MIT.
 // Copyright (c) 2014-2024 Omar Cornut
 
+#include "CpuProfiler.h"
 #include "GBufferDescription.h"
 #include "Lighting.h"
 #include "Pipeline.h"
+#include "ShaderCompiler.h"
 #include "Swapchain.h"
-#include <thread>
+#include "stb_image_write.h"
 #include <vulkan/vulkan_core.h>
 
 #define GLM_FORCE_RADIANS
@@ -18,6 +20,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
 #include "JungleApp.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -25,26 +31,65 @@
 #include "VulkanHelper.h"
 
 void JungleApp::initVulkan(const std::string &sceneName, bool recompileShaders) {
-    device.initInstance();
-    createSurface();
-    device.initDeviceForSurface(surface);
+    PROFILE_SCOPE("JungleApp::initVulkan");
+    {
+        PROFILE_SCOPE("Device setup");
+        device.headless = isHeadless();
+        device.allowAsyncCompute = useAsyncCompute;
+        device.initInstance();
+        if (!isHeadless()) {
+            createSurface();
+        }
+        device.initDeviceForSurface(surface);
+    }
+    ShaderCompiler::compileAll(recompileShaders);
 
-    swapchain = std::make_unique<Swapchain>(window, surface, &device);
+    if (isHeadless()) {
+        swapchain = std::make_unique<Swapchain>(&device, VkExtent2D{WIDTH, HEIGHT});
+    } else {
+        swapchain = std::make_unique<Swapchain>(window, surface, &device);
+    }
+    profiler = std::make_unique<GpuProfiler>(&device, swapchain.get());
+    if (device.hasAsyncCompute()) {
+        asyncCompute = std::make_unique<AsyncCompute>(&device, swapchain.get());
+    }
+    if (!gpuProfileCsv.empty()) {
+        profiler->writeCsv(gpuProfileCsv);
+    }
+    if (targetFps > 0) {
+        dynamicResolution.enabled = true;
+        dynamicResolution.targetMilliseconds = 1000.0f / targetFps;
+    }
     setupRenderStageScene(sceneName, recompileShaders);
 
-    lighting = std::make_unique<DeferredLighting>(&device, swapchain.get());
+    // The passes are declared in the order they are recorded, the targets exist once they all are.
+    renderGraph = std::make_unique<RenderGraph>(&device, swapchain.get());
+    lighting = std::make_unique<DeferredLighting>(&device, swapchain.get(), renderGraph.get(), gBuffer);
+    lighting->profiler = profiler.get();
+    postprocessing = std::make_unique<PostProcessing>(&device, swapchain.get(), renderGraph.get(),
+                                                      lighting->finalLightImage);
+    postprocessing->profiler = profiler.get();
+    lighting->fogAbsorption = &postprocessing->getFogPointer()->absorption;
+    renderGraph->compile();
+
     lighting->setup(recompileShaders, &scene, mvpSetLayout);
 
-    this->groundBVH = std::make_unique<BVH>(&device, &scene, "Ground");
+    {
+        PROFILE_SCOPE("Ground BVH");
+        this->groundBVH = std::make_unique<BVH>(&device, &scene, "Ground");
+    }
 
-    postprocessing = std::make_unique<PostProcessing>(&device, swapchain.get());
-    lighting->fogAbsorption = &postprocessing->getFogPointer()->absorption;
-    postprocessing->setupRenderStages(recompileShaders);
+    {
+        PROFILE_SCOPE("PostProcessing::setupRenderStages");
+        postprocessing->setupRenderStages(recompileShaders);
+    }
 
     createUniformBuffers();
     createDescriptorPool();
     createDescriptorSets();
     createCommandBuffers();
+    recorder = std::make_unique<CommandRecorder>(&device, swapchain.get());
+    shaderWatcher = std::make_unique<ShaderWatcher>("shaders");
 }
 
 void JungleApp::setupRenderStageScene(const std::string &sceneName, bool recompileShaders) {
@@ -57,7 +102,7 @@ void JungleApp::setupRenderStageScene(const std::string &sceneName, bool recompi
 
 void JungleApp::setupGBuffer() {
     // The layout of the gBuffer needs to match GBufferTargets
-    gBuffer.init(&device, MAX_FRAMES_IN_FLIGHT);
+    gBuffer.init(&device, Swapchain::framesInFlight);
 
     for (int i = 0; i < GBufferTarget::NumAttachments; i++) {
         if (i == GBufferTarget::Depth) {
@@ -76,26 +121,47 @@ void JungleApp::setupGBuffer() {
 }
 
 void JungleApp::mainLoop() {
-    using namespace std::chrono;
-
     while (!glfwWindowShouldClose(window)) {
-        auto startFrame = system_clock::now();
         glfwPollEvents();
         cameraMotion();
         drawFrame();
 
-        if (Swapchain::rateLimit > 0) {
-            int elapsed = duration_cast<milliseconds>(system_clock::now() - startFrame).count();
-            int maxNs = 1e6 / Swapchain::rateLimit;
-            maxNs = std::max(0, 1'000 / Swapchain::rateLimit - elapsed);
-            std::this_thread::sleep_for(milliseconds(maxNs));
+        if (!recordCameraPath.empty()) {
+            if (!recordingStart.has_value()) {
+                recordingStart = glfwGetTime();
+            }
+            recordedPath.add({
+                .time = (float) (glfwGetTime() - *recordingStart),
+                .position = cameraPosition,
+                .lookAt = cameraLookAt,
+                .up = cameraUpVector,
+                .fovY = cameraFOVY,
+                .sceneTime = sceneTime,
+            });
+        }
+
+        if (waitForPresent) {
+            swapchain->waitForPresent(1);
         }
+        framePacer.wait(Swapchain::rateLimit);
     }
 
     vkDeviceWaitIdle(device.device);
+
+    if (!recordCameraPath.empty()) {
+        recordedPath.save(recordCameraPath);
+    }
 }
 
 void JungleApp::drawImGUI() {
+    if (isHeadless()) {
+        // No windows are drawn, the final pass still renders the empty frame.
+        ImGui::GetIO().DisplaySize = ImVec2(swapchain->finalBufferSize.width, swapchain->finalBufferSize.height);
+        ImGui_ImplVulkan_NewFrame();
+        ImGui::NewFrame();
+        return;
+    }
+
     ImGui_ImplVulkan_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -103,6 +169,12 @@ void JungleApp::drawImGUI() {
         forceReloadShaders = ImGui::Button("Reload Shaders");
         ImGui::Checkbox("Show Dear ImGui Demo", &showDemoWindow);
         ImGui::Checkbox("Show Metrics", &showMetricsWindow);
+        ImGui::Checkbox("Show GPU Profiler", &showGpuProfiler);
+#ifdef JUNGLE_CPU_PROFILER
+        if (ImGui::Button("Write CPU Trace")) {
+            CpuProfiler::writeTrace("cpu-trace.json");
+        }
+#endif
         if (ImGui::CollapsingHeader("Music Settings")) {
             if (ImGui::Checkbox("Enable Music", &playMusic)) {
                 if (playMusic) mplayer.play();
@@ -123,6 +195,15 @@ void JungleApp::drawImGUI() {
             ImGui::Combo("ReSTIR Sampling Mode", &lighting->restirSamplingMode,
                          "Weighted Light Grid\0Uniform Light Grid\0Uniform\0\0");
             ImGui::SliderFloat("ReSTIR Point Light Relative Importance", &lighting->restirPointLightImportance, 0.0, 1.0);
+            ImGui::SliderInt("ReSTIR Samples per Reservoir", &lighting->restirSamplesPerReservoir, 1,
+                             MAX_SAMPLES_PER_RESERVOIR);
+            // Every value is a separate pipeline variant, so only a few are offered.
+            const int emitterSamples[] = {10, 50, 100, 200};
+            int emitterSamplesIdx = std::find(std::begin(emitterSamples), std::end(emitterSamples),
+                                              lighting->bruteforceEmitterSamples) - std::begin(emitterSamples);
+            if (ImGui::Combo("Bruteforce Emitter Samples", &emitterSamplesIdx, "10\0" "50\0" "100\0" "200\0\0")) {
+                lighting->bruteforceEmitterSamples = emitterSamples[emitterSamplesIdx];
+            }
 
             ImGui::SliderFloat("Butterfly Luminance", &lighting->pointLightIntensityMultiplier, 0.0, 1000.0);
             if (ImGui::Checkbox("Strong Butterfly Illumination", &illuminationViaButterflies)) {
@@ -143,10 +224,20 @@ void JungleApp::drawImGUI() {
         if (ImGui::CollapsingHeader("Video Settings")) {
             switchFullscreen = ImGui::Checkbox("Fullscreen", &fullscreen);
             forceRecreateSwapchain = ImGui::Checkbox("VSync", &swapchain->enableVSync);
+            ImGui::SliderInt("Frame Rate Limit", &Swapchain::rateLimit, 0, 240, Swapchain::rateLimit ? "%d" : "Off");
+            ImGui::BeginDisabled(!device.supportsPresentWait);
+            ImGui::Checkbox("Wait for Present", &waitForPresent);
+            ImGui::EndDisabled();
+            ImGui::Text("Frames in Flight: %u", Swapchain::framesInFlight);
+            ImGui::Checkbox("Dynamic Resolution", &dynamicResolution.enabled);
+            ImGui::SliderFloat("Frame Budget (ms)", &dynamicResolution.targetMilliseconds, 2.f, 50.f);
+            ImGui::SliderFloat("Min Render Scale", &dynamicResolution.minScale, 0.25f, 1.f);
+            ImGui::Text("Rendering %ux%u", swapchain->activeRenderSize().width, swapchain->activeRenderSize().height);
             ImGui::Checkbox("Enable TAA Jitter", &doJitter);
             ImGui::SliderFloat("TAA alpha", &postprocessing->getTAAPointer()->alpha, 0.f, 1.f);
             ImGui::Combo("TAA Neighborhood Clamping", &postprocessing->getTAAPointer()->mode,
                          "Off\0Min-Max\0Moment-Based\0\0");
+            ImGui::Checkbox("TAA Upscaling", &postprocessing->getTAAPointer()->upscale);
 
             ImGui::SliderInt("Denoiser iterations",
                 &lighting->getDenoiser()->iterationCount, 0, 20);
@@ -194,6 +285,7 @@ void JungleApp::drawImGUI() {
                          "None\0Hable\0AgX\0\0");
         }
         scene.drawImGUIMaterialSettings();
+        scene.drawImGUICullingSettings();
     }
     ImGui::End();
 
@@ -203,7 +295,11 @@ void JungleApp::drawImGUI() {
     if (showDemoWindow) {
         ImGui::ShowDemoWindow(&showDemoWindow);
     }
+    if (showGpuProfiler) {
+        profiler->drawImGUI(&showGpuProfiler);
+    }
 
+    std::lock_guard<std::mutex> lock(GraphicsPipeline::errorsMutex);
     for (auto &[stage, msg]: GraphicsPipeline::errorsFromShaderCompilation) {
         if (ImGui::Begin(stage.c_str())) {
             ImGui::Text("%s", msg.c_str());
@@ -213,42 +309,117 @@ void JungleApp::drawImGUI() {
 }
 
 void JungleApp::drawFrame() {
-    handleMotion();
+    PROFILE_SCOPE("JungleApp::drawFrame");
+    if (!isHeadless()) {
+        handleMotion();
+    }
 
     handleHeight();
 
-    auto imageIndex = swapchain->acquireNextImage(sceneRPass);
+    std::optional<uint32_t> imageIndex;
+    {
+        PROFILE_SCOPE("Acquire image");
+        imageIndex = swapchain->acquireNextImage(sceneRPass);
+    }
     if (!imageIndex.has_value()) {
         return;
     }
 
-    if (forceReloadShaders) {
-        GraphicsPipeline::errorsFromShaderCompilation.clear();
-        recompileShaders();
+    if (forceReloadShaders || (autoReloadShaders && shaderWatcher->poll())) {
+        startShaderReload();
     }
+    finishShaderReload();
+    updateRenderScale();
 
-    drawImGUI();
+    {
+        PROFILE_SCOPE("ImGui");
+        drawImGUI();
+    }
 
     updateUniformBuffers(swapchain->currentFrame);
 
-    auto &commandBuffer = commandBuffers[swapchain->currentFrame];
+    if (asyncCompute) {
+        PROFILE_SCOPE("Async compute");
+        asyncCompute->beginFrame();
+        // The LoD selection reads the depth pyramid of the previous frame and overwrites the selected transforms and
+        // draws, which the scene of the previous frame reads and the depth pyramid of this frame overwrites.
+        asyncCompute->submit(AsyncCompute::AfterScene, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                             VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             [&](VkCommandBuffer compute) { scene.recordLoDSelection(compute); });
+        // The butterflies are lights as well, the lighting of the previous frame reads them until its end.
+        asyncCompute->submit(AsyncCompute::AfterFrame,
+                             VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             [&](VkCommandBuffer compute) { scene.recordButterflyUpdate(compute); });
+    }
 
-    vkResetCommandBuffer(commandBuffer, 0);
+    auto &commandBuffer = commandBuffers[swapchain->currentFrame];
+    // With async compute the scene is submitted on its own, so that the compute work of the next frame can start
+    // while the rest of this frame renders.
+    auto sceneCommandBuffer = asyncCompute ? sceneCommandBuffers[swapchain->currentFrame] : commandBuffer;
 
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = 0; // Optional
     beginInfo.pInheritanceInfo = nullptr; // Optional
+    vkResetCommandBuffer(commandBuffer, 0);
     VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo))
+    if (asyncCompute) {
+        vkResetCommandBuffer(sceneCommandBuffer, 0);
+        VK_CHECK_RESULT(vkBeginCommandBuffer(sceneCommandBuffer, &beginInfo))
+    }
+
+    // The passes are recorded into secondary command buffers on all threads, the primary buffer only executes them.
+    auto mvpSet = sceneDescriptorSets[swapchain->currentFrame];
+    recorder->beginFrame();
+    std::vector<RecordingJob> jobs{
+        scene.depthPyramidJob(),
+        {.record = [&](VkCommandBuffer secondary) { lighting->recordCommandBuffer(secondary, mvpSet, &scene); }},
+        postprocessing->stepsJob(),
+    };
+    if (!asyncCompute) {
+        jobs.push_back(scene.computeJob());
+    }
+    const size_t firstDrawJob = jobs.size();
+    for (auto &job: scene.drawJobs(mvpSet, CommandRecorder::numThreads())) {
+        jobs.push_back(job);
+    }
+    std::vector<VkCommandBuffer> secondaries;
+    {
+        PROFILE_SCOPE("Record secondaries");
+        secondaries = recorder->record(jobs);
+    }
 
-    scene.recordCommandBufferCompute(commandBuffer, cameraPosition);
-    startRenderPass(commandBuffer, swapchain->currentFrame, sceneRPass);
-    scene.recordCommandBufferDraw(commandBuffer, sceneDescriptorSets[swapchain->currentFrame]);
-    vkCmdEndRenderPass(commandBuffer);
+    profiler->beginFrame(sceneCommandBuffer);
+    profiler->begin(sceneCommandBuffer, "Frame");
+    // The compute queue is not timed
+    if (!asyncCompute) {
+        profiler->begin(sceneCommandBuffer, "LoD selection");
+        vkCmdExecuteCommands(sceneCommandBuffer, 1, &secondaries[3]);
+        profiler->end(sceneCommandBuffer, "LoD selection");
+    }
+    // Timestamps cannot be written inside a render pass with secondary contents
+    profiler->begin(sceneCommandBuffer, "G-Buffer");
+    startRenderPass(sceneCommandBuffer, swapchain->currentFrame, sceneRPass);
+    vkCmdExecuteCommands(sceneCommandBuffer, secondaries.size() - firstDrawJob, &secondaries[firstDrawJob]);
+    vkCmdEndRenderPass(sceneCommandBuffer);
+    profiler->end(sceneCommandBuffer, "G-Buffer");
+    profiler->begin(sceneCommandBuffer, "Depth pyramid");
+    scene.executeDepthPyramid(sceneCommandBuffer, secondaries[0]);
+    profiler->end(sceneCommandBuffer, "Depth pyramid");
+    if (asyncCompute) {
+        VK_CHECK_RESULT(vkEndCommandBuffer(sceneCommandBuffer))
+        PROFILE_SCOPE("Submit scene");
+        asyncCompute->submitScene(sceneCommandBuffer);
+    }
 
-    lighting->recordCommandBuffer(commandBuffer, sceneDescriptorSets[swapchain->currentFrame], &scene);
-    postprocessing->recordCommandBuffer(commandBuffer,
+    profiler->begin(commandBuffer, "Lighting");
+    vkCmdExecuteCommands(commandBuffer, 1, &secondaries[1]);
+    profiler->end(commandBuffer, "Lighting");
+    profiler->begin(commandBuffer, "Post-processing");
+    postprocessing->recordCommandBuffer(commandBuffer, secondaries[2],
         swapchain->defaultTarget.framebuffers.begin()->second[*imageIndex]);
+    profiler->end(commandBuffer, "Post-processing");
+    profiler->end(commandBuffer, "Frame");
 
     VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer))
 
@@ -265,23 +436,65 @@ void JungleApp::drawFrame() {
         framebufferResized = true;
     }
 
-    auto result = swapchain->queuePresent(commandBuffers[swapchain->currentFrame], *imageIndex);
+    VkResult result;
+    {
+        PROFILE_SCOPE("Submit and present");
+        std::optional<TimelineSignal> frameSignal;
+        if (asyncCompute) {
+            frameSignal = asyncCompute->frameSignal();
+        }
+        result = swapchain->queuePresent(commandBuffers[swapchain->currentFrame], *imageIndex, frameSignal);
+    }
+    if (checkCulling || scene.cullingCheckRequested) {
+        PROFILE_SCOPE("Check culling");
+        if (!scene.checkCulling()) {
+            cullingMismatch = true;
+        }
+    }
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized ||
         forceRecreateSwapchain) {
         framebufferResized = false;
         forceRecreateSwapchain = false;
+        PROFILE_SCOPE("Resize");
         swapchain->recreateSwapChain(postprocessing->getFinalRenderPass());
 
         gBuffer.destroyAll();
         setupGBuffer();
-        scene.createPipelines(sceneRPass, mvpSetLayout, false);
-        lighting->handleResize(gBuffer, mvpSetLayout, &scene);
-        postprocessing->handleResize(lighting->finalLight, gBuffer);
+        renderGraph->compile();
+        // The pipelines stay, viewport and scissor are dynamic state and the render passes do not change. Only the
+        // images, framebuffers and descriptor sets which depend on the size are recreated.
+        scene.handleResize(gBuffer);
+        lighting->handleResize(gBuffer, &scene);
+        postprocessing->handleResize(*lighting->finalLight, gBuffer);
     } else {
         VK_CHECK_RESULT(result)
     }
 }
 
+void JungleApp::updateRenderScale() {
+    // Every measurement is only used once, the results of a frame may take longer than a frame to arrive.
+    auto frameTime = profiler->latest("Frame");
+    if (!frameTime.has_value() || frameTime->frame == lastTimedFrame) {
+        return;
+    }
+    lastTimedFrame = frameTime->frame;
+
+    if (auto scale = dynamicResolution.update(frameTime->milliseconds)) {
+        setRenderScale(*scale);
+    }
+}
+
+void JungleApp::setRenderScale(float scale) {
+    if (swapchain->dynamicScale == scale) {
+        return;
+    }
+    // The targets keep their size, only the part that is rendered to changes.
+    swapchain->dynamicScale = scale;
+    scene.handleRenderScaleChange();
+    lighting->handleRenderScaleChange();
+    postprocessing->handleRenderScaleChange();
+}
+
 void JungleApp::initWindow() {
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -331,18 +544,20 @@ void JungleApp::initImGui() {
     VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &imguiDescriptorPool));
 
     // Setup Platform/Renderer backends
-    ImGui_ImplGlfw_InitForVulkan(window, true);
+    if (!isHeadless()) {
+        ImGui_ImplGlfw_InitForVulkan(window, true);
+    }
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.Instance = device.instance;
     init_info.PhysicalDevice = device.physicalDevice;
     init_info.Device = device;
     init_info.QueueFamily = device.chosenQueues.graphicsFamily.value();
     init_info.Queue = device.graphicsQueue;
-    //init_info.PipelineCache = YOUR_PIPELINE_CACHE;
+    init_info.PipelineCache = device.pipelineCache;
     init_info.DescriptorPool = imguiDescriptorPool;
     init_info.Subpass = 0;
     init_info.MinImageCount = 2;
-    init_info.ImageCount = 2;
+    init_info.ImageCount = Swapchain::framesInFlight;
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     // init_info.Allocator = YOUR_ALLOCATOR;
     // init_info.CheckVkResultFn = check_vk_result;
@@ -375,13 +590,71 @@ void JungleApp::createSurface() {
     VK_CHECK_RESULT(glfwCreateWindowSurface(device.instance, window, nullptr, &surface))
 }
 
-void JungleApp::recompileShaders() {
-    vkDeviceWaitIdle(device);
+void JungleApp::startShaderReload() {
+    if (pendingShaderReload.valid()) {
+        shaderReloadQueued = true;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(GraphicsPipeline::errorsMutex);
+        GraphicsPipeline::errorsFromShaderCompilation.clear();
+    }
+
+    // Only reads state which stays unchanged until the reload is installed or cancelled. The kernel sizes are changed
+    // by the UI between frames, so they are copied here.
+    auto lightingConstants = lighting->computeConstants();
+    pendingShaderReload = std::async(std::launch::async, [this, lightingConstants]() {
+        auto swap = std::make_unique<PipelineSwap>();
+        // Only shaders whose preprocessed source changed get new cache keys and are compiled again.
+        ShaderCompiler::compileAll(true);
+        scene.createPipelines(sceneRPass, mvpSetLayout, true, *swap);
+        lighting->createPipeline(true, mvpSetLayout, &scene, *swap, lightingConstants);
+        lighting->getDenoiser()->createPipeline(true, *swap);
+        postprocessing->createPipeline(true, *swap);
+        return swap;
+    });
+}
+
+void JungleApp::finishShaderReload() {
+    frameNumber++;
+    // acquireNextImage waited for the fence of the current frame, so every frame at least Swapchain::framesInFlight
+    // frames old has finished, and with it the last use of pipelines replaced before it.
+    std::erase_if(retiredPipelines, [this](const auto &retired) {
+        return retired.first + Swapchain::framesInFlight <= frameNumber;
+    });
+
+    if (!pendingShaderReload.valid() ||
+        pendingShaderReload.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+
+    try {
+        retiredPipelines.emplace_back(frameNumber, pendingShaderReload.get()->apply());
+    } catch (const std::exception &e) {
+        // The pipelines created so far are dropped with the swap, the old ones stay in use.
+        std::cout << "Shader reload failed: " << e.what() << std::endl;
+        std::lock_guard<std::mutex> lock(GraphicsPipeline::errorsMutex);
+        GraphicsPipeline::errorsFromShaderCompilation.emplace_back("Shader reload", e.what());
+    }
+
+    if (shaderReloadQueued) {
+        shaderReloadQueued = false;
+        startShaderReload();
+    }
+}
+
+void JungleApp::cancelShaderReload() {
+    if (!pendingShaderReload.valid()) {
+        return;
+    }
 
-    scene.createPipelines(sceneRPass, mvpSetLayout, true);
-    lighting->createPipeline(true, mvpSetLayout, &scene);
-    lighting->getDenoiser()->createPipeline(true);
-    postprocessing->createPipeline(true);
+    try {
+        // None of its pipelines were used yet, so they can be destroyed right away.
+        pendingShaderReload.get();
+    } catch (...) {
+    }
+    shaderReloadQueued = true;
 }
 
 void JungleApp::createScenePass() {
@@ -454,13 +727,18 @@ void JungleApp::createScenePass() {
 }
 
 void JungleApp::createCommandBuffers() {
-    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    commandBuffers.resize(Swapchain::framesInFlight);
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.commandPool = device.commandPool;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
     VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()))
+
+    if (asyncCompute) {
+        sceneCommandBuffers.resize(Swapchain::framesInFlight);
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, sceneCommandBuffers.data()))
+    }
 }
 
 void JungleApp::startRenderPass(VkCommandBuffer commandBuffer, uint32_t currentFrame, VkRenderPass renderPass) {
@@ -469,7 +747,7 @@ void JungleApp::startRenderPass(VkCommandBuffer commandBuffer, uint32_t currentF
     renderPassInfo.renderPass = renderPass;
     renderPassInfo.framebuffer = gBuffer.framebuffers[sceneRPass][currentFrame];
     renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = swapchain->renderSize();
+    renderPassInfo.renderArea.extent = swapchain->activeRenderSize();
 
     std::array<VkClearValue, GBufferTarget::NumAttachments> clearValues{};
     for (int i = 0; i < GBufferTarget::NumAttachments; i++) {
@@ -482,7 +760,173 @@ void JungleApp::startRenderPass(VkCommandBuffer commandBuffer, uint32_t currentF
 
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // The scene draws are executed from secondary command buffers, see CommandRecorder.
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+}
+
+void JungleApp::benchmarkRecording(int iterations) {
+    // The draws are recorded into a secondary command buffer of the scene pass, which is never submitted.
+    VkCommandBuffer commandBuffer;
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = device.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer))
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = sceneRPass;
+    inheritanceInfo.subpass = 0;
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    const auto &measure = [&](bool baked) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo))
+            if (baked) {
+                scene.recordDrawCommands(commandBuffer, sceneDescriptorSets[0]);
+            } else {
+                scene.recordDrawCommandsUnbaked(commandBuffer, sceneDescriptorSets[0]);
+            }
+            VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer))
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+    };
+
+    double unbaked = measure(false);
+    double baked = measure(true);
+    std::cout << std::setprecision(2) << std::fixed
+              << "[benchmark] Recording " << scene.getNumDrawBatches() << " draw batches: " << unbaked
+              << " us per frame with the previous per-batch lookups, " << baked << " us baked" << std::endl;
+
+    vkFreeCommandBuffers(device, device.commandPool, 1, &commandBuffer);
+}
+
+void JungleApp::renderHeadless(int frames) {
+    // There is no input, the camera stays at the scene's default view.
+    cameraPosition = cameraFinalPosition;
+    cameraLookAt = cameraFinalLookAt;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < frames; i++) {
+        drawFrame();
+        dumpFrame(i);
+    }
+    vkDeviceWaitIdle(device);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    // Includes the time spent writing frames to disk
+    double total = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << std::setprecision(2) << std::fixed
+              << "[headless] Rendered " << frames << " frames at " << swapchain->finalBufferSize.width << "x"
+              << swapchain->finalBufferSize.height << " in " << total << " ms, " << total / frames
+              << " ms per frame" << std::endl;
+}
+
+void JungleApp::dumpFrame(int frame) {
+    if (!isHeadless() || !dumpFrames.contains(frame)) {
+        return;
+    }
+
+    auto filename = "frame-" + std::to_string(frame) + ".png";
+    auto pixels = swapchain->readImage(swapchain->lastImageIndex);
+    auto size = swapchain->finalBufferSize;
+    if (!stbi_write_png(filename.c_str(), size.width, size.height, 4, pixels.data(), size.width * 4)) {
+        std::cout << "[headless] WARN: Could not write " << filename << std::endl;
+    }
+}
+
+void JungleApp::benchmarkCameraPath() {
+    auto path = CameraPath::load(playCameraPath);
+
+    // Everything that varies between runs is fixed, so that every run renders the same frames.
+    lighting->seedRandom(0);
+    jitterSequence = 0;
+
+    // Shader edits and the dynamic resolution would change what is rendered during the run.
+    bool autoReload = autoReloadShaders;
+    bool dynamicResolutionEnabled = dynamicResolution.enabled;
+    autoReloadShaders = false;
+    dynamicResolution.enabled = false;
+    dynamicResolution.reset();
+    setRenderScale(1.0f);
+
+    // The GPU times of frames still in flight from before the playback must not be collected.
+    vkDeviceWaitIdle(device);
+    profiler->flush();
+
+    int frames = (int) (path.duration() * playbackFps) + 1;
+    std::vector<float> cpuTimes;
+    profiler->startCollecting("Frame");
+    for (int i = 0; i < frames; i++) {
+        if (!isHeadless()) {
+            glfwPollEvents();
+            if (glfwWindowShouldClose(window)) {
+                break;
+            }
+        }
+
+        auto keyframe = path.sample(i / playbackFps);
+        cameraPosition = cameraFinalPosition = keyframe.position;
+        cameraLookAt = cameraFinalLookAt = keyframe.lookAt;
+        cameraUpVector = keyframe.up;
+        cameraFOVY = keyframe.fovY;
+        fixedSceneTime = keyframe.sceneTime;
+
+        // Includes waiting for the frame in flight to finish, so it is the GPU time when GPU bound.
+        auto start = std::chrono::high_resolution_clock::now();
+        drawFrame();
+        auto end = std::chrono::high_resolution_clock::now();
+        cpuTimes.push_back(std::chrono::duration<float, std::milli>(end - start).count());
+        dumpFrame(i);
+    }
+    vkDeviceWaitIdle(device);
+    profiler->flush();
+    auto gpuTimes = profiler->stopCollecting();
+    fixedSceneTime.reset();
+    autoReloadShaders = autoReload;
+    dynamicResolution.enabled = dynamicResolutionEnabled;
+
+    auto cpu = FrameStatistics::of(cpuTimes);
+    auto gpu = FrameStatistics::of(gpuTimes);
+    std::cout << std::setprecision(2) << std::fixed
+              << "[benchmark] " << cpuTimes.size() << " frames of " << playCameraPath << "\n"
+              << "[benchmark] CPU ms: avg " << cpu.average << ", p50 " << cpu.p50 << ", p95 " << cpu.p95
+              << ", p99 " << cpu.p99 << "\n"
+              << "[benchmark] GPU ms: avg " << gpu.average << ", p50 " << gpu.p50 << ", p95 " << gpu.p95
+              << ", p99 " << gpu.p99 << std::endl;
+
+    std::ofstream summary(benchmarkSummary);
+    if (!summary.is_open()) {
+        std::cout << "[benchmark] WARN: Could not write " << benchmarkSummary << std::endl;
+        return;
+    }
+    const auto &writeSeries = [&](const char *name, const FrameStatistics &statistics,
+                                  const std::vector<float> &times) {
+        summary << "  \"" << name << "\": {\"average\": " << statistics.average << ", \"p50\": " << statistics.p50
+                << ", \"p95\": " << statistics.p95 << ", \"p99\": " << statistics.p99 << ", \"frames\": [";
+        for (size_t i = 0; i < times.size(); i++) {
+            summary << (i > 0 ? ", " : "") << times[i];
+        }
+        summary << "]}";
+    };
+    summary << std::setprecision(4) << std::fixed << "{\n"
+            << "  \"cameraPath\": \"" << playCameraPath << "\",\n"
+            << "  \"width\": " << swapchain->finalBufferSize.width << ",\n"
+            << "  \"height\": " << swapchain->finalBufferSize.height << ",\n"
+            << "  \"renderScale\": " << Swapchain::renderScale << ",\n"
+            << "  \"frames\": " << cpuTimes.size() << ",\n";
+    writeSeries("cpuMs", cpu, cpuTimes);
+    summary << ",\n";
+    // Empty if the device does not support timestamps
+    writeSeries("gpuMs", gpu, gpuTimes);
+    summary << "\n}\n";
+    std::cout << "[benchmark] Wrote summary to " << benchmarkSummary << std::endl;
 }
 
 void JungleApp::createMVPSetLayout() {
@@ -507,8 +951,8 @@ void JungleApp::createMVPSetLayout() {
 
 void JungleApp::createUniformBuffers() {
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-    mvpUBO.allocate(&device, bufferSize, MAX_FRAMES_IN_FLIGHT);
-    lastmvpUBO.allocate(&device, bufferSize, MAX_FRAMES_IN_FLIGHT);
+    mvpUBO.allocate(&device, bufferSize, Swapchain::framesInFlight);
+    lastmvpUBO.allocate(&device, bufferSize, Swapchain::framesInFlight);
     lighting->setupBuffers();
     postprocessing->setupBuffers();
 }
@@ -525,6 +969,10 @@ void JungleApp::updateUniformBuffers(uint32_t currentImage) {
         );
         time = lastTime;
     }
+    if (fixedSceneTime.has_value()) {
+        time = *fixedSceneTime;
+    }
+    sceneTime = time;
     float rotation = spinScene ? time * glm::radians(90.0f) : glm::radians(fixedRotation);
 
     UniformBufferObject ubo{};
@@ -534,19 +982,29 @@ void JungleApp::updateUniformBuffers(uint32_t currentImage) {
                                 (float) swapchain->renderSize().width / (float) swapchain->renderSize().height,
                                 nearPlane, farPlane);
     ubo.proj[1][1] *= -1;  // because GLM generates OpenGL projections
-    if (doJitter) {
+    if (doJitter && postprocessing->getTAAPointer()->isUpscaling()) {
+        // Spread over one render pixel, so that the samples of all phases cover it. Every render pixel covers several
+        // output pixels, which need more phases to be hit by a sample each.
+        auto renderSize = swapchain->activeRenderSize();
+        float upscale = (float) swapchain->finalBufferSize.width / renderSize.width;
+        auto phases = (uint32_t) std::ceil(JITTER_PHASES_PER_PIXEL * upscale * upscale);
+        ubo.jitt = halton23norm(jitterSequence % phases);
+        ubo.jitt *= glm::vec2(1.f / renderSize.width, 1.f / renderSize.height);
+        jitterSequence++;
+    } else if (doJitter) {
         ubo.jitt = halton23norm(jitterSequence);
         ubo.jitt *= glm::vec2(1.f / swapchain->finalBufferSize.width, 1.f / swapchain->finalBufferSize.height);
         jitterSequence++;
     } else {
         ubo.jitt = glm::vec2(0, 0);
     }
+    postprocessing->getTAAPointer()->jitter = ubo.jitt;
     ubo.time = time;
 
-    mvpUBO.copyTo(lastmvpUBO, (currentImage + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT, currentImage,
+    mvpUBO.copyTo(lastmvpUBO, (currentImage + Swapchain::framesInFlight - 1) % Swapchain::framesInFlight, currentImage,
                   sizeof(ubo));
     mvpUBO.update(&ubo, sizeof(ubo), currentImage);
-    scene.updateBuffers(time, cameraPosition, time - lastTime);
+    scene.updateBuffers(time, cameraPosition, time - lastTime, ubo.proj * ubo.view * ubo.modl);
     lighting->updateBuffers(ubo.proj * ubo.view, cameraPosition, cameraUpVector);
     lighting->getDenoiser()->updateCamera(ubo.proj);
 
@@ -575,7 +1033,7 @@ void JungleApp::createDescriptorPool() {
 
     // Descriptors required in JungleApp itself
     requirements.push_back({
-                                   .requireUniformBuffers = MAX_FRAMES_IN_FLIGHT * 2,
+                                   .requireUniformBuffers = Swapchain::framesInFlight * 2,
                                    .requireSamplers = 0,
                            });
 
@@ -599,9 +1057,9 @@ void JungleApp::createDescriptorPool() {
 
 void JungleApp::createDescriptorSets() {
     sceneDescriptorSets = VulkanHelper::createDescriptorSetsFromLayout(device, descriptorPool,
-                                                                       mvpSetLayout, MAX_FRAMES_IN_FLIGHT);
+                                                                       mvpSetLayout, Swapchain::framesInFlight);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
         std::vector<VkDescriptorBufferInfo> bufferInfos;
         VkDescriptorBufferInfo bufferInfo{};
         bufferInfo.buffer = mvpUBO.buffers[i];
@@ -624,14 +1082,19 @@ void JungleApp::createDescriptorSets() {
         vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
     }
 
-    scene.setupDescriptorSets(descriptorPool);
+    scene.setupDescriptorSets(descriptorPool, gBuffer);
     lighting->createDescriptorSets(descriptorPool, gBuffer, &scene);
-    postprocessing->createDescriptorSets(descriptorPool, lighting->finalLight, gBuffer);
+    postprocessing->createDescriptorSets(descriptorPool, *lighting->finalLight, gBuffer);
 }
 
 void JungleApp::cleanup() {
+    cancelShaderReload();
+    retiredPipelines.clear();
+    shaderWatcher.reset();
     ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    if (!isHeadless()) {
+        ImGui_ImplGlfw_Shutdown();
+    }
     ImGui::DestroyContext();
     swapchain.reset();
 
@@ -639,6 +1102,10 @@ void JungleApp::cleanup() {
     lastmvpUBO.destroy(&device);
     lighting.reset();
     postprocessing.reset();
+    renderGraph.reset();
+    recorder.reset();
+    profiler.reset();
+    asyncCompute.reset();
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr);
 
@@ -648,14 +1115,21 @@ void JungleApp::cleanup() {
     gBuffer.destroyAll();
 
     vkDestroyRenderPass(device, sceneRPass, nullptr);
-    vkDestroySurfaceKHR(device.instance, surface, nullptr);
+    if (!isHeadless()) {
+        vkDestroySurfaceKHR(device.instance, surface, nullptr);
+    }
     device.destroy();
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!isHeadless()) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 }
 
 void JungleApp::setupScene(const std::string &sceneName) {
-    scene = Scene(&device, swapchain.get(), sceneName);
+    {
+        PROFILE_SCOPE("Scene loading");
+        scene = Scene(&device, swapchain.get(), sceneName);
+    }
     scene.setupBuffers();
     scene.setupTextures();
     scene.computeDefaultCameraPos(cameraFinalLookAt, cameraFinalPosition, cameraUpVector, cameraFOVY, nearPlane, farPlane);
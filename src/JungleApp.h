@@ -4,15 +4,26 @@
 #ifndef VULKANBASICS_PLANETAPP_H
 #define VULKANBASICS_PLANETAPP_H
 
+#include <future>
 #include <memory>
+#include <set>
 #include "BVH.hpp"
+#include "CameraPath.h"
 #include <shaderc/shaderc.hpp>
+#include "AsyncCompute.h"
+#include "CommandRecorder.h"
+#include "DynamicResolution.h"
+#include "FramePacer.h"
+#include "GpuProfiler.h"
 #include "Lighting.h"
 #include "Scene.h"
 #include "PhysicalDevice.h"
 #include "Swapchain.h"
 #include "MusicPlayer.h"
 #include "PostProcessing.h"
+#include "PipelineSwap.h"
+#include "RenderGraph.h"
+#include "ShaderWatcher.h"
 
 const uint32_t WIDTH = 1800;
 const uint32_t HEIGHT = 1200;
@@ -28,9 +39,26 @@ struct alignas(16) UniformBufferObject {
 class JungleApp {
 public:
     void run(const std::string &sceneName, bool recompileShaders) {
-        initWindow();
+        if (!isHeadless()) {
+            initWindow();
+        }
         initVulkan(sceneName, recompileShaders);
         initImGui();
+        if (benchmarkRecordingIterations > 0) {
+            benchmarkRecording(benchmarkRecordingIterations);
+            cleanup();
+            return;
+        }
+        if (!playCameraPath.empty()) {
+            benchmarkCameraPath();
+            cleanup();
+            return;
+        }
+        if (isHeadless()) {
+            renderHeadless(headlessFrames);
+            cleanup();
+            return;
+        }
         mplayer.init();
         mainLoop();
         cleanup();
@@ -38,6 +66,31 @@ public:
     }
 
     bool fullscreen = false;
+    // Only measure the CPU time of recording the scene draws for this many iterations instead of rendering.
+    int benchmarkRecordingIterations = 0;
+    // Stream the GPU time of every profiled pass to this CSV file, if set.
+    std::string gpuProfileCsv;
+    // Render offscreen without a window, headlessFrames frames or the camera path, and exit.
+    bool headless = false;
+    int headlessFrames = 0;
+    // Frames written to frame-<N>.png when rendering headless
+    std::set<int> dumpFrames;
+    // Save the camera flight of the session to this file
+    std::string recordCameraPath;
+    // Replay this camera path with a fixed time step, report the frame times and exit
+    std::string playCameraPath;
+    float playbackFps = 60;
+    std::string benchmarkSummary = "benchmark.json";
+    // Lower the render scale automatically to hold this frame rate on the GPU, 0 to always render at full scale
+    float targetFps = 0;
+    // Wait until the previous frame is displayed before starting the next one, if the device supports it
+    bool waitForPresent = false;
+    // Run the LoD selection and butterfly simulation on a dedicated compute queue, if the device has one
+    bool useAsyncCompute = true;
+    // Compare the GPU culling with the CPU reference after every frame (see Scene::checkCulling), which stalls
+    bool checkCulling = false;
+    // Set once such a comparison found a difference
+    bool cullingMismatch = false;
 
 private:
     void initWindow();
@@ -53,13 +106,15 @@ private:
     VulkanDevice device;
     std::unique_ptr<Swapchain> swapchain;
 
-    GLFWwindow *window;
-    VkSurfaceKHR surface;
+    GLFWwindow *window{nullptr};
+    VkSurfaceKHR surface{VK_NULL_HANDLE};
 
     void createSurface();
 
     void setupRenderStageScene(const std::string &sceneName, bool recompileShaders);
 
+    // Barriers and transient targets of the lighting and post-processing passes
+    std::unique_ptr<RenderGraph> renderGraph;
     std::unique_ptr<PostProcessing> postprocessing;
     std::unique_ptr<DeferredLighting> lighting;
 
@@ -69,6 +124,22 @@ private:
     void createScenePass();
 
     std::vector<VkCommandBuffer> commandBuffers;
+    // With async compute, the first part of each frame up to the depth pyramid
+    std::vector<VkCommandBuffer> sceneCommandBuffers;
+    // Null without a dedicated compute queue
+    std::unique_ptr<AsyncCompute> asyncCompute;
+    std::unique_ptr<CommandRecorder> recorder;
+    std::unique_ptr<GpuProfiler> profiler;
+    DynamicResolution dynamicResolution;
+    // Holds the frame rate at Swapchain::rateLimit
+    FramePacer framePacer;
+
+    // Apply the scale chosen by dynamicResolution from the GPU time of the last timed frame
+    void updateRenderScale();
+    // Profiler frame number of the last time given to dynamicResolution
+    std::optional<uint64_t> lastTimedFrame;
+    // Render the given part of the targets from the next frame on, see Swapchain::dynamicScale
+    void setRenderScale(float scale);
 
     void createCommandBuffers();
 
@@ -78,6 +149,23 @@ private:
 
     void drawFrame();
 
+    void benchmarkRecording(int iterations);
+
+    bool isHeadless() {
+        return headless;
+    }
+
+    void renderHeadless(int frames);
+    // Write the frame that was just rendered to disk if it is in dumpFrames
+    void dumpFrame(int frame);
+    void benchmarkCameraPath();
+
+    CameraPath recordedPath;
+    std::optional<double> recordingStart;
+    // Time of the scene animation in the current frame. Taken from the camera path during playback.
+    float sceneTime = 0;
+    std::optional<float> fixedSceneTime;
+
     void drawImGUI();
 
     std::optional<float> lastMouseX, lastMouseY;
@@ -110,6 +198,7 @@ private:
     Scene scene;
 
     bool showMetricsWindow;
+    bool showGpuProfiler = false;
     bool forceRecreateSwapchain;
     bool switchFullscreen;
     bool forceReloadShaders;
@@ -142,7 +231,22 @@ private:
 
     float fixedRotation = 0.0;
 
-    void recompileShaders();
+    // Shader reloads compile the shaders and create all pipelines on a background thread while the old pipelines
+    // keep rendering. The new ones are installed at the start of a frame once they are ready.
+    void startShaderReload();
+    void finishShaderReload();
+    // Drop a running reload, before the objects it reads are destroyed.
+    void cancelShaderReload();
+
+    std::unique_ptr<ShaderWatcher> shaderWatcher;
+    // Reload the shaders when the watcher sees a change, off while a camera path is benchmarked
+    bool autoReloadShaders = true;
+    std::future<std::unique_ptr<PipelineSwap>> pendingShaderReload;
+    // Shaders changed while a reload was running, which may have read them before the change.
+    bool shaderReloadQueued = false;
+    // Pipelines replaced by a reload with the frame they were replaced in, destroyed once no frame in flight uses them.
+    std::vector<std::pair<uint64_t, std::vector<std::shared_ptr<void>>>> retiredPipelines;
+    uint64_t frameNumber = 0;
 
     void setupGBuffer();
 
@@ -152,6 +256,8 @@ private:
     MusicPlayer mplayer{"scenes/loop.wav"};
     bool playMusic;
     uint32_t jitterSequence = 0;
+    // Length of the jitter sequence per output pixel covered by a render pixel, when TAA upscales
+    static constexpr float JITTER_PHASES_PER_PIXEL = 8;
     bool doJitter = true;
     bool doMotion = true;
 
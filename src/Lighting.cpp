@@ -2,10 +2,12 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #include "Lighting.h"
+#include "CpuProfiler.h"
 #include "Pipeline.h"
 #include "Swapchain.h"
 #include "VulkanHelper.h"
 #include "GBufferDescription.h"
+#include <algorithm>
 #include <cmath>
 #include <vulkan/vulkan_core.h>
 #include "BVH.hpp"
@@ -44,9 +46,45 @@ struct ComputeParamsBuffer {
     glm::int32_t nEmissiveTriangles;
 };
 
-DeferredLighting::DeferredLighting(VulkanDevice* device, Swapchain* swapChain) : denoiser(device, swapChain) {
+DeferredLighting::DeferredLighting(VulkanDevice* device, Swapchain* swapChain, RenderGraph *renderGraph,
+    const RenderTarget& gBuffer) : denoiser(device, swapChain)
+{
     this->device = device;
     this->swapchain = swapChain;
+    this->renderGraph = renderGraph;
+
+    auto compositedLightImage = renderGraph->addTransient("Composited light", LIGHT_ACCUMULATION_FORMAT,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+    finalLightImage = renderGraph->addTransient("Final light", LIGHT_ACCUMULATION_FORMAT,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    compositedLight = renderGraph->target(compositedLightImage);
+    finalLight = renderGraph->target(finalLightImage);
+
+    // The G-Buffer render pass leaves its attachments ready to be sampled
+    ImageAccess gBufferWrite{
+        .stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    std::vector<std::pair<RenderGraph::Image, ImageAccess>> computeAccesses;
+    for (uint32_t i = 0; i < GBufferTarget::NumAttachments; i++) {
+        auto image = renderGraph->import("G-Buffer " + std::to_string(i), &gBuffer, i,
+            i == GBufferTarget::Depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, gBufferWrite);
+        computeAccesses.push_back({image, ImageAccess::computeRead()});
+    }
+    computeAccesses.push_back({compositedLightImage, ImageAccess::computeWrite()});
+    computePass = renderGraph->addPass("Lighting compute", computeAccesses);
+
+    auto denoiserAccesses = denoiser.addTmpTargets(renderGraph);
+    denoiserAccesses.push_back({compositedLightImage, ImageAccess::fragmentRead()});
+    denoiserAccesses.push_back({finalLightImage, ImageAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED)});
+    denoiserPass = renderGraph->addPass("Denoiser", denoiserAccesses);
+
+    // The debug render pass clears finalLight, the fog one adds to it
+    compositionPass = renderGraph->addPass("Light composition", {
+        {finalLightImage, ImageAccess::colorAttachment(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)},
+    });
 }
 
 DeferredLighting::~DeferredLighting() {
@@ -69,11 +107,16 @@ DeferredLighting::~DeferredLighting() {
     vkDestroyDescriptorSetLayout(*device, computeLayout, nullptr);
 
     vkDestroySampler(*device, linearSampler, nullptr);
-    compositedLight.destroyAll();
-    finalLight.destroyAll();
 }
 
 void DeferredLighting::createPipeline(bool recompileShaders, VkDescriptorSetLayout mvpLayout, Scene *scene) {
+    PipelineSwap swap;
+    createPipeline(recompileShaders, mvpLayout, scene, swap, computeConstants());
+    swap.apply();
+}
+
+void DeferredLighting::createPipeline(bool recompileShaders, VkDescriptorSetLayout mvpLayout, Scene *scene,
+                                      PipelineSwap &swap, const ComputeConstants &constants) {
     PipelineParameters params;
     params.shadersList = {
         {VK_SHADER_STAGE_VERTEX_BIT, "shaders/point-light.vert"},
@@ -88,7 +131,6 @@ void DeferredLighting::createPipeline(bool recompileShaders, VkDescriptorSetLayo
     params.vertexAttributeDescription = attributes;
     params.vertexInputDescription = inputs;
     params.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
-    params.extent = swapchain->renderSize();
 
     // One color attachment, no blending enabled for it
     params.blending = {BasicBlending{
@@ -100,8 +142,8 @@ void DeferredLighting::createPipeline(bool recompileShaders, VkDescriptorSetLayo
     // TODO: depth testing, we ought to enable it
     params.useDepthTest = false;
     params.descriptorSetLayouts = {mvpLayout, samplersLayout, debugLayout};
-    this->restirFogPipeline = std::make_unique<GraphicsPipeline>(device, restirFogRenderPass, 0, params);
-    this->pointLightsPipeline = std::make_unique<GraphicsPipeline>(device, debugRenderPass, 0, params);
+    swap.replace(restirFogPipeline, std::make_unique<GraphicsPipeline>(device, restirFogRenderPass, 0, params));
+    swap.replace(pointLightsPipeline, std::make_unique<GraphicsPipeline>(device, debugRenderPass, 0, params));
 
     // Second pipeline: used for debug purposes
     params.shadersList = {
@@ -115,7 +157,6 @@ void DeferredLighting::createPipeline(bool recompileShaders, VkDescriptorSetLayo
     params.vertexAttributeDescription = {};
     params.vertexInputDescription = {};
     params.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    params.extent = swapchain->renderSize();
 
     // One color attachment, no blending enabled for it
     params.blending = {{}};
@@ -123,19 +164,52 @@ void DeferredLighting::createPipeline(bool recompileShaders, VkDescriptorSetLayo
     // TODO: depth testing, we ought to enable it
     params.useDepthTest = false;
     params.descriptorSetLayouts = {mvpLayout, samplersLayout, debugLayout};
-    this->visualizationPipeline = std::make_unique<GraphicsPipeline>(device, debugRenderPass, 0, params);
+    swap.replace(visualizationPipeline, std::make_unique<GraphicsPipeline>(device, debugRenderPass, 0, params));
+
+    // Compute raytracing pipelines. The variants used so far (or the current settings at startup) are created right
+    // away, so that a reload or resize does not compile them while recording a frame.
+    const auto &usedVariants = [](const std::unique_ptr<ComputePipelineVariants> &variants,
+                                  const SpecializationConstants &current) {
+        return variants ? variants->getVariants() : std::vector<SpecializationConstants>{current};
+    };
 
-    // Compute raytracing pipeline
     ComputePipeline::Parameters p;
     p.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/direct-light.comp"};
     p.recompileShaders = recompileShaders;
     p.descriptorSetLayouts = {samplersLayout, computeLayout, samplersLayout};
-    this->raytracingPipeline = std::make_unique<ComputePipeline>(device, p);
+    p.specializationConstants[BVH_STACK_SIZE_CONSTANT] = BVH::MAX_STACK_SIZE;
+    auto raytracing = std::make_unique<ComputePipelineVariants>(device, p);
+    for (auto &constants: usedVariants(raytracingPipelines, constants.raytracing)) {
+        raytracing->get(constants);
+    }
+    swap.replace(raytracingPipelines, std::move(raytracing));
 
     p.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/restir-eval.comp"};
     p.recompileShaders = recompileShaders;
     p.descriptorSetLayouts = {samplersLayout, computeLayout};
-    this->restirEvalPipeline = std::make_unique<ComputePipeline>(device, p);
+    p.specializationConstants.clear();
+    auto restirEval = std::make_unique<ComputePipelineVariants>(device, p);
+    for (auto &constants: usedVariants(restirEvalPipelines, constants.restirEval)) {
+        restirEval->get(constants);
+    }
+    swap.replace(restirEvalPipelines, std::move(restirEval));
+}
+
+DeferredLighting::ComputeConstants DeferredLighting::computeConstants() {
+    return {raytracingConstants(), restirEvalConstants()};
+}
+
+SpecializationConstants DeferredLighting::raytracingConstants() {
+    return {
+        {SAMPLES_PER_RESERVOIR_CONSTANT, (uint32_t) std::clamp(restirSamplesPerReservoir, 1, MAX_SAMPLES_PER_RESERVOIR)},
+        {BRUTEFORCE_EMITTER_SAMPLES_CONSTANT, (uint32_t) std::max(bruteforceEmitterSamples, 1)},
+    };
+}
+
+SpecializationConstants DeferredLighting::restirEvalConstants() {
+    return {
+        {SAMPLES_PER_RESERVOIR_CONSTANT, (uint32_t) std::clamp(restirSamplesPerReservoir, 1, MAX_SAMPLES_PER_RESERVOIR)},
+    };
 }
 
 VkRenderPass DeferredLighting::createRenderPass(bool clearCompositedLight) {
@@ -200,12 +274,19 @@ void DeferredLighting::createRenderPass() {
 }
 
 void DeferredLighting::setup(bool recompileShaders, Scene *scene, VkDescriptorSetLayout mvpLayout) {
-    this->lightGrid = std::make_unique<LightGrid>(device, scene, 1, 1);
+    PROFILE_SCOPE("DeferredLighting::setup");
+    {
+        PROFILE_SCOPE("Light grid");
+        this->lightGrid = std::make_unique<LightGrid>(device, scene, 1, 1);
+    }
 
-    if (useHWRaytracing) {
-        this->raytracingAccelerator = std::make_unique<RaytracingAccelerator>(device, scene);
-    } else {
-        this->bvh = std::make_unique<BVH>(device, scene);
+    {
+        PROFILE_SCOPE("Light acceleration structure");
+        if (useHWRaytracing) {
+            this->raytracingAccelerator = std::make_unique<RaytracingAccelerator>(device, scene);
+        } else {
+            this->bvh = std::make_unique<BVH>(device, scene);
+        }
     }
 
     denoiser.setupRenderStage(recompileShaders);
@@ -213,7 +294,10 @@ void DeferredLighting::setup(bool recompileShaders, Scene *scene, VkDescriptorSe
     createRenderPass();
     linearSampler = VulkanHelper::createSampler(device, true);
     createDescriptorSetLayout();
-    createPipeline(recompileShaders, mvpLayout, scene);
+    {
+        PROFILE_SCOPE("Lighting pipelines");
+        createPipeline(recompileShaders, mvpLayout, scene);
+    }
     setupRenderTarget();
 }
 
@@ -249,14 +333,14 @@ static void computePipelineBarrier(VkCommandBuffer commandBuffer,
 void DeferredLighting::recordRaytraceBuffer(
     VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet, Scene* scene)
 {
-    // Transition attachments to GENERAL layout
-    vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        0,
-        0, nullptr,
-        0, nullptr,
-        preComputeBarriers[0].size(), preComputeBarriers[swapchain->currentFrame].data());
+    // Wait for the G-Buffer and transition compositedLight to GENERAL layout
+    renderGraph->recordBarriers(commandBuffer, computePass);
+
+    // Reservoirs written with fewer samples leave the others undefined, so they cannot be reused.
+    if (reservoirSamplesInUse != restirSamplesPerReservoir) {
+        reservoirSamplesInUse = restirSamplesPerReservoir;
+        needRestirBufferReset = true;
+    }
 
     if (needRestirBufferReset) {
         // At the first frame or after resize, we need to zero-fill the buffers to avoid reuse of stale data.
@@ -280,15 +364,17 @@ void DeferredLighting::recordRaytraceBuffer(
     }
 
     // First pass: naive raytracing or ReSTIR reservoir filling
-    const auto& bindExecComputePipeline = [&] (const std::unique_ptr<ComputePipeline>& pipeline,
+    const auto& bindExecComputePipeline = [&] (const std::string& section, const ComputePipeline& pipeline,
         std::vector<VkDescriptorSet> descriptorSets) {
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->layout, 0,
+        profiler->begin(commandBuffer, section);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0,
             descriptorSets.size(), descriptorSets.data(), 0, 0);
 
         // TODO: is 16x16 the most efficient?
-        vkCmdDispatch(commandBuffer, roundUpDiv(swapchain->renderSize().width, 16),
-            roundUpDiv(swapchain->renderSize().height, 16), 1);
+        vkCmdDispatch(commandBuffer, roundUpDiv(swapchain->activeRenderSize().width, 16),
+            roundUpDiv(swapchain->activeRenderSize().height, 16), 1);
+        profiler->end(commandBuffer, section);
     };
 
     // Wait for previous finalized reservoirs to become available for temporal reuse
@@ -298,7 +384,7 @@ void DeferredLighting::recordRaytraceBuffer(
             VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
     });
 
-    bindExecComputePipeline(raytracingPipeline,
+    bindExecComputePipeline("direct-light.comp", raytracingPipelines->get(raytracingConstants()),
         { samplersSets[curFrame()], computeSets[curFrame()], samplersSets[lastFrame()] });
 
     // Second pass: ReSTIR reservoir evaluation
@@ -308,26 +394,18 @@ void DeferredLighting::recordRaytraceBuffer(
             getComputeBarrier(tmpReservoirs[curFrame()], VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT),
         });
 
-        bindExecComputePipeline(restirEvalPipeline,
+        bindExecComputePipeline("restir-eval.comp", restirEvalPipelines->get(restirEvalConstants()),
             { samplersSets[swapchain->currentFrame], computeSets[swapchain->currentFrame] });
     }
-
-    // Transition compositedLight SHADER_READ_ONLY layout for use in the denoise shader
-    vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        0,
-        0, nullptr,
-        0, nullptr,
-        postComputeBarriers[0].size(), postComputeBarriers[swapchain->currentFrame].data());
 }
 
 void DeferredLighting::recordRasterBuffer(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet, Scene *scene, bool fogOnly) {
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = fogOnly ? restirFogRenderPass : debugRenderPass;
-    renderPassInfo.framebuffer = finalLight.framebuffers[renderPassInfo.renderPass][swapchain->currentFrame];
+    renderPassInfo.framebuffer = finalLight->framebuffers[renderPassInfo.renderPass][swapchain->currentFrame];
     renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = swapchain->renderSize();
+    renderPassInfo.renderArea.extent = swapchain->activeRenderSize();
 
     std::array<VkClearValue, 2> clearValues{};
     clearValues[0].color = {{0.0f, 0.0f, 0.0f, 0.0f}};
@@ -342,7 +420,7 @@ void DeferredLighting::recordRasterBuffer(VkCommandBuffer commandBuffer, VkDescr
     GraphicsPipeline *currentPipeline = useDebugPipeline() ? visualizationPipeline.get() : pointLightsPipeline.get();
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, currentPipeline->pipeline);
-    VulkanHelper::setFullViewportScissor(commandBuffer, swapchain->renderSize());
+    VulkanHelper::setFullViewportScissor(commandBuffer, swapchain->activeRenderSize());
     std::array<VkDescriptorSet, 3> neededSets = {
         mvpSet, samplersSets[swapchain->currentFrame], debugSets[swapchain->currentFrame],
     };
@@ -364,10 +442,20 @@ void DeferredLighting::recordCommandBuffer(
 {
     if (useRaytracingPipeline()) {
         recordRaytraceBuffer(commandBuffer, mvpSet, scene);
+        profiler->begin(commandBuffer, "Denoiser");
+        renderGraph->recordBarriers(commandBuffer, denoiserPass);
         denoiser.recordCommandBuffer(commandBuffer,
-            finalLight.framebuffers[denoiser.getRenderPass()][swapchain->currentFrame], false);
+            finalLight->framebuffers[denoiser.getRenderPass()][swapchain->currentFrame], false);
+        profiler->end(commandBuffer, "Denoiser");
+        profiler->begin(commandBuffer, "Light scattering");
+        renderGraph->recordBarriers(commandBuffer, compositionPass);
         recordRasterBuffer(commandBuffer, mvpSet, scene, true);
+        profiler->end(commandBuffer, "Light scattering");
     } else {
+        // The skipped passes still record their barriers, the layouts of the next frame depend on them
+        renderGraph->recordBarriers(commandBuffer, computePass);
+        renderGraph->recordBarriers(commandBuffer, denoiserPass);
+        renderGraph->recordBarriers(commandBuffer, compositionPass);
         recordRasterBuffer(commandBuffer, mvpSet, scene, false);
     }
 }
@@ -421,43 +509,14 @@ void DeferredLighting::createDescriptorSetLayout() {
 void DeferredLighting::createDescriptorSets(VkDescriptorPool pool, const RenderTarget& sourceBuffer, Scene *scene) {
 
     this->samplersSets =
-        VulkanHelper::createDescriptorSetsFromLayout(*device, pool, samplersLayout, MAX_FRAMES_IN_FLIGHT);
+        VulkanHelper::createDescriptorSetsFromLayout(*device, pool, samplersLayout, Swapchain::framesInFlight);
     this->debugSets =
-        VulkanHelper::createDescriptorSetsFromLayout(*device, pool, debugLayout, MAX_FRAMES_IN_FLIGHT);
+        VulkanHelper::createDescriptorSetsFromLayout(*device, pool, debugLayout, Swapchain::framesInFlight);
     this->computeSets =
-        VulkanHelper::createDescriptorSetsFromLayout(*device, pool, computeLayout, MAX_FRAMES_IN_FLIGHT);
+        VulkanHelper::createDescriptorSetsFromLayout(*device, pool, computeLayout, Swapchain::framesInFlight);
 
-    denoiser.createDescriptorSets(pool, compositedLight, sourceBuffer);
+    denoiser.createDescriptorSets(pool, *compositedLight, sourceBuffer);
     updateDescriptors(sourceBuffer, scene);
-    setupBarriers(sourceBuffer);
-}
-
-void DeferredLighting::setupBarriers(const RenderTarget& gBuffer) {
-    preComputeBarriers.resize(MAX_FRAMES_IN_FLIGHT);
-    postComputeBarriers.resize(MAX_FRAMES_IN_FLIGHT);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        preComputeBarriers[i].resize(GBufferTarget::NumAttachments + 1);
-        postComputeBarriers[i].resize(1);
-
-        for (int j = 0; j < GBufferTarget::NumAttachments; j++) {
-            preComputeBarriers[i][j] = vkutil::createImageBarrier(gBuffer.images[i][j],
-                j == GBufferTarget::Depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-
-                j == GBufferTarget::Depth ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                VK_ACCESS_SHADER_READ_BIT);
-        }
-
-        // Transition compositedLight[i] to the correct layout: before the compute pass,
-        // UNDEFINED -> GENERAL.
-        //
-        // After the compute, GENERAL -> READ_ONLY_OPTIMAL
-        preComputeBarriers[i].back() = vkutil::createImageBarrier(compositedLight.images[i][0], VK_IMAGE_ASPECT_COLOR_BIT,
-            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT);
-        postComputeBarriers[i].back() = vkutil::createImageBarrier(compositedLight.images[i][0], VK_IMAGE_ASPECT_COLOR_BIT,
-            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
-    }
 }
 
 void DeferredLighting::updateDescriptors(const RenderTarget& gBuffer, Scene *scene) {
@@ -492,7 +551,7 @@ void DeferredLighting::updateDescriptors(const RenderTarget& gBuffer, Scene *sce
     auto emiBuffer = lightGrid->emissiveTriangles.getDescriptor();
     VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo{};
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
         std::vector<VkWriteDescriptorSet> descriptorWrites;
         std::vector<VkDescriptorImageInfo> imageInfos(GBufferTarget::NumAttachments + 1);
 
@@ -503,7 +562,7 @@ void DeferredLighting::updateDescriptors(const RenderTarget& gBuffer, Scene *sce
         }
 
         // computeSets
-        imageInfos.back().imageView = compositedLight.imageViews[i][0];
+        imageInfos.back().imageView = compositedLight->imageViews[i][0];
         imageInfos.back().sampler = linearSampler;
         imageInfos.back().imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
@@ -559,7 +618,7 @@ void DeferredLighting::updateDescriptors(const RenderTarget& gBuffer, Scene *sce
     }
 
     // Transition all images to read_only_optimal so that the first frame can read the old data.
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (int i = 0; i < Swapchain::framesInFlight; i++) {
         for (int j = 0; j < GBufferTarget::NumAttachments; j++) {
             device->transitionImageLayout(gBuffer.images[i][j], VK_FORMAT_UNDEFINED,
                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
@@ -570,8 +629,8 @@ void DeferredLighting::updateDescriptors(const RenderTarget& gBuffer, Scene *sce
 
 void DeferredLighting::setupBuffers() {
     denoiser.setupBuffers();
-    debugUBO.allocate(device, sizeof(DebugOptions), MAX_FRAMES_IN_FLIGHT);
-    lightUBO.allocate(device, sizeof(LightingBuffer), MAX_FRAMES_IN_FLIGHT);
+    debugUBO.allocate(device, sizeof(DebugOptions), Swapchain::framesInFlight);
+    lightUBO.allocate(device, sizeof(LightingBuffer), Swapchain::framesInFlight);
     computeParamsUBO.allocate(device, sizeof(ComputeParamsBuffer), 1);
     updateReservoirs();
 }
@@ -584,8 +643,8 @@ void DeferredLighting::updateBuffers(glm::mat4 vp, glm::vec3 cameraPos, glm::vec
     buffer.inverseMVP = glm::inverse(vp);
     buffer.cameraPos = cameraPos;
     buffer.cameraUp = cameraUp;
-    buffer.viewportWidth = swapchain->renderSize().width;
-    buffer.viewportHeight = swapchain->renderSize().height;
+    buffer.viewportWidth = swapchain->activeRenderSize().width;
+    buffer.viewportHeight = swapchain->activeRenderSize().height;
     buffer.fogAbsorption = *fogAbsorption;
     buffer.scatterStrength = scatterStrength;
     buffer.lightBleed = lightBleed;
@@ -607,47 +666,37 @@ void DeferredLighting::updateBuffers(glm::mat4 vp, glm::vec3 cameraPos, glm::vec
 
 RequiredDescriptors DeferredLighting::getNumDescriptors() {
     auto req = denoiser.getNumDescriptors();
-    req.requireUniformBuffers += MAX_FRAMES_IN_FLIGHT * 3;
-    req.requireSamplers += 2 * MAX_FRAMES_IN_FLIGHT * GBufferTarget::NumAttachments + MAX_FRAMES_IN_FLIGHT;
-    req.requireSSBOs += MAX_FRAMES_IN_FLIGHT * 5;
+    req.requireUniformBuffers += Swapchain::framesInFlight * 3;
+    req.requireSamplers += 2 * Swapchain::framesInFlight * GBufferTarget::NumAttachments + Swapchain::framesInFlight;
+    req.requireSSBOs += Swapchain::framesInFlight * 5;
     return req;
 }
 
-void DeferredLighting::handleResize(const RenderTarget& gBuffer, VkDescriptorSetLayout mvpSetLayout, Scene *scene) {
-    compositedLight.destroyAll();
-    finalLight.destroyAll();
-
+void DeferredLighting::handleResize(const RenderTarget& gBuffer, Scene *scene) {
     setupRenderTarget();
-    createPipeline(false, mvpSetLayout, scene);
     updateReservoirs();
     updateDescriptors(gBuffer, scene);
-    setupBarriers(gBuffer);
 
-    denoiser.handleResize(compositedLight, gBuffer);
+    denoiser.handleResize(*compositedLight, gBuffer);
 }
 
-void DeferredLighting::setupRenderTarget() {
-    compositedLight.init(device, MAX_FRAMES_IN_FLIGHT);
-    compositedLight.addAttachment(swapchain->renderSize(), LIGHT_ACCUMULATION_FORMAT,
-        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
-
-    finalLight.init(device, MAX_FRAMES_IN_FLIGHT);
-    finalLight.addAttachment(swapchain->renderSize(), LIGHT_ACCUMULATION_FORMAT,
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
-
-    finalLight.createFramebuffers(debugRenderPass, swapchain->renderSize());
-    finalLight.createFramebuffers(restirFogRenderPass, swapchain->renderSize());
-    finalLight.createFramebuffers(denoiser.getRenderPass(), swapchain->renderSize());
+void DeferredLighting::handleRenderScaleChange() {
+    // The reservoirs are indexed by pixel, the ones of the previous scale would be reused at the wrong pixels.
+    needRestirBufferReset = true;
 }
 
-#define NUM_SAMPLES_PER_RESERVOIR 4
+void DeferredLighting::setupRenderTarget() {
+    finalLight->createFramebuffers(debugRenderPass, swapchain->renderSize());
+    finalLight->createFramebuffers(restirFogRenderPass, swapchain->renderSize());
+    finalLight->createFramebuffers(denoiser.getRenderPass(), swapchain->renderSize());
+}
 
 void DeferredLighting::updateReservoirs() {
     struct Reservoir {
-        alignas(16) glm::int32 selected[NUM_SAMPLES_PER_RESERVOIR];
-        alignas(16) glm::vec4 positions[NUM_SAMPLES_PER_RESERVOIR];
-        alignas(16) glm::float32 sumW[NUM_SAMPLES_PER_RESERVOIR];
-        alignas(16) glm::float32 pHat[NUM_SAMPLES_PER_RESERVOIR];
+        alignas(16) glm::int32 selected[MAX_SAMPLES_PER_RESERVOIR];
+        alignas(16) glm::vec4 positions[MAX_SAMPLES_PER_RESERVOIR];
+        alignas(16) glm::float32 sumW[MAX_SAMPLES_PER_RESERVOIR];
+        alignas(16) glm::float32 pHat[MAX_SAMPLES_PER_RESERVOIR];
         alignas(16) glm::int32 totalNumSamples;
     };
 
@@ -663,6 +712,8 @@ void DeferredLighting::updateReservoirs() {
             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
     };
 
+    reservoirs.resize(Swapchain::framesInFlight);
+    tmpReservoirs.resize(Swapchain::framesInFlight);
     std::for_each(reservoirs.begin(), reservoirs.end(), update);
     std::for_each(tmpReservoirs.begin(), tmpReservoirs.end(), update);
 }
@@ -5,6 +5,8 @@
 #define LIGHTIG_H
 
 #include "Denoiser.h"
+#include "GpuProfiler.h"
+#include "RenderGraph.h"
 #include "Scene.h"
 #include "Swapchain.h"
 #include "UniformBuffer.h"
@@ -14,11 +16,22 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include "Pipeline.h"
+#include "PipelineSwap.h"
 #include <memory>
 #include <random>
 
 #define LIGHT_ACCUMULATION_FORMAT VK_FORMAT_R32G32B32A32_SFLOAT
 
+// Storage space of a reservoir, must match restir.glsl
+#define MAX_SAMPLES_PER_RESERVOIR 4
+
+// constant_id of the specialization constants of direct-light.comp and restir-eval.comp
+enum LightingConstant : uint32_t {
+    SAMPLES_PER_RESERVOIR_CONSTANT = 0,
+    BRUTEFORCE_EMITTER_SAMPLES_CONSTANT = 1,
+    BVH_STACK_SIZE_CONSTANT = 2,
+};
+
 struct DebugOptions {
     // 0 - don't show light boxes, 1 - show light bbox as an overlay
     glm::int32_t showLightBoxes = 0;
@@ -39,18 +52,31 @@ class RaytracingAccelerator;
  */
 class DeferredLighting {
   public:
-    DeferredLighting(VulkanDevice* device, Swapchain* swapChain);
+    // Declares the lighting targets and passes, the G-Buffer is read by the compute passes.
+    DeferredLighting(VulkanDevice* device, Swapchain* swapChain, RenderGraph *renderGraph, const RenderTarget& gBuffer);
     ~DeferredLighting();
 
+    // Specialization constants of the current kernel sizes
+    struct ComputeConstants {
+        SpecializationConstants raytracing;
+        SpecializationConstants restirEval;
+    };
+    ComputeConstants computeConstants();
+
     // Will also destroy any old pipeline which exists
     void createPipeline(bool recompileShaders, VkDescriptorSetLayout mvpLayout, Scene *scene);
+    // May run on another thread than the frames, so the kernel sizes have to be passed in. They are only used if no
+    // variant was created yet.
+    void createPipeline(bool recompileShaders, VkDescriptorSetLayout mvpLayout, Scene *scene, PipelineSwap &swap,
+                        const ComputeConstants &constants);
 
     VkRenderPass debugRenderPass, restirFogRenderPass;
     std::unique_ptr<GraphicsPipeline> pointLightsPipeline;
     std::unique_ptr<GraphicsPipeline> visualizationPipeline;
     std::unique_ptr<GraphicsPipeline> restirFogPipeline;
-    std::unique_ptr<ComputePipeline> raytracingPipeline;
-    std::unique_ptr<ComputePipeline> restirEvalPipeline;
+    // Variants for the kernel sizes chosen at runtime, see raytracingConstants()
+    std::unique_ptr<ComputePipelineVariants> raytracingPipelines;
+    std::unique_ptr<ComputePipelineVariants> restirEvalPipelines;
     std::unique_ptr<BVH> bvh;
     std::unique_ptr<LightGrid> lightGrid;
     std::unique_ptr<RaytracingAccelerator> raytracingAccelerator;
@@ -64,10 +90,6 @@ class DeferredLighting {
     std::vector<VkDescriptorSet> debugSets;
     std::vector<VkDescriptorSet> computeSets;
 
-    std::vector<std::vector<VkImageMemoryBarrier>> preComputeBarriers;
-    std::vector<std::vector<VkImageMemoryBarrier>> postComputeBarriers;
-    void setupBarriers(const RenderTarget& gBuffer);
-
     VkSampler linearSampler;
 
     void setup(bool recompileshaders, Scene *scene, VkDescriptorSetLayout mvpLayout);
@@ -78,10 +100,16 @@ class DeferredLighting {
 
     void createDescriptorSets(VkDescriptorPool pool, const RenderTarget& gBuffer, Scene *scene);
 
-    RenderTarget compositedLight;
-    RenderTarget finalLight;
+    // Transient targets of the render graph
+    RenderTarget *compositedLight;
+    RenderTarget *finalLight;
+    RenderGraph::Image finalLightImage;
 
-    void handleResize(const RenderTarget& gBuffer, VkDescriptorSetLayout mvpSetLayout, Scene *scene);
+    // Recreate what depends on the render size, the pipelines do not.
+    void handleResize(const RenderTarget& gBuffer, Scene *scene);
+    // Swapchain::dynamicScale changed, the targets stay the same but the temporal ReSTIR reuse has to start over.
+    void handleRenderScaleChange();
+    // Create the framebuffers of finalLight, after the render graph is compiled
     void setupRenderTarget();
     void updateDescriptors(const RenderTarget& gBuffer, Scene *scene);
 
@@ -106,6 +134,12 @@ class DeferredLighting {
     int restirSamplingMode = 0;
     float restirPointLightImportance = 0.1;
     float pointLightIntensityMultiplier = 1.0;
+    // Compiled into the shaders as specialization constants, so every value used is a separate pipeline
+    int restirSamplesPerReservoir = 1;
+    int bruteforceEmitterSamples = 50;
+
+    SpecializationConstants raytracingConstants();
+    SpecializationConstants restirEvalConstants();
 
     bool useRaytracingPipeline() {
         return debug.compositionMode == 0;
@@ -124,7 +158,7 @@ class DeferredLighting {
     }
 
     inline int lastFrame(int idx) {
-        return (idx + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+        return (idx + Swapchain::framesInFlight - 1) % Swapchain::framesInFlight;
     }
 
     inline int curFrame() {
@@ -135,6 +169,14 @@ class DeferredLighting {
         return &denoiser;
     }
 
+    // For reproducible frames, the seed is random otherwise.
+    void seedRandom(uint32_t seed) {
+        rndGen.seed(seed);
+    }
+
+    // Times the compute passes and the denoiser, set by the owner before the first frame is recorded
+    GpuProfiler *profiler = nullptr;
+
   private:
     VulkanDevice *device;
     Swapchain *swapchain;
@@ -143,9 +185,12 @@ class DeferredLighting {
     UniformBuffer computeParamsUBO;
     Denoiser denoiser;
 
+    RenderGraph *renderGraph;
+    RenderGraph::Pass computePass, denoiserPass, compositionPass;
+
     // *2 for temporary reservoirs while using temporal and spatial reuse
-    std::array<DataBuffer, MAX_FRAMES_IN_FLIGHT> reservoirs;
-    std::array<DataBuffer, MAX_FRAMES_IN_FLIGHT> tmpReservoirs;
+    std::vector<DataBuffer> reservoirs;
+    std::vector<DataBuffer> tmpReservoirs;
 
     std::mt19937 rndGen{std::random_device{}()};
 
@@ -153,6 +198,7 @@ class DeferredLighting {
     void recordRaytraceBuffer(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet, Scene* scene);
     void updateReservoirs();
     bool needRestirBufferReset = true;
+    int reservoirSamplesInUse = 0;
 };
 
 #endif /* end of include guard: LIGHTIG_H */
@@ -0,0 +1,535 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <set>
+
+// Size of the modelled cache for the Forsyth scoring function. This is not the size of any particular hardware cache,
+// modern GPUs do not have a simple FIFO cache anyway, but a larger value favours locality over longer stretches.
+const int FORSYTH_CACHE_SIZE = 32;
+
+const uint32_t MESH_CACHE_MAGIC = 0x314f4d4a; // "JMO1"
+// Bump whenever the optimization changes, so that old cache files are not reused.
+const uint32_t MESH_CACHE_VERSION = 1;
+
+static float forsythVertexScore(int cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0) {
+        // vertex is not used anymore, it should not attract any triangles
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // vertices of the last triangle: fixed score, so that we do not prefer strips too much
+            score = 0.75f;
+        } else {
+            score = std::pow(1.0f - float(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+    }
+
+    // boost vertices with few remaining triangles, to get rid of them early
+    return score + 2.0f * std::pow(float(remainingTriangles), -0.5f);
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // triangles adjacent to each vertex, only the first remaining[v] entries are still unemitted
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (auto idx: indices) remaining[idx]++;
+
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + remaining[v];
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            adjacency[fill[indices[3 * t + k]]++] = t;
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    }
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; t++) {
+        triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] +
+                           vertexScore[indices[3 * t + 2]];
+    }
+
+    int64_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+    size_t cursor = 0;
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    std::vector<uint32_t> cache, newCache;
+
+    while (result.size() < indices.size()) {
+        if (best < 0) {
+            // no candidate adjacent to the cache, continue with the next unemitted triangle
+            while (emitted[cursor]) cursor++;
+            best = cursor;
+        }
+
+        const uint32_t tri[3] = {indices[3 * best], indices[3 * best + 1], indices[3 * best + 2]};
+        result.insert(result.end(), tri, tri + 3);
+        emitted[best] = true;
+
+        newCache.clear();
+        for (auto v: tri) {
+            auto begin = adjacency.begin() + offsets[v];
+            auto end = begin + remaining[v];
+            std::iter_swap(std::find(begin, end, best), end - 1);
+            remaining[v]--;
+
+            if (std::find(newCache.begin(), newCache.end(), v) == newCache.end()) {
+                newCache.push_back(v);
+            }
+        }
+
+        for (auto v: cache) {
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                newCache.push_back(v);
+            }
+        }
+
+        // vertices which fell out of the cache get position -1 and are updated as well
+        for (size_t i = 0; i < newCache.size(); i++) {
+            auto v = newCache[i];
+            cachePosition[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+            vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+        }
+
+        best = -1;
+        float bestScore = -std::numeric_limits<float>::infinity();
+        for (auto v: newCache) {
+            for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; i++) {
+                auto t = adjacency[i];
+                triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] +
+                                   vertexScore[indices[3 * t + 2]];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+
+        newCache.resize(std::min<size_t>(newCache.size(), FORSYTH_CACHE_SIZE));
+        std::swap(cache, newCache);
+    }
+
+    indices = std::move(result);
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+                                     float threshold) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2) return;
+
+    const unsigned int cacheSize = 16;
+    const auto inputStatistics = analyzeVertexCache(indices, positions.size(), cacheSize);
+
+    // Split into clusters wherever the cache is cold anyway, i.e. all three vertices of a triangle miss.
+    // Reordering such clusters does not change the number of transformed vertices much.
+    std::vector<size_t> clusterStarts{0};
+    std::vector<uint32_t> timestamps(positions.size(), 0);
+    uint32_t time = cacheSize + 1;
+    for (size_t t = 0; t < triangleCount; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            auto v = indices[3 * t + k];
+            if (time - timestamps[v] > cacheSize) {
+                timestamps[v] = time++;
+                misses++;
+            }
+        }
+
+        if (misses == 3 && t > clusterStarts.back()) {
+            clusterStarts.push_back(t);
+        }
+    }
+
+    if (clusterStarts.size() < 2) return;
+    clusterStarts.push_back(triangleCount);
+
+    const size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+    std::vector<float> clusterAreas(clusterCount, 0.0f);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+
+    for (size_t c = 0; c < clusterCount; c++) {
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            const auto &a = positions[indices[3 * t]];
+            const auto &b = positions[indices[3 * t + 1]];
+            const auto &d = positions[indices[3 * t + 2]];
+
+            // the length of the cross product is twice the area, so the sum is an area-weighted normal
+            auto normal = glm::cross(b - a, d - a);
+            float area = glm::length(normal);
+            auto centroid = (a + b + d) / 3.0f;
+
+            clusterNormals[c] += normal;
+            clusterCentroids[c] += centroid * area;
+            clusterAreas[c] += area;
+            meshCentroid += centroid * area;
+            meshArea += area;
+        }
+    }
+
+    if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+    // Clusters far out in the direction they are facing are likely to occlude the rest of the mesh, draw them first.
+    std::vector<float> sortKeys(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; c++) {
+        if (clusterAreas[c] <= 0.0f) continue;
+        auto centroid = clusterCentroids[c] / clusterAreas[c];
+        float normalLength = glm::length(clusterNormals[c]);
+        if (normalLength > 0.0f) {
+            sortKeys[c] = glm::dot(centroid - meshCentroid, clusterNormals[c] / normalLength);
+        }
+    }
+
+    std::vector<size_t> clusterOrder(clusterCount);
+    std::iota(clusterOrder.begin(), clusterOrder.end(), 0);
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+                     [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (auto c: clusterOrder) {
+        result.insert(result.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+    }
+
+    // Only keep the new order if it does not destroy what the vertex cache optimization achieved.
+    if (analyzeVertexCache(result, positions.size(), cacheSize).acmr <= threshold * inputStatistics.acmr) {
+        indices = std::move(result);
+    }
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexFetch(std::vector<uint32_t> &indices, size_t vertexCount) {
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertexCount, unused);
+
+    uint32_t next = 0;
+    for (auto &idx: indices) {
+        if (remap[idx] == unused) {
+            remap[idx] = next++;
+        }
+        idx = remap[idx];
+    }
+
+    // unreferenced vertices are kept at the end, so the accessors keep their size
+    for (auto &newIndex: remap) {
+        if (newIndex == unused) {
+            newIndex = next++;
+        }
+    }
+
+    return remap;
+}
+
+MeshOptimizer::VertexCacheStatistics MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t> &indices,
+                                                                     size_t vertexCount, unsigned int cacheSize) {
+    // FIFO cache: a vertex is still cached if less than cacheSize vertices have been transformed after it
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+    size_t uniqueVertices = 0;
+
+    for (auto idx: indices) {
+        if (time - timestamps[idx] > cacheSize) {
+            timestamps[idx] = time++;
+            misses++;
+        }
+
+        if (!referenced[idx]) {
+            referenced[idx] = true;
+            uniqueVertices++;
+        }
+    }
+
+    const size_t triangleCount = indices.size() / 3;
+    return VertexCacheStatistics{
+        .acmr = triangleCount > 0 ? float(misses) / triangleCount : 0.0f,
+        .atvr = uniqueVertices > 0 ? float(misses) / uniqueVertices : 0.0f,
+    };
+}
+
+struct OptimizedPrimitive {
+    std::vector<uint32_t> indices;
+    // empty if the vertices of the primitive could not be reordered
+    std::vector<uint32_t> remap;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::map<uint64_t, OptimizedPrimitive> readMeshCache(const std::string &filename) {
+    std::map<uint64_t, OptimizedPrimitive> result;
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) return result;
+
+    const auto &readU32 = [&] () {
+        uint32_t value = 0;
+        file.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    };
+
+    if (readU32() != MESH_CACHE_MAGIC || readU32() != MESH_CACHE_VERSION) {
+        return result;
+    }
+
+    uint32_t numEntries = readU32();
+    for (uint32_t i = 0; i < numEntries && file.good(); i++) {
+        uint64_t key = 0;
+        file.read(reinterpret_cast<char *>(&key), sizeof(key));
+        OptimizedPrimitive entry;
+        entry.indices.resize(readU32());
+        entry.remap.resize(readU32());
+        file.read(reinterpret_cast<char *>(entry.indices.data()), entry.indices.size() * sizeof(uint32_t));
+        file.read(reinterpret_cast<char *>(entry.remap.data()), entry.remap.size() * sizeof(uint32_t));
+        if (file.good()) {
+            result[key] = std::move(entry);
+        }
+    }
+
+    return result;
+}
+
+static void writeMeshCache(const std::string &filename, const std::map<uint64_t, OptimizedPrimitive> &entries) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "[meshopt] WARN: Could not write cache file " << filename << std::endl;
+        return;
+    }
+
+    const auto &writeU32 = [&] (uint32_t value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+
+    writeU32(MESH_CACHE_MAGIC);
+    writeU32(MESH_CACHE_VERSION);
+    writeU32(entries.size());
+    for (auto &[key, entry]: entries) {
+        file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+        writeU32(entry.indices.size());
+        writeU32(entry.remap.size());
+        file.write(reinterpret_cast<const char *>(entry.indices.data()), entry.indices.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char *>(entry.remap.data()), entry.remap.size() * sizeof(uint32_t));
+    }
+}
+
+static unsigned char *accessorData(tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    auto &bufferView = model.bufferViews[accessor.bufferView];
+    return model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset + accessor.byteOffset;
+}
+
+static const unsigned char *accessorData(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    auto &bufferView = model.bufferViews[accessor.bufferView];
+    return model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset + accessor.byteOffset;
+}
+
+std::vector<uint32_t> MeshOptimizer::readIndices(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    std::vector<uint32_t> indices(accessor.count);
+    auto data = accessorData(model, accessor);
+    for (size_t i = 0; i < accessor.count; i++) {
+        switch (accessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                indices[i] = data[i];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                indices[i] = reinterpret_cast<const uint16_t *>(data)[i];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                indices[i] = reinterpret_cast<const uint32_t *>(data)[i];
+                break;
+            default:
+                throw std::runtime_error("Invalid component type");
+        }
+    }
+    return indices;
+}
+
+static void writeIndices(tinygltf::Model &model, const tinygltf::Accessor &accessor,
+                         const std::vector<uint32_t> &indices) {
+    auto data = accessorData(model, accessor);
+    for (size_t i = 0; i < accessor.count; i++) {
+        switch (accessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                data[i] = indices[i];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                reinterpret_cast<uint16_t *>(data)[i] = indices[i];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                reinterpret_cast<uint32_t *>(data)[i] = indices[i];
+                break;
+            default:
+                throw std::runtime_error("Invalid component type");
+        }
+    }
+}
+
+static std::vector<glm::vec3> readPositions(tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    std::vector<glm::vec3> positions(accessor.count);
+    auto data = accessorData(model, accessor);
+    const size_t byteStride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+    for (size_t i = 0; i < accessor.count; i++) {
+        std::memcpy(&positions[i], data + i * byteStride, sizeof(glm::vec3));
+    }
+    return positions;
+}
+
+static void remapVertices(tinygltf::Model &model, const tinygltf::Accessor &accessor,
+                          const std::vector<uint32_t> &remap) {
+    auto data = accessorData(model, accessor);
+    const size_t elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) *
+                               tinygltf::GetNumComponentsInType(accessor.type);
+    const size_t byteStride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+
+    std::vector<unsigned char> reordered(elementSize * accessor.count);
+    for (size_t i = 0; i < accessor.count; i++) {
+        std::memcpy(&reordered[remap[i] * elementSize], data + i * byteStride, elementSize);
+    }
+    for (size_t i = 0; i < accessor.count; i++) {
+        std::memcpy(data + i * byteStride, &reordered[i * elementSize], elementSize);
+    }
+}
+
+// All accessors which hold per-vertex data of the primitive, including morph targets.
+static std::set<int> vertexAccessors(const tinygltf::Primitive &primitive) {
+    std::set<int> result;
+    for (auto &[name, accessor]: primitive.attributes) result.insert(accessor);
+    for (auto &target: primitive.targets) {
+        for (auto &[name, accessor]: target) result.insert(accessor);
+    }
+    return result;
+}
+
+void MeshOptimizer::optimizeModel(tinygltf::Model &model, const std::string &cacheFile) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Vertices may only be reordered if no other primitive reads them.
+    std::map<int, int> accessorUsers;
+    for (auto &mesh: model.meshes) {
+        for (auto &primitive: mesh.primitives) {
+            for (auto accessor: vertexAccessors(primitive)) accessorUsers[accessor]++;
+            if (primitive.indices >= 0) accessorUsers[primitive.indices]++;
+        }
+    }
+
+    auto cache = readMeshCache(cacheFile);
+    std::map<uint64_t, OptimizedPrimitive> usedEntries;
+    std::set<int> processedIndexAccessors;
+    bool cacheDirty = false;
+
+    for (auto &mesh: model.meshes) {
+        for (size_t j = 0; j < mesh.primitives.size(); j++) {
+            auto &primitive = mesh.primitives[j];
+            if (primitive.indices < 0 || !primitive.attributes.count("POSITION") ||
+                (primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != -1)) {
+                continue;
+            }
+
+            auto &indexAccessor = model.accessors[primitive.indices];
+            auto &positionAccessor = model.accessors[primitive.attributes.at("POSITION")];
+            if (processedIndexAccessors.contains(primitive.indices) || indexAccessor.sparse.isSparse ||
+                indexAccessor.bufferView < 0 || positionAccessor.bufferView < 0 ||
+                positionAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
+                positionAccessor.type != TINYGLTF_TYPE_VEC3) {
+                continue;
+            }
+            processedIndexAccessors.insert(primitive.indices);
+
+            const size_t vertexCount = positionAccessor.count;
+            bool canRemap = accessorUsers[primitive.indices] == 1;
+            for (auto accessor: vertexAccessors(primitive)) {
+                canRemap &= accessorUsers[accessor] == 1 && model.accessors[accessor].count == vertexCount &&
+                            model.accessors[accessor].bufferView >= 0 && !model.accessors[accessor].sparse.isSparse;
+            }
+
+            auto indices = readIndices(model, indexAccessor);
+            auto positions = readPositions(model, positionAccessor);
+            if (std::any_of(indices.begin(), indices.end(), [&](uint32_t idx) { return idx >= vertexCount; })) {
+                std::cout << "[meshopt] WARN: Out of range index in mesh " << mesh.name << std::endl;
+                continue;
+            }
+
+            uint64_t key = fnv1a(0xcbf29ce484222325ull, &MESH_CACHE_VERSION, sizeof(MESH_CACHE_VERSION));
+            key = fnv1a(key, indices.data(), indices.size() * sizeof(uint32_t));
+            key = fnv1a(key, positions.data(), positions.size() * sizeof(glm::vec3));
+            key = fnv1a(key, &canRemap, sizeof(canRemap));
+
+            auto before = analyzeVertexCache(indices, vertexCount);
+
+            auto cached = cache.find(key);
+            bool fromCache = cached != cache.end() && cached->second.indices.size() == indices.size() &&
+                             cached->second.remap.size() == (canRemap ? vertexCount : 0);
+
+            OptimizedPrimitive optimized;
+            if (fromCache) {
+                optimized = cached->second;
+            } else {
+                optimized.indices = indices;
+                optimizeVertexCache(optimized.indices, vertexCount);
+                optimizeOverdraw(optimized.indices, positions);
+                if (canRemap) {
+                    optimized.remap = optimizeVertexFetch(optimized.indices, vertexCount);
+                }
+                cacheDirty = true;
+            }
+
+            // the cached vertex cache statistics are not stored, they are cheap to compute
+            auto after = analyzeVertexCache(optimized.indices, vertexCount);
+            std::cout << std::setprecision(3) << std::fixed
+                      << "[meshopt] " << mesh.name << "#" << j << ": ACMR " << before.acmr << " -> " << after.acmr
+                      << ", ATVR " << before.atvr << " -> " << after.atvr
+                      << (optimized.remap.empty() ? " (shared vertices, not reordered)" : "")
+                      << (fromCache ? " (cached)" : "") << std::defaultfloat << std::endl;
+
+            writeIndices(model, indexAccessor, optimized.indices);
+            if (!optimized.remap.empty()) {
+                for (auto accessor: vertexAccessors(primitive)) {
+                    remapVertices(model, model.accessors[accessor], optimized.remap);
+                }
+            }
+
+            usedEntries[key] = std::move(optimized);
+        }
+    }
+
+    if (cacheDirty || usedEntries.size() != cache.size()) {
+        writeMeshCache(cacheFile, usedEntries);
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << "[meshopt] Optimized " << usedEntries.size() << " primitives in "
+              << std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count()
+              << "ms" << std::endl;
+}
@@ -0,0 +1,51 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_MESHOPTIMIZER_H
+#define JUNGLE_MESHOPTIMIZER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "tiny_gltf.h"
+
+/**
+ * Load-time optimization of indexed triangle meshes.
+ *
+ * Triangles are reordered for the post-transform vertex cache (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+ * and afterwards clustered and sorted for less overdraw (Sander et al., "Fast Triangle Reordering for Vertex
+ * Locality and Reduced Overdraw"). Finally, vertices are renumbered in order of first use for fetch locality.
+ */
+class MeshOptimizer {
+  public:
+    struct VertexCacheStatistics {
+        // average cache miss ratio: transformed vertices per triangle
+        float acmr;
+        // average transform to vertex ratio: transformed vertices per referenced vertex
+        float atvr;
+    };
+
+    static void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+    // Keeps the cache efficiency of the given order within threshold * ACMR while sorting clusters front to back.
+    static void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+                                 float threshold = 1.05f);
+
+    // Renumbers the vertices in the order they are referenced. Returns a remap table old index -> new index.
+    static std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> &indices, size_t vertexCount);
+
+    // Read an index accessor of any unsigned component type.
+    static std::vector<uint32_t> readIndices(const tinygltf::Model &model, const tinygltf::Accessor &accessor);
+
+    static VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount,
+                                                    unsigned int cacheSize = 16);
+
+    /**
+     * Optimize all triangle primitives of the model in place (index and vertex data in model.buffers).
+     * Results are stored in cacheFile and reused on the next start as long as the mesh data did not change.
+     */
+    static void optimizeModel(tinygltf::Model &model, const std::string &cacheFile);
+};
+
+#endif //JUNGLE_MESHOPTIMIZER_H
@@ -0,0 +1,357 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "MeshQuantizer.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+bool useMeshQuantization = false;
+
+// Offsets of bufferViews in the repacked buffer. 16 covers the alignment of all vertex and index formats.
+const size_t QUANTIZED_BUFFER_ALIGNMENT = 16;
+
+static float readComponent(const unsigned char *data, int componentType, bool normalized) {
+    switch (componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+            float value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_BYTE: {
+            float value = *reinterpret_cast<const int8_t *>(data);
+            return normalized ? std::max(value / 127.0f, -1.0f) : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+            float value = *data;
+            return normalized ? value / 255.0f : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_SHORT: {
+            int16_t raw;
+            std::memcpy(&raw, data, sizeof(raw));
+            return normalized ? std::max(raw / 32767.0f, -1.0f) : raw;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            uint16_t raw;
+            std::memcpy(&raw, data, sizeof(raw));
+            return normalized ? raw / 65535.0f : raw;
+        }
+        default:
+            throw std::runtime_error("Invalid component type");
+    }
+}
+
+template<int N>
+static std::vector<glm::vec<N, float>> readVec(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    if (tinygltf::GetNumComponentsInType(accessor.type) != N) {
+        throw std::runtime_error("Unexpected accessor type");
+    }
+
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto *data = model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset + accessor.byteOffset;
+    const size_t byteStride = accessor.ByteStride(bufferView);
+    const size_t componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+
+    std::vector<glm::vec<N, float>> result(accessor.count);
+    for (size_t i = 0; i < accessor.count; i++) {
+        for (int c = 0; c < N; c++) {
+            result[i][c] = readComponent(data + i * byteStride + c * componentSize,
+                                         accessor.componentType, accessor.normalized);
+        }
+    }
+    return result;
+}
+
+std::vector<glm::vec3> MeshQuantizer::readVec3(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    return readVec<3>(model, accessor);
+}
+
+std::vector<glm::vec4> MeshQuantizer::readVec4(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    return readVec<4>(model, accessor);
+}
+
+static std::vector<glm::vec2> readVec2(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto *data = model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset + accessor.byteOffset;
+    const size_t byteStride = accessor.ByteStride(bufferView);
+
+    std::vector<glm::vec2> result(accessor.count);
+    for (size_t i = 0; i < accessor.count; i++) {
+        std::memcpy(&result[i], data + i * byteStride, sizeof(glm::vec2));
+    }
+    return result;
+}
+
+static int16_t toSnorm16(float value) {
+    return static_cast<int16_t>(std::round(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t toUnorm16(float value) {
+    return static_cast<uint16_t>(std::round(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+// Must match decodeNormal() in shaders/vertex-quantization.glsl
+static glm::vec2 octahedralEncode(glm::vec3 n) {
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 <= 0.0f) {
+        return glm::vec2(0.0f);
+    }
+
+    n /= l1;
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return e;
+}
+
+static bool isFloatAttribute(const tinygltf::Accessor &accessor, int type) {
+    return accessor.type == type && accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT &&
+           accessor.bufferView >= 0 && !accessor.sparse.isSparse;
+}
+
+MeshQuantizer::Result MeshQuantizer::quantizeModel(tinygltf::Model &model,
+                                                   const std::vector<std::vector<int>> &meshGroups) {
+    Result result;
+
+    const int bufferIndex = model.buffers.size();
+    std::vector<unsigned char> data;
+
+    const auto &addBufferView = [&](const void *bytes, size_t size, size_t byteStride, int target) {
+        data.resize((data.size() + QUANTIZED_BUFFER_ALIGNMENT - 1) / QUANTIZED_BUFFER_ALIGNMENT
+                    * QUANTIZED_BUFFER_ALIGNMENT);
+
+        tinygltf::BufferView view;
+        view.buffer = bufferIndex;
+        view.byteOffset = data.size();
+        view.byteLength = size;
+        view.byteStride = byteStride;
+        view.target = target;
+
+        auto begin = static_cast<const unsigned char *>(bytes);
+        data.insert(data.end(), begin, begin + size);
+        model.bufferViews.push_back(view);
+        return static_cast<int>(model.bufferViews.size() - 1);
+    };
+
+    const auto &addAccessor = [&](int originalIndex, const void *bytes, size_t elementSize,
+                                  int componentType, int type, bool normalized) {
+        size_t count = model.accessors[originalIndex].count;
+
+        tinygltf::Accessor accessor;
+        accessor.name = model.accessors[originalIndex].name;
+        accessor.bufferView = addBufferView(bytes, elementSize * count, elementSize, TINYGLTF_TARGET_ARRAY_BUFFER);
+        accessor.byteOffset = 0;
+        accessor.componentType = componentType;
+        accessor.type = type;
+        accessor.normalized = normalized;
+        accessor.count = count;
+        model.accessors.push_back(accessor);
+        return static_cast<int>(model.accessors.size() - 1);
+    };
+
+    // Positions are quantized relative to the bounds of their group, so they must not be shared between groups.
+    std::map<int, std::set<size_t>> positionGroups;
+    for (size_t g = 0; g < meshGroups.size(); g++) {
+        for (int mesh: meshGroups[g]) {
+            for (auto &primitive: model.meshes[mesh].primitives) {
+                if (primitive.attributes.count("POSITION")) {
+                    positionGroups[primitive.attributes.at("POSITION")].insert(g);
+                }
+            }
+        }
+    }
+
+    // original accessor -> quantized accessor, primitives sharing an accessor also share the quantized one
+    std::map<int, int> quantized;
+    size_t bytesBefore = 0;
+    size_t bytesAfter = 0;
+
+    for (size_t g = 0; g < meshGroups.size(); g++) {
+        glm::vec3 low(std::numeric_limits<float>::max());
+        glm::vec3 high(-std::numeric_limits<float>::max());
+
+        bool canQuantize = true;
+        for (int mesh: meshGroups[g]) {
+            for (auto &primitive: model.meshes[mesh].primitives) {
+                if (!primitive.targets.empty() || !primitive.attributes.count("POSITION")) {
+                    canQuantize = false;
+                    continue;
+                }
+
+                int positionAccessor = primitive.attributes.at("POSITION");
+                if (!isFloatAttribute(model.accessors[positionAccessor], TINYGLTF_TYPE_VEC3) ||
+                    positionGroups[positionAccessor].size() > 1) {
+                    canQuantize = false;
+                    continue;
+                }
+
+                for (auto &position: readVec3(model, model.accessors[positionAccessor])) {
+                    low = glm::min(low, position);
+                    high = glm::max(high, position);
+                }
+            }
+        }
+
+        if (!canQuantize || glm::any(glm::greaterThan(low, high))) {
+            continue;
+        }
+
+        // Uniform scale, so that the normal matrix computed in the shaders stays correct.
+        glm::vec3 center = (low + high) * 0.5f;
+        float scale = std::max({high.x - low.x, high.y - low.y, high.z - low.z}) * 0.5f;
+        if (scale <= 0.0f) scale = 1.0f;
+        glm::mat4 dequantization = glm::scale(glm::translate(glm::mat4(1.0f), center), glm::vec3(scale));
+
+        for (int mesh: meshGroups[g]) {
+            result.dequantization[mesh] = dequantization;
+
+            for (auto &primitive: model.meshes[mesh].primitives) {
+                for (auto &[name, accessorIndex]: primitive.attributes) {
+                    if (quantized.contains(accessorIndex)) {
+                        accessorIndex = quantized[accessorIndex];
+                        continue;
+                    }
+
+                    const auto &accessor = model.accessors[accessorIndex];
+                    int newIndex = -1;
+                    if (name == "POSITION") {
+                        // padded to 4 components, as required by glTF for vertex attributes
+                        std::vector<int16_t> values(4 * accessor.count, 0);
+                        auto positions = readVec3(model, accessor);
+                        for (size_t i = 0; i < accessor.count; i++) {
+                            auto q = (positions[i] - center) / scale;
+                            values[4 * i + 0] = toSnorm16(q.x);
+                            values[4 * i + 1] = toSnorm16(q.y);
+                            values[4 * i + 2] = toSnorm16(q.z);
+                        }
+                        newIndex = addAccessor(accessorIndex, values.data(), 4 * sizeof(int16_t),
+                                               TINYGLTF_COMPONENT_TYPE_SHORT, TINYGLTF_TYPE_VEC3, true);
+                        model.accessors[newIndex].minValues = {-1.0, -1.0, -1.0};
+                        model.accessors[newIndex].maxValues = {1.0, 1.0, 1.0};
+                    } else if (name == "NORMAL" && isFloatAttribute(accessor, TINYGLTF_TYPE_VEC3)) {
+                        std::vector<int16_t> values(2 * accessor.count);
+                        auto normals = readVec3(model, accessor);
+                        for (size_t i = 0; i < accessor.count; i++) {
+                            auto e = octahedralEncode(normals[i]);
+                            values[2 * i + 0] = toSnorm16(e.x);
+                            values[2 * i + 1] = toSnorm16(e.y);
+                        }
+                        newIndex = addAccessor(accessorIndex, values.data(), 2 * sizeof(int16_t),
+                                               TINYGLTF_COMPONENT_TYPE_SHORT, TINYGLTF_TYPE_VEC2, true);
+                    } else if (name.starts_with("TEXCOORD_") && isFloatAttribute(accessor, TINYGLTF_TYPE_VEC2)) {
+                        auto uvs = readVec2(model, accessor);
+                        bool inUnitRange = std::all_of(uvs.begin(), uvs.end(), [] (const glm::vec2 &uv) {
+                            return glm::all(glm::greaterThanEqual(uv, glm::vec2(0.0f))) &&
+                                   glm::all(glm::lessThanEqual(uv, glm::vec2(1.0f)));
+                        });
+
+                        std::vector<uint16_t> values(2 * accessor.count);
+                        for (size_t i = 0; i < accessor.count; i++) {
+                            for (int c = 0; c < 2; c++) {
+                                values[2 * i + c] = inUnitRange ? toUnorm16(uvs[i][c]) : glm::packHalf1x16(uvs[i][c]);
+                            }
+                        }
+                        newIndex = addAccessor(accessorIndex, values.data(), 2 * sizeof(uint16_t),
+                                               TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_TYPE_VEC2,
+                                               inUnitRange);
+                        if (!inUnitRange) {
+                            result.halfFloatAccessors.insert(newIndex);
+                        }
+                    }
+
+                    if (newIndex >= 0) {
+                        bytesBefore += model.accessors[accessorIndex].count *
+                                       tinygltf::GetComponentSizeInBytes(model.accessors[accessorIndex].componentType) *
+                                       tinygltf::GetNumComponentsInType(model.accessors[accessorIndex].type);
+                        bytesAfter += model.bufferViews[model.accessors[newIndex].bufferView].byteLength;
+                        quantized[accessorIndex] = newIndex;
+                        accessorIndex = newIndex;
+                    }
+                }
+            }
+        }
+    }
+
+    // Repack everything which is still referenced into the new buffer, so the original buffers can be dropped.
+    std::set<int> liveAccessors;
+    for (auto &mesh: model.meshes) {
+        for (auto &primitive: mesh.primitives) {
+            for (auto &[name, accessor]: primitive.attributes) liveAccessors.insert(accessor);
+            for (auto &target: primitive.targets) {
+                for (auto &[name, accessor]: target) liveAccessors.insert(accessor);
+            }
+            if (primitive.indices >= 0) liveAccessors.insert(primitive.indices);
+        }
+    }
+    for (auto &node: model.nodes) {
+        // Per-instance TRANSLATION/ROTATION/SCALE, read when the instance transforms are generated
+        auto instancing = node.extensions.find("EXT_mesh_gpu_instancing");
+        if (instancing == node.extensions.end() || !instancing->second.Has("attributes")) continue;
+        auto &attributes = instancing->second.Get("attributes");
+        for (auto &name: attributes.Keys()) {
+            liveAccessors.insert(attributes.Get(name).GetNumberAsInt());
+        }
+    }
+    for (auto &skin: model.skins) {
+        if (skin.inverseBindMatrices >= 0) liveAccessors.insert(skin.inverseBindMatrices);
+    }
+    for (auto &animation: model.animations) {
+        for (auto &sampler: animation.samplers) {
+            liveAccessors.insert(sampler.input);
+            liveAccessors.insert(sampler.output);
+        }
+    }
+
+    std::set<int> liveBufferViews;
+    for (int accessor: liveAccessors) {
+        if (accessor < 0) continue;
+        liveBufferViews.insert(model.accessors[accessor].bufferView);
+        if (model.accessors[accessor].sparse.isSparse) {
+            liveBufferViews.insert(model.accessors[accessor].sparse.indices.bufferView);
+            liveBufferViews.insert(model.accessors[accessor].sparse.values.bufferView);
+        }
+    }
+    for (auto &image: model.images) {
+        liveBufferViews.insert(image.bufferView);
+    }
+
+    for (int viewIndex: liveBufferViews) {
+        if (viewIndex < 0 || model.bufferViews[viewIndex].buffer == bufferIndex) continue;
+
+        data.resize((data.size() + QUANTIZED_BUFFER_ALIGNMENT - 1) / QUANTIZED_BUFFER_ALIGNMENT
+                    * QUANTIZED_BUFFER_ALIGNMENT);
+        auto &view = model.bufferViews[viewIndex];
+        auto &source = model.buffers[view.buffer].data;
+        size_t offset = data.size();
+        data.insert(data.end(), source.begin() + view.byteOffset, source.begin() + view.byteOffset + view.byteLength);
+        view.buffer = bufferIndex;
+        view.byteOffset = offset;
+    }
+
+    size_t totalBefore = 0;
+    for (auto &buffer: model.buffers) {
+        totalBefore += buffer.data.size();
+        buffer.data.clear();
+        buffer.data.shrink_to_fit();
+    }
+
+    tinygltf::Buffer buffer;
+    buffer.name = "quantized";
+    buffer.data = std::move(data);
+    model.buffers.push_back(std::move(buffer));
+
+    if (std::find(model.extensionsUsed.begin(), model.extensionsUsed.end(), "KHR_mesh_quantization") ==
+        model.extensionsUsed.end()) {
+        model.extensionsUsed.push_back("KHR_mesh_quantization");
+    }
+
+    std::cout << "[quantize] Quantized " << quantized.size() << " vertex attributes: " << bytesBefore / 1024
+              << " KiB -> " << bytesAfter / 1024 << " KiB, total buffer size " << totalBefore / 1024 << " KiB -> "
+              << model.buffers.back().data.size() / 1024 << " KiB" << std::endl;
+
+    return result;
+}
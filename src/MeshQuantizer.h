@@ -0,0 +1,46 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_MESHQUANTIZER_H
+#define JUNGLE_MESHQUANTIZER_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <glm/glm.hpp>
+#include "tiny_gltf.h"
+
+// Quantize float vertex data at load time, set with --quantize-meshes.
+extern bool useMeshQuantization;
+
+/**
+ * Reading and writing of quantized vertex attributes in the spirit of KHR_mesh_quantization.
+ *
+ * Positions are stored as normalized 16-bit integers relative to the bounding box of the mesh. The matrix to get back
+ * to object space is folded into the transforms of the mesh. Normals are octahedral-encoded into two normalized
+ * 16-bit integers (stored as a VEC2 NORMAL accessor, decoded by decodeNormal() in the vertex shaders) and texture
+ * coordinates are stored as unorm16 if they are in [0, 1] and as half floats otherwise.
+ */
+class MeshQuantizer {
+  public:
+    struct Result {
+        // mesh index -> matrix mapping quantized positions to the original object space
+        std::map<int, glm::mat4> dequantization;
+        // accessors with 16-bit float components, which glTF can not express (stored as UNSIGNED_SHORT)
+        std::set<int> halfFloatAccessors;
+    };
+
+    // Read a VEC3/VEC4 accessor of any component type (normalized or not) as floats.
+    static std::vector<glm::vec3> readVec3(const tinygltf::Model &model, const tinygltf::Accessor &accessor);
+    static std::vector<glm::vec4> readVec4(const tinygltf::Model &model, const tinygltf::Accessor &accessor);
+
+    /**
+     * Quantize all float positions, normals and texture coordinates of the given meshes.
+     * All meshes in a group share the same dequantization matrix (e.g. the LoDs of a mesh, since they use the same
+     * transforms). Afterwards, all remaining data is repacked into a single new buffer and the original buffers
+     * are emptied, so that only the quantized data is uploaded to the GPU.
+     */
+    static Result quantizeModel(tinygltf::Model &model, const std::vector<std::vector<int>> &meshGroups);
+};
+
+#endif //JUNGLE_MESHQUANTIZER_H
@@ -0,0 +1,514 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "MeshQuantizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <tuple>
+
+LoDChainSettings autoLoDSettings;
+
+const uint32_t LOD_CACHE_MAGIC = 0x31444f4c; // "LOD1"
+// Increment whenever the simplification changes, so that stale chains are regenerated.
+const uint32_t LOD_CACHE_VERSION = 1;
+
+// Border edges add a plane perpendicular to the surface which keeps border vertices on the border line.
+// It is weighted stronger than the surface planes, since moving the silhouette is much more visible.
+const double BORDER_WEIGHT = 10.0;
+
+// Collapses which rotate the normal of a remaining triangle by more than ~75 degrees are rejected.
+const float MIN_NORMAL_COSINE = 0.25f;
+
+// A level which removes less than this fraction of the triangles of the previous level ends the chain.
+const float MIN_LEVEL_REDUCTION = 0.1f;
+
+// Symmetric 4x4 matrix of the plane equations accumulated for a vertex, together with their total weight.
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    void addPlane(glm::vec3 n, float d, double w) {
+        a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+        a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+        a22 += w * n.z * n.z; a23 += w * n.z * d;
+        a33 += w * d * d;
+        weight += w;
+    }
+
+    Quadric &operator+=(const Quadric &other) {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+        a11 += other.a11; a12 += other.a12; a13 += other.a13;
+        a22 += other.a22; a23 += other.a23;
+        a33 += other.a33;
+        weight += other.weight;
+        return *this;
+    }
+
+    // weighted mean of the squared distances of p to the planes
+    double error(glm::vec3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double sum = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+                     a11 * y * y + 2 * a12 * y * z + 2 * a13 * y +
+                     a22 * z * z + 2 * a23 * z +
+                     a33;
+        return weight > 0 ? std::max(sum / weight, 0.0) : 0.0;
+    }
+};
+
+enum class VertexKind {
+    Manifold,
+    // on exactly one open border, may only move along it
+    Border,
+    // seams, non-manifold vertices and border corners
+    Locked,
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+std::vector<uint32_t> MeshSimplifier::simplify(const std::vector<uint32_t> &indices,
+                                               const std::vector<glm::vec3> &positions, size_t targetIndexCount,
+                                               float targetError, float *resultError) {
+    std::vector<uint32_t> result = indices;
+    if (resultError) *resultError = 0.0f;
+
+    const size_t vertexCount = positions.size();
+    if (result.size() <= targetIndexCount || vertexCount == 0) {
+        return result;
+    }
+
+    // Referenced vertices with the same position are welded, so that seams can be told apart from real borders.
+    std::vector<uint32_t> welded(vertexCount);
+    std::vector<uint32_t> weldedSize;
+    {
+        std::vector<bool> referenced(vertexCount);
+        for (auto index: result) referenced[index] = true;
+
+        std::map<std::tuple<float, float, float>, uint32_t> positionMap;
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            auto [it, inserted] = positionMap.try_emplace({positions[v].x, positions[v].y, positions[v].z},
+                                                          weldedSize.size());
+            if (inserted) weldedSize.push_back(0);
+            welded[v] = it->second;
+            if (referenced[v]) weldedSize[it->second]++;
+        }
+    }
+
+    glm::vec3 min = positions[0], max = positions[0];
+    for (auto &p: positions) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    float extent = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+    if (extent <= 0.0f) {
+        return result;
+    }
+    const double errorLimit = double(targetError * extent) * double(targetError * extent);
+
+    // directed edges between welded vertices -> number of triangles using them
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> edges;
+    const auto &findEdges = [&] () {
+        edges.clear();
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = welded[result[t + e]], b = welded[result[t + (e + 1) % 3]];
+                if (a != b) edges[{a, b}]++;
+            }
+        }
+    };
+    const auto &isBorderEdge = [&] (uint32_t a, uint32_t b) {
+        return edges.contains({a, b}) != edges.contains({b, a});
+    };
+
+    findEdges();
+    std::vector<Quadric> quadrics(weldedSize.size());
+    for (size_t t = 0; t + 2 < result.size(); t += 3) {
+        glm::vec3 p0 = positions[result[t]], p1 = positions[result[t + 1]], p2 = positions[result[t + 2]];
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float doubleArea = glm::length(normal);
+        if (doubleArea == 0.0f) continue;
+        normal /= doubleArea;
+
+        for (int e = 0; e < 3; e++) {
+            quadrics[welded[result[t + e]]].addPlane(normal, -glm::dot(normal, p0), 0.5 * doubleArea);
+        }
+
+        for (int e = 0; e < 3; e++) {
+            uint32_t a = result[t + e], b = result[t + (e + 1) % 3];
+            if (!isBorderEdge(welded[a], welded[b])) continue;
+            glm::vec3 edge = positions[b] - positions[a];
+            float length = glm::length(edge);
+            if (length == 0.0f) continue;
+            glm::vec3 borderNormal = glm::normalize(glm::cross(edge, normal));
+            float d = -glm::dot(borderNormal, positions[a]);
+            quadrics[welded[a]].addPlane(borderNormal, d, BORDER_WEIGHT * length * length);
+            quadrics[welded[b]].addPlane(borderNormal, d, BORDER_WEIGHT * length * length);
+        }
+    }
+
+    double maxCost = 0.0;
+    std::vector<VertexKind> kinds(vertexCount);
+    std::vector<uint32_t> borderEdges(weldedSize.size());
+    std::vector<bool> nonManifold(weldedSize.size());
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+    std::vector<uint32_t> vertexTriangles;
+
+    // Every pass collapses a set of independent edges in order of their cost, then rebuilds the topology.
+    while (result.size() > targetIndexCount) {
+        std::fill(borderEdges.begin(), borderEdges.end(), 0);
+        std::fill(nonManifold.begin(), nonManifold.end(), false);
+        for (auto &[edge, count]: edges) {
+            if (count > 1) {
+                nonManifold[edge.first] = nonManifold[edge.second] = true;
+            }
+            if (!edges.contains({edge.second, edge.first})) {
+                borderEdges[edge.first]++;
+                borderEdges[edge.second]++;
+            }
+        }
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            uint32_t w = welded[v];
+            if (weldedSize[w] > 1 || nonManifold[w] || (borderEdges[w] != 0 && borderEdges[w] != 2)) {
+                kinds[v] = VertexKind::Locked;
+            } else {
+                kinds[v] = borderEdges[w] == 0 ? VertexKind::Manifold : VertexKind::Border;
+            }
+        }
+
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for (auto index: result) triangleOffsets[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++) triangleOffsets[v + 1] += triangleOffsets[v];
+        vertexTriangles.resize(result.size());
+        {
+            std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++) vertexTriangles[fill[result[i]]++] = i / 3;
+        }
+
+        std::vector<Collapse> collapses;
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            for (int e = 0; e < 3; e++) {
+                // both directions of every edge, the other direction is not necessarily part of any triangle
+                for (auto [from, to]: {std::pair{result[t + e], result[t + (e + 1) % 3]},
+                                       std::pair{result[t + (e + 1) % 3], result[t + e]}}) {
+                    if (kinds[from] == VertexKind::Locked) continue;
+                    if (kinds[from] == VertexKind::Border &&
+                        (kinds[to] == VertexKind::Manifold || !isBorderEdge(welded[from], welded[to]))) {
+                        continue;
+                    }
+                    Quadric q = quadrics[welded[from]];
+                    q += quadrics[welded[to]];
+                    collapses.push_back({from, to, q.error(positions[to])});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+        std::vector<uint32_t> remap(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++) remap[v] = v;
+        std::vector<bool> locked(weldedSize.size());
+        size_t triangleCount = result.size() / 3;
+        size_t appliedCollapses = 0;
+
+        for (auto &collapse: collapses) {
+            if (collapse.cost > errorLimit || triangleCount * 3 <= targetIndexCount) break;
+            if (locked[welded[collapse.from]] || locked[welded[collapse.to]]) continue;
+
+            // Reject collapses which flip a triangle. The triangles around an unlocked vertex are unchanged in
+            // this pass, since all neighbours of a collapsed vertex get locked.
+            bool flips = false;
+            size_t removedTriangles = 0;
+            for (uint32_t i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++) {
+                const uint32_t *triangle = &result[vertexTriangles[i] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+                    removedTriangles++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = positions[triangle[k]];
+                    q[k] = triangle[k] == collapse.from ? positions[collapse.to] : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                // A small positive threshold also rejects almost degenerate triangles, whose normals are unreliable
+                // and would otherwise let a later collapse flip the triangle in two steps.
+                if (glm::dot(before, after) <= MIN_NORMAL_COSINE * glm::length(before) * glm::length(after)) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips) continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[welded[collapse.to]] += quadrics[welded[collapse.from]];
+            for (uint32_t i = triangleOffsets[collapse.from]; i < triangleOffsets[collapse.from + 1]; i++) {
+                for (int k = 0; k < 3; k++) {
+                    locked[welded[result[vertexTriangles[i] * 3 + k]]] = true;
+                }
+            }
+
+            triangleCount -= removedTriangles;
+            maxCost = std::max(maxCost, collapse.cost);
+            appliedCollapses++;
+        }
+
+        if (appliedCollapses == 0) break;
+
+        size_t writeIndex = 0;
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            uint32_t a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+            if (a == b || b == c || c == a) continue;
+            result[writeIndex++] = a;
+            result[writeIndex++] = b;
+            result[writeIndex++] = c;
+        }
+        result.resize(writeIndex);
+        findEdges();
+    }
+
+    if (resultError) *resultError = float(std::sqrt(maxCost)) / extent;
+    return result;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// primitive hash -> index lists of the generated levels
+using LoDCache = std::map<uint64_t, std::vector<std::vector<uint32_t>>>;
+
+static LoDCache readLoDCache(const std::string &filename) {
+    LoDCache result;
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) return result;
+
+    const auto &readU32 = [&] () {
+        uint32_t value = 0;
+        file.read(reinterpret_cast<char *>(&value), sizeof(value));
+        return value;
+    };
+
+    if (readU32() != LOD_CACHE_MAGIC || readU32() != LOD_CACHE_VERSION) {
+        return result;
+    }
+
+    uint32_t numEntries = readU32();
+    for (uint32_t i = 0; i < numEntries && file.good(); i++) {
+        uint64_t key = 0;
+        file.read(reinterpret_cast<char *>(&key), sizeof(key));
+        std::vector<std::vector<uint32_t>> levels(readU32());
+        for (auto &level: levels) {
+            level.resize(readU32());
+            file.read(reinterpret_cast<char *>(level.data()), level.size() * sizeof(uint32_t));
+        }
+        if (file.good()) {
+            result[key] = std::move(levels);
+        }
+    }
+
+    return result;
+}
+
+static void writeLoDCache(const std::string &filename, const LoDCache &entries) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "[lod] WARN: Could not write cache file " << filename << std::endl;
+        return;
+    }
+
+    const auto &writeU32 = [&] (uint32_t value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+
+    writeU32(LOD_CACHE_MAGIC);
+    writeU32(LOD_CACHE_VERSION);
+    writeU32(entries.size());
+    for (auto &[key, levels]: entries) {
+        file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+        writeU32(levels.size());
+        for (auto &level: levels) {
+            writeU32(level.size());
+            file.write(reinterpret_cast<const char *>(level.data()), level.size() * sizeof(uint32_t));
+        }
+    }
+}
+
+static std::string formatDistance(float distance) {
+    std::ostringstream stream;
+    stream << distance;
+    return stream.str();
+}
+
+std::vector<int> MeshSimplifier::generateLoDChains(tinygltf::Model &model, const std::vector<int> &meshes,
+                                                   const LoDChainSettings &settings, const std::string &cacheFile) {
+    std::vector<int> newMeshes;
+    if (settings.levels <= 0) return newMeshes;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto cache = readLoDCache(cacheFile);
+    LoDCache usedEntries;
+    bool cacheDirty = false;
+
+    // The index data of all generated levels goes into one new buffer, the vertex data is shared with the base mesh.
+    tinygltf::Buffer lodBuffer;
+    lodBuffer.name = "generated-lods";
+    const int lodBufferIndex = model.buffers.size();
+    std::vector<tinygltf::Mesh> lodMeshes;
+
+    for (int meshIndex: meshes) {
+        const tinygltf::Mesh &mesh = model.meshes[meshIndex];
+
+        bool supported = !mesh.primitives.empty();
+        size_t triangleCount = 0;
+        for (auto &primitive: mesh.primitives) {
+            supported &= primitive.indices >= 0 && primitive.attributes.count("POSITION") &&
+                         (primitive.mode == TINYGLTF_MODE_TRIANGLES || primitive.mode == -1);
+            if (!supported) break;
+            auto &positionAccessor = model.accessors[primitive.attributes.at("POSITION")];
+            supported &= model.accessors[primitive.indices].bufferView >= 0 && positionAccessor.bufferView >= 0 &&
+                         positionAccessor.type == TINYGLTF_TYPE_VEC3;
+            triangleCount += model.accessors[primitive.indices].count / 3;
+        }
+        if (!supported || triangleCount < settings.minTriangles) continue;
+
+        // levels[primitive][level - 1]
+        std::vector<std::vector<std::vector<uint32_t>>> levels;
+        size_t numLevels = 0;
+        for (size_t j = 0; j < mesh.primitives.size(); j++) {
+            auto &primitive = mesh.primitives[j];
+            auto indices = MeshOptimizer::readIndices(model, model.accessors[primitive.indices]);
+            auto positions = MeshQuantizer::readVec3(model, model.accessors[primitive.attributes.at("POSITION")]);
+            if (std::any_of(indices.begin(), indices.end(), [&](uint32_t idx) { return idx >= positions.size(); })) {
+                std::cout << "[lod] WARN: Out of range index in mesh " << mesh.name << std::endl;
+                levels.emplace_back();
+                continue;
+            }
+
+            uint64_t key = fnv1a(0xcbf29ce484222325ull, &LOD_CACHE_VERSION, sizeof(LOD_CACHE_VERSION));
+            key = fnv1a(key, &settings.levels, sizeof(settings.levels));
+            key = fnv1a(key, &settings.reduction, sizeof(settings.reduction));
+            key = fnv1a(key, &settings.maxError, sizeof(settings.maxError));
+            key = fnv1a(key, indices.data(), indices.size() * sizeof(uint32_t));
+            key = fnv1a(key, positions.data(), positions.size() * sizeof(glm::vec3));
+
+            auto cached = cache.find(key);
+            if (cached != cache.end()) {
+                levels.push_back(cached->second);
+            } else {
+                std::vector<std::vector<uint32_t>> primitiveLevels;
+                const std::vector<uint32_t> *previous = &indices;
+                for (int level = 0; level < settings.levels; level++) {
+                    size_t target = size_t(float(previous->size() / 3) * settings.reduction) * 3;
+                    float error = settings.maxError * float(1 << level);
+                    auto simplified = simplify(*previous, positions, target, error);
+                    if (float(simplified.size()) > float(previous->size()) * (1.0f - MIN_LEVEL_REDUCTION)) {
+                        break;
+                    }
+                    MeshOptimizer::optimizeVertexCache(simplified, positions.size());
+                    primitiveLevels.push_back(std::move(simplified));
+                    previous = &primitiveLevels.back();
+                }
+                levels.push_back(std::move(primitiveLevels));
+                cacheDirty = true;
+            }
+            usedEntries[key] = levels.back();
+            numLevels = std::max(numLevels, levels.back().size());
+        }
+
+        if (numLevels == 0) continue;
+
+        std::cout << "[lod] " << mesh.name << ": " << triangleCount;
+        for (size_t level = 0; level < numLevels; level++) {
+            tinygltf::Mesh lodMesh = mesh;
+            float minDistance = settings.firstDistance * float(1 << level);
+            lodMesh.name = mesh.name + "_LOD_" + formatDistance(minDistance);
+            if (level + 1 < numLevels) {
+                lodMesh.name += "_" + formatDistance(minDistance * 2.0f);
+            }
+
+            size_t levelTriangles = 0;
+            for (size_t j = 0; j < lodMesh.primitives.size(); j++) {
+                auto &primitive = lodMesh.primitives[j];
+                // primitives which could not be simplified as far keep their last level
+                if (levels[j].empty()) {
+                    levelTriangles += model.accessors[primitive.indices].count / 3;
+                    continue;
+                }
+                auto &indices = levels[j][std::min(level, levels[j].size() - 1)];
+                levelTriangles += indices.size() / 3;
+
+                const size_t vertexCount = model.accessors[primitive.attributes.at("POSITION")].count;
+                const bool shortIndices = vertexCount <= 0xffff;
+                const size_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+
+                tinygltf::BufferView bufferView;
+                bufferView.buffer = lodBufferIndex;
+                bufferView.byteOffset = (lodBuffer.data.size() + 3) & ~size_t(3);
+                bufferView.byteLength = indices.size() * indexSize;
+                bufferView.target = TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER;
+                lodBuffer.data.resize(bufferView.byteOffset + bufferView.byteLength);
+                for (size_t i = 0; i < indices.size(); i++) {
+                    if (shortIndices) {
+                        uint16_t index = indices[i];
+                        std::memcpy(&lodBuffer.data[bufferView.byteOffset + i * indexSize], &index, indexSize);
+                    } else {
+                        std::memcpy(&lodBuffer.data[bufferView.byteOffset + i * indexSize], &indices[i], indexSize);
+                    }
+                }
+
+                tinygltf::Accessor accessor;
+                accessor.bufferView = model.bufferViews.size();
+                accessor.componentType = shortIndices ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT
+                                                      : TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+                accessor.count = indices.size();
+                accessor.type = TINYGLTF_TYPE_SCALAR;
+                model.bufferViews.push_back(bufferView);
+                primitive.indices = model.accessors.size();
+                model.accessors.push_back(accessor);
+            }
+
+            std::cout << " -> " << levelTriangles;
+            lodMeshes.push_back(std::move(lodMesh));
+        }
+        std::cout << " triangles" << std::endl;
+    }
+
+    if (!lodBuffer.data.empty()) {
+        model.buffers.push_back(std::move(lodBuffer));
+    }
+    for (auto &lodMesh: lodMeshes) {
+        newMeshes.push_back(model.meshes.size());
+        model.meshes.push_back(std::move(lodMesh));
+    }
+
+    if (cacheDirty || usedEntries.size() != cache.size()) {
+        writeLoDCache(cacheFile, usedEntries);
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    std::cout << "[lod] Generated " << newMeshes.size() << " LoD meshes in "
+              << std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count()
+              << "ms" << std::endl;
+
+    return newMeshes;
+}
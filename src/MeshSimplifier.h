@@ -0,0 +1,57 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_MESHSIMPLIFIER_H
+#define JUNGLE_MESHSIMPLIFIER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "tiny_gltf.h"
+
+struct LoDChainSettings {
+    // number of generated levels per mesh, 0 disables the generation
+    int levels = 0;
+    // target triangle count of a level relative to the previous level
+    float reduction = 0.5f;
+    // distance at which the first generated level is used, every further level doubles it
+    float firstDistance = 20.0f;
+    // maximum geometric error of the first level relative to the mesh extent, doubled for every further level
+    float maxError = 0.01f;
+    // meshes with fewer triangles are left alone
+    size_t minTriangles = 256;
+};
+
+// Set with --auto-lods <LEVELS> and --auto-lod-distance <DISTANCE>.
+extern LoDChainSettings autoLoDSettings;
+
+/**
+ * Quadric error metric mesh simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error
+ * Metrics") for generating LoD chains at load time.
+ *
+ * Edges are only collapsed onto existing vertices, so the simplified index buffers reference the vertex data of the
+ * original mesh and no attributes need to be interpolated. Vertices on attribute seams (several vertices with the same
+ * position, e.g. a UV seam) never move, and vertices on open borders only move along the border, so the silhouette
+ * and the texture mapping stay intact.
+ */
+class MeshSimplifier {
+  public:
+    /**
+     * Simplify an indexed triangle list until it has at most targetIndexCount indices or the next collapse would
+     * introduce an error larger than targetError (relative to the extent of the mesh).
+     * If resultError is given, it is set to the relative error of the result.
+     */
+    static std::vector<uint32_t> simplify(const std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+                                          size_t targetIndexCount, float targetError, float *resultError = nullptr);
+
+    /**
+     * Generate LoD chains for the given base meshes. The new meshes reuse the vertex accessors and materials of their
+     * base mesh, get new index accessors and are named NAME_LOD_<MIN>_<MAX>, so they can be registered like LoDs
+     * from the scene file. Results are stored in cacheFile. Returns the indices of the new meshes.
+     */
+    static std::vector<int> generateLoDChains(tinygltf::Model &model, const std::vector<int> &meshes,
+                                              const LoDChainSettings &settings, const std::string &cacheFile);
+};
+
+#endif //JUNGLE_MESHSIMPLIFIER_H
@@ -3,6 +3,7 @@
 
 #include "PhysicalDevice.h"
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <set>
 #include <GLFW/glfw3.h>
@@ -17,6 +18,8 @@ bool enableValidationLayers = true;
 
 bool crashOnValidationWarning = false;
 
+static const char *PIPELINE_CACHE_FILE = "shaders/pipelines.cache";
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -62,12 +65,14 @@ bool VulkanDevice::checkValidationLayerSupport() {
     return true;
 }
 
-std::vector<const char *> getRequiredExtensions() {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-    std::vector<const char *> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+std::vector<const char *> getRequiredExtensions(bool headless) {
+    std::vector<const char *> extensions;
+    if (!headless) {
+        uint32_t glfwExtensionCount = 0;
+        const char **glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (enableValidationLayers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -76,10 +81,11 @@ std::vector<const char *> getRequiredExtensions() {
     return extensions;
 }
 
-std::vector<const char*> getDeviceExtensions() {
-    std::vector<const char*> extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME
-    };
+std::vector<const char*> getDeviceExtensions(bool headless) {
+    std::vector<const char*> extensions;
+    if (!headless) {
+        extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 
     if (useHWRaytracing) {
         extensions.push_back(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME);
@@ -112,7 +118,7 @@ void VulkanDevice::createInstance() {
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     createInfo.pApplicationInfo = &appInfo;
 
-    auto extensions = getRequiredExtensions();
+    auto extensions = getRequiredExtensions(headless);
     createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
     createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -218,23 +224,42 @@ bool VulkanDevice::isDeviceSuitable(VkPhysicalDevice const& device, VkSurfaceKHR
     VkPhysicalDeviceFeatures deviceFeatures;
     vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
+    VkPhysicalDeviceVulkan12Features deviceFeaturesVk12{};
+    deviceFeaturesVk12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceVulkan11Features deviceFeaturesVk11{};
+    deviceFeaturesVk11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    deviceFeaturesVk11.pNext = &deviceFeaturesVk12;
+    VkPhysicalDeviceFeatures2 deviceFeatures2{};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &deviceFeaturesVk11;
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
     QueueFamilyIndices indices = findQueueFamilies(device, surface);
 
     VkBool32 surfaceSupported = VK_FALSE;
-    if (indices.presentFamily.has_value()) {
+    if (headless) {
+        surfaceSupported = VK_TRUE;
+    } else if (indices.presentFamily.has_value()) {
         vkGetPhysicalDeviceSurfaceSupportKHR(device, indices.presentFamily.value(), surface, &surfaceSupported);
     }
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported && surfaceSupported == VK_TRUE) {
+    bool swapChainAdequate = headless;
+    if (!headless && extensionsSupported && surfaceSupported == VK_TRUE) {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface);
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
 
     return deviceFeatures.samplerAnisotropy &&
            deviceFeatures.geometryShader &&
+           deviceFeatures.multiDrawIndirect &&
+           deviceFeatures.drawIndirectFirstInstance &&
+           deviceFeatures.shaderSampledImageArrayDynamicIndexing &&
+           deviceFeaturesVk11.shaderDrawParameters &&
+           deviceFeaturesVk12.drawIndirectCount &&
+           deviceFeaturesVk12.runtimeDescriptorArray &&
+           deviceFeaturesVk12.descriptorBindingPartiallyBound &&
            indices.isComplete() &&
            extensionsSupported &&
            swapChainAdequate &&
@@ -246,6 +271,10 @@ void VulkanDevice::createLogicalDevice(VkSurfaceKHR surface) {
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {chosenQueues.graphicsFamily.value(), chosenQueues.presentFamily.value()};
+    bool asyncCompute = allowAsyncCompute && chosenQueues.computeFamily.has_value();
+    if (asyncCompute) {
+        uniqueQueueFamilies.insert(chosenQueues.computeFamily.value());
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily: uniqueQueueFamilies) {
@@ -260,6 +289,11 @@ void VulkanDevice::createLogicalDevice(VkSurfaceKHR surface) {
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
     deviceFeatures.geometryShader = VK_TRUE;
+    // scene draws are issued with vkCmdDrawIndexedIndirectCount, see Scene::recordDrawCommands
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    // bindless materials, see Scene::setupMaterials
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -267,7 +301,29 @@ void VulkanDevice::createLogicalDevice(VkSurfaceKHR surface) {
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    auto deviceExtensions = getDeviceExtensions();;
+    auto deviceExtensions = getDeviceExtensions(headless);
+
+    // Optional, lets Swapchain::waitForPresent block until a frame has been displayed
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    presentIdFeatures.pNext = &presentWaitFeatures;
+
+    auto available = availableDeviceExtensions(physicalDevice);
+    if (!headless && available.contains(VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+        available.contains(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 supportedFeatures{};
+        supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext = &presentIdFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+        supportsPresentWait = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+    }
+    if (supportsPresentWait) {
+        deviceExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        deviceExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    }
+
     createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
     createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
@@ -278,14 +334,9 @@ void VulkanDevice::createLogicalDevice(VkSurfaceKHR surface) {
         createInfo.enabledLayerCount = 0;
     }
 
-    VkPhysicalDeviceBufferDeviceAddressFeaturesEXT deviceAddressFeatures{};
-    deviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_ADDRESS_FEATURES_EXT;
-    deviceAddressFeatures.bufferDeviceAddress = VK_TRUE;
-
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeatures{};
     accelFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
     accelFeatures.accelerationStructure = VK_TRUE;
-    accelFeatures.pNext = &deviceAddressFeatures;
 
     VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{};
     rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
@@ -296,18 +347,48 @@ void VulkanDevice::createLogicalDevice(VkSurfaceKHR surface) {
     deviceFeaturesVk13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
     deviceFeaturesVk13.maintenance4 = VK_TRUE;
 
+    VkPhysicalDeviceVulkan12Features deviceFeaturesVk12{};
+    deviceFeaturesVk12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    deviceFeaturesVk12.drawIndirectCount = VK_TRUE;
+    deviceFeaturesVk12.runtimeDescriptorArray = VK_TRUE;
+    deviceFeaturesVk12.descriptorBindingPartiallyBound = VK_TRUE;
+    // synchronizes the graphics and compute queue, see AsyncCompute
+    deviceFeaturesVk12.timelineSemaphore = VK_TRUE;
+    // for the acceleration structures. Part of the Vulkan 1.2 features, which must not be chained together with
+    // VkPhysicalDeviceBufferDeviceAddressFeatures.
+    deviceFeaturesVk12.bufferDeviceAddress = useHWRaytracing ? VK_TRUE : VK_FALSE;
+
+    // gl_DrawID selects the material of a draw
+    VkPhysicalDeviceVulkan11Features deviceFeaturesVk11{};
+    deviceFeaturesVk11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+    deviceFeaturesVk11.shaderDrawParameters = VK_TRUE;
+    deviceFeaturesVk11.pNext = &deviceFeaturesVk12;
+    deviceFeaturesVk13.pNext = &deviceFeaturesVk11;
+
     if (useHWRaytracing) {
-        deviceFeaturesVk13.pNext = &rayQueryFeatures;
+        deviceFeaturesVk12.pNext = &rayQueryFeatures;
     } else {
-        deviceFeaturesVk13.pNext = NULL;
+        deviceFeaturesVk12.pNext = NULL;
     }
 
     createInfo.pNext = &deviceFeaturesVk13;
+    if (supportsPresentWait) {
+        presentWaitFeatures.pNext = &deviceFeaturesVk13;
+        createInfo.pNext = &presentIdFeatures;
+    }
 
     VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &createInfo, nullptr, &device))
 
+    if (supportsPresentWait) {
+        vkWaitForPresentKHR = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+    }
+
     vkGetDeviceQueue(device, chosenQueues.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, chosenQueues.presentFamily.value(), 0, &presentQueue);
+    if (asyncCompute) {
+        vkGetDeviceQueue(device, chosenQueues.computeFamily.value(), 0, &computeQueue);
+        std::cout << "[device] Async compute on queue family " << chosenQueues.computeFamily.value() << std::endl;
+    }
 }
 
 VulkanDevice::QueueFamilyIndices VulkanDevice::findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface) {
@@ -325,7 +406,12 @@ VulkanDevice::QueueFamilyIndices VulkanDevice::findQueueFamilies(VkPhysicalDevic
             indices.graphicsFamily = i;
         }
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        if (headless) {
+            // Nothing is presented, the graphics queue stands in for the present queue.
+            presentSupport = indices.graphicsFamily == (uint32_t) i;
+        } else {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        }
         if (presentSupport) {
             indices.presentFamily = i;
         }
@@ -334,24 +420,46 @@ VulkanDevice::QueueFamilyIndices VulkanDevice::findQueueFamilies(VkPhysicalDevic
         }
         i++;
     }
+
+    for (uint32_t family = 0; family < queueFamilyCount; family++) {
+        auto flags = queueFamilies[family].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            indices.computeFamily = family;
+            break;
+        }
+    }
     return indices;
 }
 
-bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice const& device) {
+std::vector<uint32_t> VulkanDevice::bufferQueueFamilies() {
+    if (!hasAsyncCompute()) {
+        return {};
+    }
+    return {chosenQueues.graphicsFamily.value(), chosenQueues.computeFamily.value()};
+}
+
+std::set<std::string> VulkanDevice::availableDeviceExtensions(VkPhysicalDevice const& device) {
     uint32_t extensionCount;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
     std::vector<VkExtensionProperties> availableExtensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-    auto ext = getDeviceExtensions();
-    std::set<std::string> requiredExtensions(ext.begin(), ext.end());
-
+    std::set<std::string> names;
     for (const auto &extension: availableExtensions) {
-        requiredExtensions.erase(extension.extensionName);
+        names.insert(extension.extensionName);
     }
+    return names;
+}
 
-    return requiredExtensions.empty();
+bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice const& device) {
+    auto available = availableDeviceExtensions(device);
+    for (const char *extension: getDeviceExtensions(headless)) {
+        if (!available.contains(extension)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void VulkanDevice::initInstance() {
@@ -363,6 +471,7 @@ void VulkanDevice::initDeviceForSurface(VkSurfaceKHR surface) {
     pickPhysicalDevice(surface);
     createLogicalDevice(surface);
     createCommandPool();
+    createPipelineCache();
 
     if (useHWRaytracing) {
         setupRaytracing();
@@ -371,6 +480,8 @@ void VulkanDevice::initDeviceForSurface(VkSurfaceKHR surface) {
 
 void VulkanDevice::destroy()
 {
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
     vkDestroyCommandPool(device, commandPool, nullptr);
     vkDestroyDevice(device, nullptr);
     if (enableValidationLayers) {
@@ -548,14 +659,66 @@ void VulkanDevice::createCommandPool() {
     VK_CHECK_RESULT(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool))
 }
 
+void VulkanDevice::createPipelineCache() {
+    std::vector<char> data;
+    if (fileExists(PIPELINE_CACHE_FILE)) {
+        data = readFile(PIPELINE_CACHE_FILE);
+
+        // Drivers should reject data of other devices themselves, but not all of them check it carefully.
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        VkPipelineCacheHeaderVersionOne header{};
+        if (data.size() >= sizeof(header)) {
+            std::memcpy(&header, data.data(), sizeof(header));
+        }
+        if (data.size() < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+            std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            std::cout << "[pipelines] Ignoring " << PIPELINE_CACHE_FILE << " of a different device or driver"
+                      << std::endl;
+            data.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.data();
+    VK_CHECK_RESULT(vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache))
+}
+
+void VulkanDevice::savePipelineCache() {
+    size_t size = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr))
+    std::vector<char> data(size);
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, data.data()))
+    data.resize(size);
+
+    std::ofstream file(PIPELINE_CACHE_FILE, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "[pipelines] WARN: Could not write cache file " << PIPELINE_CACHE_FILE << std::endl;
+        return;
+    }
+    file.write(data.data(), (std::streamsize) data.size());
+}
+
 VkDescriptorSetLayout VulkanDevice::createDescriptorSetLayout(
-    const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+    const std::vector<VkDescriptorBindingFlags>& bindingFlags)
 {
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = bindings.size();
     layoutInfo.pBindings = bindings.data();
 
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flagsInfo.bindingCount = bindingFlags.size();
+    flagsInfo.pBindingFlags = bindingFlags.data();
+    if (!bindingFlags.empty()) {
+        layoutInfo.pNext = &flagsInfo;
+    }
+
     VkDescriptorSetLayout layout;
     VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout));
     return layout;
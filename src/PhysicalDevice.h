@@ -9,6 +9,8 @@
 #include <vulkan/vulkan.h>
 #include <vector>
 #include <optional>
+#include <set>
+#include <string>
 
 extern bool crashOnValidationWarning;
 
@@ -21,6 +23,17 @@ class VulkanDevice
   public:
     VkInstance instance;
 
+    // Render without a window: no surface or swapchain extensions are used, initDeviceForSurface gets
+    // VK_NULL_HANDLE. Has to be set before initInstance.
+    bool headless = false;
+
+    // VK_KHR_present_id and VK_KHR_present_wait are enabled, known after initDeviceForSurface
+    bool supportsPresentWait = false;
+
+    // Create a queue of a compute-only family if the device has one, see AsyncCompute. Has to be set before
+    // initDeviceForSurface.
+    bool allowAsyncCompute = true;
+
     void initInstance();
     void initDeviceForSurface(VkSurfaceKHR surface);
 
@@ -31,10 +44,22 @@ class VulkanDevice
 
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    // Queue of chosenQueues.computeFamily, VK_NULL_HANDLE if there is none or it is not used
+    VkQueue computeQueue{VK_NULL_HANDLE};
+
+    bool hasAsyncCompute() {
+        return computeQueue != VK_NULL_HANDLE;
+    }
+
+    // Queue families which use buffers, buffers are shared between them instead of transferring their ownership.
+    std::vector<uint32_t> bufferQueueFamilies();
 
     // Command pool on the graphics queue
     VkCommandPool commandPool;
 
+    // Used for all pipelines, loaded from disk at startup and saved again in destroy()
+    VkPipelineCache pipelineCache{VK_NULL_HANDLE};
+
     // Allow implicit conversion to a VkDevice, makes our life much easier
     operator VkDevice() {
         return device;
@@ -43,6 +68,8 @@ class VulkanDevice
     struct QueueFamilyIndices {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // A family with compute but without graphics support, whose queues usually run next to the graphics queue
+        std::optional<uint32_t> computeFamily;
 
         bool isComplete() {
             return graphicsFamily.has_value() && presentFamily.has_value();
@@ -72,8 +99,10 @@ class VulkanDevice
         VkImageLayout oldLayout, VkImageLayout newLayout, VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT);
 
     // Helper functions
+    // bindingFlags is either empty or has one entry per binding
     VkDescriptorSetLayout createDescriptorSetLayout(
-        const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+        const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+        const std::vector<VkDescriptorBindingFlags>& bindingFlags = {});
     void writeDescriptorSets(const std::vector<VkWriteDescriptorSet>& sets);
 
     uint64_t getBufferDeviceAddress(VkBuffer buffer);
@@ -86,6 +115,8 @@ class VulkanDevice
     PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
     PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR;
     PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
+    // Only loaded if supportsPresentWait
+    PFN_vkWaitForPresentKHR vkWaitForPresentKHR{nullptr};
 
     void setupRaytracing();
 
@@ -104,7 +135,10 @@ class VulkanDevice
     void createInstance();
 
     void createCommandPool();
+    void createPipelineCache();
+    void savePipelineCache();
 
+    static std::set<std::string> availableDeviceExtensions(VkPhysicalDevice const& device);
     bool checkDeviceExtensionSupport(VkPhysicalDevice const& device);
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
 
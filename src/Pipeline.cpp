@@ -2,7 +2,9 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #include "Pipeline.h"
+#include "ShaderCompiler.h"
 #include "VulkanHelper.h"
+#include <mutex>
 #include <shaderc/shaderc.h>
 #include <vulkan/vulkan_core.h>
 
@@ -38,6 +40,17 @@ static shaderc_shader_kind getShadercType(VkShaderStageFlagBits stageType) {
     }
 }
 
+static std::vector<char> loadShaderCode(const ShaderSource &source, bool recompile) {
+    auto [code, message] = ShaderCompiler::getShaderCode(source.second, getShadercType(source.first), recompile);
+    if (!message.empty()) {
+        std::lock_guard<std::mutex> lock(GraphicsPipeline::errorsMutex);
+        GraphicsPipeline::errorsFromShaderCompilation.emplace_back(source.second, message);
+        std::cout << "Error while compiling shader " << source.second << ":" << std::endl;
+        std::cout << message << std::endl;
+    }
+    return code;
+}
+
 static VkShaderModule createShaderModule(VulkanDevice *device, std::vector<char> code) {
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -48,20 +61,41 @@ static VkShaderModule createShaderModule(VulkanDevice *device, std::vector<char>
     return shaderModule;
 }
 
+struct SpecializationData {
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint32_t> values;
+    VkSpecializationInfo info{};
+
+    explicit SpecializationData(const SpecializationConstants& constants) {
+        for (auto& [id, value] : constants) {
+            entries.push_back(VkSpecializationMapEntry{
+                .constantID = id,
+                .offset = static_cast<uint32_t>(values.size() * sizeof(uint32_t)),
+                .size = sizeof(uint32_t),
+            });
+            values.push_back(value);
+        }
+
+        info.mapEntryCount = entries.size();
+        info.pMapEntries = entries.data();
+        info.dataSize = values.size() * sizeof(uint32_t);
+        info.pData = values.data();
+    }
+
+    const VkSpecializationInfo* get() const {
+        return entries.empty() ? nullptr : &info;
+    }
+};
+
 GraphicsPipeline::GraphicsPipeline(VulkanDevice* device, VkRenderPass renderPass, int subpassId,
     const PipelineParameters& params) {
 
     std::vector<VkPipelineShaderStageCreateInfo> stages;
     std::vector<VkShaderModule> shaderModules;
+    SpecializationData specialization{params.specializationConstants};
 
     for (auto& [type, shaderFile] : params.shadersList) {
-        auto [code, message] = getShaderCode(shaderFile, getShadercType(type), params.recompileShaders);
-        if (!message.empty()) {
-            this->errorsFromShaderCompilation.emplace_back(shaderFile, message);
-            std::cout << "Error while compiling shader " << shaderFile << ":" << std::endl;
-            std::cout << message << std::endl;
-        }
-
+        auto code = loadShaderCode({type, shaderFile}, params.recompileShaders);
         VkShaderModule module = createShaderModule(device, code);
         shaderModules.push_back(module);
 
@@ -70,6 +104,7 @@ GraphicsPipeline::GraphicsPipeline(VulkanDevice* device, VkRenderPass renderPass
         shaderStageInfo.stage = type;
         shaderStageInfo.module = module;
         shaderStageInfo.pName = "main";
+        shaderStageInfo.pSpecializationInfo = specialization.get();
         stages.push_back(shaderStageInfo);
     }
 
@@ -95,18 +130,7 @@ GraphicsPipeline::GraphicsPipeline(VulkanDevice* device, VkRenderPass renderPass
     inputAssembly.topology = params.topology;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float) params.extent.width;
-    viewport.height = (float) params.extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = params.extent;
-
+    // Viewport and scissor are dynamic, so the pipeline does not depend on the size of the targets.
     VkPipelineViewportStateCreateInfo viewportState{};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
@@ -194,7 +218,7 @@ GraphicsPipeline::GraphicsPipeline(VulkanDevice* device, VkRenderPass renderPass
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(*device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(*device, device->pipelineCache, 1, &pipelineInfo, nullptr, &pipeline));
     for (auto& module : shaderModules) {
         vkDestroyShaderModule(*device, module, nullptr);
     }
@@ -203,6 +227,7 @@ GraphicsPipeline::GraphicsPipeline(VulkanDevice* device, VkRenderPass renderPass
 }
 
 std::vector<std::pair<std::string, std::string>> GraphicsPipeline::errorsFromShaderCompilation;
+std::mutex GraphicsPipeline::errorsMutex;
 
 GraphicsPipeline::~GraphicsPipeline() {
     vkDestroyPipeline(*device, pipeline, nullptr);
@@ -213,14 +238,9 @@ ComputePipeline::ComputePipeline(VulkanDevice* device, const Parameters& params)
 {
     this->device = device;
 
-    auto [code, message] = getShaderCode(params.source.second, getShadercType(params.source.first), params.recompileShaders);
-    if (!message.empty()) {
-        GraphicsPipeline::errorsFromShaderCompilation.emplace_back(params.source.second, message);
-        std::cout << "Error while compiling shader " << params.source.second << ":" << std::endl;
-        std::cout << message << std::endl;
-    }
-
+    auto code = loadShaderCode(params.source, params.recompileShaders);
     VkShaderModule module = createShaderModule(device, code);
+    SpecializationData specialization{params.specializationConstants};
 
     VkComputePipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -228,6 +248,7 @@ ComputePipeline::ComputePipeline(VulkanDevice* device, const Parameters& params)
     pipelineInfo.stage.stage = params.source.first;
     pipelineInfo.stage.module = module;
     pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.pSpecializationInfo = specialization.get();
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -241,7 +262,7 @@ ComputePipeline::ComputePipeline(VulkanDevice* device, const Parameters& params)
     }
 
     pipelineInfo.layout = layout;
-    if (vkCreateComputePipelines(*device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    if (vkCreateComputePipelines(*device, device->pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create compute pipeline!");
     }
 
@@ -253,3 +274,33 @@ ComputePipeline::~ComputePipeline()
     vkDestroyPipeline(*device, pipeline, nullptr);
     vkDestroyPipelineLayout(*device, layout, nullptr);
 }
+
+ComputePipelineVariants::ComputePipelineVariants(VulkanDevice* device, const ComputePipeline::Parameters& params)
+{
+    this->device = device;
+    this->params = params;
+}
+
+ComputePipeline& ComputePipelineVariants::get(const SpecializationConstants& constants)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& variant = variants[constants];
+    if (!variant) {
+        auto variantParams = params;
+        for (auto& [id, value] : constants) {
+            variantParams.specializationConstants[id] = value;
+        }
+        variant = std::make_unique<ComputePipeline>(device, variantParams);
+    }
+    return *variant;
+}
+
+std::vector<SpecializationConstants> ComputePipelineVariants::getVariants()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<SpecializationConstants> result;
+    for (auto& [constants, _] : variants) {
+        result.push_back(constants);
+    }
+    return result;
+}
@@ -5,7 +5,11 @@
 #define PIPELINE_H
 
 #include "PhysicalDevice.h"
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <vulkan/vulkan_core.h>
 
 /**
@@ -27,13 +31,15 @@ struct RequiredDescriptors {
 using ShaderSource = std::pair<VkShaderStageFlagBits, std::string>;
 using ShaderList = std::vector<ShaderSource>;
 
+// Values of specialization constants: constant_id -> 32-bit value (booleans are 0 or 1).
+using SpecializationConstants = std::map<uint32_t, uint32_t>;
+
 struct PipelineParameters {
     ShaderList shadersList;
     bool recompileShaders = false;
     VkPrimitiveTopology topology;
 
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
-    VkExtent2D extent;
 
     std::vector<VkVertexInputAttributeDescription> vertexAttributeDescription;
     std::vector<VkVertexInputBindingDescription> vertexInputDescription;
@@ -44,6 +50,9 @@ struct PipelineParameters {
     std::vector<VkPushConstantRange> pushConstants;
     bool backFaceCulling = true;
     bool isButterfly;
+
+    // Applied to all shader stages, unused ids are ignored.
+    SpecializationConstants specializationConstants;
 };
 
 class GraphicsPipeline {
@@ -52,6 +61,8 @@ class GraphicsPipeline {
     ~GraphicsPipeline();
 
     static std::vector<std::pair<std::string, std::string>> errorsFromShaderCompilation;
+    // Pipelines are created on several threads, also while a frame reads the errors.
+    static std::mutex errorsMutex;
 
     VkPipeline pipeline;
     VkPipelineLayout layout;
@@ -67,6 +78,7 @@ class ComputePipeline {
         std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
         std::vector<VkPushConstantRange> pushConstantRanges;
         bool recompileShaders = false;
+        SpecializationConstants specializationConstants;
     };
 
     ComputePipeline(VulkanDevice* device, const Parameters& params);
@@ -79,4 +91,26 @@ class ComputePipeline {
     VulkanDevice *device;
 };
 
+/**
+ * Permutations of a compute pipeline which only differ in some specialization constants, e.g. sample counts chosen
+ * at runtime. Each variant is created on first use and kept until the whole set is destroyed.
+ */
+class ComputePipelineVariants {
+  public:
+    ComputePipelineVariants(VulkanDevice* device, const ComputePipeline::Parameters& params);
+
+    // The variant with the given constants in addition to those of params. May be called from several threads.
+    ComputePipeline& get(const SpecializationConstants& constants);
+
+    // Constants of all variants created so far.
+    std::vector<SpecializationConstants> getVariants();
+
+  private:
+    VulkanDevice *device;
+    ComputePipeline::Parameters params;
+
+    std::mutex mutex;
+    std::map<SpecializationConstants, std::unique_ptr<ComputePipeline>> variants;
+};
+
 #endif /* end of include guard: PIPELINE_H */
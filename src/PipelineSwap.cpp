@@ -0,0 +1,23 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "PipelineSwap.h"
+
+void PipelineSwap::onApply(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    callbacks.push_back(std::move(callback));
+}
+
+std::vector<std::shared_ptr<void>> PipelineSwap::apply() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::shared_ptr<void>> replaced;
+    for (auto &replace: replacements) {
+        replaced.push_back(replace());
+    }
+    for (auto &callback: callbacks) {
+        callback();
+    }
+    replacements.clear();
+    callbacks.clear();
+    return replaced;
+}
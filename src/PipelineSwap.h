@@ -0,0 +1,45 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_PIPELINESWAP_H
+#define JUNGLE_PIPELINESWAP_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Pipelines created away from the render thread, which are assigned to the members of their owners later.
+ *
+ * Shader reloads create all pipelines on a background thread while the frames in flight keep using the old ones,
+ * the new pipelines are then installed with apply() at the start of a frame. The replaced values are handed back to
+ * the caller, which has to keep them alive until all frames recorded with them have finished on the GPU.
+ */
+class PipelineSwap {
+  public:
+    // Assign value to target once apply() is called. May be called from several threads.
+    template <typename T>
+    void replace(T &target, std::type_identity_t<T> value) {
+        auto staged = std::make_shared<T>(std::move(value));
+        std::lock_guard<std::mutex> lock(mutex);
+        replacements.push_back([&target, staged]() -> std::shared_ptr<void> {
+            std::swap(target, *staged);
+            return staged;
+        });
+    }
+
+    // Called after all values have been assigned, e.g. to invalidate command buffers using the old pipelines.
+    void onApply(std::function<void()> callback);
+
+    // Assign all staged values, returns the replaced ones.
+    std::vector<std::shared_ptr<void>> apply();
+
+  private:
+    std::mutex mutex;
+    std::vector<std::function<std::shared_ptr<void>()>> replacements;
+    std::vector<std::function<void()>> callbacks;
+};
+
+#endif //JUNGLE_PIPELINESWAP_H
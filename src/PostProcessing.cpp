@@ -5,14 +5,17 @@
 #include "Pipeline.h"
 #include "Tonemap.h"
 #include "Swapchain.h"
+#include <optional>
 #include <vulkan/vulkan_core.h>
 
-PostProcessing::PostProcessing(VulkanDevice *device, Swapchain *swapChain) :
+PostProcessing::PostProcessing(VulkanDevice *device, Swapchain *swapChain, RenderGraph *renderGraph,
+                               RenderGraph::Image source) :
         tonemap(Tonemap(device, swapChain)),
         taa(TAA(device, swapChain)),
         fog(GlobalFog(device, swapChain)),
         device(device),
-        swapchain(swapChain) {
+        swapchain(swapChain),
+        renderGraph(renderGraph) {
 
     // Generate a list of steps
     this->steps.push_back({
@@ -22,6 +25,7 @@ PostProcessing::PostProcessing(VulkanDevice *device, Swapchain *swapChain) :
     this->steps.push_back({
         .algorithm = &taa,
         .useRenderSize = false,
+        .keepsHistory = true,
     });
 
     this->steps.push_back({
@@ -31,20 +35,39 @@ PostProcessing::PostProcessing(VulkanDevice *device, Swapchain *swapChain) :
 
     // Set target now, otherwise the vector might move the target to another address if it has to grow
     for (auto& step : steps) {
-        if (step.algorithm == &taa) taa.setPTarget(&step.target);
+        if (step.algorithm == &taa) taa.setPTarget(&step.historyTarget);
     }
 
+    // Every step samples the target of the step before it, the history targets are not part of the render graph
+    std::optional<RenderGraph::Image> input = source;
     for (auto& step : steps) {
-        if (step.isFinal) continue;
-        step.target.init(device, MAX_FRAMES_IN_FLIGHT);
-        step.target.addAttachment(step.getTargetSize(swapchain), POST_PROCESSING_FORMAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+        std::vector<std::pair<RenderGraph::Image, ImageAccess>> accesses;
+        if (input.has_value()) {
+            accesses.push_back({*input, ImageAccess::fragmentRead()});
+        }
+        input.reset();
+
+        if (step.keepsHistory) {
+            step.target = &step.historyTarget;
+            step.target->init(device, Swapchain::framesInFlight);
+            step.target->addAttachment(step.getTargetSize(swapchain), POST_PROCESSING_FORMAT,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+        } else if (!step.isFinal) {
+            input = renderGraph->addTransient(step.algorithm->getShaderName(), POST_PROCESSING_FORMAT,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                step.useRenderSize ? RenderGraph::RenderSize : RenderGraph::FinalBufferSize);
+            step.target = renderGraph->target(*input);
+            accesses.push_back({*input, ImageAccess::colorAttachment(VK_IMAGE_LAYOUT_UNDEFINED)});
+        }
+        step.pass = renderGraph->addPass(step.algorithm->getShaderName(), accesses);
     }
+
+    cachedSteps = std::make_unique<CommandBufferCache>(device, swapChain);
 }
 
 PostProcessing::~PostProcessing() {
     for (auto& step : steps) {
-        step.target.destroyAll();
+        step.historyTarget.destroyAll();
     }
 }
 
@@ -52,22 +75,57 @@ void PostProcessing::setupRenderStages(bool recompileShaders) {
     for (auto& step : steps) {
         step.algorithm->setupRenderStage(recompileShaders);
         if (!step.isFinal) {
-            step.target.createFramebuffers(step.algorithm->getRenderPass(), step.getTargetSize(swapchain));
+            step.target->createFramebuffers(step.algorithm->getRenderPass(), step.getTargetSize(swapchain));
         }
     }
 }
 
 void PostProcessing::createPipeline(bool recompileShaders) {
+    PipelineSwap swap;
+    createPipeline(recompileShaders, swap);
+    swap.apply();
+}
+
+void PostProcessing::createPipeline(bool recompileShaders, PipelineSwap &swap) {
     for (auto& step : steps) {
-        step.algorithm->createPipeline(recompileShaders);
+        step.algorithm->createPipeline(recompileShaders, swap);
     }
+    swap.onApply([this]() {
+        cachedSteps->invalidate();
+    });
 }
 
-void PostProcessing::recordCommandBuffer(VkCommandBuffer commandBuffer, VkFramebuffer finalTarget) {
+RecordingJob PostProcessing::stepsJob() {
+    return {
+        .record = [this](VkCommandBuffer commandBuffer) {
+            for (auto& step : steps) {
+                if (!step.isFinal) {
+                    auto rpass = step.algorithm->getRenderPass();
+                    auto section = step.algorithm->getShaderName() + ".frag";
+                    renderGraph->recordBarriers(commandBuffer, step.pass);
+                    profiler->begin(commandBuffer, section);
+                    step.algorithm->recordCommandBuffer(commandBuffer,
+                        step.target->framebuffers[rpass][swapchain->currentFrame], false);
+                    profiler->end(commandBuffer, section);
+                }
+            }
+        },
+        .cache = cachedSteps.get(),
+    };
+}
+
+void PostProcessing::recordCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBuffer stepCommands,
+                                         VkFramebuffer finalTarget) {
+    vkCmdExecuteCommands(commandBuffer, 1, &stepCommands);
     for (auto& step : steps) {
-        auto rpass = step.algorithm->getRenderPass();
-        step.algorithm->recordCommandBuffer(commandBuffer,
-            step.isFinal ? finalTarget : step.target.framebuffers[rpass][swapchain->currentFrame], step.isFinal);
+        if (step.isFinal) {
+            // Includes rendering ImGui
+            auto section = step.algorithm->getShaderName() + ".frag";
+            renderGraph->recordBarriers(commandBuffer, step.pass);
+            profiler->begin(commandBuffer, section);
+            step.algorithm->recordCommandBuffer(commandBuffer, finalTarget, true);
+            profiler->end(commandBuffer, section);
+        }
     }
 }
 
@@ -85,9 +143,10 @@ void PostProcessing::updateBuffers() {
 
 void PostProcessing::createDescriptorSets(VkDescriptorPool pool, const RenderTarget &sourceBuffer,
                                           const RenderTarget &gBuffer) {
+    cachedSteps->invalidate();
     for (size_t i = 0; i < steps.size(); i++) {
         steps[i].algorithm->createDescriptorSets(pool,
-            i == 0 ? sourceBuffer : steps[i - 1].target, gBuffer);
+            i == 0 ? sourceBuffer : *steps[i - 1].target, gBuffer);
     }
 }
 
@@ -103,21 +162,29 @@ RequiredDescriptors PostProcessing::getNumDescriptors() {
 }
 
 void PostProcessing::handleResize(const RenderTarget &sourceBuffer, const RenderTarget &gBuffer) {
+    cachedSteps->invalidate();
     for (size_t i = 0; i < steps.size(); i++) {
-        if (!steps[i].isFinal) {
-            steps[i].target.destroyAll();
-            steps[i].target.init(device, MAX_FRAMES_IN_FLIGHT);
-            steps[i].target.addAttachment(steps[i].getTargetSize(swapchain), POST_PROCESSING_FORMAT,
+        // The transient targets were recreated by the render graph already
+        if (steps[i].keepsHistory) {
+            steps[i].target->destroyAll();
+            steps[i].target->init(device, Swapchain::framesInFlight);
+            steps[i].target->addAttachment(steps[i].getTargetSize(swapchain), POST_PROCESSING_FORMAT,
                 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
                 VK_IMAGE_ASPECT_COLOR_BIT);
-            steps[i].target.createFramebuffers(steps[i].algorithm->getRenderPass(),
+        }
+        if (!steps[i].isFinal) {
+            steps[i].target->createFramebuffers(steps[i].algorithm->getRenderPass(),
                 steps[i].getTargetSize(swapchain));
         }
 
-        steps[i].algorithm->handleResize(i == 0 ? sourceBuffer : steps[i - 1].target, gBuffer);
+        steps[i].algorithm->handleResize(i == 0 ? sourceBuffer : *steps[i - 1].target, gBuffer);
     }
 }
 
+void PostProcessing::handleRenderScaleChange() {
+    cachedSteps->invalidate();
+}
+
 void PostProcessing::enable() {
     for (auto& step : steps) {
         step.algorithm->enable();
@@ -11,31 +11,45 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include "Pipeline.h"
+#include "PipelineSwap.h"
 #include "Tonemap.h"
 #include "TAA.h"
 #include "GlobalFog.h"
+#include "CommandBufferCache.h"
+#include "CommandRecorder.h"
+#include "GpuProfiler.h"
+#include "RenderGraph.h"
 
 /**
  * A helper class which manages PostProcessingping-related resources
  */
 class PostProcessing {
 public:
-    PostProcessing(VulkanDevice *device, Swapchain *swapChain);
+    // Declares the targets and passes of the steps, the first step samples the source image.
+    PostProcessing(VulkanDevice *device, Swapchain *swapChain, RenderGraph *renderGraph, RenderGraph::Image source);
 
     ~PostProcessing();
 
     // Will also destroy any old pipeline which exists
     void createPipeline(bool recompileShaders);
+    void createPipeline(bool recompileShaders, PipelineSwap &swap);
 
     std::vector<VkDescriptorSet> PostProcessingDescriptorSets;
     std::vector<VkSampler> PostProcessingSamplers;
 
     void setupRenderStages(bool recompileShaders);
 
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, VkFramebuffer_T *finalTarget);
+    // All steps except the final one, which targets the swapchain image and renders ImGui
+    RecordingJob stepsJob();
+
+    // Execute the commands of stepsJob and record the final step.
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, VkCommandBuffer stepCommands, VkFramebuffer finalTarget);
 
     void handleResize(const RenderTarget &sourceBuffer, const RenderTarget &gBuffer);
 
+    // The steps at render resolution record the viewport of Swapchain::activeRenderSize.
+    void handleRenderScaleChange();
+
     void setupBuffers();
 
     void updateBuffers();
@@ -61,6 +75,9 @@ public:
         return tonemap.getRenderPass();
     }
 
+    // Times every step, set by the owner before the first frame is recorded
+    GpuProfiler *profiler = nullptr;
+
     void enable();
 
     void disable();
@@ -68,6 +85,7 @@ public:
 private:
     VulkanDevice *device;
     Swapchain *swapchain;
+    RenderGraph *renderGraph;
 
     GlobalFog fog;
     Tonemap tonemap;
@@ -75,9 +93,14 @@ private:
 
     struct StepInfo {
         PostProcessingStepBase *algorithm;
-        RenderTarget target = {};
+        // Either historyTarget or a transient target of the render graph, none for the final step
+        RenderTarget *target = nullptr;
+        // Target with an image per frame in flight, for steps which read their output of the previous frame
+        RenderTarget historyTarget = {};
         bool useRenderSize = true;
         bool isFinal = false;
+        bool keepsHistory = false;
+        RenderGraph::Pass pass;
 
         VkExtent2D getTargetSize(Swapchain *swapchain) {
             return useRenderSize ? swapchain->renderSize() : swapchain->finalBufferSize;
@@ -85,6 +108,7 @@ private:
     };
 
     std::vector<StepInfo> steps;
+    std::unique_ptr<CommandBufferCache> cachedSteps;
 };
 
 #endif /* end of include guard: POSTPROCESSING_H */
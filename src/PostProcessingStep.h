@@ -15,6 +15,7 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include "Pipeline.h"
+#include "PipelineSwap.h"
 #include "VulkanHelper.h"
 #include <memory>
 #include "GBufferDescription.h"
@@ -51,11 +52,17 @@ public:
     };
 
     VkExtent2D getViewport() {
-        return (flags & PPSTEP_RENDER_FULL_RES) ? swapchain->finalBufferSize : swapchain->renderSize();
+        return (flags & PPSTEP_RENDER_FULL_RES) ? swapchain->finalBufferSize : swapchain->activeRenderSize();
     }
 
     // Will also destroy any old pipeline which exists
     void createPipeline(bool recompileShaders) {
+        PipelineSwap swap;
+        createPipeline(recompileShaders, swap);
+        swap.apply();
+    };
+
+    void createPipeline(bool recompileShaders, PipelineSwap &swap) {
         PipelineParameters params;
 
         params.shadersList = {
@@ -69,7 +76,6 @@ public:
         params.vertexAttributeDescription = {};
         params.vertexInputDescription = {};
         params.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        params.extent = getViewport();
 
         // One color attachment, no blending enabled for it
         params.blending = {{}};
@@ -77,7 +83,7 @@ public:
         params.pushConstants = getPushConstantRanges();
 
         params.descriptorSetLayouts = {descriptorSetLayout};
-        this->pipeline = std::make_unique<GraphicsPipeline>(device, renderPass, 0, params);
+        swap.replace(pipeline, std::make_unique<GraphicsPipeline>(device, renderPass, 0, params));
     };
 
     virtual std::vector<VkPushConstantRange> getPushConstantRanges() {
@@ -93,7 +99,7 @@ public:
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = (flags & PPSTEP_RENDER_LAST) ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+        colorAttachment.finalLayout = (flags & PPSTEP_RENDER_LAST) ? swapchain->finalLayout()
                                                   : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
         VkAttachmentReference colorAttachmentRef{};
@@ -144,8 +150,8 @@ public:
             swapchain->createFramebuffersForRender(renderPass);
         }
 
-        samplers.resize(MAX_FRAMES_IN_FLIGHT);
-        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        samplers.resize(Swapchain::framesInFlight);
+        for (int i = 0; i < Swapchain::framesInFlight; i++) {
             samplers[i].resize(GBufferTarget::NumAttachments + 1 + getAdditionalSamplersCount());
             for (int j = 0; j < GBufferTarget::NumAttachments + 1 + getAdditionalSamplersCount(); j++) {
                 samplers[i][j] = VulkanHelper::createSampler(device, false);
@@ -239,9 +245,9 @@ public:
 
     };
 
+    // The pipeline does not depend on the size, the viewport is set when recording.
     virtual void handleResize(const RenderTarget &sourceBuffer, const RenderTarget &gBuffer) {
         updateSamplerBindings(sourceBuffer, gBuffer);
-        createPipeline(false);
     };
 
     virtual void
@@ -250,7 +256,7 @@ public:
                           const RenderTarget &sourceBuffer) {}
 
     void updateSamplerBindings(const RenderTarget &sourceBuffer, const RenderTarget &gBuffer) {
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
             VkDescriptorImageInfo imageInfo{};
             imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
             imageInfo.imageView = sourceBuffer.imageViews[i].at(0);
@@ -316,14 +322,14 @@ public:
         const RenderTarget &gBuffer)
     {
         descriptorSets = VulkanHelper::createDescriptorSetsFromLayout(
-            *device, pool, descriptorSetLayout, MAX_FRAMES_IN_FLIGHT);
+            *device, pool, descriptorSetLayout, Swapchain::framesInFlight);
         updateSamplerBindings(sourceBuffer, gBuffer);
     };
 
     virtual RequiredDescriptors getNumDescriptors() {
         return {
-                .requireUniformBuffers = MAX_FRAMES_IN_FLIGHT,
-                .requireSamplers = MAX_FRAMES_IN_FLIGHT *
+                .requireUniformBuffers = Swapchain::framesInFlight,
+                .requireSamplers = Swapchain::framesInFlight *
                                    (1 + GBufferTarget::NumAttachments + getAdditionalSamplersCount()),
         };
     };
@@ -333,10 +339,11 @@ public:
 
     virtual void setupBuffers() = 0;
     virtual void updateBuffers() = 0;
-protected:
-    virtual void updateUBOContent() {};
 
+    // Name of the fragment shader, also used to name the step in profiles
     virtual std::string getShaderName() = 0;
+protected:
+    virtual void updateUBOContent() {};
 
     std::vector<std::vector<VkSampler>> samplers;
     std::vector<VkDescriptorSet> descriptorSets;
@@ -362,7 +369,7 @@ class PostProcessingStep : public PostProcessingStepBase {
 
     UBOType ubo{};
     void setupBuffers() override {
-        uniformBuffer.allocate(device, sizeof(UBOType), MAX_FRAMES_IN_FLIGHT);
+        uniformBuffer.allocate(device, sizeof(UBOType), Swapchain::framesInFlight);
     };
 
     void updateBuffers() override {
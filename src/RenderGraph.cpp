@@ -0,0 +1,357 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "RenderGraph.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "VulkanHelper.h"
+
+static constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+ImageAccess ImageAccess::computeRead() {
+    return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+ImageAccess ImageAccess::computeWrite() {
+    return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, true};
+}
+
+ImageAccess ImageAccess::fragmentRead() {
+    return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+ImageAccess ImageAccess::colorAttachment(VkImageLayout initialLayout) {
+    return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            initialLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, initialLayout == VK_IMAGE_LAYOUT_UNDEFINED};
+}
+
+VkImage RenderGraph::ImageInfo::imageOfFrame(uint32_t frame) const {
+    return transient ? image : importedTarget->images[frame][attachment];
+}
+
+RenderGraph::RenderGraph(VulkanDevice *device, Swapchain *swapchain) : device(device), swapchain(swapchain) {
+    VkPhysicalDeviceMemoryProperties properties;
+    vkGetPhysicalDeviceMemoryProperties(device->physicalDevice, &properties);
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        if (properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+            deviceLocalTypes |= 1u << i;
+        }
+    }
+}
+
+RenderGraph::~RenderGraph() {
+    destroyTransients();
+}
+
+RenderGraph::Image RenderGraph::addTransient(const std::string &name, VkFormat format, VkImageUsageFlags usage,
+                                             Size size) {
+    images.push_back({
+        .name = name,
+        .transient = true,
+        .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+        .format = format,
+        .usage = usage,
+        .size = size,
+        .target = std::make_unique<RenderTarget>(),
+    });
+    return images.size() - 1;
+}
+
+RenderGraph::Image RenderGraph::import(const std::string &name, const RenderTarget *target, uint32_t attachment,
+                                       VkImageAspectFlags aspect, ImageAccess before) {
+    images.push_back({
+        .name = name,
+        .transient = false,
+        .aspect = aspect,
+        .importedTarget = target,
+        .attachment = attachment,
+        .before = before,
+    });
+    return images.size() - 1;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string &name,
+                                       const std::vector<std::pair<Image, ImageAccess>> &accesses) {
+    passes.push_back({
+        .name = name,
+        .accesses = accesses,
+    });
+    return passes.size() - 1;
+}
+
+RenderTarget *RenderGraph::target(Image image) {
+    return images[image].target.get();
+}
+
+void RenderGraph::compile() {
+    destroyTransients();
+
+    for (auto &info : images) {
+        if (!info.transient) {
+            continue;
+        }
+
+        auto extent = info.size == RenderSize ? swapchain->renderSize() : swapchain->finalBufferSize;
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent = {extent.width, extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = info.format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = info.usage;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_CHECK_RESULT(vkCreateImage(*device, &imageInfo, nullptr, &info.image))
+        vkGetImageMemoryRequirements(*device, info.image, &info.requirements);
+    }
+
+    allocateMemory();
+
+    for (auto &info : images) {
+        if (info.transient) {
+            info.target->init(device, Swapchain::framesInFlight);
+            info.target->addAttachment(std::vector<VkImage>(Swapchain::framesInFlight, info.image), info.format,
+                                       info.aspect);
+        }
+    }
+
+    deriveBarriers();
+}
+
+void RenderGraph::destroyTransients() {
+    for (auto &info : images) {
+        if (info.transient) {
+            info.target->destroyAll();
+            vkDestroyImage(*device, info.image, nullptr);
+            info.image = VK_NULL_HANDLE;
+        }
+    }
+
+    for (auto memory : memories) {
+        vkFreeMemory(*device, memory, nullptr);
+    }
+    memories.clear();
+}
+
+void RenderGraph::allocateMemory() {
+    for (auto &info : images) {
+        info.firstPass = passes.size();
+        info.lastPass = 0;
+    }
+    for (Pass pass = 0; pass < passes.size(); pass++) {
+        for (auto &[image, _] : passes[pass].accesses) {
+            images[image].firstPass = std::min(images[image].firstPass, pass);
+            images[image].lastPass = std::max(images[image].lastPass, pass);
+        }
+    }
+
+    std::vector<Image> transients;
+    for (Image image = 0; image < images.size(); image++) {
+        if (!images[image].transient) {
+            continue;
+        }
+        // An unused image is kept apart from all others
+        if (images[image].firstPass > images[image].lastPass) {
+            images[image].firstPass = 0;
+            images[image].lastPass = passes.size();
+        }
+        transients.push_back(image);
+    }
+
+    // Largest first, so that the smaller images are bound to the memory of larger ones
+    std::stable_sort(transients.begin(), transients.end(), [&](Image a, Image b) {
+        return images[a].requirements.size > images[b].requirements.size;
+    });
+
+    struct Allocation {
+        VkDeviceSize size = 0;
+        uint32_t memoryTypeBits = ~0u;
+        std::vector<Image> users;
+    };
+    std::vector<Allocation> allocations;
+
+    for (auto image : transients) {
+        auto &info = images[image];
+        auto overlaps = [&](Image other) {
+            return images[other].firstPass <= info.lastPass && info.firstPass <= images[other].lastPass;
+        };
+        auto fits = [&](const Allocation &allocation) {
+            return (allocation.memoryTypeBits & info.requirements.memoryTypeBits & deviceLocalTypes) != 0 &&
+                   std::none_of(allocation.users.begin(), allocation.users.end(), overlaps);
+        };
+
+        auto allocation = std::find_if(allocations.begin(), allocations.end(), fits);
+        if (allocation == allocations.end()) {
+            allocation = allocations.insert(allocations.end(), Allocation{});
+        }
+        allocation->size = std::max(allocation->size, info.requirements.size);
+        allocation->memoryTypeBits &= info.requirements.memoryTypeBits;
+        allocation->users.push_back(image);
+        info.memory = allocation - allocations.begin();
+    }
+
+    VkDeviceSize allocatedSize = 0;
+    for (auto &allocation : allocations) {
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = allocation.size;
+        allocInfo.memoryTypeIndex = VulkanHelper::findMemoryType(device->physicalDevice, allocation.memoryTypeBits,
+                                                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VkDeviceMemory memory;
+        VK_CHECK_RESULT(vkAllocateMemory(*device, &allocInfo, nullptr, &memory))
+        memories.push_back(memory);
+        allocatedSize += allocation.size;
+    }
+
+    VkDeviceSize separateSize = 0;
+    for (auto image : transients) {
+        auto &info = images[image];
+        VK_CHECK_RESULT(vkBindImageMemory(*device, info.image, memories[info.memory], 0))
+        separateSize += info.requirements.size * Swapchain::framesInFlight;
+    }
+
+    std::cout << "[render graph] " << transients.size() << " transient images in " << allocations.size()
+              << " allocations of " << (allocatedSize >> 20) << " MiB, instead of " << (separateSize >> 20)
+              << " MiB for separate images per frame in flight" << std::endl;
+}
+
+const RenderGraph::ImageInfo &RenderGraph::previousUser(Image image) const {
+    auto &info = images[image];
+    const ImageInfo *before = nullptr;
+    const ImageInfo *last = &info;
+    for (auto &other : images) {
+        if (!other.transient || other.memory != info.memory) {
+            continue;
+        }
+        if (other.lastPass < info.firstPass && (!before || other.lastPass > before->lastPass)) {
+            before = &other;
+        }
+        if (other.lastPass > last->lastPass) {
+            last = &other;
+        }
+    }
+    return before ? *before : *last;
+}
+
+void RenderGraph::deriveBarriers() {
+    // What an access has to wait for
+    struct State {
+        // The last write, or the last layout transition
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        // Reads since then, and the stages the write is visible to
+        VkPipelineStageFlags readStages = 0;
+        VkPipelineStageFlags visibleStages = 0;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        bool used = false;
+    };
+
+    std::vector<State> states(images.size());
+    for (Image image = 0; image < images.size(); image++) {
+        auto &before = images[image].before;
+        if (!images[image].transient) {
+            auto writes = before.access & WRITE_ACCESS;
+            states[image] = {
+                .writeStages = writes ? before.stages : 0,
+                .writeAccess = writes,
+                .readStages = writes ? 0 : before.stages,
+                .layout = before.finalLayout,
+                .used = true,
+            };
+        }
+    }
+
+    for (auto &pass : passes) {
+        pass.srcStages = 0;
+        pass.dstStages = 0;
+        pass.memoryBarrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        pass.imageBarriers.assign(Swapchain::framesInFlight, {});
+
+        for (auto &[image, access] : pass.accesses) {
+            auto &info = images[image];
+            auto &state = states[image];
+            auto writes = access.access & WRITE_ACCESS;
+            bool transition =
+                access.layout != VK_IMAGE_LAYOUT_UNDEFINED && (access.discard || access.layout != state.layout);
+
+            VkPipelineStageFlags srcStages = 0;
+            VkAccessFlags srcAccess = 0;
+            if (!state.used) {
+                if (!access.discard) {
+                    throw std::runtime_error("[render graph] " + info.name + " is read by " + pass.name +
+                                             " before it is written");
+                }
+                // Wait for all accesses to the memory by the image which used it before, possibly this one in the
+                // previous frame
+                auto &previous = previousUser(image);
+                for (auto &other : passes) {
+                    for (auto &[otherImage, otherAccess] : other.accesses) {
+                        if (&images[otherImage] == &previous) {
+                            srcStages |= otherAccess.stages;
+                            srcAccess |= otherAccess.access & WRITE_ACCESS;
+                        }
+                    }
+                }
+            } else if (writes || transition) {
+                srcStages = state.writeStages | state.readStages;
+                srcAccess = state.writeAccess;
+            } else if (access.stages & ~state.visibleStages) {
+                srcStages = state.writeStages;
+                srcAccess = state.writeAccess;
+            }
+
+            if (srcStages || transition) {
+                pass.srcStages |= srcStages ? srcStages : (VkPipelineStageFlags) VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                pass.dstStages |= access.stages;
+                if (transition) {
+                    // The accesses to memory bound to another image are covered by the memory barrier below
+                    for (uint32_t frame = 0; frame < Swapchain::framesInFlight; frame++) {
+                        pass.imageBarriers[frame].push_back(vkutil::createImageBarrier(info.imageOfFrame(frame),
+                            info.aspect, access.discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout, access.layout,
+                            state.used ? srcAccess : 0, access.access));
+                    }
+                }
+                if ((!transition || !state.used) && srcAccess) {
+                    pass.memoryBarrier.srcAccessMask |= srcAccess;
+                    pass.memoryBarrier.dstAccessMask |= access.access;
+                }
+            }
+
+            if (writes || transition || !state.used) {
+                state.writeStages = access.stages;
+                state.writeAccess = writes;
+                state.readStages = writes ? 0 : access.stages;
+                state.visibleStages = access.stages;
+            } else {
+                state.readStages |= access.stages;
+                state.visibleStages |= access.stages;
+            }
+            state.layout = access.finalLayout;
+            state.used = true;
+        }
+    }
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, Pass pass) {
+    auto &info = passes[pass];
+    if (info.srcStages == 0) {
+        return;
+    }
+
+    auto &imageBarriers = info.imageBarriers[swapchain->currentFrame];
+    bool memoryBarrier = info.memoryBarrier.srcAccessMask != 0;
+    vkCmdPipelineBarrier(commandBuffer, info.srcStages, info.dstStages, 0,
+        memoryBarrier ? 1 : 0, &info.memoryBarrier,
+        0, nullptr,
+        imageBarriers.size(), imageBarriers.data());
+}
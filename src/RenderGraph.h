@@ -0,0 +1,144 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_RENDERGRAPH_H
+#define JUNGLE_RENDERGRAPH_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "PhysicalDevice.h"
+#include "Swapchain.h"
+
+// How a pass uses an image
+struct ImageAccess {
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    // Layout the image has to be in when the pass starts. UNDEFINED if the pass transitions it itself, like a render
+    // pass whose attachment has an initialLayout of UNDEFINED.
+    VkImageLayout layout;
+    // Layout the pass leaves the image in
+    VkImageLayout finalLayout;
+    // The previous contents are not needed, the image is completely overwritten
+    bool discard = false;
+
+    static ImageAccess computeRead();
+    static ImageAccess computeWrite();
+    static ImageAccess fragmentRead();
+    // Color attachment of a render pass with the given initialLayout, the render passes all end in
+    // SHADER_READ_ONLY_OPTIMAL.
+    static ImageAccess colorAttachment(VkImageLayout initialLayout);
+};
+
+/**
+ * Derives the barriers between the passes of a frame and manages the memory of the images only used within a frame.
+ *
+ * Passes declare which images they read and write, in the order they are recorded, and record the barriers derived
+ * for them right before their commands. A barrier is only placed where an access depends on an earlier one, i.e.
+ * after a write, before overwriting what was read, or for a layout transition, and all barriers before the same pass
+ * are merged into one.
+ *
+ * Transient images are written before they are read in every frame, so a single image serves all frames in flight.
+ * Transient images whose passes do not overlap are bound to the same memory, the first pass using one waits for the
+ * last pass which used the memory before, possibly in the previous frame. Imported images are the attachments of a
+ * render target with an image per frame in flight, they are only synchronized.
+ *
+ * The barriers of every pass have to be recorded in every frame, also if the pass skips its work, so that the layouts
+ * the later passes expect are always reached.
+ */
+class RenderGraph {
+  public:
+    using Image = uint32_t;
+    using Pass = uint32_t;
+
+    enum Size {
+        RenderSize,
+        FinalBufferSize,
+    };
+
+    RenderGraph(VulkanDevice *device, Swapchain *swapchain);
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph &operator=(const RenderGraph &) = delete;
+
+    // Declare a transient color image. Its target is filled by compile, with an image view per frame in flight which
+    // all show the same image.
+    Image addTransient(const std::string &name, VkFormat format, VkImageUsageFlags usage, Size size = RenderSize);
+
+    // Declare an attachment of a target which is created and resized by its owner. `before` is the last access to it
+    // in a frame before the first pass of the graph.
+    Image import(const std::string &name, const RenderTarget *target, uint32_t attachment,
+                 VkImageAspectFlags aspect, ImageAccess before);
+
+    // Passes run in the order they are added.
+    Pass addPass(const std::string &name, const std::vector<std::pair<Image, ImageAccess>> &accesses);
+
+    // Target of a transient image, it stays the same object but only has images after compile.
+    RenderTarget *target(Image image);
+
+    // Create the transient images at the current size, bind them to memory and derive the barriers. Has to be called
+    // after the imported targets are (re)created, and destroys the framebuffers of the previous transient targets.
+    void compile();
+
+    // Barriers needed before the pass in the current frame
+    void recordBarriers(VkCommandBuffer commandBuffer, Pass pass);
+
+  private:
+    struct ImageInfo {
+        std::string name;
+        bool transient;
+        VkImageAspectFlags aspect;
+
+        // Transient images
+        VkFormat format;
+        VkImageUsageFlags usage;
+        Size size;
+        std::unique_ptr<RenderTarget> target;
+        VkImage image = VK_NULL_HANDLE;
+        VkMemoryRequirements requirements{};
+        // Index into memories
+        size_t memory = 0;
+        // First and last pass using the image
+        Pass firstPass = 0;
+        Pass lastPass = 0;
+
+        // Imported images
+        const RenderTarget *importedTarget = nullptr;
+        uint32_t attachment = 0;
+        ImageAccess before{};
+
+        VkImage imageOfFrame(uint32_t frame) const;
+    };
+
+    struct PassInfo {
+        std::string name;
+        std::vector<std::pair<Image, ImageAccess>> accesses;
+
+        // The derived barriers, nothing is recorded if srcStages is 0
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        VkMemoryBarrier memoryBarrier{};
+        // Per frame in flight, the images of imported targets differ between frames
+        std::vector<std::vector<VkImageMemoryBarrier>> imageBarriers;
+    };
+
+    VulkanDevice *device;
+    Swapchain *swapchain;
+
+    std::vector<ImageInfo> images;
+    std::vector<PassInfo> passes;
+    std::vector<VkDeviceMemory> memories;
+    // Memory types which are device local
+    uint32_t deviceLocalTypes = 0;
+
+    void destroyTransients();
+    void allocateMemory();
+    void deriveBarriers();
+
+    // The transient image which used the memory of the given one last before it, possibly in the previous frame.
+    const ImageInfo &previousUser(Image image) const;
+};
+
+#endif //JUNGLE_RENDERGRAPH_H
@@ -1,14 +1,21 @@
 // The content of this file is licensed under MIT.
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
+#include <algorithm>
 #include <iostream>
 #include "PhysicalDevice.h"
 #include "GBufferDescription.h"
 #include "Pipeline.h"
+#include "CpuProfiler.h"
 #include "Scene.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshQuantizer.h"
+#include "InstanceCulling.h"
 #include "VulkanHelper.h"
 #include "imgui.h"
 #include <glm/gtc/matrix_transform.hpp>
+#include <exception>
 #include <iomanip>
 #include <stdexcept>
 #include <vulkan/vulkan_core.h>
@@ -24,17 +31,9 @@
 #define FIXED_COLOR "COLOR_0"
 #define TEXCOORD0 "TEXCOORD_0"
 #define NORMAL "NORMAL"
+#define EXT_MESH_GPU_INSTANCING "EXT_mesh_gpu_instancing"
 
-const int MAX_RECURSION = 10;
-
-struct DisplacementPushConstants {
-    glm::int32_t normalMapOnly alignas(4);
-    glm::float32_t materialReflectivity alignas(4);
-};
-
-struct EmissiveColor {
-    glm::vec4 RGBS;
-};
+const int MAX_NODE_DEPTH = 10;
 
 static bool string_contains(std::string a, std::string b) {
     return a.find(b) != a.npos;
@@ -72,6 +71,15 @@ static bool materialIsOpaque(tinygltf::Material &material) {
     return material.alphaMode == "OPAQUE"; // could use double-sided parameter instead
 }
 
+// Accessors of the vertex bindings 0, 1 and 2 of the pipeline
+static std::array<std::optional<int>, 3> getVertexAccessors(const PipelineDescription &descr) {
+    return {
+        descr.vertexPosAccessor,
+        descr.vertexFixedColorAccessor.has_value() ? descr.vertexFixedColorAccessor : descr.vertexTexcoordsAccessor,
+        descr.vertexNormalAccessor,
+    };
+}
+
 PipelineDescription Scene::getPipelineDescriptionForPrimitive(const tinygltf::Primitive &primitive) {
     PipelineDescription descr;
 
@@ -83,6 +91,7 @@ PipelineDescription Scene::getPipelineDescriptionForPrimitive(const tinygltf::Pr
 
     if (attributes.count(NORMAL)) {
         descr.vertexNormalAccessor = attributes.at(NORMAL);
+        descr.octahedralNormals = model.accessors[attributes.at(NORMAL)].type == TINYGLTF_TYPE_VEC2;
     }
 
     bool has_texcoords = attributes.count(TEXCOORD0);
@@ -110,13 +119,18 @@ PipelineDescription Scene::getPipelineDescriptionForPrimitive(const tinygltf::Pr
 
     if (has_texcoords && materialUsesNormalTexture(material)) {
         descr.useNormalMap = true;
-        if (materialUsesDisplacedTexture(material)) {
-            descr.useDisplacement = true;
-        }
     }
 
     descr.isOpaque = materialIsOpaque(material);
 
+    auto vertexAccessors = getVertexAccessors(descr);
+    for (int i = 0; i < GeometryBuffers::NUM_ATTRIBUTES; i++) {
+        if (vertexAccessors[i].has_value()) {
+            descr.vertexLayout.attributes[i] = GeometryBuffers::attributeFormat(model, *vertexAccessors[i],
+                halfFloatAccessors.contains(*vertexAccessors[i]));
+        }
+    }
+
     return descr;
 }
 
@@ -134,10 +148,27 @@ Scene::Scene(VulkanDevice *device, Swapchain *swapchain, std::string filename) {
         throw std::runtime_error("[loader] ERR: " + err);
     }
 
+    // Reorder index and vertex data before anything reads it (BVH, buffer upload).
+    MeshOptimizer::optimizeModel(model, filename + ".meshopt");
+
     for (size_t i = 0; i < model.meshes.size(); i++) {
         addLoD(i);
     }
 
+    // Meshes without LoDs from the scene file get a generated chain, registered like hand-made LoDs.
+    if (autoLoDSettings.levels > 0) {
+        std::vector<int> baseMeshes;
+        for (auto &[meshName, lodList]: lods) {
+            if (lodList.size() == 1 && !meshName.starts_with("BUTTERFLY_")) {
+                baseMeshes.push_back(lodList[0].mesh);
+            }
+        }
+        for (int meshIndex: MeshSimplifier::generateLoDChains(model, baseMeshes, autoLoDSettings,
+                                                              filename + ".lods")) {
+            addLoD(meshIndex);
+        }
+    }
+
     for (auto &[meshName, lodList]: lods) {
         std::sort(lodList.begin(), lodList.end());
         // remove or restrict 0-to-infinity lods if more lods are present
@@ -158,10 +189,20 @@ Scene::Scene(VulkanDevice *device, Swapchain *swapchain, std::string filename) {
             }
 
         }
+        // select_lods.comp keeps per-LoD counters in shared memory
+        if (lodList.size() > MAX_LODS_PER_MESH) {
+            std::cout << "[loader] WARN: Mesh " << meshName << " has more than " << MAX_LODS_PER_MESH
+                      << " LoDs, the most distant ones are ignored" << std::endl;
+            lodList.resize(MAX_LODS_PER_MESH);
+        }
     }
 
+    // Must happen before the pipeline descriptions are computed, since the accessors change.
+    if (useMeshQuantization) {
+        quantizeMeshes();
+    }
 
-    // We precompute a list of mesh primitives to be rendered with each of the generated programs.
+    // We precompute the pipeline of every mesh primitive to be rendered.
     for (auto [basename, lodList]: lods) {
         for (auto lod: lodList) {
             for (size_t j = 0; j < model.meshes[lod.mesh].primitives.size(); j++) {
@@ -177,201 +218,249 @@ Scene::Scene(VulkanDevice *device, Swapchain *swapchain, std::string filename) {
                     descr.isButterfly = true;
                 }
 
-                meshPrimitivesWithPipeline[descr][lod].emplace_back(j);
+                primitivePipelines[std::pair(lod.mesh, (int) j)] = descr;
             }
         }
     }
+
+    depthPyramid = std::make_unique<DepthPyramid>(device, swapchain);
+    cachedCompute = std::make_unique<CommandBufferCache>(device, swapchain);
+    cachedDepthPyramid = std::make_unique<CommandBufferCache>(device, swapchain);
 }
 
 bool Scene::useButterflies() {
     return butterflies.size() > 0 && butterflyVolumeMesh >= 0;
 }
 
-void Scene::recordCommandBufferCompute(VkCommandBuffer commandBuffer, glm::vec3 cameraPosition) {
+RecordingJob Scene::computeJob() {
+    return {
+        .record = [this](VkCommandBuffer commandBuffer) { recordComputeCommands(commandBuffer); },
+        .cache = cachedCompute.get(),
+    };
+}
+
+void Scene::recordComputeCommands(VkCommandBuffer commandBuffer) {
+    recordButterflyUpdate(commandBuffer);
+    if (numLoDSelectionWorkgroups > 0) {
+        // The draws of the previous frame may still read the selected transforms and draw commands,
+        // and the depth pyramid of the previous frame must be complete.
+        VkMemoryBarrier previousFrameBarrier{};
+        previousFrameBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        previousFrameBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        previousFrameBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, {},
+                             1, &previousFrameBarrier, 0, nullptr, 0, nullptr);
+    }
+    recordLoDSelection(commandBuffer);
+
+    VkMemoryBarrier computeBarrier{};
+    computeBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    computeBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    computeBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, {},
+                         1, &computeBarrier, 0, nullptr, 0, nullptr);
+}
+
+void Scene::recordButterflyUpdate(VkCommandBuffer commandBuffer) {
     if (useButterflies()) {
-        // update butterflies
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, updateButterfliesPipeline->pipeline);
         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, updateButterfliesPipeline->layout,
                                 0, 1, &updateButterfliesDescriptorSet, 0, nullptr);
         vkCmdDispatch(commandBuffer, numButterflies, 1, 1);
     }
-    // update lods
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, updateLoDsPipeline->pipeline);
-    for (auto &[meshName, meshLods]: lods) {
-        if (meshLods.size() > 1) {
-            uint32_t n = meshTransforms[meshNameMap[meshName]].size();
-            for (int lodIndex = 0; lodIndex < meshLods.size(); lodIndex++) {
-                auto lod = meshLods[lodIndex];
-                bool hasHigher = lodIndex < meshLods.size() - 1;
-                bool hasLower = lodIndex > 0;
-                float lodDistMax = lod.dist_max;
-                float lodDistMin = lod.dist_min;
-                LodUpdatePushConstants constants = {{hasHigher, hasLower, lodDistMax, lodDistMin}, cameraPosition};
-                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, updateLoDsPipeline->layout,
-                                        0, 1, &updateLoDsDescriptorSets[lodComputeDescriptorSetsMap[std::pair(meshNameMap[meshName],lodIndex)]], 0, nullptr);
-                vkCmdPushConstants(commandBuffer, updateLoDsPipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT,
-                                   0, sizeof(constants), &constants);
-                vkCmdDispatch(commandBuffer, n, 1, 1);
-            }
-        }
+}
+
+void Scene::recordLoDSelection(VkCommandBuffer commandBuffer) {
+    if (numLoDSelectionWorkgroups > 0) {
+        vkCmdFillBuffer(commandBuffer, buffers[lodCountersBuffer].buffer, 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(commandBuffer, buffers[drawCountsBuffer].buffer, 0, VK_WHOLE_SIZE, 0);
+        VkMemoryBarrier counterClearBarrier{};
+        counterClearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        counterClearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        counterClearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, {},
+                             1, &counterClearBarrier, 0, nullptr, 0, nullptr);
+
+        // cull every instance, select its LoD and compact the transforms and instance counts in a single pass
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, selectLoDsPipeline->pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, selectLoDsPipeline->layout,
+                                0, 1, &lodSelectionDescriptorSets[swapchain->currentFrame], 0, nullptr);
+        vkCmdDispatch(commandBuffer, numLoDSelectionWorkgroups, 1, 1);
     }
-    VkMemoryBarrier lodUpdateBarrier{};
-    lodUpdateBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    lodUpdateBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    lodUpdateBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, {},
-                         1, &lodUpdateBarrier, 0, nullptr, 0, nullptr);
-    // remove invalid transforms
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compressLoDsPipeline->pipeline);
-    for (auto &[meshName, meshLods]: lods) {
-        if (meshLods.size() > 1) {
-            uint32_t n = meshTransforms[meshNameMap[meshName]].size();
-            for (int lodIndex = 0; lodIndex < meshLods.size(); lodIndex++) {
-                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compressLoDsPipeline->layout,
-                                        0, 1, &compressLoDsDescriptorSets[lodComputeDescriptorSetsMap[std::pair(meshNameMap[meshName],lodIndex)]], 0, nullptr);
-                vkCmdDispatch(commandBuffer, n, 1, 1);
+}
+
+RecordingJob Scene::depthPyramidJob() {
+    return {
+        .record = [this](VkCommandBuffer commandBuffer) {
+            if (numLoDSelectionWorkgroups > 0) {
+                depthPyramid->recordCommandBuffer(commandBuffer);
             }
-        }
+        },
+        .cache = cachedDepthPyramid.get(),
+    };
+}
+
+void Scene::executeDepthPyramid(VkCommandBuffer commandBuffer, VkCommandBuffer pyramidCommands) {
+    if (numLoDSelectionWorkgroups == 0) {
+        return;
     }
-    VkMemoryBarrier lodCompressionBarrier{};
-    lodCompressionBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    lodCompressionBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    lodCompressionBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, {},
-                         1, &lodCompressionBarrier, 0, nullptr, 0, nullptr);
-    VkBufferCopy instanceCountRegion{};
-    instanceCountRegion.size = sizeof(VkDrawIndexedIndirectCommand::instanceCount);
-    instanceCountRegion.srcOffset = sizeof(uint32_t);
-    instanceCountRegion.dstOffset = offsetof(VkDrawIndexedIndirectCommand, instanceCount);
-    VkBufferCopy countToSizeRegion{};
-    countToSizeRegion.size = sizeof(uint32_t);
-    countToSizeRegion.srcOffset = sizeof(uint32_t);
-    countToSizeRegion.dstOffset = 0;
-    for (auto [meshName, lodList]: lods) {
-        if (lodList.size() <= 1) continue; // only update loded meshes
-        for (int i = 0; i < lodList.size(); i++) {
-            auto metaBuffer = buffers[lodMetaBuffersMap[std::pair(meshNameMap[meshName], i)]];
-            auto meshIndex = lodList[i].mesh;
-            auto mesh = model.meshes[meshIndex];
-            for (int j = 0; j < mesh.primitives.size(); j++) {
-                auto drawCommandBuffer = buffers[lodIndirectDrawBufferMap[std::pair(meshIndex, j)]];
-                vkCmdCopyBuffer(commandBuffer, metaBuffer.buffer, drawCommandBuffer.buffer, 1, &instanceCountRegion);
-                // set size equal to count. this is necessary, since invalid transforms at the end would not reduce size
-                vkCmdCopyBuffer(commandBuffer, metaBuffer.buffer, metaBuffer.buffer, 1, &countToSizeRegion);
-            }
-        }
+    if (!enableOcclusionCulling) {
+        // the pyramid would be outdated when occlusion culling is enabled again
+        depthPyramid->isValid = false;
+        return;
     }
-    VkMemoryBarrier drawCountCopyBarrier{};
-    drawCountCopyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    drawCountCopyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    drawCountCopyBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, {},
-                         1, &drawCountCopyBarrier, 0, nullptr, 0, nullptr);
+
+    vkCmdExecuteCommands(commandBuffer, 1, &pyramidCommands);
+    // also when the commands were recorded in an earlier frame
+    depthPyramid->isValid = true;
+    pyramidViewProjection = currentViewProjection;
 }
 
-void Scene::recordCommandBufferDraw(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet) {
-    VulkanHelper::setFullViewportScissor(commandBuffer, swapchain->renderSize());
-    // Draw all primitives with all available graphicsPipelines.
-    for (auto &[programDescr, lodMeshMap]: meshPrimitivesWithPipeline) {
-        auto &pipeline = graphicsPipelines[programDescr];
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
-        for (auto &[lod, primitivesList]: lodMeshMap) {
-            // bind transformations for each mesh
-            bindingDescriptorSets.clear();
-            bindingDescriptorSets.push_back(mvpSet);
-            if (programDescr.isButterfly) {
-                bindingDescriptorSets.push_back(renderButterfliesDescriptorSet);
-            } else {
-                bindingDescriptorSets.push_back(meshTransformsDescriptorSets[descriptorSetsMap[lod]]);
-            }
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0,
-                                    bindingDescriptorSets.size(), bindingDescriptorSets.data(), 0, nullptr);
+std::vector<RecordingJob> Scene::drawJobs(VkDescriptorSet mvpSet, size_t maxJobs) {
+    // Baked here, so that the jobs only read the draw list.
+    if (drawListOutdated) {
+        bakeDrawList();
+    }
+
+    // Contiguous ranges of batches, a job has to bind all of its state itself.
+    size_t numJobs = std::clamp<size_t>((bakedDraws.size() + MIN_BATCHES_PER_DRAW_JOB - 1) / MIN_BATCHES_PER_DRAW_JOB,
+                                        1, std::max<size_t>(maxJobs, 1));
+    while (cachedDraws.size() < numJobs) {
+        cachedDraws.push_back(std::make_unique<CommandBufferCache>(device, swapchain));
+    }
+
+    std::vector<RecordingJob> jobs;
+    for (size_t i = 0; i < numJobs; i++) {
+        size_t first = bakedDraws.size() * i / numJobs;
+        size_t count = bakedDraws.size() * (i + 1) / numJobs - first;
+        jobs.push_back({
+            .record = [this, mvpSet, first, count](VkCommandBuffer commandBuffer) {
+                recordDrawCommands(commandBuffer, mvpSet, first, count);
+            },
+            .renderPass = renderPass,
+            .subpass = 0,
+            .cache = cachedDraws[i].get(),
+        });
+    }
+    return jobs;
+}
 
-            for (auto &primitiveId: primitivesList) {
-                // Bind the specific texture for each primitive
-                renderPrimitiveInstances(lod.mesh, primitiveId, commandBuffer, programDescr, pipeline->layout);
-            }
+void Scene::recordDrawCommands(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet, size_t first, size_t count) {
+    VulkanHelper::setFullViewportScissor(commandBuffer, swapchain->activeRenderSize());
+    if (drawListOutdated) {
+        bakeDrawList();
+    }
+    count = std::min(count, bakedDraws.size() - std::min(first, bakedDraws.size()));
+    if (count == 0) {
+        return;
+    }
+
+    // One indirect draw per pipeline, the number of draws is written by select_lods.comp. The vertex shaders look up
+    // the material of each draw with gl_DrawID relative to the first draw of the batch.
+    // All scene pipelines share their set layouts, so sets 0 and 2 stay bound across pipeline changes.
+    geometry.bindIndexBuffer(commandBuffer);
+    std::array<VkDescriptorSet, 3> sets{mvpSet, bakedDraws[first].instanceSet,
+                                        materialsDescriptorSets[swapchain->currentFrame]};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bakedDraws[first].layout, 0,
+                            sets.size(), sets.data(), 0, nullptr);
+    VkDescriptorSet boundInstanceSet = bakedDraws[first].instanceSet;
+    for (size_t i = first; i < first + count; i++) {
+        const auto &draw = bakedDraws[i];
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.pipeline);
+        if (draw.instanceSet != boundInstanceSet) {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.layout, 1,
+                                    1, &draw.instanceSet, 0, nullptr);
+            boundInstanceSet = draw.instanceSet;
+        }
+        if (i == first || draw.bindVertexBuffers) {
+            GeometryBuffers::bindVertexBuffers(commandBuffer, draw.vertexBuffers);
         }
+
+        vkCmdPushConstants(commandBuffer, draw.layout, VK_SHADER_STAGE_VERTEX_BIT,
+                           0, sizeof(uint32_t), &draw.firstDraw);
+        vkCmdDrawIndexedIndirectCount(commandBuffer, draw.drawBuffer, draw.drawOffset,
+                                      draw.countBuffer, draw.countOffset,
+                                      draw.maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
     }
 }
 
-void Scene::renderPrimitiveInstances(int meshId, int primitiveId, VkCommandBuffer commandBuffer,
-                                     const PipelineDescription &descr, VkPipelineLayout pipelineLayout) {
-
-    auto &primitive = model.meshes[meshId].primitives[primitiveId];
-    if (materialDSet.contains(primitive.material)) {
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelineLayout, 2, 1, &materialDSet[primitive.material], 0, nullptr);
+void Scene::recordDrawCommandsUnbaked(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet) {
+    VulkanHelper::setFullViewportScissor(commandBuffer, swapchain->activeRenderSize());
+    if (drawBatches.empty()) {
+        return;
     }
 
-    if (descr.useNormalMap) {
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelineLayout, 3, 1, &materialSettingSets[swapchain->currentFrame], 0, nullptr);
-
-        DisplacementPushConstants pc;
-        pc.normalMapOnly = !descr.useDisplacement;
-        pc.materialReflectivity = descr.useSSR;
-        vkCmdPushConstants(commandBuffer, pipelineLayout,
-            VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DisplacementPushConstants), &pc);
-    }
-
-    if (descr.useEmissiveColor) {
-        auto emissiveFactor = model.materials[primitive.material].emissiveFactor;
-        EmissiveColor col;
-        col.RGBS.r = emissiveFactor[0];
-        col.RGBS.g = emissiveFactor[1];
-        col.RGBS.b = emissiveFactor[2];
-        col.RGBS.a = 1 / 255.f;
-        if (model.materials[primitive.material].extensions.contains("KHR_materials_emissive_strength")) {
-            col.RGBS.a = model.materials[primitive.material]
-                    .extensions["KHR_materials_emissive_strength"]
-                    .Get("emissiveStrength").GetNumberAsDouble() / 255.f;
+    geometry.bindIndexBuffer(commandBuffer);
+    std::vector<VkDescriptorSet> bindingDescriptorSets;
+    const VertexLayout *boundLayout = nullptr;
+    for (size_t batchIndex = 0; batchIndex < drawBatches.size(); batchIndex++) {
+        auto &batch = drawBatches[batchIndex];
+        auto &pipeline = graphicsPipelines[batch.descr];
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+        bindingDescriptorSets.clear();
+        bindingDescriptorSets.push_back(mvpSet);
+        if (batch.descr.isButterfly) {
+            bindingDescriptorSets.push_back(renderButterfliesDescriptorSet);
+        } else {
+            bindingDescriptorSets.push_back(meshTransformsDescriptorSet);
         }
-        vkCmdPushConstants(commandBuffer, pipelineLayout,
-                           VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(EmissiveColor), &col);
-    }
+        bindingDescriptorSets.push_back(materialsDescriptorSets[swapchain->currentFrame]);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0,
+                                bindingDescriptorSets.size(), bindingDescriptorSets.data(), 0, nullptr);
 
-    std::vector<VkBuffer> vertexBuffers;
-    std::vector<VkDeviceSize> offsets;
-    const auto &addBufferOffset = [&](const char *attribute) {
-        const auto &bufferView = model.bufferViews[model.accessors[primitive.attributes[attribute]].bufferView];
-        vertexBuffers.push_back(buffers[bufferView.buffer].buffer);
-        offsets.push_back(bufferView.byteOffset);
-    };
+        if (!boundLayout || !(*boundLayout == batch.descr.vertexLayout)) {
+            GeometryBuffers::bindVertexBuffers(commandBuffer, geometry.getVertexBuffers(batch.descr.vertexLayout));
+            boundLayout = &batch.descr.vertexLayout;
+        }
 
-    if (descr.vertexPosAccessor.has_value()) {
-        addBufferOffset(POSITION);
+        vkCmdPushConstants(commandBuffer, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT,
+                           0, sizeof(uint32_t), &batch.firstDraw);
+        vkCmdDrawIndexedIndirectCount(commandBuffer, buffers[compactedDrawCommandsBuffer].buffer,
+                                      batch.firstDraw * sizeof(VkDrawIndexedIndirectCommand),
+                                      buffers[drawCountsBuffer].buffer, batchIndex * sizeof(uint32_t),
+                                      batch.maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
     }
-    if (descr.vertexFixedColorAccessor.has_value()) {
-        addBufferOffset(FIXED_COLOR);
-    } else if (descr.vertexTexcoordsAccessor.has_value()) {
-        addBufferOffset(TEXCOORD0);
-    }
-    if (descr.vertexNormalAccessor.has_value()) {
-        addBufferOffset(NORMAL);
-    }
-
-    vkCmdBindVertexBuffers(commandBuffer, 0, vertexBuffers.size(), vertexBuffers.data(), offsets.data());
-
-    if (primitive.indices >= 0) {
-        auto indexAccessorIndex = primitive.indices;
-        auto indexBufferViewIndex = model.accessors[indexAccessorIndex].bufferView;
-        auto indexBufferIndex = model.bufferViews[indexBufferViewIndex].buffer;
-        auto indexBuffer = buffers[indexBufferIndex];
-        auto indexBufferOffset = model.bufferViews[indexBufferViewIndex].byteOffset;
-        auto indexBufferType = VulkanHelper::gltfTypeToVkIndexType(
-                model.accessors[indexAccessorIndex].componentType);
-        vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, indexBufferOffset, indexBufferType);
-        if (lodIndirectDrawBufferMap.count({meshId, primitiveId})) {
-            vkCmdDrawIndexedIndirect(commandBuffer,
-                buffers[lodIndirectDrawBufferMap[std::pair(meshId, primitiveId)]].buffer, 0, 1, 0);
-        }
-    } else {
-        throw std::runtime_error("Non-indexed geometry is currently not supported.");
+}
+
+void Scene::bakeDrawList() {
+    bakedDraws.clear();
+    const VertexLayout *boundLayout = nullptr;
+    for (size_t batchIndex = 0; batchIndex < drawBatches.size(); batchIndex++) {
+        auto &batch = drawBatches[batchIndex];
+        auto &pipeline = graphicsPipelines.at(batch.descr);
+
+        BakedDraw draw{};
+        draw.pipeline = pipeline->pipeline;
+        draw.layout = pipeline->layout;
+        draw.instanceSet = batch.descr.isButterfly ? renderButterfliesDescriptorSet : meshTransformsDescriptorSet;
+        draw.bindVertexBuffers = !boundLayout || !(*boundLayout == batch.descr.vertexLayout);
+        draw.vertexBuffers = geometry.getVertexBuffers(batch.descr.vertexLayout);
+        boundLayout = &batch.descr.vertexLayout;
+        draw.drawBuffer = buffers[compactedDrawCommandsBuffer].buffer;
+        draw.drawOffset = batch.firstDraw * sizeof(VkDrawIndexedIndirectCommand);
+        draw.countBuffer = buffers[drawCountsBuffer].buffer;
+        draw.countOffset = batchIndex * sizeof(uint32_t);
+        draw.firstDraw = batch.firstDraw;
+        draw.maxDrawCount = batch.maxDrawCount;
+        bakedDraws.push_back(draw);
+    }
+    drawListOutdated = false;
+}
+
+void Scene::invalidateCommandBuffers() {
+    drawListOutdated = true;
+    cachedCompute->invalidate();
+    for (auto &cache: cachedDraws) {
+        cache->invalidate();
     }
+    cachedDepthPyramid->invalidate();
+}
+
+size_t Scene::getNumDrawBatches() {
+    return drawBatches.size();
 }
 
 void Scene::drawPointLights(VkCommandBuffer commandBuffer) {
@@ -383,196 +472,87 @@ void Scene::drawPointLights(VkCommandBuffer commandBuffer) {
 }
 
 
-void Scene::setupDescriptorSets(VkDescriptorPool descriptorPool) {
-    meshTransformsDescriptorSets = VulkanHelper::createDescriptorSetsFromLayout(
-            *device, descriptorPool, meshTransformsDescriptorSetLayout, getNumLods());
+void Scene::setupDescriptorSets(VkDescriptorPool descriptorPool, const RenderTarget &gBuffer) {
+    ensureDescriptorSetLayouts();
+    invalidateCommandBuffers();
+    if (useButterflies()) {
+        setupButterfliesDescriptorSets(descriptorPool);
+    }
 
-    updateLoDsDescriptorSets = VulkanHelper::createDescriptorSetsFromLayout(
-            *device, descriptorPool, lodUpdateDescriptorSetLayout, getNumLods());
+    if (numLoDSelectionWorkgroups > 0) {
+        meshTransformsDescriptorSet = VulkanHelper::createDescriptorSetsFromLayout(
+                *device, descriptorPool, meshTransformsDescriptorSetLayout, 1)[0];
+        device->writeDescriptorSets({
+            vkutil::createDescriptorWriteSBO(buffers[lodTransformsBuffer].getDescriptor(), meshTransformsDescriptorSet, 0),
+        });
 
-    compressLoDsDescriptorSets = VulkanHelper::createDescriptorSetsFromLayout(
-            *device, descriptorPool, lodCompressDescriptorSetLayout, getNumLods());
+        depthPyramid->createDescriptorSets(descriptorPool, gBuffer);
+        lodSelectionDescriptorSets = VulkanHelper::createDescriptorSetsFromLayout(
+                *device, descriptorPool, lodSelectionDescriptorSetLayout, Swapchain::framesInFlight);
+        updateLoDSelectionDescriptorSets();
+    }
 
-    if (useButterflies()) {
-        setupButterfliesDescriptorSets(descriptorPool);
+    // All textures in the order of their slots, the material buffer indexes into this array.
+    std::vector<VkDescriptorImageInfo> textureInfos(textures.size());
+    for (auto &[_, texture]: textures) {
+        textureInfos[texture.slot] = vkutil::createDescriptorImageInfo(texture.imageView, texture.sampler);
     }
 
-    int transformsDescriptorIndex = 0;
-    int lodComputeDescriptorIndex = 0;
-    for (auto [meshName, lodList]: lods) {
-        if (meshTransforms[meshNameMap[meshName]].size() <= 0) {
-            continue;  // Special meshes without transforms (e.g. butterflies) can not be LoDed
+    materialsDescriptorSets = VulkanHelper::createDescriptorSetsFromLayout(*device, descriptorPool,
+        materialsDescriptorSetLayout, Swapchain::framesInFlight);
+    for (int i = 0; i < Swapchain::framesInFlight; i++) {
+        auto &set = materialsDescriptorSets[i];
+        auto settingsInfo = vkutil::createDescriptorBufferInfo(materialBuffer.buffers[i], 0, sizeof(MaterialSettings));
+        std::vector<VkWriteDescriptorSet> writes{
+            vkutil::createDescriptorWriteSBO(buffers[materialDataBuffer].getDescriptor(), set, 0),
+            vkutil::createDescriptorWriteUBO(settingsInfo, set, 2),
+        };
+        if (compactedDrawMaterialsBuffer >= 0) {
+            writes.push_back(vkutil::createDescriptorWriteSBO(
+                buffers[compactedDrawMaterialsBuffer].getDescriptor(), set, 1));
         }
-        for (int lodIndex = 0; lodIndex < lodList.size(); lodIndex++) {
-            const std::pair<int, int> &lodIdentifier = std::pair(meshNameMap[meshName], lodIndex);
-            auto meshTransformsBufferIndex = lodTransformsBuffersMap[lodIdentifier];
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = buffers[meshTransformsBufferIndex].buffer;
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(ModelTransform) * meshTransforms[meshNameMap[meshName]].size();
-
-            VkWriteDescriptorSet descriptorWrite{};
-            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            const LoD &lod = lodList[lodIndex];
-            descriptorSetsMap[lod] = transformsDescriptorIndex++;
-            descriptorWrite.dstSet = meshTransformsDescriptorSets[descriptorSetsMap[lod]];
-            descriptorWrite.dstBinding = 0;
-            descriptorWrite.dstArrayElement = 0;
-            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            descriptorWrite.descriptorCount = 1;
-            descriptorWrite.pBufferInfo = &bufferInfo;
-            descriptorWrite.pImageInfo = nullptr; // Optional
-            descriptorWrite.pTexelBufferView = nullptr; // Optional
-
-            vkUpdateDescriptorSets(*device, 1, &descriptorWrite, 0, nullptr);
-
-            if (lodList.size() > 1) {
-                // todo maybe clean this mess up
-                lodComputeDescriptorSetsMap[lodIdentifier] = lodComputeDescriptorIndex++;
-
-                auto lodTransformsBufferIndex = lodTransformsBuffersMap[lodIdentifier];
-                auto lodMetaBufferIndex = lodMetaBuffersMap[lodIdentifier];
-                auto lodUpIdentifier = std::pair(meshNameMap[meshName],
-                                                 lodIndex + 1 < lodList.size() ? lodIndex + 1 : lodIndex);
-                auto lodDownIdentifier = std::pair(meshNameMap[meshName],
-                                                   lodIndex - 1 >= 0 ? lodIndex - 1 : lodIndex);
-                auto upLodTransformsBufferIndex = lodTransformsBuffersMap[lodUpIdentifier];
-                auto upLodMetaBufferIndex = lodMetaBuffersMap[lodUpIdentifier];
-                auto downLodTransformsBufferIndex = lodTransformsBuffersMap[lodDownIdentifier];
-                auto downLodMetaBufferIndex = lodMetaBuffersMap[lodDownIdentifier];
-                auto trafoSize = sizeof(ModelTransform) * meshTransforms[meshNameMap[meshName]].size();
-                auto metaSize = ((meshTransforms[meshNameMap[meshName]].size() / 32 + 1) + 2) * sizeof(glm::uint);
-
-                VkDescriptorBufferInfo transformsBufferInfo{};
-                transformsBufferInfo.buffer = buffers[lodTransformsBufferIndex].buffer;
-                transformsBufferInfo.offset = 0;
-                transformsBufferInfo.range = trafoSize;
-
-                VkDescriptorBufferInfo metaBufferInfo{};
-                metaBufferInfo.buffer = buffers[lodMetaBufferIndex].buffer;
-                metaBufferInfo.offset = 0;
-                metaBufferInfo.range = metaSize;
-
-                VkDescriptorBufferInfo upTransformsBufferInfo{};
-                upTransformsBufferInfo.buffer = buffers[upLodTransformsBufferIndex].buffer;
-                upTransformsBufferInfo.offset = 0;
-                upTransformsBufferInfo.range = trafoSize;
-
-                VkDescriptorBufferInfo upMetaBufferInfo{};
-                upMetaBufferInfo.buffer = buffers[upLodMetaBufferIndex].buffer;
-                upMetaBufferInfo.offset = 0;
-                upMetaBufferInfo.range = metaSize;
-
-                VkDescriptorBufferInfo downTransformsBufferInfo{};
-                downTransformsBufferInfo.buffer = buffers[downLodTransformsBufferIndex].buffer;
-                downTransformsBufferInfo.offset = 0;
-                downTransformsBufferInfo.range = trafoSize;
-
-                VkDescriptorBufferInfo downMetaBufferInfo{};
-                downMetaBufferInfo.buffer = buffers[downLodMetaBufferIndex].buffer;
-                downMetaBufferInfo.offset = 0;
-                downMetaBufferInfo.range = metaSize;
-
-                std::vector<VkDescriptorBufferInfo> updateBufferInfos {
-                    upMetaBufferInfo,upTransformsBufferInfo,
-                    metaBufferInfo,transformsBufferInfo,
-                    downMetaBufferInfo, downTransformsBufferInfo
-                };
-
-                VkWriteDescriptorSet descriptorWriteUpdate{};
-                descriptorWriteUpdate.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWriteUpdate.dstSet = updateLoDsDescriptorSets[lodComputeDescriptorSetsMap[lodIdentifier]];
-                descriptorWriteUpdate.dstBinding = 0;
-                descriptorWriteUpdate.dstArrayElement = 0;
-                descriptorWriteUpdate.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                descriptorWriteUpdate.descriptorCount = updateBufferInfos.size();
-                descriptorWriteUpdate.pBufferInfo = updateBufferInfos.data();
-                descriptorWriteUpdate.pImageInfo = nullptr; // Optional
-                descriptorWriteUpdate.pTexelBufferView = nullptr; // Optional
-
-                vkUpdateDescriptorSets(*device, 1, &descriptorWriteUpdate, 0, nullptr);
-
-                std::vector<VkDescriptorBufferInfo> compressBufferInfos {
-                    metaBufferInfo, transformsBufferInfo
-                };
-
-                VkWriteDescriptorSet descriptorWriteCompress{};
-                descriptorWriteCompress.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWriteCompress.dstSet = compressLoDsDescriptorSets[lodComputeDescriptorSetsMap[lodIdentifier]];
-                descriptorWriteCompress.dstBinding = 0;
-                descriptorWriteCompress.dstArrayElement = 0;
-                descriptorWriteCompress.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                descriptorWriteCompress.descriptorCount = compressBufferInfos.size();
-                descriptorWriteCompress.pBufferInfo = compressBufferInfos.data();
-                descriptorWriteCompress.pImageInfo = nullptr; // Optional
-                descriptorWriteCompress.pTexelBufferView = nullptr; // Optional
-
-                vkUpdateDescriptorSets(*device, 1, &descriptorWriteCompress, 0, nullptr);
-            }
+        if (!textureInfos.empty()) {
+            auto textureWrite = vkutil::createDescriptorWriteSampler(textureInfos[0], set, 3);
+            textureWrite.descriptorCount = textureInfos.size();
+            writes.push_back(textureWrite);
         }
+        device->writeDescriptorSets(writes);
     }
+}
 
-    materialSettingSets = VulkanHelper::createDescriptorSetsFromLayout(*device, descriptorPool,
-        materialsSettingsLayout, MAX_FRAMES_IN_FLIGHT);
-    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        auto bInfo = vkutil::createDescriptorBufferInfo(materialBuffer.buffers[i], 0, sizeof(MaterialSettings));
+void Scene::updateLoDSelectionDescriptorSets() {
+    for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
+        auto &set = lodSelectionDescriptorSets[i];
+        auto cullingInfo = vkutil::createDescriptorBufferInfo(cullingBuffer.buffers[i], 0, sizeof(CullingData));
         device->writeDescriptorSets({
-            vkutil::createDescriptorWriteUBO(bInfo, materialSettingSets[i], 0),
+            vkutil::createDescriptorWriteSBO(buffers[lodInstancesBuffer].getDescriptor(), set, 0),
+            vkutil::createDescriptorWriteSBO(buffers[lodWorkgroupsBuffer].getDescriptor(), set, 1),
+            vkutil::createDescriptorWriteSBO(buffers[lodRangesBuffer].getDescriptor(), set, 2),
+            vkutil::createDescriptorWriteSBO(buffers[lodCountersBuffer].getDescriptor(), set, 3),
+            vkutil::createDescriptorWriteSBO(buffers[lodTransformsBuffer].getDescriptor(), set, 4),
+            vkutil::createDescriptorWriteSBO(buffers[drawCommandsBuffer].getDescriptor(), set, 5),
+            vkutil::createDescriptorWriteSBO(buffers[drawCommandInfosBuffer].getDescriptor(), set, 6),
+            vkutil::createDescriptorWriteSBO(depthPyramid->buffer.getDescriptor(), set, 7),
+            vkutil::createDescriptorWriteUBO(cullingInfo, set, 8),
+            vkutil::createDescriptorWriteSBO(buffers[compactedDrawCommandsBuffer].getDescriptor(), set, 9),
+            vkutil::createDescriptorWriteSBO(buffers[drawCountsBuffer].getDescriptor(), set, 10),
+            vkutil::createDescriptorWriteSBO(buffers[compactedDrawMaterialsBuffer].getDescriptor(), set, 11),
         });
     }
+}
 
-    const auto& findTexture = [&] (int gltfId) -> LoadedTexture& {
-        auto gTex = model.textures[gltfId];
-        return textures[gTex.source];
-    };
-
-    for (size_t i = 0; i < model.materials.size(); i++) {
-        VkDescriptorSetLayout desiredLayout = VK_NULL_HANDLE;
-        std::vector<VkDescriptorImageInfo> boundTextures;
-        std::vector<VkDescriptorBufferInfo> boundBuffers;
-        if (materialUsesBaseTexture(model.materials[i])) {
-            desiredLayout = albedoDSLayout;
-            auto& albedo = findTexture(model.materials[i].values.find(BASE_COLOR_TEXTURE)->second.TextureIndex());
-            boundTextures.push_back(vkutil::createDescriptorImageInfo(albedo.imageView, albedo.sampler));
-
-            if (materialUsesEmissiveTexture(model.materials[i])) {
-                desiredLayout = emissiveTextureDSLayout;
-                auto& emissive = findTexture(model.materials[i].emissiveTexture.index);
-                boundTextures.push_back(vkutil::createDescriptorImageInfo(emissive.imageView, emissive.sampler));
-            }
-
-            if (materialUsesNormalTexture(model.materials[i])) {
-                desiredLayout = albedoDisplacementDSLayout;
-                auto& normal = findTexture(model.materials[i].normalTexture.index);
-                boundTextures.push_back(vkutil::createDescriptorImageInfo(normal.imageView, normal.sampler));
-
-                if (materialUsesDisplacedTexture(model.materials[i])) {
-                    auto& disp = findTexture(model.materials[i].occlusionTexture.index);
-                    boundTextures.push_back(vkutil::createDescriptorImageInfo(disp.imageView, disp.sampler));
-                } else {
-                    // We map the normal texture as both normal texture and as the height map.
-                    // Vulkan requires that we bind all textures even if we don't use them ...
-                    boundTextures.push_back(boundTextures.back());
-                }
-            }
-        }
-
-        if (desiredLayout != VK_NULL_HANDLE) {
-            materialDSet[i] =
-                VulkanHelper::createDescriptorSetsFromLayout(*device, descriptorPool, desiredLayout, 1)[0];
-
-            std::vector<VkWriteDescriptorSet> writes;
-            size_t id = 0;
-            for (id = 0; id < boundTextures.size(); id++) {
-                writes.push_back(vkutil::createDescriptorWriteSampler(boundTextures[id], materialDSet[i], id));
-            }
-
-            for (size_t j = 0; j < boundBuffers.size(); j++, id++) {
-                writes.push_back(vkutil::createDescriptorWriteUBO(boundBuffers[j], materialDSet[i], id));
-            }
+void Scene::handleResize(const RenderTarget &gBuffer) {
+    invalidateCommandBuffers();
+    if (numLoDSelectionWorkgroups > 0) {
+        depthPyramid->handleResize(gBuffer);
+        updateLoDSelectionDescriptorSets();
+    }
+}
 
-            device->writeDescriptorSets(writes);
-        }
+void Scene::handleRenderScaleChange() {
+    invalidateCommandBuffers();
+    if (numLoDSelectionWorkgroups > 0) {
+        depthPyramid->updateLevels();
     }
 }
 
@@ -652,132 +632,261 @@ void Scene::setupButterfliesDescriptorSets(VkDescriptorPool descriptorPool) {
 }
 
 RequiredDescriptors Scene::getNumDescriptors() {
+    auto pyramid = depthPyramid->getNumDescriptors();
     return RequiredDescriptors{
-            .requireUniformBuffers = getNumLods() * 2 /*transforms, meta*/ +
-                    (unsigned int) model.materials.size() + MAX_FRAMES_IN_FLIGHT + 2 /*butterflies*/,
-            .requireSamplers = (unsigned int) model.materials.size() * 3,
+            .requireUniformBuffers = Swapchain::framesInFlight /*material settings*/ + 2 /*butterflies*/
+                + Swapchain::framesInFlight /*culling*/,
+            .requireSamplers = (unsigned int) textures.size() * Swapchain::framesInFlight + pyramid.requireSamplers,
+            .requireSSBOs = 1 /*transforms*/ + 11 * Swapchain::framesInFlight /*LoD selection*/
+                + 2 * Swapchain::framesInFlight /*materials*/ + pyramid.requireSSBOs,
     };
 }
 
-unsigned int Scene::getNumLods() {
-    return std::accumulate(lods.begin(), lods.end(), 0u,
-                           [](const unsigned int previous, const std::pair<std::string, std::vector<LoD>> &p) {
-                               return previous + p.second.size();
-                           });
-}
-
 void Scene::setupBuffers() {
-    unsigned long numBuffers = model.buffers.size();
-    buffers.resize(numBuffers);
-    for (unsigned long i = 0; i < numBuffers; ++i) {
-        buffers[i].uploadData(device, model.buffers[i].data,
-            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-    }
+    PROFILE_SCOPE("Scene::setupBuffers");
+    // Vertex and index data is uploaded packed into shared buffers in setupPrimitiveDrawBuffers.
     for (auto node: model.scenes[model.defaultScene].nodes) {
-        generateTransforms(node, glm::mat4(1.f), MAX_RECURSION);
+        generateTransforms(node);
     }
 
     setupStorageBuffers();
     setupPrimitiveDrawBuffers();
 }
 
-void Scene::generateTransforms(int nodeIndex, glm::mat4 oldTransform, int maxRecursion) {
-    if (maxRecursion <= 0) return;
+void Scene::generateTransforms(int rootNode) {
+    struct PendingNode {
+        int nodeIndex;
+        glm::mat4 parentTransform;
+        int depth;
+    };
 
-    auto node = model.nodes[nodeIndex];
-    if (node.mesh >= 0 && lods[model.meshes[node.mesh].name].size() == 0 && !(node.name == "BUTTERFLYVOLUME")) {
-        // transforms for the mesh contained in the node come from a different source (butterflies, LOD-models)
-        return;
-    }
+    // Depth-first traversal with an explicit stack, so deep or wide hierarchies are not copied around.
+    std::vector<PendingNode> stack{{rootNode, glm::mat4(1.f), 0}};
+    while (!stack.empty()) {
+        auto [nodeIndex, parentTransform, depth] = stack.back();
+        stack.pop_back();
+        if (depth >= MAX_NODE_DEPTH) continue;
+
+        auto &node = model.nodes[nodeIndex];
+        if (node.mesh >= 0 && lods[model.meshes[node.mesh].name].size() == 0 && !(node.name == "BUTTERFLYVOLUME")) {
+            // transforms for the mesh contained in the node come from a different source (butterflies, LOD-models)
+            continue;
+        }
 
-    auto transform = VulkanHelper::transformFromMatrixOrComponents(node.matrix,
-                                                                   node.scale, node.rotation, node.translation);
-    auto newTransform = oldTransform * transform;
+        auto transform = VulkanHelper::transformFromMatrixOrComponents(node.matrix,
+                                                                       node.scale, node.rotation, node.translation);
+        auto newTransform = parentTransform * transform;
 
-    if (node.mesh >= 0) {
-        if (node.name == "BUTTERFLYVOLUME") {
-            butterflyVolumeTransform = ModelTransform{newTransform};
-            butterflyVolumeMesh = node.mesh;
-        } else {
-            meshTransforms[node.mesh].push_back(ModelTransform{newTransform});
-        }
-    } else if (node.extensions.contains("KHR_lights_punctual")) {
-        auto light_idx = node.extensions["KHR_lights_punctual"].Get("light").Get<int>();
-        auto light = model.extensions["KHR_lights_punctual"].Get("lights").Get(light_idx);
-        auto type = light.Get("type").Get<std::string>();
-        if (type == "point") {  // we currently do not support "directional" and "spot" lights.
-            glm::vec3 light_color = glm::vec3(1.f, 1.f, 1.f);
-            if (light.Has("color")) {
-                light_color = glm::vec3(light.Get("color").Get(0).Get<double>(),
-                                        light.Get("color").Get(1).Get<double>(),
-                                        light.Get("color").Get(2).Get<double>());
-            }
-            float light_intensity = 1;
-            if (light.Has("intensity")) {
-                light_intensity = static_cast<float>(light.Get("intensity").Get<double>());
-            }
-            auto name = light.Get("name").Get<std::string>();
-            float wind = name.find("WIND") != name.npos;
-            if (name.starts_with("BUTTERFLYLIGHT_")) {
-                butterflyLights[stoi(name.substr(15))] = {
-                        glm::vec3(0.0f),
-                        light_color,
-                        light_intensity,
-                        wind,
-                        glm::vec3(0.0f),
-                };
+        if (node.mesh >= 0) {
+            if (node.name == "BUTTERFLYVOLUME") {
+                butterflyVolumeTransform = ModelTransform{newTransform};
+                butterflyVolumeMesh = node.mesh;
+            } else if (node.extensions.contains(EXT_MESH_GPU_INSTANCING)) {
+                addInstancedTransforms(node, newTransform);
             } else {
-                lights.push_back({glm::make_vec3(newTransform[3]), light_color, light_intensity, wind});
+                meshTransforms[node.mesh].push_back(ModelTransform{newTransform * getDequantization(node.mesh)});
             }
+        } else if (node.extensions.contains("KHR_lights_punctual")) {
+            addLight(node, newTransform);
+        } else if (node.camera >= 0) {
+            if (model.cameras[node.camera].type == "perspective") {
+                auto &perspective = model.cameras[node.camera].perspective;
+                cameras.push_back({
+                                          node.name,
+                                          newTransform,
+                                          static_cast<float>(perspective.yfov),
+                                          static_cast<float>(perspective.znear),
+                                          static_cast<float>(perspective.zfar)
+                                  });
+            }
+        }
+
+        // reversed, so that children are visited in the same order as before
+        for (auto child = node.children.rbegin(); child != node.children.rend(); ++child) {
+            stack.push_back({*child, newTransform, depth + 1});
+        }
+    }
+}
+
+void Scene::addLight(tinygltf::Node &node, const glm::mat4 &transform) {
+    auto light_idx = node.extensions["KHR_lights_punctual"].Get("light").Get<int>();
+    auto &light = model.extensions["KHR_lights_punctual"].Get("lights").Get(light_idx);
+    auto type = light.Get("type").Get<std::string>();
+    if (type == "point") {  // we currently do not support "directional" and "spot" lights.
+        glm::vec3 light_color = glm::vec3(1.f, 1.f, 1.f);
+        if (light.Has("color")) {
+            light_color = glm::vec3(light.Get("color").Get(0).Get<double>(),
+                                    light.Get("color").Get(1).Get<double>(),
+                                    light.Get("color").Get(2).Get<double>());
+        }
+        float light_intensity = 1;
+        if (light.Has("intensity")) {
+            light_intensity = static_cast<float>(light.Get("intensity").Get<double>());
+        }
+        auto name = light.Get("name").Get<std::string>();
+        float wind = name.find("WIND") != name.npos;
+        if (name.starts_with("BUTTERFLYLIGHT_")) {
+            butterflyLights[stoi(name.substr(15))] = {
+                    glm::vec3(0.0f),
+                    light_color,
+                    light_intensity,
+                    wind,
+                    glm::vec3(0.0f),
+            };
         } else {
-            std::cout << "[lights] WARN: Detected unsupported light of type " << type << std::endl;
+            lights.push_back({glm::make_vec3(transform[3]), light_color, light_intensity, wind});
         }
-    } else if (node.camera >= 0) {
-        if (model.cameras[node.camera].type == "perspective") {
-            auto perspective = model.cameras[node.camera].perspective;
-            cameras.push_back({
-                                      node.name,
-                                      newTransform,
-                                      static_cast<float>(perspective.yfov),
-                                      static_cast<float>(perspective.znear),
-                                      static_cast<float>(perspective.zfar)
-                              });
+    } else {
+        std::cout << "[lights] WARN: Detected unsupported light of type " << type << std::endl;
+    }
+}
+
+void Scene::addInstancedTransforms(tinygltf::Node &node, const glm::mat4 &nodeTransform) {
+    const auto &attributes = node.extensions[EXT_MESH_GPU_INSTANCING].Get("attributes");
+    const auto &getAccessor = [&](const char *name) {
+        return attributes.Has(name) ? attributes.Get(name).GetNumberAsInt() : -1;
+    };
+
+    int translationAccessor = getAccessor("TRANSLATION");
+    int rotationAccessor = getAccessor("ROTATION");
+    int scaleAccessor = getAccessor("SCALE");
+
+    size_t count = 0;
+    for (int accessor: {translationAccessor, rotationAccessor, scaleAccessor}) {
+        if (accessor >= 0) {
+            count = std::max(count, model.accessors[accessor].count);
         }
     }
 
-    for (int child: node.children) {
-        generateTransforms(child, newTransform, maxRecursion - 1);
+    // Read the accessors in bulk, missing attributes are the identity.
+    std::vector<glm::vec3> translations = translationAccessor >= 0 ?
+        MeshQuantizer::readVec3(model, model.accessors[translationAccessor]) : std::vector<glm::vec3>(count, glm::vec3(0));
+    std::vector<glm::vec4> rotations = rotationAccessor >= 0 ?
+        MeshQuantizer::readVec4(model, model.accessors[rotationAccessor]) : std::vector<glm::vec4>(count, {0, 0, 0, 1});
+    std::vector<glm::vec3> scales = scaleAccessor >= 0 ?
+        MeshQuantizer::readVec3(model, model.accessors[scaleAccessor]) : std::vector<glm::vec3>(count, glm::vec3(1));
+
+    if (translations.size() != count || rotations.size() != count || scales.size() != count) {
+        std::cout << "[loader] WARN: " << EXT_MESH_GPU_INSTANCING << " attributes of node " << node.name
+                  << " have different counts, skipping." << std::endl;
+        return;
+    }
+
+    auto &transforms = meshTransforms[node.mesh];
+    size_t first = transforms.size();
+    transforms.resize(first + count);
+
+    const glm::mat4 dequantization = getDequantization(node.mesh);
+    #pragma omp parallel for
+    for (size_t i = 0; i < count; i++) {
+        // glTF quaternions are stored as (x, y, z, w)
+        glm::quat rotation(rotations[i].w, rotations[i].x, rotations[i].y, rotations[i].z);
+        glm::mat4 instance = glm::translate(glm::mat4(1.0f), translations[i]) * glm::toMat4(rotation) *
+                             glm::scale(glm::mat4(1.0f), scales[i]);
+        transforms[first + i] = ModelTransform{nodeTransform * instance * dequantization};
     }
 }
 
 void Scene::setupPrimitiveDrawBuffers() {
+    PROFILE_SCOPE("Scene::setupPrimitiveDrawBuffers");
+    struct PendingDraw {
+        VkDrawIndexedIndirectCommand command;
+        uint32_t lod;
+        PipelineDescription descr;
+        int material;
+    };
+
+    std::vector<PendingDraw> pendingDraws;
     for (auto [mesh, transforms]: meshTransforms) {
-        for (int i = 0; i < lods[model.meshes[mesh].name].size(); i++) {
-            auto lod = lods[model.meshes[mesh].name][i];
+        auto &lodList = lods[model.meshes[mesh].name];
+        for (int i = 0; i < lodList.size(); i++) {
+            auto lod = lodList[i];
             for (int j = 0; j < model.meshes[lod.mesh].primitives.size(); j++) {
-                auto primitive = model.meshes[lod.mesh].primitives[j];
-                if (primitive.indices >= 0) {
-                    auto indexAccessorIndex = primitive.indices;
-                    uint32_t numIndices = model.accessors[indexAccessorIndex].count;
-                    VkDrawIndexedIndirectCommand drawCommand{};
-                    drawCommand.indexCount = numIndices;
-                    if (model.meshes[mesh].name.starts_with("BUTTERFLY_")) {
-                        auto butterflyCount = getButterflyCount(stoi(model.meshes[mesh].name.substr(10)));
-                        drawCommand.firstInstance = butterflyCount.first;
-                        drawCommand.instanceCount = (i == 0) ? butterflyCount.second : 0;
-                    } else {
-                        drawCommand.instanceCount = (i == 0) ? transforms.size() : 0;
-                    }
-
-                    lodIndirectDrawBufferMap[std::pair(lod.mesh, j)] = buffers.size();
-                    buffers.push_back({});
-                    buffers.back().uploadData(device, &drawCommand, sizeof(drawCommand),
-                                              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                auto &primitive = model.meshes[lod.mesh].primitives[j];
+                if (!primitivePipelines.contains(std::pair(lod.mesh, j))) {
+                    continue;
                 }
+                if (primitive.indices < 0) {
+                    throw std::runtime_error("Non-indexed geometry is currently not supported.");
+                }
+
+                auto &descr = primitivePipelines[std::pair(lod.mesh, j)];
+                auto range = geometry.addPrimitive(model, getVertexAccessors(descr), primitive.indices,
+                                                   halfFloatAccessors);
+                VkDrawIndexedIndirectCommand drawCommand{};
+                drawCommand.indexCount = range.indexCount;
+                drawCommand.firstIndex = range.firstIndex;
+                drawCommand.vertexOffset = range.vertexOffset;
+                uint32_t drawCommandLoD = NO_LOD_SELECTION;
+                if (model.meshes[mesh].name.starts_with("BUTTERFLY_")) {
+                    auto butterflyCount = getButterflyCount(stoi(model.meshes[mesh].name.substr(10)));
+                    drawCommand.firstInstance = butterflyCount.first;
+                    drawCommand.instanceCount = (i == 0) ? butterflyCount.second : 0;
+                } else {
+                    // the instance count of the visible instances is written by select_lods.comp every frame
+                    drawCommandLoD = lodSelectionIndexMap[std::pair(mesh, i)];
+                    drawCommand.firstInstance = lodSelectionRanges[drawCommandLoD].firstOutput;
+                }
+
+                pendingDraws.push_back({drawCommand, drawCommandLoD, descr, primitive.material});
             }
         }
     }
+    // Draws of the same pipeline form a batch, materials are looked up per draw.
+    std::stable_sort(pendingDraws.begin(), pendingDraws.end(), [](const PendingDraw &a, const PendingDraw &b) {
+        return std::tie(a.descr, a.material) < std::tie(b.descr, b.material);
+    });
+
+    std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+    std::vector<DrawCommandInfo> drawCommandInfos;
+    std::vector<uint32_t> drawMaterials;
+    std::vector<uint32_t> drawCounts;
+    for (auto &draw: pendingDraws) {
+        if (drawBatches.empty() || !(drawBatches.back().descr == draw.descr)) {
+            drawBatches.push_back({draw.descr, (uint32_t) drawCommands.size(), 0});
+            drawCounts.push_back(0);
+        }
+        drawCommandInfos.push_back({draw.lod, (uint32_t) drawBatches.size() - 1, drawBatches.back().firstDraw,
+                                    (uint32_t) draw.material});
+        drawCommands.push_back(draw.command);
+        drawMaterials.push_back(draw.material);
+        drawBatches.back().maxDrawCount++;
+        drawCounts.back()++;
+    }
+
+    numDrawCommands = drawCommands.size();
+    if (numDrawCommands == 0) return;
+
+    geometry.upload(device);
+
+    drawCommandsBuffer = buffers.size();
+    buffers.push_back({});
+    buffers.back().uploadData(device, drawCommands, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    drawCommandInfosBuffer = buffers.size();
+    buffers.push_back({});
+    buffers.back().uploadData(device, drawCommandInfos, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // Without instances to select, all draws stay as uploaded here.
+    compactedDrawCommandsBuffer = buffers.size();
+    buffers.push_back({});
+    buffers.back().uploadData(device, drawCommands,
+                              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    drawCountsBuffer = buffers.size();
+    buffers.push_back({});
+    buffers.back().uploadData(device, drawCounts,
+                              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    compactedDrawMaterialsBuffer = buffers.size();
+    buffers.push_back({});
+    buffers.back().uploadData(device, drawMaterials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 }
 
 std::pair<unsigned long, unsigned long> Scene::getButterflyCount(int butterflyType) {
@@ -795,37 +904,77 @@ std::pair<unsigned long, unsigned long> Scene::getButterflyCount(int butterflyTy
 }
 
 void Scene::setupStorageBuffers() {
+    PROFILE_SCOPE("Scene::setupStorageBuffers");
+    std::vector<ModelTransform> lodInstances;
+    std::vector<LoDSelectionWorkgroup> lodWorkgroups;
+    uint32_t numSelectedTransforms = 0;
+
     for (auto [mesh, transforms]: meshTransforms) {
-        for (int i = 0; i < lods[model.meshes[mesh].name].size(); i++) {
-            lodTransformsBuffersMap[std::pair(mesh, i)] = buffers.size();
-            buffers.push_back({});
-            if (i == 0) {
-                buffers.back().uploadData(device, transforms, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            } else {
-                buffers.back().createEmpty(device, sizeof(ModelTransform) * transforms.size(),
-                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            }
-            if (lods[model.meshes[mesh].name].size() > 1) {  // if model is LoDed, we need metadata.
-                lodMetaBuffersMap[std::pair(mesh, i)] = buffers.size();
-                buffers.push_back({});
-                size_t bufferSizeUints = (transforms.size() / 32 + 1) + 2;
-                if (i == 0) {
-                    std::vector<uint32_t> bufferData;
-                    bufferData.resize(bufferSizeUints, static_cast<unsigned int>(~0));
-                    bufferData[0] = transforms.size();
-                    bufferData[1] = transforms.size();
-                    buffers.back().uploadData(device, bufferData,
-                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-                } else {
-                    buffers.back().createEmpty(device, sizeof(glm::uint32) * bufferSizeUints,
-                                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-                }
-            }
+        auto &lodList = lods[model.meshes[mesh].name];
+        if (lodList.empty()) {
+            continue;
+        }
+        if (model.meshes[mesh].name.starts_with("BUTTERFLY_")) {
+            continue; // drawn with the positions of butterflies.comp
+        }
+
+        // Meshes without LoDs are a chain of one, so that all instances are culled in the same pass.
+        std::vector<int> lodMeshes;
+        for (auto &lod: lodList) {
+            lodMeshes.push_back(lod.mesh);
+        }
+        glm::vec4 boundingSphere = InstanceCulling::computeBoundingSphere(model, lodMeshes);
+
+        // Every LoD gets a region large enough for all instances of the mesh in the shared transforms buffer.
+        uint32_t firstLoD = lodSelectionRanges.size();
+        for (int i = 0; i < lodList.size(); i++) {
+            lodSelectionIndexMap[std::pair(mesh, i)] = lodSelectionRanges.size();
+            lodSelectionRanges.push_back({lodList[i].dist_min, lodList[i].dist_max, numSelectedTransforms, 0});
+            numSelectedTransforms += transforms.size();
         }
+        for (size_t first = 0; first < transforms.size(); first += LOD_SELECTION_WORKGROUP_SIZE) {
+            lodWorkgroups.push_back({
+                firstLoD, (uint32_t) lodList.size(), (uint32_t) (lodInstances.size() + first),
+                (uint32_t) std::min<size_t>(LOD_SELECTION_WORKGROUP_SIZE, transforms.size() - first),
+                boundingSphere,
+            });
+        }
+        lodInstances.insert(lodInstances.end(), transforms.begin(), transforms.end());
+    }
+
+    numLoDSelectionWorkgroups = lodWorkgroups.size();
+    if (numLoDSelectionWorkgroups > 0) {
+        // The inputs and outputs of select_lods.comp can be read back by checkCulling
+        lodInstancesBuffer = buffers.size();
+        buffers.push_back({});
+        buffers.back().uploadData(device, lodInstances,
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        lodWorkgroupsBuffer = buffers.size();
+        buffers.push_back({});
+        buffers.back().uploadData(device, lodWorkgroups,
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        lodRangesBuffer = buffers.size();
+        buffers.push_back({});
+        buffers.back().uploadData(device, lodSelectionRanges, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        // finished workgroups and one instance count per LoD
+        lodCountersBuffer = buffers.size();
+        buffers.push_back({});
+        buffers.back().createEmpty(device, sizeof(uint32_t) * (1 + lodSelectionRanges.size()),
+                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        lodTransformsBuffer = buffers.size();
+        buffers.push_back({});
+        buffers.back().createEmpty(device, sizeof(ModelTransform) * numSelectedTransforms,
+                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        cullingBuffer.allocate(device, sizeof(CullingData), Swapchain::framesInFlight);
     }
 
     std::vector<LightData> allLights;
@@ -860,7 +1009,7 @@ void Scene::setupStorageBuffers() {
             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     }
 
-    materialBuffer.allocate(device, sizeof(MaterialSettings), MAX_FRAMES_IN_FLIGHT);
+    materialBuffer.allocate(device, sizeof(MaterialSettings), Swapchain::framesInFlight);
 }
 
 Scene::PointLightCount Scene::getPointLights() {
@@ -869,8 +1018,10 @@ Scene::PointLightCount Scene::getPointLights() {
 
 void Scene::destroyBuffers() {
     for (auto buffer: buffers) buffer.destroy(device);
+    geometry.destroy(device);
     butterfliesMetaBuffer.destroy(device);
     materialBuffer.destroy(device);
+    cullingBuffer.destroy(device);
 }
 
 std::tuple<std::vector<VkVertexInputAttributeDescription>, std::vector<VkVertexInputBindingDescription>>
@@ -915,33 +1066,17 @@ Scene::getLightsAttributeAndBindingDescriptions() {
     return {attributeDescriptions, bindingDescriptions};
 }
 
-VkVertexInputBindingDescription Scene::getVertexBindingDescription(int accessor, int bindingId) {
-    VkVertexInputBindingDescription bindingDescription;
-
-    bindingDescription.binding = bindingId;
-    bindingDescription.stride = VulkanHelper::strideFromGltfType(
-            model.accessors[accessor].type,
-            model.accessors[accessor].componentType,
-            model.bufferViews[model.accessors[accessor].bufferView].byteStride);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    return bindingDescription;
-}
-
 void Scene::ensureDescriptorSetLayouts() {
-    if (lodUpdateDescriptorSetLayout == VK_NULL_HANDLE) {
-        lodUpdateDescriptorSetLayout = device->createDescriptorSetLayout(
-            {
-                vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-                vkutil::createSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-                vkutil::createSetLayoutBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-                vkutil::createSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-                vkutil::createSetLayoutBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-                vkutil::createSetLayoutBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-            }
-        );
+    if (lodSelectionDescriptorSetLayout == VK_NULL_HANDLE) {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        for (uint32_t binding = 0; binding <= 11; binding++) {
+            bindings.push_back(vkutil::createSetLayoutBinding(binding,
+                binding == 8 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT));
+        }
+        lodSelectionDescriptorSetLayout = device->createDescriptorSetLayout(bindings);
     }
 
-
     if (updateButterfliesDescriptorSetLayout == VK_NULL_HANDLE) {
         updateButterfliesDescriptorSetLayout = device->createDescriptorSetLayout(
             {
@@ -960,83 +1095,57 @@ void Scene::ensureDescriptorSetLayouts() {
         );
     }
 
-    if (lodCompressDescriptorSetLayout == VK_NULL_HANDLE) {
-        lodCompressDescriptorSetLayout = device->createDescriptorSetLayout(
-            {
-                vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-                vkutil::createSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT),
-            }
-        );
-    }
-
     if (meshTransformsDescriptorSetLayout == VK_NULL_HANDLE) {
         meshTransformsDescriptorSetLayout = device->createDescriptorSetLayout({
             vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
         });
     }
 
-    if (albedoDSLayout == VK_NULL_HANDLE) {
-        albedoDSLayout = device->createDescriptorSetLayout({
-            vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT),
-        });
-    }
-
-    if (emissiveTextureDSLayout == VK_NULL_HANDLE) {
-        emissiveTextureDSLayout = device->createDescriptorSetLayout({
-            vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT),
-            vkutil::createSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT),
-        });
-    }
-
-    if (albedoDisplacementDSLayout == VK_NULL_HANDLE) {
-        albedoDisplacementDSLayout = device->createDescriptorSetLayout({
-            vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT),
-            vkutil::createSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT),
-            vkutil::createSetLayoutBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT),
-            vkutil::createSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT),
-        });
-    }
-
-    if (materialsSettingsLayout == VK_NULL_HANDLE) {
-        materialsSettingsLayout = device->createDescriptorSetLayout({
-            vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT),
+    if (materialsDescriptorSetLayout == VK_NULL_HANDLE) {
+        // The texture array is sized for the loaded textures, partially bound for scenes without any.
+        auto texturesBinding = vkutil::createSetLayoutBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                              VK_SHADER_STAGE_FRAGMENT_BIT);
+        texturesBinding.descriptorCount = std::max<uint32_t>(textures.size(), 1);
+        materialsDescriptorSetLayout = device->createDescriptorSetLayout({
+            vkutil::createSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
+            vkutil::createSetLayoutBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT),
+            vkutil::createSetLayoutBinding(2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT),
+            texturesBinding,
+        }, {
+            0,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT, // scenes without draws
+            0,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
         });
     }
 }
 
 void Scene::destroyDescriptorSetLayouts() {
     vkDestroyDescriptorSetLayout(*device, meshTransformsDescriptorSetLayout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, albedoDSLayout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, albedoDisplacementDSLayout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, materialsSettingsLayout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, lodUpdateDescriptorSetLayout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, lodCompressDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(*device, materialsDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(*device, lodSelectionDescriptorSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(*device, updateButterfliesDescriptorSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(*device, renderButterfliesDescriptorSetLayout, nullptr);
-    vkDestroyDescriptorSetLayout(*device, emissiveTextureDSLayout, NULL);
 }
 
-void calculateBoundingBox(const tinygltf::Model &model, glm::vec3 &minBounds, glm::vec3 &maxBounds) {
+void calculateBoundingBox(const tinygltf::Model &model, const std::map<int, glm::mat4> &meshDequantization,
+                          glm::vec3 &minBounds, glm::vec3 &maxBounds) {
     minBounds = glm::vec3(std::numeric_limits<float>::max());
     maxBounds = glm::vec3(-std::numeric_limits<float>::max());
 
-    for (const auto &mesh: model.meshes) {
-        for (const auto &primitive: mesh.primitives) {
+    for (size_t meshIndex = 0; meshIndex < model.meshes.size(); meshIndex++) {
+        glm::mat4 dequantization = meshDequantization.contains(meshIndex) ?
+            meshDequantization.at(meshIndex) : glm::mat4(1.0f);
+
+        for (const auto &primitive: model.meshes[meshIndex].primitives) {
             const auto &attributes = primitive.attributes;
             if (attributes.find("POSITION") != attributes.end()) {
-                const int accessorIdx = attributes.at("POSITION");
-                const auto &accessor = model.accessors[accessorIdx];
-                const auto &bufferView = model.bufferViews[accessor.bufferView];
-                const auto &buffer = model.buffers[bufferView.buffer];
-                const size_t byteStride = accessor.ByteStride(bufferView);
-
-                for (size_t i = 0; i < accessor.count; ++i) {
-                    const int pos = bufferView.byteOffset + accessor.byteOffset + i * byteStride;
-                    const float *ptr = reinterpret_cast<const float *>(&buffer.data[pos]);
-                    for (int j = 0; j < 3; ++j) {
-                        minBounds[j] = std::min(minBounds[j], ptr[j]);
-                        maxBounds[j] = std::max(maxBounds[j], ptr[j]);
-                    }
+                const auto &accessor = model.accessors[attributes.at("POSITION")];
+                for (const auto &position: MeshQuantizer::readVec3(model, accessor)) {
+                    const auto p = glm::vec3(dequantization * glm::vec4(position, 1.0f));
+                    minBounds = glm::min(minBounds, p);
+                    maxBounds = glm::max(maxBounds, p);
                 }
             }
         }
@@ -1060,7 +1169,7 @@ void Scene::computeDefaultCameraPos(glm::vec3 &lookAt, glm::vec3 &position, glm:
     // Compute bbox of the meshes, point to the middle and have a small distance
     // This works only for small test models, for bigger models, export a camera!
     glm::vec3 min, max;
-    calculateBoundingBox(model, min, max);
+    calculateBoundingBox(model, meshDequantization, min, max);
 
     fovy = 45.0f;
     lookAt = (min + max) / 2.0f;
@@ -1124,6 +1233,7 @@ Scene::LoadedTexture uploadGLTFImage(VulkanDevice *device, const tinygltf::Image
 }
 
 void Scene::setupTextures() {
+    PROFILE_SCOPE("Scene::setupTextures");
     const auto& loadTexture = [&] (int textureIdx) {
 
         // We have a texture here
@@ -1137,7 +1247,10 @@ void Scene::setupTextures() {
             throw std::runtime_error("Image with negative dimensions, maybe a missing asset!");
         }
 
+        PROFILE_SCOPE("Texture upload");
+        uint32_t slot = textures.size();
         textures[gTexture.source] = uploadGLTFImage(device, image);
+        textures[gTexture.source].slot = slot;
         textures[gTexture.source].imageView =
             device->createImageView(textures[gTexture.source].image, textures[gTexture.source].imageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
         textures[gTexture.source].sampler = VulkanHelper::createSampler(device, true);
@@ -1163,6 +1276,52 @@ void Scene::setupTextures() {
             loadTexture(material.emissiveTexture.index);
         }
     }
+
+    setupMaterials();
+}
+
+void Scene::setupMaterials() {
+    const auto& findSlot = [&] (int gltfId) {
+        return textures[model.textures[gltfId].source].slot;
+    };
+
+    // Everything the shaders need to know about a material, so that nothing is looked up while recording draws.
+    std::vector<MaterialData> materials(std::max<size_t>(model.materials.size(), 1));
+    for (size_t i = 0; i < model.materials.size(); i++) {
+        const auto &material = model.materials[i];
+        auto &data = materials[i];
+
+        if (materialUsesBaseTexture(material)) {
+            data.albedoTexture = findSlot(material.values.find(BASE_COLOR_TEXTURE)->second.TextureIndex());
+        }
+        if (materialUsesEmissiveTexture(material)) {
+            data.emissiveTexture = findSlot(material.emissiveTexture.index);
+        }
+        if (materialUsesNormalTexture(material)) {
+            data.normalTexture = findSlot(material.normalTexture.index);
+            // Without a height map, the normal texture is mapped as both, the shader only reads the normals then.
+            data.heightTexture = data.normalTexture;
+            if (materialUsesDisplacedTexture(material)) {
+                data.heightTexture = findSlot(material.occlusionTexture.index);
+                data.normalMapOnly = 0;
+            }
+        }
+        data.reflectivity = materialUsesSSR(material) ? 1.0f : 0.0f;
+
+        if (material.emissiveFactor.size() >= 3) {
+            data.emissiveColor = glm::vec4(material.emissiveFactor[0], material.emissiveFactor[1],
+                                           material.emissiveFactor[2], 1 / 255.f);
+        }
+        auto strength = material.extensions.find("KHR_materials_emissive_strength");
+        if (strength != material.extensions.end()) {
+            data.emissiveColor.a = strength->second.Get("emissiveStrength").GetNumberAsDouble() / 255.f;
+        }
+    }
+
+    materialDataBuffer = buffers.size();
+    buffers.push_back({});
+    buffers.back().uploadData(device, materials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 }
 
 void Scene::destroyTextures() {
@@ -1179,41 +1338,78 @@ void Scene::destroyAll() {
     destroyTextures();
     destroyBuffers();
     destroyPipelines();
+    depthPyramid.reset();
+    cachedCompute.reset();
+    cachedDraws.clear();
+    cachedDepthPyramid.reset();
 }
 
 void Scene::destroyPipelines() {
     graphicsPipelines.clear();
-    updateLoDsPipeline.reset();
-    compressLoDsPipeline.reset();
+    invalidateCommandBuffers();
+    selectLoDsPipeline.reset();
     updateButterfliesPipeline.reset();
 }
 
 void Scene::createPipelines(VkRenderPass renderPass, VkDescriptorSetLayout mvpLayout, bool forceRecompile) {
     destroyPipelines();
-    for (auto &[descr, _]: meshPrimitivesWithPipeline) {
-        createPipelinesWithDescription(descr, renderPass, mvpLayout, forceRecompile);
+    this->renderPass = renderPass;
+    PipelineSwap swap;
+    createPipelines(renderPass, mvpLayout, forceRecompile, swap);
+    swap.apply();
+}
+
+void Scene::createPipelines(VkRenderPass renderPass, VkDescriptorSetLayout mvpLayout, bool forceRecompile,
+                            PipelineSwap &swap) {
+    PROFILE_SCOPE("Scene::createPipelines");
+    // Many primitives share a pipeline, create every distinct one once and spread them over all threads.
+    std::set<PipelineDescription> uniqueDescriptions;
+    for (auto &[_, descr]: primitivePipelines) {
+        uniqueDescriptions.insert(descr);
+    }
+    std::vector<PipelineDescription> descriptions(uniqueDescriptions.begin(), uniqueDescriptions.end());
+    std::vector<std::unique_ptr<GraphicsPipeline>> pipelines(descriptions.size());
+    std::vector<std::exception_ptr> errors(descriptions.size());
+    ensureDescriptorSetLayouts();
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int) descriptions.size(); i++) {
+        try {
+            PROFILE_SCOPE("Create pipeline");
+            pipelines[i] = createPipelineWithDescription(descriptions[i], renderPass, mvpLayout, forceRecompile);
+        } catch (...) {
+            // Exceptions must not leave the parallel region.
+            errors[i] = std::current_exception();
+        }
+    }
+    for (auto &error: errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    std::map<PipelineDescription, std::unique_ptr<GraphicsPipeline>> newPipelines;
+    for (size_t i = 0; i < descriptions.size(); i++) {
+        newPipelines[descriptions[i]] = std::move(pipelines[i]);
     }
+    swap.replace(graphicsPipelines, std::move(newPipelines));
+
     ComputePipeline::Parameters butterfliesParams{};
     butterfliesParams.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/butterflies.comp"};
     butterfliesParams.recompileShaders = forceRecompile;
     butterfliesParams.descriptorSetLayouts = {updateButterfliesDescriptorSetLayout};
-    this->updateButterfliesPipeline = std::make_unique<ComputePipeline>(device, butterfliesParams);
-
-    ComputePipeline::Parameters updateParams{};
-    updateParams.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/update_lods.comp"};
-    updateParams.recompileShaders = forceRecompile;
-    updateParams.descriptorSetLayouts = {lodUpdateDescriptorSetLayout};
-    VkPushConstantRange lodInfoRange{};
-    lodInfoRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    lodInfoRange.size = sizeof(LodUpdatePushConstants);
-    updateParams.pushConstantRanges.push_back(lodInfoRange);
-    this->updateLoDsPipeline = std::make_unique<ComputePipeline>(device, updateParams);
-
-    ComputePipeline::Parameters compressParams{};
-    compressParams.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/compress_lods.comp"};
-    compressParams.recompileShaders = forceRecompile;
-    compressParams.descriptorSetLayouts = {lodCompressDescriptorSetLayout};
-    this->compressLoDsPipeline = std::make_unique<ComputePipeline>(device, compressParams);
+    swap.replace(updateButterfliesPipeline, std::make_unique<ComputePipeline>(device, butterfliesParams));
+
+    ComputePipeline::Parameters selectParams{};
+    selectParams.source = {VK_SHADER_STAGE_COMPUTE_BIT, "shaders/select_lods.comp"};
+    selectParams.recompileShaders = forceRecompile;
+    selectParams.descriptorSetLayouts = {lodSelectionDescriptorSetLayout};
+    swap.replace(selectLoDsPipeline, std::make_unique<ComputePipeline>(device, selectParams));
+    depthPyramid->createPipeline(forceRecompile, swap);
+
+    // The baked draws and cached command buffers reference the replaced pipelines.
+    swap.onApply([this]() {
+        invalidateCommandBuffers();
+    });
 }
 
 static ShaderList selectShaders(const PipelineDescription &descr) {
@@ -1286,24 +1482,26 @@ static ShaderList selectShaders(const PipelineDescription &descr) {
     };
 }
 
-void Scene::createPipelinesWithDescription(PipelineDescription descr, VkRenderPass renderPass,
-                                           VkDescriptorSetLayout mvpLayout, bool forceRecompile) {
-    if (graphicsPipelines.count(descr)) {
-        return;
-    }
-
+std::unique_ptr<GraphicsPipeline> Scene::createPipelineWithDescription(const PipelineDescription &descr,
+                                                                      VkRenderPass renderPass,
+                                                                      VkDescriptorSetLayout mvpLayout,
+                                                                      bool forceRecompile) {
     std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
     std::vector<VkVertexInputBindingDescription> bindingDescriptions;
-    const auto &addAttributeAndBinding = [&](int location, int binding, int accessor) {
+    // The streams in GeometryBuffers are tightly packed, one binding per attribute.
+    const auto &addAttributeAndBinding = [&](int location, int binding) {
         VkVertexInputAttributeDescription description{};
         description.binding = binding;
         description.location = location;
-        description.format = VulkanHelper::gltfTypeToVkFormat(model.accessors[accessor].type,
-                                                              model.accessors[accessor].componentType,
-                                                              model.accessors[accessor].normalized);
+        description.format = descr.vertexLayout.attributes[binding].format;
         description.offset = 0;
         attributeDescriptions.push_back(description);
-        bindingDescriptions.push_back(getVertexBindingDescription(accessor, binding));
+
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = binding;
+        bindingDescription.stride = descr.vertexLayout.attributes[binding].size;
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        bindingDescriptions.push_back(bindingDescription);
     };
 
     if (!descr.vertexPosAccessor) {
@@ -1316,36 +1514,19 @@ void Scene::createPipelinesWithDescription(PipelineDescription descr, VkRenderPa
 
     PipelineParameters params;
 
-    ensureDescriptorSetLayouts();
-    std::vector<VkDescriptorSetLayout> dsLayouts{mvpLayout, meshTransformsDescriptorSetLayout};
-    addAttributeAndBinding(0, 0, *descr.vertexPosAccessor);
-    addAttributeAndBinding(2, 2, *descr.vertexNormalAccessor);
-    if (descr.vertexFixedColorAccessor.has_value()) {
-        addAttributeAndBinding(1, 1, *descr.vertexFixedColorAccessor);
-    } else if (descr.vertexTexcoordsAccessor.has_value()) {
-        addAttributeAndBinding(1, 1, *descr.vertexTexcoordsAccessor);
-
-        if (descr.useEmissiveTexture) {
-            dsLayouts.push_back(emissiveTextureDSLayout);
-        }
-        else if (descr.useNormalMap) {
-            dsLayouts.push_back(albedoDisplacementDSLayout);
-            dsLayouts.push_back(materialsSettingsLayout);
-            params.pushConstants.push_back(VkPushConstantRange{
-                .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-                .offset = 0,
-                .size = sizeof(DisplacementPushConstants),
-            });
-        } else {
-            dsLayouts.push_back(albedoDSLayout);
-        }
-    } else if (descr.useEmissiveColor) {
-        params.pushConstants.push_back({
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-            .offset = 0,
-            .size = sizeof(EmissiveColor)
-        });
-    } else {
+    // All scene pipelines share one layout, the material of a draw is found with the first draw of its batch.
+    std::vector<VkDescriptorSetLayout> dsLayouts{mvpLayout, meshTransformsDescriptorSetLayout,
+                                                 materialsDescriptorSetLayout};
+    params.pushConstants.push_back(VkPushConstantRange{
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(uint32_t),
+    });
+    addAttributeAndBinding(0, 0);
+    addAttributeAndBinding(2, 2);
+    if (descr.vertexFixedColorAccessor.has_value() || descr.vertexTexcoordsAccessor.has_value()) {
+        addAttributeAndBinding(1, 1);
+    } else if (!descr.useEmissiveColor) {
         throw std::runtime_error("Mesh primitive without color or texcoords is not supported by shaders!");
     }
 
@@ -1354,7 +1535,6 @@ void Scene::createPipelinesWithDescription(PipelineDescription descr, VkRenderPa
     params.vertexAttributeDescription = attributeDescriptions;
     params.vertexInputDescription = bindingDescriptions;
     params.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    params.extent = swapchain->renderSize();
     params.backFaceCulling = descr.isOpaque;
 
     // We don't want any blending for the color attachments (-1 for the depth attachment)
@@ -1364,8 +1544,9 @@ void Scene::createPipelinesWithDescription(PipelineDescription descr, VkRenderPa
     params.descriptorSetLayouts = dsLayouts;
 
     params.isButterfly = descr.isButterfly;
+    params.specializationConstants[0] = descr.octahedralNormals;
 
-    graphicsPipelines[descr] = std::make_unique<GraphicsPipeline>(device, renderPass, 0, params);
+    return std::make_unique<GraphicsPipeline>(device, renderPass, 0, params);
 }
 
 static void setFromCamera(glm::vec3& lookAt, glm::vec3& position, glm::vec3& up,
@@ -1389,8 +1570,26 @@ void Scene::cameraButtons(glm::vec3& lookAt, glm::vec3& position, glm::vec3& up,
     }
 }
 
-void Scene::updateBuffers(float sceneTime, glm::vec3 cameraPosition, float timeDelta) {
+void Scene::updateBuffers(float sceneTime, glm::vec3 cameraPosition, float timeDelta,
+                          const glm::mat4 &viewProjection) {
     materialBuffer.update(&materialSettings, sizeof(materialSettings), swapchain->currentFrame);
+
+    if (numLoDSelectionWorkgroups > 0) {
+        CullingData culling{};
+        auto planes = InstanceCulling::frustumPlanes(viewProjection);
+        std::copy(planes.begin(), planes.end(), culling.frustumPlanes);
+        culling.pyramidViewProjection = pyramidViewProjection;
+        std::copy(depthPyramid->levels.begin(), depthPyramid->levels.end(), culling.pyramidLevels);
+        culling.cameraPosition = cameraPosition;
+        culling.numDrawCommands = numDrawCommands;
+        culling.numPyramidLevels = depthPyramid->levels.size();
+        culling.frustumCulling = enableFrustumCulling;
+        culling.occlusionCulling = enableOcclusionCulling && depthPyramid->isValid;
+        cullingBuffer.update(&culling, sizeof(culling), swapchain->currentFrame);
+        currentViewProjection = viewProjection;
+        lastCulling = culling;
+    }
+
     ButterfliesMeta butterfliesMeta{};
     butterfliesMeta.time = sceneTime;
     butterfliesMeta.cameraPosition = cameraPosition;
@@ -1411,6 +1610,86 @@ void Scene::drawImGUIMaterialSettings() {
     }
 }
 
+void Scene::drawImGUICullingSettings() {
+    if (ImGui::CollapsingHeader("Culling Settings")) {
+        ImGui::Checkbox("Frustum Culling", &enableFrustumCulling);
+        ImGui::Checkbox("Occlusion Culling", &enableOcclusionCulling);
+        if (numLoDSelectionWorkgroups > 0 && ImGui::Button("Compare with CPU reference")) {
+            cullingCheckRequested = true;
+        }
+    }
+}
+
+bool Scene::checkCulling() {
+    cullingCheckRequested = false;
+    if (numLoDSelectionWorkgroups == 0) {
+        return true;
+    }
+    vkDeviceWaitIdle(*device);
+
+    // Every level of the pyramid built after the last frame has to be the reduction of the level below.
+    const auto &levels = depthPyramid->levels;
+    auto pyramid = depthPyramid->buffer.readData<float>(device, InstanceCulling::pyramidSize(levels));
+    size_t pyramidMismatches = 0;
+    if (depthPyramid->isValid) {
+        auto expectedPyramid = InstanceCulling::buildDepthPyramid(pyramid, levels);
+        for (size_t i = 0; i < pyramid.size(); i++) {
+            pyramidMismatches += pyramid[i] != expectedPyramid[i];
+        }
+    }
+
+    // The selection of the last frame used the pyramid before, so select again with the view of the last frame
+    // against the current one. The culling data is overwritten by the next frame anyway.
+    CullingData culling = lastCulling;
+    culling.pyramidViewProjection = pyramidViewProjection;
+    std::copy(levels.begin(), levels.end(), culling.pyramidLevels);
+    culling.numPyramidLevels = levels.size();
+    culling.occlusionCulling = enableOcclusionCulling && depthPyramid->isValid;
+    cullingBuffer.update(&culling, sizeof(culling), swapchain->currentFrame);
+
+    VkCommandBuffer commandBuffer = device->beginSingleTimeCommands();
+    recordLoDSelection(commandBuffer);
+    device->endSingleTimeCommands(commandBuffer);
+
+    auto instances = buffers[lodInstancesBuffer].readData<glm::mat4>(
+        device, buffers[lodInstancesBuffer].size / sizeof(glm::mat4));
+    auto workgroups = buffers[lodWorkgroupsBuffer].readData<LoDSelectionWorkgroup>(device, numLoDSelectionWorkgroups);
+    auto counters = buffers[lodCountersBuffer].readData<uint32_t>(device, 1 + lodSelectionRanges.size());
+    auto transforms = buffers[lodTransformsBuffer].readData<glm::mat4>(
+        device, buffers[lodTransformsBuffer].size / sizeof(glm::mat4));
+    auto expected = InstanceCulling::selectInstances(instances, workgroups, lodSelectionRanges, culling, pyramid,
+                                                     transforms.size());
+
+    // The order within a LoD depends on the scheduling of the workgroups, only the sets of transforms are compared.
+    const auto &sorted = [](std::vector<glm::mat4>::iterator begin, std::vector<glm::mat4>::iterator end) {
+        std::vector<glm::mat4> result(begin, end);
+        std::sort(result.begin(), result.end(), [](const glm::mat4 &a, const glm::mat4 &b) {
+            return std::lexicographical_compare(&a[0][0], &a[0][0] + 16, &b[0][0], &b[0][0] + 16);
+        });
+        return result;
+    };
+    size_t rangeMismatches = 0;
+    uint32_t visible = 0;
+    uint32_t expectedVisible = 0;
+    for (size_t i = 0; i < lodSelectionRanges.size(); i++) {
+        uint32_t count = counters[1 + i];
+        uint32_t expectedCount = expected.lodCounts[i];
+        visible += count;
+        expectedVisible += expectedCount;
+        auto first = lodSelectionRanges[i].firstOutput;
+        if (count != expectedCount ||
+            sorted(transforms.begin() + first, transforms.begin() + first + count) !=
+            sorted(expected.transforms.begin() + first, expected.transforms.begin() + first + count)) {
+            rangeMismatches++;
+        }
+    }
+
+    std::cout << "[culling] GPU selected " << visible << " instances, the CPU reference " << expectedVisible << ". "
+              << rangeMismatches << " of " << lodSelectionRanges.size() << " LoDs and " << pyramidMismatches
+              << " of " << pyramid.size() << " depth pyramid texels differ." << std::endl;
+    return rangeMismatches == 0 && pyramidMismatches == 0;
+}
+
 void Scene::addLoD(int meshIndex) {
     tinygltf::Mesh mesh = model.meshes[meshIndex];
     auto name = mesh.name;
@@ -1452,6 +1731,44 @@ void Scene::addLoD(int meshIndex) {
     lods[name].push_back(lod);
 }
 
+void Scene::quantizeMeshes() {
+    // All LoDs of a mesh are drawn with the transforms of the base mesh, so they must share the dequantization.
+    // Butterflies and the butterfly volume are not drawn with the mesh transforms and stay unquantized.
+    std::set<int> excludedMeshes;
+    for (auto &node: model.nodes) {
+        if (node.name == "BUTTERFLYVOLUME" && node.mesh >= 0) {
+            excludedMeshes.insert(node.mesh);
+        }
+    }
+
+    std::vector<std::vector<int>> meshGroups;
+    for (auto &[basename, lodList]: lods) {
+        if (basename.starts_with("BUTTERFLY_")) continue;
+
+        std::vector<int> group;
+        for (auto &lod: lodList) {
+            if (!excludedMeshes.contains(lod.mesh)) {
+                group.push_back(lod.mesh);
+            }
+        }
+
+        if (group.size() == lodList.size()) {
+            meshGroups.push_back(group);
+        }
+    }
+
+    auto result = MeshQuantizer::quantizeModel(model, meshGroups);
+    meshDequantization = std::move(result.dequantization);
+    halfFloatAccessors = std::move(result.halfFloatAccessors);
+}
+
+glm::mat4 Scene::getDequantization(int meshIndex) {
+    if (meshDequantization.contains(meshIndex)) {
+        return meshDequantization[meshIndex];
+    }
+    return glm::mat4(1.0f);
+}
+
 std::vector<glm::vec3> Scene::computeButterflyVolumeVertices() {
     std::vector<glm::vec3> vertices;
     for (auto primitive: model.meshes[butterflyVolumeMesh].primitives) {
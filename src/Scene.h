@@ -5,6 +5,7 @@
 #define JUNGLE_SCENE_H
 
 #include <memory>
+#include <set>
 #include <vulkan/vulkan.h>
 #include <vector>
 #include <glm/glm.hpp>
@@ -15,6 +16,12 @@
 #include "tiny_gltf.h"
 #include "PhysicalDevice.h"
 #include "DataBuffer.h"
+#include "CommandBufferCache.h"
+#include "CommandRecorder.h"
+#include "DepthPyramid.h"
+#include "GeometryBuffers.h"
+#include "InstanceCulling.h"
+#include "PipelineSwap.h"
 
 struct ModelTransform {
     glm::mat4 model;
@@ -41,11 +48,6 @@ struct alignas(16) ButterfliesMeta {
     int bufferflyVolumeTriangleCount;
 };
 
-struct LodUpdatePushConstants {
-    glm::vec4 lodMeta;
-    glm::vec3 cameraPosition;
-};
-
 struct LoD {
     int mesh;
     float dist_min;
@@ -73,13 +75,21 @@ struct PipelineDescription {
 
     bool useSSR = false;
     bool useNormalMap = false;
-    bool useDisplacement = false;
 
     bool isOpaque = true;
 
+    // NORMAL is a VEC2 accessor with octahedral-encoded normals (see MeshQuantizer)
+    bool octahedralNormals = false;
+
+    // Formats of the attributes in the shared vertex buffers. The accessors above only tell which attributes are
+    // used, so that primitives of different meshes share a pipeline and their draws can be merged.
+    VertexLayout vertexLayout;
+
     auto toTuple() const {
-        return std::make_tuple(vertexPosAccessor, vertexTexcoordsAccessor, vertexFixedColorAccessor,
-            useNormalMap, useDisplacement, useSSR);
+        return std::make_tuple(vertexLayout, vertexPosAccessor.has_value(), vertexTexcoordsAccessor.has_value(),
+            vertexFixedColorAccessor.has_value(), vertexNormalAccessor.has_value(),
+            useNormalMap, useSSR, octahedralNormals, isOpaque,
+            isButterfly, isWater, useEmissiveTexture, useEmissiveColor);
     }
 
     bool operator < (const PipelineDescription& other) const {
@@ -96,6 +106,20 @@ struct PipelineDescription {
     bool useEmissiveColor{false};
 };
 
+// Per-material data of the bindless material buffer, must match Material in material.glsl
+struct MaterialData {
+    // rgb, strength (cast to 8 bit float)
+    glm::vec4 emissiveColor{0.0f};
+    // indices into the scene texture array
+    glm::uint32_t albedoTexture = 0;
+    glm::uint32_t emissiveTexture = 0;
+    glm::uint32_t normalTexture = 0;
+    glm::uint32_t heightTexture = 0;
+    glm::int32_t normalMapOnly = 1;
+    glm::float32_t reflectivity = 0.0f;
+    glm::uint32_t padding[2]{};
+};
+
 struct MaterialSettings {
     glm::float32_t heightScale = 0.05;
     glm::int32_t raymarchSteps = 200;
@@ -112,19 +136,43 @@ public:
     explicit Scene(VulkanDevice *device, Swapchain *swapchain, std::string filename);
 
     void createPipelines(VkRenderPass renderPass, VkDescriptorSetLayout mvpLayout, bool forceRecompile);
+    // Create the pipelines for the same render pass into swap, the current ones stay in use until it is applied.
+    void createPipelines(VkRenderPass renderPass, VkDescriptorSetLayout mvpLayout, bool forceRecompile,
+                         PipelineSwap &swap);
 
     // free up all resources
     void destroyAll();
 
     void setupBuffers();
-    void updateBuffers(float sceneTime, glm::vec3 cameraPosition, float timeDelta);
+    void updateBuffers(float sceneTime, glm::vec3 cameraPosition, float timeDelta, const glm::mat4 &viewProjection);
 
     void setupTextures();
     void destroyTextures();
 
-    void setupDescriptorSets(VkDescriptorPool descriptorPool);
-    void recordCommandBufferCompute(VkCommandBuffer commandBuffer, glm::vec3 cameraPosition);
-    void recordCommandBufferDraw(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet);
+    void setupDescriptorSets(VkDescriptorPool descriptorPool, const RenderTarget &gBuffer);
+    void handleResize(const RenderTarget &gBuffer);
+    // The draws and the depth pyramid use Swapchain::activeRenderSize.
+    void handleRenderScaleChange();
+    // Jobs recording the culling compute, the draws and the depth pyramid into cached secondary command buffers (see
+    // CommandRecorder), which are only recorded again after pipelines or descriptor sets changed. mvpSet must be the
+    // same in every frame with the same frame in flight.
+    RecordingJob computeJob();
+    // The parts of the culling compute, without any synchronization with the frames before and the draws, for a
+    // compute queue next to the graphics queue (see AsyncCompute). They are recorded again every time.
+    void recordButterflyUpdate(VkCommandBuffer commandBuffer);
+    void recordLoDSelection(VkCommandBuffer commandBuffer);
+    // Up to maxJobs jobs for the scene render pass, each drawing a part of the draw batches.
+    std::vector<RecordingJob> drawJobs(VkDescriptorSet mvpSet, size_t maxJobs);
+    RecordingJob depthPyramidJob();
+    // Execute the commands of depthPyramidJob after the scene pass, if occlusion culling is used.
+    void executeDepthPyramid(VkCommandBuffer commandBuffer, VkCommandBuffer pyramidCommands);
+    // Record the given range of draw batches directly.
+    void recordDrawCommands(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet,
+                            size_t first = 0, size_t count = SIZE_MAX);
+    // The recording of the draws before they were baked, which looks up the pipeline and binds all sets and vertex
+    // buffers for every batch. Only kept as the baseline of --benchmark-recording.
+    void recordDrawCommandsUnbaked(VkCommandBuffer commandBuffer, VkDescriptorSet mvpSet);
+    size_t getNumDrawBatches();
 
     void destroyBuffers();
     std::tuple<std::vector<VkVertexInputAttributeDescription>, std::vector<VkVertexInputBindingDescription>>
@@ -152,11 +200,21 @@ public:
         VkImageView imageView;
         VkSampler sampler;
         VkFormat imageFormat;
+        // index in the texture array of the material descriptor set
+        uint32_t slot;
     };
 
     void drawPointLights(VkCommandBuffer buffer);
     void cameraButtons(glm::vec3 &lookAt, glm::vec3 &position, glm::vec3 &up, float &fovy, float &near, float &far);
     void drawImGUIMaterialSettings();
+    void drawImGUICullingSettings();
+
+    // Select the instances of the last frame again on the GPU and compare the visible instances and LoDs, as well as
+    // the levels of the depth pyramid, with the CPU reference in InstanceCulling. Waits for the device to be idle,
+    // returns whether everything matches.
+    bool checkCulling();
+    // Set by the button in the culling settings, the check has to run between frames.
+    bool cullingCheckRequested = false;
 
     tinygltf::Model model;
     std::map<int, std::vector<ModelTransform>> meshTransforms;
@@ -170,50 +228,120 @@ public:
 
     std::map<PipelineDescription, std::unique_ptr<GraphicsPipeline>> graphicsPipelines;
 
-    // meshPrimitivesWithPipeline[description][meshId] -> list of primitives of the mesh with given pipeline
-    std::map<PipelineDescription, std::map<LoD, std::vector<int>>> meshPrimitivesWithPipeline;
+    // (mesh, primitive) -> pipeline used to draw it
+    std::map<std::pair<int, int>, PipelineDescription> primitivePipelines;
     PipelineDescription getPipelineDescriptionForPrimitive(const tinygltf::Primitive& primitive);
 
-    void createPipelinesWithDescription(PipelineDescription descr,
+    // Called on several threads at once by createPipelines, must not modify the scene.
+    std::unique_ptr<GraphicsPipeline> createPipelineWithDescription(const PipelineDescription &descr,
         VkRenderPass renderPass, VkDescriptorSetLayout mvpLayout, bool forceRecompile);
 
-    void renderPrimitiveInstances(int meshId, int primitiveId,
-        VkCommandBuffer commandBuffer, const PipelineDescription& descr, VkPipelineLayout pipelineLayout);
-
-    void generateTransforms(int nodeIndex, glm::mat4 oldTransform, int maxRecursion);
+    // All draws of a pipeline, issued with a single vkCmdDrawIndexedIndirectCount.
+    struct DrawBatch {
+        PipelineDescription descr;
+        // region of the batch in the compacted draw commands
+        uint32_t firstDraw;
+        uint32_t maxDrawCount;
+    };
+    std::vector<DrawBatch> drawBatches;
+    GeometryBuffers geometry;
+
+    // A DrawBatch with all handles and offsets resolved, so that recording the draws touches no map or buffer index.
+    struct BakedDraw {
+        VkPipeline pipeline;
+        VkPipelineLayout layout;
+        // set 1, the selected transforms or the butterflies
+        VkDescriptorSet instanceSet;
+        // only bound if the vertex layout differs from the previous draw, or at the start of a draw job
+        bool bindVertexBuffers;
+        std::array<VkBuffer, GeometryBuffers::NUM_ATTRIBUTES> vertexBuffers;
+        VkBuffer drawBuffer;
+        VkDeviceSize drawOffset;
+        VkBuffer countBuffer;
+        VkDeviceSize countOffset;
+        uint32_t firstDraw;
+        uint32_t maxDrawCount;
+    };
+    std::vector<BakedDraw> bakedDraws;
+    // Set whenever pipelines or descriptor sets are recreated, the draws are baked again before the next recording.
+    bool drawListOutdated = true;
+    void bakeDrawList();
+
+    VkRenderPass renderPass{VK_NULL_HANDLE};
+    std::unique_ptr<CommandBufferCache> cachedCompute;
+    // one per draw job
+    std::vector<std::unique_ptr<CommandBufferCache>> cachedDraws;
+    static const size_t MIN_BATCHES_PER_DRAW_JOB = 8;
+    std::unique_ptr<CommandBufferCache> cachedDepthPyramid;
+    void recordComputeCommands(VkCommandBuffer commandBuffer);
+    void invalidateCommandBuffers();
+
+    void generateTransforms(int rootNode);
+    void addLight(tinygltf::Node &node, const glm::mat4 &transform);
+    // Per-instance transforms of a node with EXT_mesh_gpu_instancing
+    void addInstancedTransforms(tinygltf::Node &node, const glm::mat4 &nodeTransform);
     void ensureDescriptorSetLayouts();
 
-    VkVertexInputBindingDescription getVertexBindingDescription(int accessor, int bindingId);
     void setupStorageBuffers();
 
     VkDescriptorSetLayout meshTransformsDescriptorSetLayout{VK_NULL_HANDLE};
-    VkDescriptorSetLayout materialsSettingsLayout{VK_NULL_HANDLE};
-
-    VkDescriptorSetLayout albedoDSLayout{VK_NULL_HANDLE};
-    VkDescriptorSetLayout emissiveTextureDSLayout{VK_NULL_HANDLE};
-    VkDescriptorSetLayout albedoDisplacementDSLayout{VK_NULL_HANDLE};
+    // Set 2 of all scene pipelines: materials, materials of the compacted draws, settings and all textures
+    VkDescriptorSetLayout materialsDescriptorSetLayout{VK_NULL_HANDLE};
 
-    VkDescriptorSetLayout lodUpdateDescriptorSetLayout{VK_NULL_HANDLE};
-    VkDescriptorSetLayout lodCompressDescriptorSetLayout{VK_NULL_HANDLE};
+    VkDescriptorSetLayout lodSelectionDescriptorSetLayout{VK_NULL_HANDLE};
 
-    std::vector<VkDescriptorSet> meshTransformsDescriptorSets;
-    std::vector<VkDescriptorSet> updateLoDsDescriptorSets;
-    std::vector<VkDescriptorSet> compressLoDsDescriptorSets;
-    std::vector<VkDescriptorSet> materialSettingSets;
+    // All meshes except butterflies read their selected transforms from lodTransformsBuffer
+    VkDescriptorSet meshTransformsDescriptorSet{VK_NULL_HANDLE};
+    std::vector<VkDescriptorSet> lodSelectionDescriptorSets;
+    // one per frame in flight because of the material settings
+    std::vector<VkDescriptorSet> materialsDescriptorSets;
 
     std::map<int, int> buffersMap;
-    std::map<std::pair<int, int>, int> lodTransformsBuffersMap;
-    std::map<std::pair<int, int>, int> lodIndirectDrawBufferMap;
-    std::map<std::pair<int, int>, int> lodMetaBuffersMap;
-    std::map<LoD, int> descriptorSetsMap;
-    std::map<std::pair<int, int>, int> lodComputeDescriptorSetsMap;
 
+    // Draw commands sorted by batch. select_lods.comp compacts the ones with visible instances per batch into
+    // compactedDrawCommandsBuffer and counts them in drawCountsBuffer.
+    int drawCommandsBuffer{-1};
+    int compactedDrawCommandsBuffer{-1};
+    int drawCountsBuffer{-1};
+    int compactedDrawMaterialsBuffer{-1};
+    uint32_t numDrawCommands{0};
+
+    // GPU culling and LoD selection of all instances (except butterflies) in one dispatch of select_lods.comp
+    int lodInstancesBuffer{-1};
+    int lodWorkgroupsBuffer{-1};
+    int lodRangesBuffer{-1};
+    int lodCountersBuffer{-1};
+    int lodTransformsBuffer{-1};
+    int drawCommandInfosBuffer{-1};
+    uint32_t numLoDSelectionWorkgroups{0};
+    std::vector<LoDSelectionRange> lodSelectionRanges;
+    // (mesh, lod index) -> index into lodSelectionRanges
+    std::map<std::pair<int, int>, uint32_t> lodSelectionIndexMap;
+
+    bool enableFrustumCulling = true;
+    bool enableOcclusionCulling = true;
+    UniformBuffer cullingBuffer;
+    std::unique_ptr<DepthPyramid> depthPyramid;
+    glm::mat4 currentViewProjection{1.0f};
+    // view projection of the frame the depth pyramid was built from
+    glm::mat4 pyramidViewProjection{1.0f};
+    // culling parameters of the latest frame, for checkCulling
+    CullingData lastCulling{};
+    void updateLoDSelectionDescriptorSets();
+
+
+    // mesh index -> dequantization matrix for quantized positions, folded into the transforms of the mesh
+    std::map<int, glm::mat4> meshDequantization;
+    std::set<int> halfFloatAccessors;
+    void quantizeMeshes();
+    glm::mat4 getDequantization(int meshIndex);
 
     std::map<std::string, int> meshNameMap;
     std::map<std::string, std::vector<LoD>> lods; // map base names to LoDs. if none exist, just use the same
-    std::vector<VkDescriptorSet> bindingDescriptorSets;
     std::map<int, LoadedTexture> textures;
-    std::map<int, VkDescriptorSet> materialDSet;
+    // MaterialData of all glTF materials
+    int materialDataBuffer{-1};
+    void setupMaterials();
 
     static const unsigned int numButterflies = 128;
     std::map<int, int> butterflies;  // butterfly number to mesh index
@@ -240,13 +368,10 @@ public:
     UniformBuffer materialBuffer;
     void addLoD(int meshIndex);
 
-    std::unique_ptr<ComputePipeline> updateLoDsPipeline;
-
-    std::unique_ptr<ComputePipeline> compressLoDsPipeline;
+    std::unique_ptr<ComputePipeline> selectLoDsPipeline;
 
     void setupPrimitiveDrawBuffers();
 
-    unsigned int getNumLods();
 
     void destroyPipelines();
 
@@ -0,0 +1,236 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "ShaderCompiler.h"
+#include "CpuProfiler.h"
+#include "GlslIncluder.hpp"
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+
+extern bool useHWRaytracing;
+
+static const char *SHADER_DIRECTORY = "shaders";
+static const char *CACHE_DIRECTORY = "shaders/cache";
+// Increment when the compiler setup changes in a way the cache key does not capture
+static const uint32_t SHADER_CACHE_VERSION = 1;
+
+#ifdef NDEBUG
+ShaderCompiler::Profile ShaderCompiler::profile = ShaderCompiler::Profile::Release;
+#else
+ShaderCompiler::Profile ShaderCompiler::profile = ShaderCompiler::Profile::Debug;
+#endif
+
+// Guards the bookkeeping below
+static std::mutex cacheMutex;
+// Keys compiled or loaded by this process. forceCompile only distrusts entries of earlier runs, so these are used as is.
+static std::set<uint64_t> trustedKeys;
+// Held while a key is compiled, so that pipelines sharing a shader do not compile it twice
+static std::map<uint64_t, std::unique_ptr<std::mutex>> keyMutexes;
+// Last SPIR-V that compiled successfully per shader file, used while the shader has errors
+static std::map<std::string, std::vector<char>> lastValidCode;
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::vector<std::string> shaderMacros() {
+    if (useHWRaytracing) {
+        return {"USE_HW_RAYTRACING"};
+    }
+    return {};
+}
+
+static std::optional<shaderc_shader_kind> kindFromExtension(const std::string &extension) {
+    static const std::map<std::string, shaderc_shader_kind> kinds{
+        {".vert", shaderc_vertex_shader},
+        {".geom", shaderc_geometry_shader},
+        {".frag", shaderc_fragment_shader},
+        {".comp", shaderc_compute_shader},
+    };
+    if (!kinds.contains(extension)) {
+        return std::nullopt;
+    }
+    return kinds.at(extension);
+}
+
+static shaderc::CompileOptions createOptions(std::set<std::string> *dependencies) {
+    shaderc::CompileOptions options;
+    options.SetIncluder(std::make_unique<GlslIncluder>(dependencies));
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
+    if (ShaderCompiler::profile == ShaderCompiler::Profile::Release) {
+        options.SetOptimizationLevel(shaderc_optimization_level_performance);
+    } else {
+        options.SetOptimizationLevel(shaderc_optimization_level_zero);
+        options.SetGenerateDebugInfo();
+    }
+    for (auto &macro: shaderMacros()) {
+        options.AddMacroDefinition(macro);
+    }
+    return options;
+}
+
+// Everything but the source that selects the SPIR-V of a shader: stage, macros and profile
+static uint64_t variantKey(shaderc_shader_kind kind) {
+    uint64_t key = fnv1a(0xcbf29ce484222325ull, &SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION));
+    key = fnv1a(key, &kind, sizeof(kind));
+    key = fnv1a(key, &ShaderCompiler::profile, sizeof(ShaderCompiler::profile));
+    for (auto &macro: shaderMacros()) {
+        key = fnv1a(key, macro.c_str(), macro.size() + 1);
+    }
+    return key;
+}
+
+static uint64_t cacheKey(const std::string &preprocessedSource, uint64_t variant) {
+    return fnv1a(variant, preprocessedSource.data(), preprocessedSource.size());
+}
+
+static std::string hex(uint64_t value) {
+    std::stringstream result;
+    result << std::hex << std::setw(16) << std::setfill('0') << value;
+    return result.str();
+}
+
+// <source>.<variant>.<key>.spv, so that the entries of older versions of a source in the same variant can be found
+static std::string cacheFilename(const std::string &sourceName, uint64_t variant, uint64_t key) {
+    return std::string(CACHE_DIRECTORY) + "/" + sourceName + "." + hex(variant) + "." + hex(key) + ".spv";
+}
+
+// Delete the entries of a source and variant other than the given one, so that editing shaders does not grow the
+// cache without limit. Must be called with cacheMutex held, cached files are only read with it.
+static void removeOlderEntries(const std::string &sourceName, uint64_t variant, const std::string &spvFilename) {
+    auto prefix = sourceName + "." + hex(variant) + ".";
+    auto keep = std::filesystem::path(spvFilename).filename().string();
+    std::error_code error;
+    for (auto &entry: std::filesystem::directory_iterator(CACHE_DIRECTORY, error)) {
+        auto name = entry.path().filename().string();
+        if (name.starts_with(prefix) && name.ends_with(".spv") && name != keep) {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+}
+
+static std::mutex &keyMutex(uint64_t key) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto &mutex = keyMutexes[key];
+    if (!mutex) {
+        mutex = std::make_unique<std::mutex>();
+    }
+    return *mutex;
+}
+
+// Empty if the shader could not be compiled, message holds the errors then.
+static std::vector<char> compileShader(const std::string &filename, shaderc_shader_kind kind, bool forceCompile,
+                                       std::string &message) {
+    // shaderc compilers may be used by several threads concurrently
+    static shaderc::Compiler compiler;
+
+    if (!fileExists(filename)) {
+        message = "Non-existent shader file: " + filename;
+        return {};
+    }
+
+    auto sourceName = filename.substr(filename.find_last_of("/\\") + 1);
+    auto fileContent = readFile(filename);
+    std::string source(fileContent.begin(), fileContent.end());
+
+    std::set<std::string> dependencies;
+    auto options = createOptions(&dependencies);
+    auto preprocessed = compiler.PreprocessGlsl(source, kind, sourceName.c_str(), options);
+    if (preprocessed.GetCompilationStatus() != shaderc_compilation_status_success) {
+        message = "Shader compilation failed:\n" + preprocessed.GetErrorMessage();
+        return {};
+    }
+
+    uint64_t variant = variantKey(kind);
+    uint64_t key = cacheKey({preprocessed.cbegin(), preprocessed.cend()}, variant);
+    auto spvFilename = cacheFilename(sourceName, variant, key);
+
+    std::lock_guard<std::mutex> keyLock(keyMutex(key));
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        bool trusted = !forceCompile || trustedKeys.contains(key);
+        if (trusted && fileExists(spvFilename)) {
+            trustedKeys.insert(key);
+            return readFile(spvFilename);
+        }
+    }
+
+    PROFILE_SCOPE("Compile shader");
+    auto startTS = std::chrono::system_clock::now();
+    std::cout << "Compiling source file " << filename << std::endl;
+
+    auto result = compiler.CompileGlslToSpv(source, kind, sourceName.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        message = "Shader compilation failed:\n" + result.GetErrorMessage();
+        return {};
+    }
+    std::vector<char> code = {reinterpret_cast<const char *>(result.cbegin()),
+                              reinterpret_cast<const char *>(result.cend())};
+
+    auto endTS = std::chrono::system_clock::now();
+    std::cout << "Compilation of " << filename << " took " <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(endTS - startTS).count() << "ms" << std::endl;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::filesystem::create_directories(CACHE_DIRECTORY);
+    std::ofstream file(spvFilename, std::ios::binary);
+    if (file.is_open()) {
+        file.write(code.data(), (std::streamsize) code.size());
+        removeOlderEntries(sourceName, variant, spvFilename);
+    } else {
+        std::cout << "[shaders] WARN: Could not write cache file " << spvFilename << std::endl;
+    }
+    trustedKeys.insert(key);
+    return code;
+}
+
+std::tuple<std::vector<char>, std::string> ShaderCompiler::getShaderCode(const std::string &filename,
+                                                                         shaderc_shader_kind kind,
+                                                                         bool forceCompile) {
+    std::string message;
+    auto code = compileShader(filename, kind, forceCompile, message);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!code.empty()) {
+        lastValidCode[filename] = code;
+        return {code, message};
+    }
+    if (!lastValidCode.contains(filename)) {
+        throw std::runtime_error("Could not compile shader " + filename + ":\n" + message);
+    }
+    return {lastValidCode[filename], message};
+}
+
+void ShaderCompiler::compileAll(bool forceCompile) {
+    PROFILE_SCOPE("ShaderCompiler::compileAll");
+    std::vector<std::pair<std::string, shaderc_shader_kind>> shaders;
+    for (auto &entry: std::filesystem::directory_iterator(SHADER_DIRECTORY)) {
+        auto kind = kindFromExtension(entry.path().extension().string());
+        if (entry.is_regular_file() && kind.has_value()) {
+            shaders.emplace_back(entry.path().generic_string(), *kind);
+        }
+    }
+
+    auto startTS = std::chrono::system_clock::now();
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int) shaders.size(); i++) {
+        std::string message;
+        compileShader(shaders[i].first, shaders[i].second, forceCompile, message);
+    }
+    auto endTS = std::chrono::system_clock::now();
+    std::cout << "[shaders] Checked " << shaders.size() << " shaders in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(endTS - startTS).count() << "ms" << std::endl;
+}
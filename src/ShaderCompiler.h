@@ -0,0 +1,49 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_SHADERCOMPILER_H
+#define JUNGLE_SHADERCOMPILER_H
+
+#include <string>
+#include <tuple>
+#include <vector>
+#include <shaderc/shaderc.hpp>
+
+/**
+ * GLSL to SPIR-V compilation with a content addressed cache in shaders/cache/.
+ *
+ * The cache key is a hash of the preprocessed source, which contains all included files, together with the shader
+ * stage, the macro definitions and the compiler profile. Editing a shader or one of its includes, or toggling
+ * --hw-raytracing, thus selects a different entry instead of reusing stale SPIR-V. Only the latest entry of every
+ * source is kept per stage, macros and profile, older ones are deleted when a new one is written. All functions may
+ * be called from several threads at once.
+ */
+class ShaderCompiler {
+  public:
+    enum class Profile {
+        // Unoptimized with debug info, for shader debuggers
+        Debug,
+        // Optimized for performance without debug info
+        Release,
+    };
+
+    // Release in builds with NDEBUG, otherwise Debug
+    static Profile profile;
+
+    /**
+     * SPIR-V of a shader, compiled if it is not in the cache yet, and the error message if compilation failed.
+     * With forceCompile, cache entries written by earlier runs are compiled again.
+     * If a shader has errors, the last SPIR-V compiled for it during this run is returned, or an exception is thrown
+     * if there is none.
+     */
+    static std::tuple<std::vector<char>, std::string> getShaderCode(const std::string &filename,
+                                                                    shaderc_shader_kind kind, bool forceCompile);
+
+    /**
+     * Compile every shader in shaders/ which is missing in the cache on all threads, so that the pipelines created
+     * afterwards only load their SPIR-V. Errors are reported once a pipeline uses the broken shader.
+     */
+    static void compileAll(bool forceCompile);
+};
+
+#endif //JUNGLE_SHADERCOMPILER_H
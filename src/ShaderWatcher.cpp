@@ -0,0 +1,62 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#include "ShaderWatcher.h"
+#include <iostream>
+
+#ifdef __linux__
+#include <set>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Includes end in .glsl, editors also touch swap and backup files in the directory which are ignored.
+static bool isShaderSource(const std::string &name) {
+    static const std::set<std::string> extensions{".vert", ".geom", ".frag", ".comp", ".glsl"};
+    auto dot = name.find_last_of('.');
+    return dot != std::string::npos && extensions.contains(name.substr(dot));
+}
+
+ShaderWatcher::ShaderWatcher(const std::string &directory) {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::cout << "[shaders] WARN: Could not watch " << directory << " for changes" << std::endl;
+    }
+}
+
+ShaderWatcher::~ShaderWatcher() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool ShaderWatcher::poll() {
+    if (fd < 0) {
+        return false;
+    }
+
+    bool changed = false;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    // Saving a file usually produces several events, they are all drained here and reported once.
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            if (!(event->mask & IN_ISDIR) && event->len > 0 && isShaderSource(event->name)) {
+                changed = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+#else
+ShaderWatcher::ShaderWatcher(const std::string &directory) {
+    std::cout << "[shaders] Automatic shader reloading is only supported on Linux" << std::endl;
+}
+
+ShaderWatcher::~ShaderWatcher() = default;
+
+bool ShaderWatcher::poll() {
+    return false;
+}
+#endif
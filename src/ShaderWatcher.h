@@ -0,0 +1,28 @@
+// The content of this file is licensed under MIT.
+// Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
+
+#ifndef JUNGLE_SHADERWATCHER_H
+#define JUNGLE_SHADERWATCHER_H
+
+#include <string>
+
+/**
+ * Watches the shader sources in a directory for changes with inotify, to reload shaders automatically when they are
+ * saved. On other platforms than Linux no changes are ever reported.
+ */
+class ShaderWatcher {
+  public:
+    explicit ShaderWatcher(const std::string &directory);
+    ~ShaderWatcher();
+
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+    // True if a shader source was written, created or moved into the directory since the last call. Never blocks.
+    bool poll();
+
+  private:
+    int fd = -1;
+};
+
+#endif //JUNGLE_SHADERWATCHER_H
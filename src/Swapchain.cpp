@@ -2,12 +2,15 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #include "Swapchain.h"
+#include "DataBuffer.h"
 #include "VulkanHelper.h"
 #include <algorithm>
+#include <cstring>
 #include <vulkan/vulkan_core.h>
 
 float Swapchain::renderScale = 1.0;
 int Swapchain::rateLimit = 0;
+uint32_t Swapchain::framesInFlight = MIN_FRAMES_IN_FLIGHT;
 
 void RenderTarget::init(VulkanDevice* device, int nrFrames) {
     this->device = device;
@@ -84,13 +87,15 @@ void RenderTarget::createFramebuffers(VkRenderPass renderPass, VkExtent2D extent
 
 void Swapchain::cleanupSwapChain() {
     defaultTarget.destroyAll();
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
         vkDestroySemaphore(*device, renderFinishedSemaphores[i], nullptr);
         vkDestroySemaphore(*device, imageAvailableSemaphores[i], nullptr);
         vkDestroyFence(*device, inFlightFences[i], nullptr);
     }
 
-    vkDestroySwapchainKHR(*device, swapChain, nullptr);
+    if (swapChain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(*device, swapChain, nullptr);
+    }
 }
 
 void Swapchain::recreateSwapChain(VkRenderPass renderPass) {
@@ -156,6 +161,7 @@ VkExtent2D Swapchain::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilit
 }
 
 void Swapchain::createSwapChain() {
+    firstPresentId = presentId + 1;
     auto swapChainSupport = device->querySwapChainSupport(device->physicalDevice, surface);
 
     VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -205,6 +211,13 @@ void Swapchain::createSwapChain() {
 }
 
 void Swapchain::createImageViews() {
+    if (isHeadless()) {
+        defaultTarget.init(device, Swapchain::framesInFlight);
+        defaultTarget.addAttachment(finalBufferSize, swapChainImageFormat,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+        return;
+    }
+
     defaultTarget.init(device, swapChainImages.size());
     defaultTarget.addAttachment(swapChainImages, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
 }
@@ -240,6 +253,15 @@ Swapchain::Swapchain(GLFWwindow* window, VkSurfaceKHR surface, VulkanDevice* dev
     createImageViews();
 }
 
+Swapchain::Swapchain(VulkanDevice* device, VkExtent2D extent) {
+    this->device = device;
+    // Same byte order as PNG files, see readImage
+    swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    finalBufferSize = extent;
+    createSyncObjects();
+    createImageViews();
+}
+
 Swapchain::~Swapchain() {
     cleanupSwapChain();
 }
@@ -247,6 +269,12 @@ Swapchain::~Swapchain() {
 std::optional<uint32_t> Swapchain::acquireNextImage(VkRenderPass renderPass) {
     vkWaitForFences(*device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
+    if (isHeadless()) {
+        // The image of a frame in flight is free again once its fence is signaled.
+        vkResetFences(*device, 1, &inFlightFences[currentFrame]);
+        return currentFrame;
+    }
+
     uint32_t imageIndex;
     VkResult result = vkAcquireNextImageKHR(*device, swapChain, UINT64_MAX,
         imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
@@ -262,39 +290,128 @@ std::optional<uint32_t> Swapchain::acquireNextImage(VkRenderPass renderPass) {
     return imageIndex;
 }
 
-VkResult Swapchain::queuePresent(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+VkResult Swapchain::queuePresent(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                                 std::optional<TimelineSignal> signal) {
+    lastImageIndex = imageIndex;
+
+    // The values of binary semaphores are ignored
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<uint64_t> signalValues;
+    if (!isHeadless()) {
+        signalSemaphores.push_back(renderFinishedSemaphores[currentFrame]);
+        signalValues.push_back(0);
+    }
+    if (signal.has_value()) {
+        signalSemaphores.push_back(signal->semaphore);
+        signalValues.push_back(signal->value);
+    }
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = signalValues.size();
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = signalSemaphores.size();
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    if (isHeadless()) {
+        VK_CHECK_RESULT(vkQueueSubmit(device->graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]))
+        currentFrame = (currentFrame + 1) % Swapchain::framesInFlight;
+        return VK_SUCCESS;
+    }
+
     VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
     submitInfo.waitSemaphoreCount = 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
     VK_CHECK_RESULT(vkQueueSubmit(device->graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]))
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrame];
     VkSwapchainKHR swapChains[] = {swapChain};
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = swapChains;
     presentInfo.pImageIndices = &imageIndex;
     presentInfo.pResults = nullptr; // Optional
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    VkPresentIdKHR presentIdInfo{};
+    if (device->supportsPresentWait) {
+        presentId++;
+        presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentIdInfo.swapchainCount = 1;
+        presentIdInfo.pPresentIds = &presentId;
+        presentInfo.pNext = &presentIdInfo;
+    }
+
+    currentFrame = (currentFrame + 1) % Swapchain::framesInFlight;
     return vkQueuePresentKHR(device->presentQueue, &presentInfo);
 }
 
+void Swapchain::waitForPresent(uint64_t queuedFrames) {
+    // Presents on an older swapchain can not be waited for on the current one.
+    if (!device->supportsPresentWait || presentId < firstPresentId + queuedFrames) {
+        return;
+    }
+
+    // The timeout covers images which are never displayed, e.g. while the window is minimized.
+    VkResult result = device->vkWaitForPresentKHR(*device, swapChain, presentId - queuedFrames, 100'000'000);
+    if (result != VK_SUCCESS && result != VK_TIMEOUT && result != VK_SUBOPTIMAL_KHR &&
+        result != VK_ERROR_OUT_OF_DATE_KHR) {
+        VK_CHECK_RESULT(result)
+    }
+}
+
+std::vector<uint8_t> Swapchain::readImage(uint32_t imageIndex) {
+    vkDeviceWaitIdle(*device);
+
+    DataBuffer staging;
+    VkDeviceSize size = (VkDeviceSize) finalBufferSize.width * finalBufferSize.height * 4;
+    staging.uploadData(device, nullptr, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    VkImage image = defaultTarget.images[imageIndex][0];
+    VkCommandBuffer commandBuffer = device->beginSingleTimeCommands();
+
+    // The final pass already left the image in TRANSFER_SRC_OPTIMAL, only its writes have to be made visible.
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {finalBufferSize.width, finalBufferSize.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging.buffer, 1, &region);
+    device->endSingleTimeCommands(commandBuffer);
+
+    std::vector<uint8_t> pixels(size);
+    void *data;
+    VK_CHECK_RESULT(vkMapMemory(*device, staging.memory, 0, size, 0, &data))
+    std::memcpy(pixels.data(), data, size);
+    vkUnmapMemory(*device, staging.memory);
+    staging.destroy(device);
+    return pixels;
+}
+
 void Swapchain::createSyncObjects() {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    imageAvailableSemaphores.resize(Swapchain::framesInFlight);
+    renderFinishedSemaphores.resize(Swapchain::framesInFlight);
+    inFlightFences.resize(Swapchain::framesInFlight);
 
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -303,7 +420,7 @@ void Swapchain::createSyncObjects() {
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < Swapchain::framesInFlight; i++) {
         VK_CHECK_RESULT(vkCreateSemaphore(*device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]))
         VK_CHECK_RESULT(vkCreateSemaphore(*device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]))
         VK_CHECK_RESULT(vkCreateFence(*device, &fenceInfo, nullptr, &inFlightFences[i]))
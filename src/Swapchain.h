@@ -7,9 +7,18 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include "PhysicalDevice.h"
+#include <algorithm>
 #include <map>
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Range of Swapchain::framesInFlight
+const uint32_t MIN_FRAMES_IN_FLIGHT = 2;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+// A value a timeline semaphore is set to by a queue submission
+struct TimelineSignal {
+    VkSemaphore semaphore;
+    uint64_t value;
+};
 
 /**
  * A class to maintain an off-screen collection of render targets, one per swapchain frame
@@ -41,15 +50,39 @@ class RenderTarget {
 
 /**
  * A class which manages the swapchain and render targets for the window.
+ *
+ * Without a window (headless), the frames are rendered into offscreen images instead, one per frame in flight,
+ * which are submitted but never presented.
  */
 class Swapchain
 {
   public:
     Swapchain(GLFWwindow* window, VkSurfaceKHR surface, VulkanDevice* device);
+    Swapchain(VulkanDevice* device, VkExtent2D extent);
     ~Swapchain();
 
     std::optional<uint32_t> acquireNextImage(VkRenderPass renderPass);
-    VkResult queuePresent(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    // Submit the last command buffer of the frame, which also signals the given timeline semaphore, and present it.
+    VkResult queuePresent(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                          std::optional<TimelineSignal> signal = {});
+
+    // Block until at most queuedFrames presented images are still waiting to be displayed, which bounds the latency
+    // between recording a frame and showing it. Does nothing without VK_KHR_present_wait.
+    void waitForPresent(uint64_t queuedFrames);
+
+    bool isHeadless() {
+        return surface == VK_NULL_HANDLE;
+    }
+
+    // Layout of the images after the final pass: presentable, or ready to be read back when headless
+    VkImageLayout finalLayout() {
+        return isHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    }
+
+    // Waits for the device and copies a headless image to the host, tightly packed with 4 bytes per pixel.
+    std::vector<uint8_t> readImage(uint32_t imageIndex);
+    // Image of the last queuePresent call
+    uint32_t lastImageIndex = 0;
 
     void createFramebuffersForRender(VkRenderPass renderPass);
     void recreateSwapChain(VkRenderPass renderPass);
@@ -59,7 +92,14 @@ class Swapchain
     VkExtent2D finalBufferSize;
     static float renderScale;
     static int rateLimit;
+    // Number of frames recorded while the GPU still works on earlier ones. Every per-frame resource exists this often,
+    // so it can only be set before the renderer is initialized. More frames smooth out CPU spikes, fewer lower latency.
+    static uint32_t framesInFlight;
+
+    // Fraction of renderSize() which is rendered to, lowered by DynamicResolution to stay within a frame budget
+    float dynamicScale = 1.0f;
 
+    // Size the render resolution targets are allocated with
     VkExtent2D renderSize() {
         return {
             (uint32_t)(finalBufferSize.width * renderScale),
@@ -67,8 +107,16 @@ class Swapchain
         };
     }
 
+    // Top left part of the render resolution targets used by the current frame, for viewports and dispatches
+    VkExtent2D activeRenderSize() {
+        return {
+            std::max(1u, (uint32_t)(renderSize().width * dynamicScale)),
+            std::max(1u, (uint32_t)(renderSize().height * dynamicScale)),
+        };
+    }
+
     bool enableVSync = false;
-    VkSwapchainKHR swapChain;
+    VkSwapchainKHR swapChain{VK_NULL_HANDLE};
 
     RenderTarget defaultTarget;
     VkFormat chooseDepthFormat();
@@ -76,9 +124,9 @@ class Swapchain
     uint32_t currentFrame = 0;
 
   private:
-    GLFWwindow *window;
+    GLFWwindow *window{nullptr};
     VulkanDevice *device;
-    VkSurfaceKHR surface;
+    VkSurfaceKHR surface{VK_NULL_HANDLE};
 
     void cleanupSwapChain();
 
@@ -98,6 +146,10 @@ class Swapchain
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
+
+    // Id of the last present, and the first one on the current swapchain. Ids increase across swapchains.
+    uint64_t presentId = 0;
+    uint64_t firstPresentId = 1;
 };
 
 #endif /* end of include guard: JUNGLE_SWAPCHAIN */
@@ -23,6 +23,21 @@ void TAA::updateUBOContent() {
     ubo.mode = enabled ? mode : 0;
     ubo.width = getViewport().width;
     ubo.height = getViewport().height;
+    ubo.renderUVScale = {
+        (float) swapchain->activeRenderSize().width / swapchain->renderSize().width,
+        (float) swapchain->activeRenderSize().height / swapchain->renderSize().height,
+    };
+    ubo.renderSize = glm::vec2(swapchain->activeRenderSize().width, swapchain->activeRenderSize().height);
+    // Two units of normalized device coordinates span the viewport. The image moves with the jitter, so every pixel
+    // shows the unjittered image at its center minus the jitter.
+    ubo.jitter = -jitter * ubo.renderSize * 0.5f;
+    ubo.upscale = isUpscaling();
+}
+
+bool TAA::isUpscaling() {
+    auto renderSize = swapchain->activeRenderSize();
+    return enabled && upscale && (renderSize.width < swapchain->finalBufferSize.width ||
+                                  renderSize.height < swapchain->finalBufferSize.height);
 }
 
 TAA::TAA(VulkanDevice *pDevice, Swapchain *pSwapchain)
@@ -45,7 +60,7 @@ TAA::getAdditionalSamplers(std::vector<VkWriteDescriptorSet> &descriptorWrites,
 
     // On the first frame, the image is in VK_IMAGE_LAYOUT_UNDEFINED.
     // We force transition to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL to avoid validation errors
-    int prevIdx = (frameIndex + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+    int prevIdx = (frameIndex + Swapchain::framesInFlight - 1) % Swapchain::framesInFlight;
     // Format isn't important for this call
     device->transitionImageLayout(taaTarget->images[prevIdx].at(0), VK_FORMAT_R8G8B8A8_SRGB,
         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
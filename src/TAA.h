@@ -21,6 +21,11 @@ struct TAAUBO {
     glm::int32 mode;
     glm::uint width;
     glm::uint height;
+    // Part of the render resolution inputs which holds the current frame, see Swapchain::activeRenderSize
+    glm::vec2 renderUVScale;
+    glm::vec2 renderSize;
+    glm::vec2 jitter;
+    glm::int32 upscale;
 };
 
 /**
@@ -46,9 +51,18 @@ public:
 
     void enable() override;
 
+    // Whether the current frame is reconstructed from render resolution samples, only if upscale is set and the
+    // render resolution is below the output resolution.
+    bool isUpscaling();
+
     float alpha{0.1};
     int mode{1};
     bool enabled{true};
+    // Reconstruct the output from the jittered render resolution samples instead of filtering them bilinearly, when
+    // rendering at a lower resolution
+    bool upscale{true};
+    // Jitter of the current frame in normalized device coordinates, as applied to the projection
+    glm::vec2 jitter{0, 0};
     RenderTarget *taaTarget;
 };
 
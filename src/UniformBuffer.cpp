@@ -12,7 +12,7 @@ void UniformBuffer::allocate(VulkanDevice* device, size_t size, size_t copies, V
     for (int i = 0; i < copies; i++) {
         VulkanHelper::createBuffer(*device, device->physicalDevice, size, usageFlags,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            buffers[i], memories[i]);
+            buffers[i], memories[i], device->bufferQueueFamilies());
 
         vkMapMemory(*device, memories[i], 0, size, 0, &mappedPointer[i]);
     }
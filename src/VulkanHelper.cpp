@@ -17,19 +17,24 @@
 #include <glm/glm.hpp>
 #include "VulkanHelper.h"
 
-std::map<std::string, std::filesystem::file_time_type> lastRecompileTimestamp;
-std::map<std::string, std::set<std::string>> recompileDependencies;
 bool useHWRaytracing = false;
 
 void
 VulkanHelper::createBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize size,
                            VkBufferUsageFlags usage,
-                           VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory) {
+                           VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory,
+                           const std::vector<uint32_t> &queueFamilies) {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
     bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (queueFamilies.size() > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = queueFamilies.size();
+        bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+    } else {
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
 
     VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer))
 
@@ -116,6 +121,26 @@ VulkanHelper::uploadBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkD
     vkFreeMemory(device, stagingBufferMemory, nullptr);
 }
 
+void
+VulkanHelper::downloadBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize bufferSize,
+                             VkBuffer buffer, void *data, VkCommandPool commandPool, VkQueue queue) {
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(device, physicalDevice, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer,
+                 stagingBufferMemory);
+
+    copyBuffer(device, buffer, stagingBuffer, bufferSize, commandPool, queue);
+
+    void *bufferData;
+    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &bufferData);
+    memcpy(data, bufferData, (size_t) bufferSize);
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+}
+
 VkFormat VulkanHelper::gltfTypeToVkFormat(int type, int componentType, bool normalized) {
     if (normalized) {
         switch (componentType) {
@@ -273,6 +298,42 @@ VkFormat VulkanHelper::gltfTypeToVkFormat(int type, int componentType, bool norm
     }
 }
 
+VkFormat VulkanHelper::gltfAccessorToVertexFormat(const tinygltf::Accessor &accessor, size_t stride) {
+    if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+        return gltfTypeToVkFormat(accessor.type, accessor.componentType, accessor.normalized);
+    }
+
+    int numComponents = tinygltf::GetNumComponentsInType(accessor.type);
+    size_t componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+    // Three-component 8 and 16 bit formats are rarely supported for vertex input.
+    // glTF pads each element to 4 bytes, so we can read the padding as fourth component instead.
+    if (numComponents == 3 && strideFromGltfType(accessor.type, accessor.componentType, stride) >= 4 * componentSize) {
+        numComponents = 4;
+    }
+
+    // Indexed by [normalized][numComponents - 1]
+    const auto &select = [&](const VkFormat (&formats)[2][4]) {
+        return formats[accessor.normalized ? 1 : 0][numComponents - 1];
+    };
+
+    switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return select({{VK_FORMAT_R8_USCALED, VK_FORMAT_R8G8_USCALED, VK_FORMAT_R8G8B8_USCALED, VK_FORMAT_R8G8B8A8_USCALED},
+                           {VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8A8_UNORM}});
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+            return select({{VK_FORMAT_R8_SSCALED, VK_FORMAT_R8G8_SSCALED, VK_FORMAT_R8G8B8_SSCALED, VK_FORMAT_R8G8B8A8_SSCALED},
+                           {VK_FORMAT_R8_SNORM, VK_FORMAT_R8G8_SNORM, VK_FORMAT_R8G8B8_SNORM, VK_FORMAT_R8G8B8A8_SNORM}});
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            return select({{VK_FORMAT_R16_USCALED, VK_FORMAT_R16G16_USCALED, VK_FORMAT_R16G16B16_USCALED, VK_FORMAT_R16G16B16A16_USCALED},
+                           {VK_FORMAT_R16_UNORM, VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16A16_UNORM}});
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+            return select({{VK_FORMAT_R16_SSCALED, VK_FORMAT_R16G16_SSCALED, VK_FORMAT_R16G16B16_SSCALED, VK_FORMAT_R16G16B16A16_SSCALED},
+                           {VK_FORMAT_R16_SNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16B16_SNORM, VK_FORMAT_R16G16B16A16_SNORM}});
+        default:
+            return gltfTypeToVkFormat(accessor.type, accessor.componentType, accessor.normalized);
+    }
+}
+
 uint32_t VulkanHelper::strideFromGltfType(int type, int componentType, size_t stride) {
     if (stride == 0) {
         return tinygltf::GetNumComponentsInType(type) * tinygltf::GetComponentSizeInBytes(componentType);
@@ -86,86 +86,8 @@ static void writeFile(const std::string &filename, const std::vector<char> &buff
 #include <filesystem>
 #include <set>
 
-extern std::map<std::string, std::filesystem::file_time_type> lastRecompileTimestamp;
-extern std::map<std::string, std::set<std::string>> recompileDependencies;
-
-static bool shouldRecompileFile(const std::string& filename, const std::string spvFilename,
-    bool recompileOnLoad) {
-
-    if (!fileExists(spvFilename)) {
-        // We have to recompile since the shader has never been compiled!
-        return true;
-    }
-
-    if (!recompileOnLoad) {
-        // We don't want to force-recompile, so just ignore.
-        return false;
-    }
-
-    if (!fileExists(filename)) {
-        throw std::runtime_error("Non-existent shader file: " + filename);
-    }
-
-    auto lastModifyTS = std::filesystem::last_write_time(filename);
-    for (auto& dep : recompileDependencies[filename]) {
-        lastModifyTS = std::max(lastModifyTS,
-            std::filesystem::last_write_time(dep));
-    }
-
-    if (!lastRecompileTimestamp.contains(filename) ||
-        lastRecompileTimestamp[filename] < lastModifyTS)
-    {
-        lastRecompileTimestamp[filename] = lastModifyTS;
-        return true;
-    }
-
-    return false;
-}
-
 extern bool useHWRaytracing;
 
-static std::tuple<std::vector<char>, std::string> getShaderCode(const std::string &filename, shaderc_shader_kind kind, bool recompile) {
-    std::string message;
-    auto sourceName = filename.substr(filename.find_last_of("/\\") + 1, filename.find_last_of('.'));
-    auto spvFilename = filename + ".spv";
-
-    if (shouldRecompileFile(filename, spvFilename, recompile)) {
-        auto startTS = std::chrono::system_clock::now();
-        std::cout << "Compiling source file " << filename << std::endl;
-
-        shaderc::Compiler compiler;
-        shaderc::CompileOptions options;
-        options.SetGenerateDebugInfo();
-        options.SetIncluder(std::make_unique<GlslIncluder>(&recompileDependencies[filename]));
-        options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
-        if (useHWRaytracing) {
-            options.AddMacroDefinition("USE_HW_RAYTRACING");
-        }
-
-        auto file_content = readFile(filename);
-        file_content.push_back('\0');
-        std::string source = file_content.data();
-        shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(
-                source, kind, sourceName.c_str(), options);
-
-        if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
-            message = "Shader compilation failed:\n" + result.GetErrorMessage();
-            std::cout << message << std::endl;
-        } else {
-            std::vector<char> spirv = {reinterpret_cast<const char *>(result.cbegin()),
-                                       reinterpret_cast<const char *>(result.cend())};
-
-            writeFile(spvFilename, spirv);
-        }
-
-        auto endTS = std::chrono::system_clock::now();
-        std::cout << "Compilation of " << filename << " took " <<
-            std::chrono::duration_cast<std::chrono::milliseconds>(endTS-startTS).count() << "ms" << std::endl;
-    }
-
-    return {readFile(spvFilename), message};
-}
-
 // Beginning of section Copyright (C) 2016-2023 by Sascha Willems - www.saschawillems.de.
 #define VK_CHECK_RESULT(f)                                                                                \
 {                                                                                                         \
@@ -187,14 +109,23 @@ class VulkanHelper {
 public:
     static uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
+    // A buffer used by more than one of the given queue families is shared between them (VK_SHARING_MODE_CONCURRENT).
     static void createBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize size, VkBufferUsageFlags usage,
-                             VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory);
+                             VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory,
+                             const std::vector<uint32_t> &queueFamilies = {});
 
     static void uploadBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize bufferSize, VkBuffer buffer,
                       const void *data, VkCommandPool commandPool, VkQueue queue);
 
+    // Copy the start of a buffer with VK_BUFFER_USAGE_TRANSFER_SRC_BIT back to the host, after the queue is idle.
+    static void downloadBuffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize bufferSize,
+                               VkBuffer buffer, void *data, VkCommandPool commandPool, VkQueue queue);
+
     static VkFormat gltfTypeToVkFormat(int type, int componentType, bool normalized);
 
+    // Format for a vertex attribute which the shaders read as floats (see KHR_mesh_quantization).
+    static VkFormat gltfAccessorToVertexFormat(const tinygltf::Accessor &accessor, size_t stride);
+
     static uint32_t strideFromGltfType(int type, int componentType, size_t stride);
 
     static VkIndexType gltfTypeToVkIndexType(int componentType);
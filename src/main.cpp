@@ -2,9 +2,13 @@
 // Copyright (c) 2024 Ilia Bozhinov, Lars Erber.
 
 #include <iostream>
+#include <sstream>
 #include "JungleApp.h"
 #include "PhysicalDevice.h"
 #include "VulkanHelper.h"
+#include "MeshQuantizer.h"
+#include "MeshSimplifier.h"
+#include "ShaderCompiler.h"
 
 int main(int argc, char **argv) {
     JungleApp app{};
@@ -21,6 +25,11 @@ int main(int argc, char **argv) {
             recompileShaders = true;
         }
 
+        if (!strcmp(argv[i], "--shader-profile")) {
+            ShaderCompiler::profile = !strcmp(argv[i+1], "debug") ?
+                ShaderCompiler::Profile::Debug : ShaderCompiler::Profile::Release;
+        }
+
         if (!strcmp(argv[i], "--crash-on-validation-message")) {
             crashOnValidationWarning = true;
         }
@@ -29,10 +38,31 @@ int main(int argc, char **argv) {
             Swapchain::renderScale = std::atof(argv[i+1]);
         }
 
+        if (!strcmp(argv[i], "--target-fps")) {
+            app.targetFps = std::atof(argv[i+1]);
+        }
+
         if (!strcmp(argv[i], "--ratelimit")) {
             Swapchain::rateLimit = std::atoi(argv[i+1]);
         }
 
+        if (!strcmp(argv[i], "--frames-in-flight")) {
+            Swapchain::framesInFlight = std::clamp(std::atoi(argv[i+1]), (int) MIN_FRAMES_IN_FLIGHT,
+                                                   (int) MAX_FRAMES_IN_FLIGHT);
+        }
+
+        if (!strcmp(argv[i], "--wait-for-present")) {
+            app.waitForPresent = true;
+        }
+
+        if (!strcmp(argv[i], "--check-culling")) {
+            app.checkCulling = true;
+        }
+
+        if (!strcmp(argv[i], "--no-async-compute")) {
+            app.useAsyncCompute = false;
+        }
+
         if (!strcmp(argv[i], "--hw-raytracing")) {
             useHWRaytracing = true;
         }
@@ -40,6 +70,55 @@ int main(int argc, char **argv) {
         if (!strcmp(argv[i], "--fullscreen")) {
             app.fullscreen = true;
         }
+
+        if (!strcmp(argv[i], "--quantize-meshes")) {
+            useMeshQuantization = true;
+        }
+
+        if (!strcmp(argv[i], "--auto-lods")) {
+            autoLoDSettings.levels = std::atoi(argv[i+1]);
+        }
+
+        if (!strcmp(argv[i], "--auto-lod-distance")) {
+            autoLoDSettings.firstDistance = std::atof(argv[i+1]);
+        }
+
+        if (!strcmp(argv[i], "--benchmark-recording")) {
+            app.benchmarkRecordingIterations = std::atoi(argv[i+1]);
+        }
+
+        if (!strcmp(argv[i], "--gpu-profile-csv")) {
+            app.gpuProfileCsv = argv[i+1];
+        }
+
+        if (!strcmp(argv[i], "--headless")) {
+            app.headless = true;
+            app.headlessFrames = std::atoi(argv[i+1]);
+        }
+
+        if (!strcmp(argv[i], "--record-camera")) {
+            app.recordCameraPath = argv[i+1];
+        }
+
+        if (!strcmp(argv[i], "--play-camera")) {
+            app.playCameraPath = argv[i+1];
+        }
+
+        if (!strcmp(argv[i], "--playback-fps")) {
+            app.playbackFps = std::atof(argv[i+1]);
+        }
+
+        if (!strcmp(argv[i], "--benchmark-summary")) {
+            app.benchmarkSummary = argv[i+1];
+        }
+
+        if (!strcmp(argv[i], "--dump-frames")) {
+            std::stringstream frames(argv[i+1]);
+            std::string frame;
+            while (std::getline(frames, frame, ',')) {
+                app.dumpFrames.insert(std::atoi(frame.c_str()));
+            }
+        }
     }
 
     try {
@@ -49,5 +128,5 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    return app.cullingMismatch ? EXIT_FAILURE : EXIT_SUCCESS;
 }